@@ -1,14 +1,91 @@
 #include "AdBlockFilter.h"
 #include "Bitfield.h"
-#include "FastHash.h"
-#include "URL.h"
+#include "RequestContext.h"
+#include "StringPool.h"
 
 #include <algorithm>
 #include <array>
 
+#include <QElapsedTimer>
+
 namespace adblock
 {
 
+/// True if the evaluations of each filter are being counted and timed
+static std::atomic_bool profilingEnabled { false };
+
+QDataStream &operator<<(QDataStream &out, const Filter &filter)
+{
+    out << static_cast<qint32>(filter.m_category)
+        << filter.m_ruleString
+        << filter.m_evalString
+        << filter.m_contentSecurityPolicy
+        << filter.m_exception
+        << filter.m_important
+        << filter.m_disabled
+        << filter.m_redirect
+        << filter.m_redirectName
+        << static_cast<quint64>(filter.m_allowedTypes)
+        << static_cast<quint64>(filter.m_blockedTypes)
+        << filter.m_matchCase
+        << filter.m_matchAll
+        << filter.m_domainBlacklist
+        << filter.m_domainWhitelist;
+
+    const bool hasRegExp = (filter.m_category == FilterCategory::RegExp);
+    out << hasRegExp;
+    if (hasRegExp)
+        out << filter.m_regExpPattern << static_cast<qint32>(filter.m_regExpOptions) << filter.m_regExpLiteral;
+
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, Filter &filter)
+{
+    qint32 category;
+    quint64 allowedTypes, blockedTypes;
+
+    in >> category
+       >> filter.m_ruleString
+       >> filter.m_evalString
+       >> filter.m_contentSecurityPolicy
+       >> filter.m_exception
+       >> filter.m_important
+       >> filter.m_disabled
+       >> filter.m_redirect
+       >> filter.m_redirectName
+       >> allowedTypes
+       >> blockedTypes
+       >> filter.m_matchCase
+       >> filter.m_matchAll
+       >> filter.m_domainBlacklist
+       >> filter.m_domainWhitelist;
+
+    filter.m_category = static_cast<FilterCategory>(category);
+    filter.m_allowedTypes = static_cast<ElementType>(allowedTypes);
+    filter.m_blockedTypes = static_cast<ElementType>(blockedTypes);
+
+    // The regular expression itself is only created once the filter is first evaluated
+    delete filter.m_regExp.exchange(nullptr);
+
+    bool hasRegExp = false;
+    in >> hasRegExp;
+    if (hasRegExp)
+    {
+        qint32 options;
+        in >> filter.m_regExpPattern >> options >> filter.m_regExpLiteral;
+        filter.m_regExpOptions = QRegularExpression::PatternOptions(QFlag(options));
+    }
+    else
+    {
+        filter.m_regExpPattern.clear();
+        filter.m_regExpOptions = QRegularExpression::NoPatternOption;
+        filter.m_regExpLiteral.clear();
+    }
+
+    return in;
+}
+
 Filter::Filter(const QString &rule) :
     m_category(FilterCategory::None),
     m_ruleString(rule),
@@ -25,10 +102,15 @@ Filter::Filter(const QString &rule) :
     m_matchAll(false),
     m_domainBlacklist(),
     m_domainWhitelist(),
+    m_regExpPattern(),
+    m_regExpOptions(QRegularExpression::NoPatternOption),
     m_regExp(nullptr),
-    m_differenceHash(0),
-    m_evalStringHash(0),
-    m_needleWStr()
+    m_regExpLiteral(),
+    m_numRegExpEvaluations(0),
+    m_regExpEvaluationTime(0),
+    m_numEvaluations(0),
+    m_numMatches(0),
+    m_evaluationTime(0)
 {
 }
 
@@ -48,33 +130,43 @@ Filter::Filter(const Filter &other) :
     m_matchAll(other.m_matchAll),
     m_domainBlacklist(other.m_domainBlacklist),
     m_domainWhitelist(other.m_domainWhitelist),
-    m_regExp(other.m_regExp ? std::make_unique<QRegularExpression>(*other.m_regExp) : nullptr),
-    m_differenceHash(other.m_differenceHash),
-    m_evalStringHash(other.m_evalStringHash),
-    m_needleWStr(other.m_needleWStr)
+    m_regExpPattern(other.m_regExpPattern),
+    m_regExpOptions(other.m_regExpOptions),
+    m_regExp(nullptr),
+    m_regExpLiteral(other.m_regExpLiteral),
+    m_numRegExpEvaluations(other.m_numRegExpEvaluations.load()),
+    m_regExpEvaluationTime(other.m_regExpEvaluationTime.load()),
+    m_numEvaluations(other.m_numEvaluations.load()),
+    m_numMatches(other.m_numMatches.load()),
+    m_evaluationTime(other.m_evaluationTime.load())
 {
 }
 
 Filter::Filter(Filter &&other) noexcept :
     m_category(other.m_category),
-    m_ruleString(other.m_ruleString),
-    m_evalString(other.m_evalString),
-    m_contentSecurityPolicy(other.m_contentSecurityPolicy),
+    m_ruleString(std::move(other.m_ruleString)),
+    m_evalString(std::move(other.m_evalString)),
+    m_contentSecurityPolicy(std::move(other.m_contentSecurityPolicy)),
     m_exception(other.m_exception),
     m_important(other.m_important),
     m_disabled(other.m_disabled),
     m_redirect(other.m_redirect),
-    m_redirectName(other.m_redirectName),
+    m_redirectName(std::move(other.m_redirectName)),
     m_allowedTypes(other.m_allowedTypes),
     m_blockedTypes(other.m_blockedTypes),
     m_matchCase(other.m_matchCase),
     m_matchAll(other.m_matchAll),
     m_domainBlacklist(std::move(other.m_domainBlacklist)),
     m_domainWhitelist(std::move(other.m_domainWhitelist)),
-    m_regExp(std::move(other.m_regExp)),
-    m_differenceHash(other.m_differenceHash),
-    m_evalStringHash(other.m_evalStringHash),
-    m_needleWStr(other.m_needleWStr)
+    m_regExpPattern(std::move(other.m_regExpPattern)),
+    m_regExpOptions(other.m_regExpOptions),
+    m_regExp(other.m_regExp.exchange(nullptr)),
+    m_regExpLiteral(std::move(other.m_regExpLiteral)),
+    m_numRegExpEvaluations(other.m_numRegExpEvaluations.load()),
+    m_regExpEvaluationTime(other.m_regExpEvaluationTime.load()),
+    m_numEvaluations(other.m_numEvaluations.load()),
+    m_numMatches(other.m_numMatches.load()),
+    m_evaluationTime(other.m_evaluationTime.load())
 {
 }
 
@@ -97,10 +189,15 @@ Filter &Filter::operator =(const Filter &other)
         m_matchAll = other.m_matchAll;
         m_domainBlacklist = other.m_domainBlacklist;
         m_domainWhitelist = other.m_domainWhitelist;
-        m_regExp = (other.m_regExp ? std::make_unique<QRegularExpression>(*other.m_regExp) : nullptr);
-        m_differenceHash = other.m_differenceHash;
-        m_evalStringHash = other.m_evalStringHash;
-        m_needleWStr = other.m_needleWStr;
+        m_regExpPattern = other.m_regExpPattern;
+        m_regExpOptions = other.m_regExpOptions;
+        delete m_regExp.exchange(nullptr);
+        m_regExpLiteral = other.m_regExpLiteral;
+        m_numRegExpEvaluations.store(other.m_numRegExpEvaluations.load());
+        m_regExpEvaluationTime.store(other.m_regExpEvaluationTime.load());
+        m_numEvaluations.store(other.m_numEvaluations.load());
+        m_numMatches.store(other.m_numMatches.load());
+        m_evaluationTime.store(other.m_evaluationTime.load());
     }
 
     return *this;
@@ -111,30 +208,36 @@ Filter &Filter::operator =(Filter &&other) noexcept
     if (this != &other)
     {
         m_category = other.m_category;
-        m_ruleString = other.m_ruleString;
-        m_evalString = other.m_evalString;
-        m_contentSecurityPolicy = other.m_contentSecurityPolicy;
+        m_ruleString = std::move(other.m_ruleString);
+        m_evalString = std::move(other.m_evalString);
+        m_contentSecurityPolicy = std::move(other.m_contentSecurityPolicy);
         m_exception = other.m_exception;
         m_important = other.m_important;
         m_disabled = other.m_disabled;
         m_redirect = other.m_redirect;
-        m_redirectName = other.m_redirectName;
+        m_redirectName = std::move(other.m_redirectName);
         m_allowedTypes = other.m_allowedTypes;
         m_blockedTypes = other.m_blockedTypes;
         m_matchCase = other.m_matchCase;
         m_matchAll = other.m_matchAll;
         m_domainBlacklist = std::move(other.m_domainBlacklist);
         m_domainWhitelist = std::move(other.m_domainWhitelist);
-        m_regExp = std::move(other.m_regExp);
-        m_differenceHash = other.m_differenceHash;
-        m_evalStringHash = other.m_evalStringHash;
-        m_needleWStr = other.m_needleWStr;
+        m_regExpPattern = std::move(other.m_regExpPattern);
+        m_regExpOptions = other.m_regExpOptions;
+        delete m_regExp.exchange(other.m_regExp.exchange(nullptr));
+        m_regExpLiteral = std::move(other.m_regExpLiteral);
+        m_numRegExpEvaluations.store(other.m_numRegExpEvaluations.load());
+        m_regExpEvaluationTime.store(other.m_regExpEvaluationTime.load());
+        m_numEvaluations.store(other.m_numEvaluations.load());
+        m_numMatches.store(other.m_numMatches.load());
+        m_evaluationTime.store(other.m_evaluationTime.load());
     }
     return *this;
 }
 
 Filter::~Filter()
 {
+    delete m_regExp.load();
 }
 
 FilterCategory Filter::getCategory() const
@@ -187,23 +290,96 @@ const QString &Filter::getRedirectName() const
     return m_redirectName;
 }
 
-bool Filter::isMatch(const QString &baseUrl, const QString &requestUrl, const QString &requestDomain, ElementType typeMask) const
+void Filter::internStrings(StringPool &stringPool)
 {
-    if (m_disabled)
-        return false;
+    m_ruleString = stringPool.intern(m_ruleString);
+    m_evalString = stringPool.intern(m_evalString);
+    m_domainBlacklist.intern(stringPool);
+    m_domainWhitelist.intern(stringPool);
+    m_contentSecurityPolicy = stringPool.intern(m_contentSecurityPolicy);
+    m_redirectName = stringPool.intern(m_redirectName);
+}
 
-    // Check for domain restrictions
-    if (hasDomainRules() && !isDomainStyleMatch(baseUrl))
-        return false;
+quint32 Filter::getNumRegExpEvaluations() const
+{
+    return m_numRegExpEvaluations.load(std::memory_order_relaxed);
+}
 
-    // Special cases
-    if (typeMask == ElementType::InlineScript && !hasElementType(m_blockedTypes, ElementType::InlineScript))
-        return false;
-    if (hasElementType(m_blockedTypes, ElementType::ThirdParty) && !hasElementType(typeMask, ElementType::ThirdParty))
-        return false;
-    if (hasElementType(m_allowedTypes, ElementType::ThirdParty) && hasElementType(typeMask, ElementType::ThirdParty))
+qint64 Filter::getRegExpEvaluationTime() const
+{
+    return m_regExpEvaluationTime.load(std::memory_order_relaxed);
+}
+
+quint32 Filter::getNumEvaluations() const
+{
+    return m_numEvaluations.load(std::memory_order_relaxed);
+}
+
+quint32 Filter::getNumMatches() const
+{
+    return m_numMatches.load(std::memory_order_relaxed);
+}
+
+qint64 Filter::getEvaluationTime() const
+{
+    return m_evaluationTime.load(std::memory_order_relaxed);
+}
+
+void Filter::setProfilingEnabled(bool value)
+{
+    profilingEnabled.store(value, std::memory_order_relaxed);
+}
+
+bool Filter::isProfilingEnabled()
+{
+    return profilingEnabled.load(std::memory_order_relaxed);
+}
+
+bool Filter::isMatch(const RequestContext &context) const
+{
+    if (!isProfilingEnabled())
+        return isRequestMatch(context);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool match = isRequestMatch(context);
+
+    addEvaluation(match, timer.nsecsElapsed());
+    return match;
+}
+
+bool Filter::isOptionMatch(const RequestContext &context) const
+{
+    const ElementType typeMask = context.getElementType();
+    if (!isProfilingEnabled())
+        return isRequestEligible(context.getFirstPartyHost(), typeMask) && isElementTypeMatch(typeMask);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool match = isRequestEligible(context.getFirstPartyHost(), typeMask) && isElementTypeMatch(typeMask);
+
+    addEvaluation(match, timer.nsecsElapsed());
+    return match;
+}
+
+void Filter::addEvaluation(bool match, qint64 elapsedTime) const
+{
+    m_numEvaluations.fetch_add(1, std::memory_order_relaxed);
+    if (match)
+        m_numMatches.fetch_add(1, std::memory_order_relaxed);
+    m_evaluationTime.fetch_add(elapsedTime, std::memory_order_relaxed);
+}
+
+bool Filter::isRequestMatch(const RequestContext &context) const
+{
+    const ElementType typeMask = context.getElementType();
+    if (!isRequestEligible(context.getFirstPartyHost(), typeMask))
         return false;
 
+    const QString &requestUrl = context.getUrlString();
+
     bool match = m_matchAll;
 
     if (!match)
@@ -216,10 +392,12 @@ bool Filter::isMatch(const QString &baseUrl, const QString &requestUrl, const QS
             case FilterCategory::StylesheetCustom:
                 return false;
             case FilterCategory::Domain:
-                match = isDomainMatch(requestDomain, m_evalString);
+                // Entity filters apply to the domain under any public suffix, including those with more than one label
+                match = isDomainMatch(context.getDomain(), m_evalString)
+                        || (m_evalString.endsWith(QLatin1Char('.')) && isDomainMatch(context.getEntityDomain(), m_evalString));
                 break;
             case FilterCategory::DomainStart:
-                match = isDomainStartMatch(requestUrl, URL(requestDomain).getSecondLevelDomain());
+                match = isDomainStartMatch(requestUrl, context.getRegistrableDomain());
                 break;
             case FilterCategory::StringStartMatch:
                 match = requestUrl.startsWith(m_evalString, caseSensitivity);
@@ -231,47 +409,17 @@ bool Filter::isMatch(const QString &baseUrl, const QString &requestUrl, const QS
                 match = (requestUrl.compare(m_evalString, caseSensitivity) == 0);
                 break;
             case FilterCategory::StringContains:
-            {
-                QString haystack = (m_matchCase ? requestUrl : requestUrl.toLower());
-                std::wstring haystackWStr = haystack.toStdWString();
-                match = FastHash::isMatch(m_needleWStr, haystackWStr, m_evalStringHash, m_differenceHash);
+                match = requestUrl.contains(m_evalString, caseSensitivity);
                 break;
-            }
             case FilterCategory::RegExp:
-                match = m_regExp->match(requestUrl).hasMatch();
+                match = isRegExpMatch(requestUrl, caseSensitivity);
                 break;
             default:
                 break;
         }
     }
 
-    if (match)
-    {
-        // Check for element type restrictions (in specific order)
-        static constexpr std::array<ElementType, 13> elemTypes = {  ElementType::XMLHTTPRequest,  ElementType::Document,   ElementType::Object,
-                                                   ElementType::Subdocument,     ElementType::Image,      ElementType::Script,
-                                                   ElementType::Stylesheet,      ElementType::WebSocket,  ElementType::ObjectSubrequest,
-                                                   ElementType::InlineScript,    ElementType::Ping,       ElementType::CSP,
-                                                   ElementType::Other };
-
-        for (std::size_t i = 0; i < elemTypes.size(); ++i)
-        {
-            ElementType currentType = elemTypes[i];
-            bool isRequestOfType = hasElementType(typeMask, currentType);
-            if (hasElementType(m_allowedTypes, currentType) && isRequestOfType)
-                return false;
-            if (hasElementType(m_blockedTypes, currentType) && isRequestOfType)
-                return true;
-        }
-
-
-        //ElementType::ThirdParty | ElementType::MatchCase | ElementType::Collapse
-        ElementType ignoreTypeMask = static_cast<ElementType>(~0x00038000ULL);
-        if ((m_blockedTypes & ignoreTypeMask) != ElementType::None)
-            return false;
-    }
-
-    return match;
+    return match && isElementTypeMatch(typeMask);
 }
 
 bool Filter::isDomainStyleMatch(const QString &domain) const
@@ -282,18 +430,68 @@ bool Filter::isDomainStyleMatch(const QString &domain) const
     if (m_domainBlacklist.empty() && m_domainWhitelist.empty())
         return true;
 
-    for (const QString &d : m_domainWhitelist)
-    {
-        if (isDomainMatch(domain, d))
-            return false;
-    }
-    for (const QString &d : m_domainBlacklist)
+    if (m_domainWhitelist.matches(domain))
+        return false;
+
+    return m_domainBlacklist.empty() || m_domainBlacklist.matches(domain);
+}
+
+bool Filter::isRequestEligible(const QString &baseUrl, ElementType typeMask) const
+{
+    if (m_disabled)
+        return false;
+
+    // Check for domain restrictions
+    if (hasDomainRules() && !isDomainStyleMatch(baseUrl))
+        return false;
+
+    // Special cases
+    if (typeMask == ElementType::InlineScript && !hasElementType(m_blockedTypes, ElementType::InlineScript))
+        return false;
+    if (hasElementType(m_blockedTypes, ElementType::ThirdParty) && !hasElementType(typeMask, ElementType::ThirdParty))
+        return false;
+    if (hasElementType(m_allowedTypes, ElementType::ThirdParty) && hasElementType(typeMask, ElementType::ThirdParty))
+        return false;
+
+    return true;
+}
+
+bool Filter::isElementTypeMatch(ElementType typeMask) const
+{
+    return isElementTypeMatch(m_allowedTypes, m_blockedTypes, typeMask);
+}
+
+bool Filter::isElementTypeMatch(ElementType allowedTypes, ElementType blockedTypes, ElementType typeMask)
+{
+    // Check for element type restrictions (in specific order)
+    static constexpr std::array<ElementType, 13> elemTypes = {  ElementType::XMLHTTPRequest,  ElementType::Document,   ElementType::Object,
+                                               ElementType::Subdocument,     ElementType::Image,      ElementType::Script,
+                                               ElementType::Stylesheet,      ElementType::WebSocket,  ElementType::ObjectSubrequest,
+                                               ElementType::InlineScript,    ElementType::Ping,       ElementType::CSP,
+                                               ElementType::Other };
+    static constexpr uint64_t elemTypesMask = 0x003805FFULL;
+
+    // Most requests have one type, so the types that the filter has options for can usually be checked with one mask
+    const uint64_t relevantTypes = static_cast<uint64_t>((allowedTypes | blockedTypes) & typeMask) & elemTypesMask;
+    if (relevantTypes != 0 && (relevantTypes & (relevantTypes - 1)) == 0)
+        return (static_cast<uint64_t>(allowedTypes) & relevantTypes) == 0;
+
+    if (relevantTypes != 0)
     {
-        if (isDomainMatch(domain, d))
-            return true;
+        for (std::size_t i = 0; i < elemTypes.size(); ++i)
+        {
+            ElementType currentType = elemTypes[i];
+            bool isRequestOfType = (typeMask & currentType) == currentType;
+            if ((allowedTypes & currentType) == currentType && isRequestOfType)
+                return false;
+            if ((blockedTypes & currentType) == currentType && isRequestOfType)
+                return true;
+        }
     }
 
-    return false;
+    //ElementType::ThirdParty | ElementType::MatchCase | ElementType::Collapse
+    ElementType ignoreTypeMask = static_cast<ElementType>(~0x00038000ULL);
+    return (blockedTypes & ignoreTypeMask) == ElementType::None;
 }
 
 void Filter::addDomainToWhitelist(const QString &domainStr)
@@ -311,7 +509,7 @@ void Filter::setEvalString(const QString &evalString)
     m_evalString = evalString;
 }
 
-bool Filter::isDomainMatch(QString base, const QString &domainStr) const
+bool Filter::isDomainMatch(QStringRef base, const QString &domainStr) const
 {
     // Check if domain match is being performed on an entity filter
     if (domainStr.endsWith(QChar('.')))
@@ -327,7 +525,39 @@ bool Filter::isDomainMatch(QString base, const QString &domainStr) const
     return (evalIdx > 0 && base.at(evalIdx - 1) == QChar('.'));
 }
 
-bool Filter::isDomainStartMatch(const QString &requestUrl, const QString &secondLevelDomain) const
+bool Filter::isRegExpMatch(const QString &requestUrl, Qt::CaseSensitivity caseSensitivity) const
+{
+    if (!m_regExpLiteral.isEmpty() && !requestUrl.contains(m_regExpLiteral, caseSensitivity))
+        return false;
+
+    if (!isProfilingEnabled())
+        return getRegExp().match(requestUrl).hasMatch();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool match = getRegExp().match(requestUrl).hasMatch();
+
+    m_regExpEvaluationTime.fetch_add(timer.nsecsElapsed(), std::memory_order_relaxed);
+    m_numRegExpEvaluations.fetch_add(1, std::memory_order_relaxed);
+    return match;
+}
+
+const QRegularExpression &Filter::getRegExp() const
+{
+    QRegularExpression *regExp = m_regExp.load(std::memory_order_acquire);
+    if (regExp != nullptr)
+        return *regExp;
+
+    // Requests may evaluate the filter on several threads at once. Only the first expression to be stored is kept
+    auto newRegExp = std::make_unique<QRegularExpression>(m_regExpPattern, m_regExpOptions);
+    if (m_regExp.compare_exchange_strong(regExp, newRegExp.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+        regExp = newRegExp.release();
+
+    return *regExp;
+}
+
+bool Filter::isDomainStartMatch(const QString &requestUrl, const QStringRef &secondLevelDomain) const
 {
     Qt::CaseSensitivity caseSensitivity = m_matchCase ? Qt::CaseSensitive : Qt::CaseInsensitive;
     int matchIdx = requestUrl.indexOf(m_evalString, 0, caseSensitivity);
@@ -340,16 +570,6 @@ bool Filter::isDomainStartMatch(const QString &requestUrl, const QString &second
     return false;
 }
 
-void Filter::hashEvalString()
-{
-    if (m_matchAll || m_evalString.isEmpty())
-        return;
-
-    m_needleWStr = m_evalString.toStdWString();
-    m_differenceHash = FastHash::getDifferenceHash(static_cast<quint64>(m_evalString.size()));
-    m_evalStringHash = FastHash::getNeedleHash(m_needleWStr);
-}
-
 void Filter::setContentSecurityPolicy(const QString &csp)
 {
     m_contentSecurityPolicy = csp;
@@ -2,14 +2,18 @@
 #define ADBLOCKFILTER_H
 
 #include "Bitfield.h"
+#include "DomainSet.h"
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <tuple>
+#include <QDataStream>
 #include <QHash>
 #include <QRegularExpression>
 #include <QSet>
 #include <QString>
+#include <QStringRef>
 
 /**
  * @ingroup AdBlock
@@ -52,6 +56,16 @@ struct EnableBitfield<ElementType>
 namespace adblock
 {
 
+class Filter;
+class RequestContext;
+class StringPool;
+
+/// Serializes the parsed state of a filter, used to cache compiled filter lists
+QDataStream &operator<<(QDataStream &out, const Filter &filter);
+
+/// Deserializes a filter that was written with the output stream operator
+QDataStream &operator>>(QDataStream &in, Filter &filter);
+
 /**
  * @ingroup AdBlock
  * @brief Mutually exclusive categories that an AdBlock filter may belong to.
@@ -97,10 +111,16 @@ enum class CosmeticFilter
  */
 class Filter
 {
+    friend class CosmeticFilterIndex;
+    friend class FilterBucket;
+    friend class FilterMask;
     friend class FilterContainer;
     friend class FilterParser;
     friend class AdBlockManager;
 
+    friend QDataStream &operator<<(QDataStream &out, const Filter &filter);
+    friend QDataStream &operator>>(QDataStream &in, Filter &filter);
+
 public:
     /// Constructs the filter given the corresponding rule (a line in an adblock plus-formatted file)
     explicit Filter(const QString &rule);
@@ -149,17 +169,52 @@ class Filter
 
     /**
      * @brief Determines whether or not the network request matches the filter
-     * @param baseUrl URL of the original network request
-     * @param requestUrl URL of the actual network request
-     * @param requestDomain Domain of the request URL
-     * @param typeMask Element type(s) associated with the request. Filter will disregard if type is set to none
+     * @param context Normalized form of the network request. Filter will disregard if its element type is set to none
      * @return True if request matches filter, false if else.
      */
-    bool isMatch(const QString &baseUrl, const QString &requestUrl, const QString &requestDomain, ElementType typeMask) const;
+    bool isMatch(const RequestContext &context) const;
 
-    /// Returns true if this rule is of the Stylesheet category and applies to the given domain, returns false if else.
+    /**
+     * @brief Determines whether or not the network request matches the options of the filter. This is used
+     *        when the filter's evaluation string is already known to have been found in the request URL.
+     * @param context Normalized form of the network request
+     * @return True if request matches the filter options, false if else.
+     */
+    bool isOptionMatch(const RequestContext &context) const;
+
+    /// Returns true if this rule applies to the given domain, returns false if else. A rule with only
+    /// whitelisted domains applies to every domain outside of its whitelist. Used for the domains of cosmetic
+    /// filters, and for the domain option of network filters, where the domain is that of the first party
     bool isDomainStyleMatch(const QString &domain) const;
 
+    /// Replaces the rule, evaluation string, domain names and option values of the filter with their interned
+    /// copies from the string pool
+    void internStrings(StringPool &stringPool);
+
+    /// Returns the number of times the regular expression of the filter has been evaluated against a request while
+    /// profiling was enabled
+    quint32 getNumRegExpEvaluations() const;
+
+    /// Returns the cumulative time, in nanoseconds, spent evaluating the regular expression of the filter while
+    /// profiling was enabled
+    qint64 getRegExpEvaluationTime() const;
+
+    /// Returns the number of times the filter has been evaluated against a request while profiling was enabled
+    quint32 getNumEvaluations() const;
+
+    /// Returns the number of evaluations, while profiling was enabled, in which the filter matched the request
+    quint32 getNumMatches() const;
+
+    /// Returns the cumulative time, in nanoseconds, spent evaluating the filter while profiling was enabled
+    qint64 getEvaluationTime() const;
+
+    /// Enables or disables the profiling of filter evaluations. While enabled, each call to \ref isMatch or
+    /// \ref isOptionMatch is counted and timed. Disabled by default
+    static void setProfilingEnabled(bool value);
+
+    /// Returns true if the evaluations of each filter are being profiled, false if else
+    static bool isProfilingEnabled();
+
     /// Returns true if the given ElementType bitfield is set for the bit associated with the target ElementType
     inline bool hasElementType(ElementType subject, ElementType target) const
     {
@@ -179,18 +234,37 @@ class Filter
     /// Evaluates the rule, setting the filter to reflect the corresponding value(s)
     void setRule(const QString &rule);
 
-    /// Calculates the hash value of the evaluation string and the difference hash variable, used in Rabin-Karp string matching algorithm
-    void hashEvalString();
-
     /// Sets the content security policy of the filter
     void setContentSecurityPolicy(const QString &csp);
 
 private:
+    /// Determines whether or not the network request matches the filter, without profiling the evaluation
+    bool isRequestMatch(const RequestContext &context) const;
+
+    /// Adds an evaluation of the filter, which took the given number of nanoseconds, to its profiling counters
+    void addEvaluation(bool match, qint64 elapsedTime) const;
+
+    /// Checks the domain and party restrictions of the filter, returning true if the request may be matched by the filter
+    bool isRequestEligible(const QString &baseUrl, ElementType typeMask) const;
+
+    /// Checks the element type options of the filter against the type(s) of a request that matched the filter's pattern
+    bool isElementTypeMatch(ElementType typeMask) const;
+
+    /// Checks the given allowed and blocked element types of a filter against the type(s) of a request
+    static bool isElementTypeMatch(ElementType allowedTypes, ElementType blockedTypes, ElementType typeMask);
+
     /// Returns true if the given domain matches the base domain string, false if else
-    bool isDomainMatch(QString base, const QString &domainStr) const;
+    bool isDomainMatch(QStringRef base, const QString &domainStr) const;
+
+    /// Evaluates the regular expression of the filter against the request URL, skipping the evaluation
+    /// if the URL does not contain the literal string that is required by the expression
+    bool isRegExpMatch(const QString &requestUrl, Qt::CaseSensitivity caseSensitivity) const;
+
+    /// Returns the regular expression of the filter, creating it from its pattern the first time it is needed
+    const QRegularExpression &getRegExp() const;
 
     /// Compares the requested domain the evaluation string, returning true if the filter matches the request, false if else
-    bool isDomainStartMatch(const QString &requestUrl, const QString &secondLevelDomain) const;
+    bool isDomainStartMatch(const QString &requestUrl, const QStringRef &secondLevelDomain) const;
 
 protected:
     /// Filter category
@@ -199,7 +273,8 @@ class Filter
     /// Original rule string
     QString m_ruleString;
 
-    /// Comparison string for evaluating rules (only used if category of filter is not RegExp)
+    /// Comparison string for evaluating rules. For RegExp filters converted from AdBlock Plus syntax,
+    /// this holds the original pattern, which is only used to index the filter by its tokens
     QString m_evalString;
 
     /// Content security policy for filters with blocking type CSP
@@ -233,23 +308,40 @@ class Filter
     bool m_matchAll;
 
     /// List of domains that the filter rule applies to. Specified by the domain filter option
-    QSet<QString> m_domainBlacklist;
+    DomainSet m_domainBlacklist;
 
     /// List of domains that the filter rule does not apply to. Specified by the domain filter option
-    QSet<QString> m_domainWhitelist;
+    DomainSet m_domainWhitelist;
 
-    /// Unique pointer to a regular expression used by the filter, if filter is of the category RegExp
-    std::unique_ptr<QRegularExpression> m_regExp;
+    /// Pattern of the regular expression used by the filter, if filter is of the category RegExp
+    QString m_regExpPattern;
 
-private:
-    /// Used for string hash computations in rabin-karp matching algorithm
-    quint64 m_differenceHash;
+    /// Options of the regular expression used by the filter
+    QRegularExpression::PatternOptions m_regExpOptions;
+
+    /// Regular expression used by the filter, if filter is of the category RegExp. Created from the pattern
+    /// and options on the first evaluation of the filter, so that filters loaded from the compiled filter
+    /// cache do not build an expression that may never be used. Owned by the filter
+    mutable std::atomic<QRegularExpression*> m_regExp;
+
+    /// A string that appears in every URL matched by the regular expression, if one could be found when parsing
+    /// the filter. Requests without this string are rejected before the regular expression is evaluated
+    QString m_regExpLiteral;
+
+    /// Number of times the regular expression has been evaluated while profiling was enabled
+    mutable std::atomic<quint32> m_numRegExpEvaluations;
+
+    /// Cumulative time, in nanoseconds, spent evaluating the regular expression while profiling was enabled
+    mutable std::atomic<qint64> m_regExpEvaluationTime;
+
+    /// Number of times the filter has been evaluated while profiling was enabled
+    mutable std::atomic<quint32> m_numEvaluations;
 
-    /// Contains a hash of the evaluation string, used if filter category is StringContains
-    quint64 m_evalStringHash;
+    /// Number of profiled evaluations in which the filter matched the request
+    mutable std::atomic<quint32> m_numMatches;
 
-    /// Wide-string used in rabin-karp string matching algorithm
-    std::wstring m_needleWStr;
+    /// Cumulative time, in nanoseconds, spent in profiled evaluations of the filter
+    mutable std::atomic<qint64> m_evaluationTime;
 };
 
 }
@@ -1,213 +1,285 @@
 #include "AdBlockFilterContainer.h"
-#include "URL.h"
+#include "CommonUtil.h"
+#include "RequestContext.h"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
 
 #include <QHash>
 
 namespace adblock
 {
 
-Filter *FilterContainer::findImportantBlockingFilter(
-        const QString &baseUrl,
-        const QString &requestUrl,
-        const QString &requestDomain,
-        ElementType typeMask)
+/// Generation of the next filter container to be constructed
+static std::atomic<quint64> nextGeneration { 1 };
+
+/// Maximum number of selectors in each chunk of the global stylesheet
+static const int stylesheetChunkSize = 1000;
+
+FilterContainer::FilterContainer() :
+    m_generation(nextGeneration.fetch_add(1)),
+    m_subscriptionArenas(),
+    m_localFilters(),
+    m_stylesheetScripts(),
+    m_escapedStyleRules(),
+    m_importantBlockFilters(),
+    m_blockFilters(),
+    m_blockFiltersByPattern(),
+    m_patternMatcher(),
+    m_blockFiltersByDomain(),
+    m_allowFilters(),
+    m_domainStyleFilters(),
+    m_domainJSFilters(),
+    m_customStyleFilters(),
+    m_genericHideFilters(),
+    m_cspFilters(),
+    m_importantInlineScriptFilters(),
+    m_inlineScriptFilters()
 {
-    for (auto it = m_importantBlockFilters.begin(); it != m_importantBlockFilters.end(); ++it)
-    {
-        Filter *filter = *it;
-        if (filter->isMatch(baseUrl, requestUrl, requestDomain, typeMask))
-        {
-            it = m_importantBlockFilters.erase(it);
-            m_importantBlockFilters.push_front(filter);
+}
 
-            return filter;
-        }
-    }
+FilterContainer::FilterContainer(const std::vector<Subscription> &subscriptions) :
+    m_generation(nextGeneration.fetch_add(1)),
+    m_subscriptionArenas(),
+    m_localFilters(),
+    m_stylesheetScripts(),
+    m_escapedStyleRules(),
+    m_importantBlockFilters(),
+    m_blockFilters(),
+    m_blockFiltersByPattern(),
+    m_patternMatcher(),
+    m_blockFiltersByDomain(),
+    m_allowFilters(),
+    m_domainStyleFilters(),
+    m_domainJSFilters(),
+    m_customStyleFilters(),
+    m_genericHideFilters(),
+    m_cspFilters(),
+    m_importantInlineScriptFilters(),
+    m_inlineScriptFilters()
+{
+    extractFilters(subscriptions);
+}
 
-    return nullptr;
+quint64 FilterContainer::getGeneration() const
+{
+    return m_generation;
 }
 
-Filter *FilterContainer::findBlockingRequestFilter(
-        const QString &requestSecondLevelDomain,
-        const QString &baseUrl,
-        const QString &requestUrl,
-        const QString &requestDomain,
-        ElementType typeMask)
+Filter *FilterContainer::findImportantBlockingFilter(const RequestContext &context) const
 {
-    Filter *matchingBlockFilter = nullptr;
-    auto checkFiltersForMatch = [&](std::deque<Filter*> &filterContainer) {
-        for (auto it = filterContainer.begin(); it != filterContainer.end(); ++it)
-        {
-            Filter *filter = *it;
-            if (filter->isMatch(baseUrl, requestUrl, requestDomain, typeMask))
-            {
-                matchingBlockFilter = filter;
-                it = filterContainer.erase(it);
-                filterContainer.push_front(filter);
-                return;
-            }
-        }
-    };
+    return m_importantBlockFilters.findMatch(context);
+}
 
-    auto itr = m_blockFiltersByDomain.find(requestSecondLevelDomain);
-    if (itr != m_blockFiltersByDomain.end())
-        checkFiltersForMatch(*itr);
+Filter *FilterContainer::findBlockingRequestFilter(const RequestContext &context) const
+{
+    Filter *matchingBlockFilter = findDomainMatch(context);
 
     if (matchingBlockFilter == nullptr)
-        checkFiltersForMatch(m_blockFilters);
+        matchingBlockFilter = m_blockFilters.findMatch(context);
 
     if (matchingBlockFilter == nullptr)
-        checkFiltersForMatch(m_blockFiltersByPattern);
+        matchingBlockFilter = findPatternMatch(context);
 
     return matchingBlockFilter;
 }
 
-Filter *FilterContainer::findWhitelistingFilter(const QString &baseUrl, const QString &requestUrl, const QString &requestDomain, ElementType typeMask)
+Filter *FilterContainer::findWhitelistingFilter(const RequestContext &context) const
 {
-    for (Filter *filter : m_allowFilters)
-    {
-        if (filter->isMatch(baseUrl, requestUrl, requestDomain, typeMask))
-        {
-            return filter;
-        }
-    }
-
-    return nullptr;
+    return m_allowFilters.findMatch(context);
 }
 
-bool FilterContainer::hasGenericHideFilter(const QString &requestUrl, const QString &secondLevelDomain) const
+bool FilterContainer::hasGenericHideFilter(const RequestContext &context) const
 {
-    for (Filter *filter : m_genericHideFilters)
-    {
-        if (filter->isMatch(requestUrl, requestUrl, secondLevelDomain, ElementType::Other))
-            return true;
-    }
+    return m_genericHideFilters.findMatch(context) != nullptr;
+}
 
-    return false;
+const std::vector<QString> &FilterContainer::getStylesheetScripts() const
+{
+    return m_stylesheetScripts;
 }
 
-const QString &FilterContainer::getCombinedFilterStylesheet() const
+const QString &FilterContainer::getEscapedStyleRule(const Filter *filter) const
 {
-    return m_stylesheet;
+    static const QString emptyRule;
+
+    auto it = m_escapedStyleRules.constFind(filter);
+    return it != m_escapedStyleRules.constEnd() ? it.value() : emptyRule;
 }
 
 std::vector<Filter*> FilterContainer::getDomainBasedHidingFilters(const QString &domain) const
+{
+    return m_domainStyleFilters.findMatches(domain);
+}
+
+std::vector<Filter*> FilterContainer::getDomainBasedCustomHidingFilters(const QString &domain) const
+{
+    return m_customStyleFilters.findMatches(domain);
+}
+
+std::vector<Filter*> FilterContainer::getDomainBasedScriptInjectionFilters(const QString &domain) const
+{
+    return m_domainJSFilters.findMatches(domain);
+}
+
+std::vector<Filter*> FilterContainer::getMatchingCSPFilters(const RequestContext &context) const
 {
     std::vector<Filter*> result;
+    if (m_cspFilters.empty())
+        return result;
+
     std::vector<Filter*> matches;
-    QHash<QString, bool> whitelistedFilters;
-    for (Filter *filter : m_domainStyleFilters)
+    QHash<QString, bool> whitelistedCSP;
+    for (Filter *filter : m_cspFilters.findAllMatches(context))
     {
-        if (filter->isDomainStyleMatch(domain))
-        {
-            if (filter->isException())
-                whitelistedFilters.insert(filter->getEvalString(), true);
-            else
-                matches.push_back(filter);
-        }
+        if (filter->isException())
+            whitelistedCSP.insert(filter->getContentSecurityPolicy(), true);
+        else
+            matches.push_back(filter);
     }
     for (Filter *filter : matches)
     {
-        if (whitelistedFilters.constFind(filter->getEvalString()) == whitelistedFilters.constEnd())
+        if (whitelistedCSP.constFind(filter->getContentSecurityPolicy()) == whitelistedCSP.constEnd())
             result.push_back(filter);
     }
     return result;
 }
 
-std::vector<Filter*> FilterContainer::getDomainBasedCustomHidingFilters(const QString &domain) const
+const Filter *FilterContainer::findInlineScriptBlockingFilter(const RequestContext &context) const
 {
-    std::vector<Filter*> result;
-    for (Filter *filter : m_customStyleFilters)
-    {
-        if (filter->isDomainStyleMatch(domain))
-            result.push_back(filter);
-    }
+    // Filter::isRequestEligible() rejects any filter without the inline-script option when the context has
+    // no other type, so untyped filters and filters with only negated types (such as $~image) cannot match
+    // here. Only the filters with the option are indexed for this lookup
+    const Filter *result = m_importantInlineScriptFilters.findMatch(context);
+
+    if (!result)
+        result = m_inlineScriptFilters.findMatch(context);
+
     return result;
 }
 
-std::vector<Filter*> FilterContainer::getDomainBasedScriptInjectionFilters(const QString &domain) const
+std::vector<Filter*> FilterContainer::getCostliestRegExpFilters(std::size_t count) const
 {
+    // Take a snapshot of the evaluation times, as they may be updated by other threads while sorting
+    std::vector<std::pair<qint64, Filter*>> costs;
+    auto addCosts = [&costs](const FilterArena &arena) {
+        for (Filter *filter : arena.getFilters())
+        {
+            if (filter->getNumRegExpEvaluations() > 0)
+                costs.emplace_back(filter->getRegExpEvaluationTime(), filter);
+        }
+    };
+    for (const std::pair<QString, std::shared_ptr<FilterArena>> &subscription : m_subscriptionArenas)
+        addCosts(*subscription.second);
+    addCosts(m_localFilters);
+
+    count = std::min(count, costs.size());
+    std::partial_sort(costs.begin(), costs.begin() + static_cast<std::ptrdiff_t>(count), costs.end(),
+                      [](const std::pair<qint64, Filter*> &a, const std::pair<qint64, Filter*> &b) {
+        return a.first > b.first;
+    });
+
     std::vector<Filter*> result;
-    for (Filter *filter : m_domainJSFilters)
-    {
-        if (filter->isDomainStyleMatch(domain))
-            result.push_back(filter);
-    }
+    result.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+        result.push_back(costs[i].second);
     return result;
 }
 
-std::vector<Filter*> FilterContainer::getMatchingCSPFilters(const QString &requestUrl, const QString &domain) const
+std::vector<FilterProfile> FilterContainer::getFilterProfiles() const
 {
-    std::vector<Filter*> result;
-    std::vector<Filter*> matches;
-    QHash<QString, bool> whitelistedCSP;
-    for (Filter *filter : m_cspFilters)
+    std::vector<FilterProfile> result;
+
+    for (const std::pair<QString, std::shared_ptr<FilterArena>> &subscription : m_subscriptionArenas)
     {
-        if (filter->isMatch(requestUrl, requestUrl, domain, ElementType::CSP))
+        for (const Filter *filter : subscription.second->getFilters())
         {
-            if (filter->isException())
-                whitelistedCSP.insert(filter->getContentSecurityPolicy(), true);
-            else
-                matches.push_back(filter);
+            switch (filter->getCategory())
+            {
+                case FilterCategory::Stylesheet:
+                case FilterCategory::StylesheetJS:
+                case FilterCategory::StylesheetCustom:
+                    continue;
+                default:
+                    break;
+            }
+
+            result.push_back({ filter->getRule(), subscription.first, filter->getNumEvaluations(),
+                               filter->getNumMatches(), filter->getEvaluationTime() });
         }
     }
-    for (Filter *filter : matches)
-    {
-        if (whitelistedCSP.constFind(filter->getContentSecurityPolicy()) == whitelistedCSP.constEnd())
-            result.push_back(filter);
-    }
+
     return result;
 }
 
-const Filter *FilterContainer::findInlineScriptBlockingFilter(const QString &requestUrl, const QString &domain) const
+std::size_t FilterContainer::getFilterIndexMemoryUsage() const
 {
-    auto filterCSPCheck = [&](const std::deque<Filter*> &filterContainer) -> const Filter* {
-        for (const Filter *filter : filterContainer)
+    return m_importantBlockFilters.getMemoryUsage()
+            + m_blockFilters.getMemoryUsage()
+            + m_allowFilters.getMemoryUsage()
+            + m_genericHideFilters.getMemoryUsage()
+            + m_cspFilters.getMemoryUsage()
+            + m_importantInlineScriptFilters.getMemoryUsage()
+            + m_inlineScriptFilters.getMemoryUsage();
+}
+
+Filter *FilterContainer::findDomainMatch(const RequestContext &context) const
+{
+    if (m_blockFiltersByDomain.isEmpty())
+        return nullptr;
+
+    Filter *result = nullptr;
+    auto findMatchingFilter = [&](int, quint64 hash) {
+        auto it = m_blockFiltersByDomain.constFind(hash);
+        if (it == m_blockFiltersByDomain.constEnd())
+            return false;
+
+        for (Filter *filter : *it)
         {
-            if (filter->isMatch(requestUrl, requestUrl, domain, ElementType::InlineScript))
+            if (filter->isMatch(context))
             {
-                return filter;
+                result = filter;
+                return true;
             }
         }
-        return nullptr;
+        return false;
     };
 
-    const Filter *result = filterCSPCheck(m_importantBlockFilters);
+    // Check the filters of the request domain and each of its parent domains
+    const QStringRef domain = context.getDomain();
+    if (DomainSet::forEachSuffix(domain, findMatchingFilter))
+        return result;
 
-    if (!result)
-    {
-        auto it = m_blockFiltersByDomain.find(domain);
-        if (it != m_blockFiltersByDomain.end())
-        {
-            result = filterCSPCheck(*it);
-        }
-    }
+    // Entity filters (ex: ||google.^) are keyed by their name with a trailing '.', which is compared to the domain
+    // without its public suffix, and to the domain without its top-level domain
+    const QStringRef entityDomain = context.getEntityDomain();
+    if (!entityDomain.isEmpty() && DomainSet::forEachSuffix(entityDomain, findMatchingFilter))
+        return result;
 
-    if (!result)
-        result = filterCSPCheck(m_blockFilters);
-
-    if (!result)
-        result = filterCSPCheck(m_blockFiltersByPattern);
+    const QStringRef domainWithoutTld = domain.left(domain.lastIndexOf(QLatin1Char('.')) + 1);
+    if (!domainWithoutTld.isEmpty() && domainWithoutTld != entityDomain)
+        DomainSet::forEachSuffix(domainWithoutTld, findMatchingFilter);
 
     return result;
 }
 
-void FilterContainer::clearFilters()
+Filter *FilterContainer::findPatternMatch(const RequestContext &context) const
 {
-    m_importantBlockFilters.clear();
-    m_allowFilters.clear();
-    m_blockFilters.clear();
-    m_blockFiltersByPattern.clear();
-    m_blockFiltersByDomain.clear();
-    m_stylesheet.clear();
-    m_domainStyleFilters.clear();
-    m_domainJSFilters.clear();
-    m_customStyleFilters.clear();
-    m_genericHideFilters.clear();
-    m_cspFilters.clear();
+    Filter *result = nullptr;
+    m_patternMatcher.search(context.getUrlString(), [&](int patternId) {
+        Filter *filter = m_blockFiltersByPattern[static_cast<std::size_t>(patternId)];
+        if (filter->isOptionMatch(context))
+        {
+            result = filter;
+            return true;
+        }
+        return false;
+    });
+    return result;
 }
 
-void FilterContainer::extractFilters(std::vector<Subscription> &subscriptions)
+void FilterContainer::extractFilters(const std::vector<Subscription> &subscriptions)
 {
     // Used to store css rules for the global stylesheet and domain-specific stylesheets
     QHash<QString, Filter*> stylesheetFilterMap;
@@ -216,19 +288,18 @@ void FilterContainer::extractFilters(std::vector<Subscription> &subscriptions)
     // Used to remove bad filters (badfilter option from uBlock)
     QSet<QString> badFilters, badHideFilters;
 
-    // Setup global stylesheet string
-    m_stylesheet = QLatin1String("<style>");
-
-    for (Subscription &sub : subscriptions)
+    for (const Subscription &sub : subscriptions)
     {
+        // Share the arena of the subscription, which keeps its filters valid for the lifetime of this container
+        std::shared_ptr<FilterArena> arena = sub.getFilterArena();
+        if (!arena)
+            continue;
+
+        m_subscriptionArenas.emplace_back(sub.getName(), arena);
+
         // Add filters to appropriate containers
-        const size_t numFilters = sub.getNumFilters();
-        for (size_t i = 0; i < numFilters; ++i)
+        for (Filter *filter : arena->getFilters())
         {
-            Filter *filter = sub.getFilter(i);
-            if (!filter)
-                continue;
-
             if (filter->getCategory() == FilterCategory::Stylesheet)
             {
                 if (filter->isException())
@@ -238,11 +309,12 @@ void FilterContainer::extractFilters(std::vector<Subscription> &subscriptions)
             }
             else if (filter->getCategory() == FilterCategory::StylesheetJS)
             {
-                m_domainJSFilters.push_back(filter);
+                m_domainJSFilters.add(filter);
             }
             else if (filter->getCategory() == FilterCategory::StylesheetCustom)
             {
-                m_customStyleFilters.push_back(filter);
+                m_customStyleFilters.add(filter);
+                m_escapedStyleRules.insert(filter, CommonUtil::escapeJavaScriptString(filter->getEvalString()));
             }
             else if (filter->hasElementType(filter->m_blockedTypes, ElementType::BadFilter))
             {
@@ -251,63 +323,53 @@ void FilterContainer::extractFilters(std::vector<Subscription> &subscriptions)
             else if (filter->hasElementType(filter->m_blockedTypes, ElementType::CSP))
             {
                 if (!filter->hasElementType(filter->m_blockedTypes, ElementType::PopUp)) // Temporary workaround for issues with popup types
-                    m_cspFilters.push_back(filter);
+                    m_cspFilters.add(filter);
             }
             else
             {
                 if (filter->isException())
                 {
                     if (filter->hasElementType(filter->m_blockedTypes, ElementType::GenericHide))
-                        m_genericHideFilters.push_back(filter);
+                        m_genericHideFilters.add(filter);
                     else
-                        m_allowFilters.push_back(filter);
+                        m_allowFilters.add(filter);
                 }
                 else if (filter->isImportant())
                 {
                     if (filter->hasElementType(filter->m_blockedTypes, ElementType::GenericHide))
                         badHideFilters.insert(filter->getRule());
                     else
-                        m_importantBlockFilters.push_back(filter);
+                    {
+                        m_importantBlockFilters.add(filter);
+                        if (filter->hasElementType(filter->m_blockedTypes, ElementType::InlineScript))
+                            m_importantInlineScriptFilters.add(filter);
+                    }
                 }
-                else if (filter->getCategory() == FilterCategory::StringContains)
+                else if (filter->getCategory() == FilterCategory::StringContains && !filter->m_matchCase && !filter->m_matchAll)
                 {
                     m_blockFiltersByPattern.push_back(filter);
                 }
                 else if (filter->getCategory() == FilterCategory::Domain)
                 {
-                    const URL filterUrl { QUrl::fromUserInput(filter->getEvalString()) };
-                    const QString filterDomain = filterUrl.getSecondLevelDomain();
-                    auto it = m_blockFiltersByDomain.find(filterDomain);
-                    if (it != m_blockFiltersByDomain.end())
-                    {
-                        it->push_back(filter);
-                    }
-                    else
-                    {
-                        std::deque<Filter*> queue;
-                        queue.push_back(filter);
-                        m_blockFiltersByDomain.insert(filterDomain, queue);
-                    }
+                    m_blockFiltersByDomain[DomainSet::hashDomain(filter->getEvalString())].push_back(filter);
                 }
                 else
                 {
-                    m_blockFilters.push_back(filter);
+                    m_blockFilters.add(filter);
                 }
+
+                if (!filter->isException() && !filter->isImportant()
+                        && filter->hasElementType(filter->m_blockedTypes, ElementType::InlineScript))
+                    m_inlineScriptFilters.add(filter);
             }
         }
     }
 
     // Remove bad filters from all applicable filter containers
-    auto removeBadFiltersFromVector = [&badFilters](std::vector<Filter*> &filterContainer) {
-        for (auto it = filterContainer.begin(); it != filterContainer.end();)
-        {
-            if (badFilters.contains((*it)->getRule()))
-                it = filterContainer.erase(it);
-            else
-                ++it;
-        }
+    auto isBadFilter = [&badFilters](Filter *filter) {
+        return badFilters.contains(filter->getRule());
     };
-    auto removeBadFiltersFromDeque = [&badFilters](std::deque<Filter*> &filterContainer) {
+    auto removeBadFiltersFromVector = [&badFilters](std::vector<Filter*> &filterContainer) {
         for (auto it = filterContainer.begin(); it != filterContainer.end();)
         {
             if (badFilters.contains((*it)->getRule()))
@@ -317,18 +379,34 @@ void FilterContainer::extractFilters(std::vector<Subscription> &subscriptions)
         }
     };
 
-    removeBadFiltersFromVector(m_allowFilters);
+    m_importantBlockFilters.removeIf(isBadFilter);
+    m_allowFilters.removeIf(isBadFilter);
+    m_blockFilters.removeIf(isBadFilter);
 
-    removeBadFiltersFromDeque(m_blockFilters);
-    removeBadFiltersFromDeque(m_blockFiltersByPattern);
-
-    for (std::deque<Filter*> &queue : m_blockFiltersByDomain)
+    for (std::vector<Filter*> &domainFilters : m_blockFiltersByDomain)
     {
-        removeBadFiltersFromDeque(queue);
+        removeBadFiltersFromVector(domainFilters);
     }
 
-    removeBadFiltersFromVector(m_cspFilters);
-    removeBadFiltersFromVector(m_genericHideFilters);
+    removeBadFiltersFromVector(m_blockFiltersByPattern);
+    m_cspFilters.removeIf(isBadFilter);
+    m_genericHideFilters.removeIf(isBadFilter);
+    m_importantInlineScriptFilters.removeIf(isBadFilter);
+    m_inlineScriptFilters.removeIf(isBadFilter);
+
+    // Index the network filters by their tokens
+    m_importantBlockFilters.build();
+    m_allowFilters.build();
+    m_blockFilters.build();
+    m_genericHideFilters.build();
+    m_cspFilters.build();
+    m_importantInlineScriptFilters.build();
+    m_inlineScriptFilters.build();
+
+    // Compile the string-contains filters into one automaton
+    for (Filter *filter : m_blockFiltersByPattern)
+        m_patternMatcher.addPattern(filter->getEvalString());
+    m_patternMatcher.build();
 
     // Parse stylesheet exceptions
     QHashIterator<QString, Filter*> it(stylesheetExceptionMap);
@@ -340,42 +418,50 @@ void FilterContainer::extractFilters(std::vector<Subscription> &subscriptions)
         if (!stylesheetFilterMap.contains(it.key()))
             continue;
 
+        // The blocking rule may be shared with a container that is still in use, so modify a copy of it instead
         Filter *filter = it.value();
-        stylesheetFilterMap.value(it.key())->m_domainWhitelist.unite(filter->m_domainBlacklist);
+        Filter *whitelistedFilter = m_localFilters.addCopy(*stylesheetFilterMap.value(it.key()));
+        whitelistedFilter->m_domainWhitelist.unite(filter->m_domainBlacklist);
+        stylesheetFilterMap.insert(it.key(), whitelistedFilter);
     }
 
-    // Parse stylesheet blocking rules
+    // Parse stylesheet blocking rules. The selectors of the global stylesheet are unique, as they are the keys of the map
+    QString chunk;
+    int numChunkSelectors = 0;
+    auto addStylesheetChunk = [&]() {
+        chunk.append(QLatin1String("{ display: none !important; } </style>');"));
+        chunk.squeeze();
+        m_stylesheetScripts.push_back(chunk);
+        chunk.clear();
+        numChunkSelectors = 0;
+    };
+
     it = QHashIterator<QString, Filter*>(stylesheetFilterMap);
-    int numStylesheetRules = 0;
     while (it.hasNext())
     {
         it.next();
         Filter *filter = it.value();
 
+        const QString escapedSelector = CommonUtil::escapeJavaScriptString(filter->getEvalString());
         if (filter->hasDomainRules())
         {
-            m_domainStyleFilters.push_back(filter);
+            m_domainStyleFilters.add(filter);
+            m_escapedStyleRules.insert(filter, escapedSelector);
             continue;
         }
 
-        if (numStylesheetRules > 1000)
-        {
-            m_stylesheet = m_stylesheet.left(m_stylesheet.size() - 1);
-            m_stylesheet.append(QLatin1String("{ display: none !important; } "));
-            numStylesheetRules = 0;
-        }
+        if (numChunkSelectors == 0)
+            chunk = QLatin1String("document.body.insertAdjacentHTML('beforeend', '<style>");
+        else
+            chunk.append(QLatin1Char(','));
 
-        m_stylesheet.append(filter->getEvalString() + QChar(','));
-        ++numStylesheetRules;
+        chunk.append(escapedSelector);
+        if (++numChunkSelectors == stylesheetChunkSize)
+            addStylesheetChunk();
     }
 
-    // Complete global stylesheet string
-    if (numStylesheetRules > 0)
-    {
-        m_stylesheet = m_stylesheet.left(m_stylesheet.size() - 1);
-        m_stylesheet.append(QLatin1String("{ display: none !important; } "));
-    }
-    m_stylesheet.append(QLatin1String("</style>"));
+    if (numChunkSelectors > 0)
+        addStylesheetChunk();
 }
 
 }
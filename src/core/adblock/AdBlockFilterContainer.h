@@ -3,9 +3,15 @@
 
 #include "AdBlockFilter.h"
 #include "AdBlockSubscription.h"
+#include "AhoCorasick.h"
+#include "CosmeticFilterIndex.h"
+#include "DomainSet.h"
+#include "FilterArena.h"
+#include "FilterBucket.h"
 
-#include <deque>
 #include <functional>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include <QHash>
@@ -15,57 +21,88 @@
 namespace adblock
 {
 
+/**
+ * @struct FilterProfile
+ * @brief A snapshot of the profiling counters of a network filter
+ * @ingroup AdBlock
+ */
+struct FilterProfile
+{
+    /// Rule of the filter
+    QString Rule;
+
+    /// Name of the subscription that the filter belongs to
+    QString Subscription;
+
+    /// Number of times the filter was evaluated against a request while profiling was enabled
+    quint32 NumEvaluations;
+
+    /// Number of profiled evaluations in which the filter matched the request
+    quint32 NumMatches;
+
+    /// Cumulative time, in nanoseconds, spent in profiled evaluations of the filter
+    qint64 EvaluationTime;
+};
+
 /**
  * @class FilterContainer
  * @brief Stores filter rules in various containers, optimized for fastest lookup time.
+ *
+ * The container is immutable once constructed, so its lookup methods may be called from
+ * any number of threads concurrently. A reload of the filter lists is performed by
+ * building a new container and swapping it in place of the old one.
  * @ingroup AdBlock
  */
 class FilterContainer
 {
-    friend class AdBlockManager;
-
 public:
-    /// Default constructor
-    FilterContainer() = default;
+    /// Constructs an empty filter container, which matches no requests
+    FilterContainer();
+
+    /// Constructs the filter container from the filters of each enabled subscription
+    explicit FilterContainer(const std::vector<Subscription> &subscriptions);
+
+    /// Copy constructor (forbid)
+    FilterContainer(const FilterContainer &other) = delete;
+
+    /// Copy assignment operator (forbid)
+    FilterContainer &operator =(const FilterContainer &other) = delete;
+
+    /// Returns the generation of the container, a number that is unique to each constructed container
+    quint64 getGeneration() const;
 
     /**
      * @brief Searches the important blocking filter container for the first match
-     * @param baseUrl URL of the original network request
-     * @param requestUrl URL of the actual network request
-     * @param requestDomain Domain of the request URL
-     * @param typeMask Element type(s) associated with the request.
+     * @param context Normalized form of the network request
      * @return A pointer to the first matching filter rule, or a nullptr if not found
      */
-    Filter *findImportantBlockingFilter(const QString &baseUrl, const QString &requestUrl, const QString &requestDomain, ElementType typeMask);
+    Filter *findImportantBlockingFilter(const RequestContext &context) const;
 
     /**
      * @brief Searches the blocking filter containers (excluding the important blocking filter container) for the first network request match
-     * @param requestSecondLevelDomain Second level domain of the requested URL
-     * @param baseUrl URL of the original network request
-     * @param requestUrl URL of the actual network request
-     * @param requestDomain Domain of the request URL
-     * @param typeMask Element type(s) associated with the request.
+     * @param context Normalized form of the network request
      * @return A pointer to the first matching filter rule, or a nullptr if not found
      */
-    Filter *findBlockingRequestFilter(const QString &requestSecondLevelDomain, const QString &baseUrl,
-                                             const QString &requestUrl, const QString &requestDomain, ElementType typeMask);
+    Filter *findBlockingRequestFilter(const RequestContext &context) const;
 
     /**
      * @brief Searches the whitelisting filter container for the first match
-     * @param baseUrl URL of the original network request
-     * @param requestUrl URL of the actual network request
-     * @param requestDomain Domain of the request URL
-     * @param typeMask Element type(s) associated with the request.
+     * @param context Normalized form of the network request
      * @return A pointer to the first matching filter rule, or a nullptr if not found
      */
-    Filter *findWhitelistingFilter(const QString &baseUrl, const QString &requestUrl, const QString &requestDomain, ElementType typeMask);
+    Filter *findWhitelistingFilter(const RequestContext &context) const;
+
+    /// Searches for a matching domain-specific filters of which the generic element hiding rules do not apply, given
+    /// the context of a page. Returns true if a matching filter was found, or false otherwise.
+    bool hasGenericHideFilter(const RequestContext &context) const;
 
-    /// Searches for a matching domain-specific filters of which the generic element hiding rules do not apply.
-    /// Returns true if a matching filter was found, or false otherwise.
-    bool hasGenericHideFilter(const QString &requestUrl, const QString &secondLevelDomain) const;
+    /// Returns the scripts that add the global CSS hiding rules to a page. The rules are split into chunks of a fixed
+    /// number of selectors, and each script inserts one chunk into the page in the form of an HTML <style>...</style> node
+    const std::vector<QString> &getStylesheetScripts() const;
 
-    /// Returns the union of all global CSS hiding rules, in the form of an HTML <style>...</style> node
-    const QString &getCombinedFilterStylesheet() const;
+    /// Returns the CSS of the given domain-specific hiding filter or custom stylesheet filter, escaped for use in a
+    /// single-quoted JavaScript string. This is the selector of a hiding filter, or the full rule of a custom stylesheet filter
+    const QString &getEscapedStyleRule(const Filter *filter) const;
 
     /// Returns a vector containing any filters that are meant to hide elements on the given domain
     std::vector<Filter*> getDomainBasedHidingFilters(const QString &domain) const;
@@ -77,56 +114,99 @@ class FilterContainer
     std::vector<Filter*> getDomainBasedScriptInjectionFilters(const QString &domain) const;
 
     /// Returns a vector containing any filters that have a CSP rule to be applied to the given request
-    std::vector<Filter*> getMatchingCSPFilters(const QString &requestUrl, const QString &domain) const;
+    std::vector<Filter*> getMatchingCSPFilters(const RequestContext &context) const;
 
     /**
-     * @brief Searches for a filter rule that prevents the given page from loading inline scripts
-     * @param requestUrl Full requested URL, in string form
-     * @param domain Domain of the requested URL
+     * @brief Searches for a filter rule that prevents the given page from loading inline scripts. Only filters
+     *        with the inline-script option apply, filters without a type or with only negated types do not
+     * @param context Context of the page, with the \ref ElementType::InlineScript type
      * @return A pointer to a matching filter if found, or a nullptr otherwise
      */
-    const Filter *findInlineScriptBlockingFilter(const QString &requestUrl, const QString &domain) const;
+    const Filter *findInlineScriptBlockingFilter(const RequestContext &context) const;
+
+    /// Returns up to count filters with regular expressions, ordered by the time spent evaluating their expressions, from most to least.
+    /// The time is only measured while \ref Filter::isProfilingEnabled is true
+    std::vector<Filter*> getCostliestRegExpFilters(std::size_t count) const;
+
+    /// Returns the profiling counters of each network filter in the container, in order of their subscriptions.
+    /// The counters are only updated while \ref Filter::isProfilingEnabled is true
+    std::vector<FilterProfile> getFilterProfiles() const;
 
-protected:
-    /// Clears current filter data
-    void clearFilters();
+    /// Returns the number of bytes allocated by the token indexes of the network filters, not counting the filters themselves
+    std::size_t getFilterIndexMemoryUsage() const;
 
+private:
     /// Extracts ad blocking filter rules from the given container of filter list subscriptions.
-    void extractFilters(std::vector<Subscription> &subscriptions);
+    void extractFilters(const std::vector<Subscription> &subscriptions);
+
+    /// Searches the Domain category filters of the request domain and each of its parent domains for the first match
+    Filter *findDomainMatch(const RequestContext &context) const;
+
+    /// Searches the request URL for the evaluation strings of all string-contains blocking filters in a single pass,
+    /// returning the first of those filters whose options also match the request, or a nullptr if not found
+    Filter *findPatternMatch(const RequestContext &context) const;
 
 private:
-    /// Global adblock stylesheet
-    QString m_stylesheet;
+    /// Generation of the container
+    quint64 m_generation;
+
+    /// Name of each subscription the container was built from, paired with the arena of its filters. Sharing the arenas
+    /// keeps the filters valid after their subscription is reloaded, and each arena is freed in one step once the last
+    /// container and subscription using it are gone
+    std::vector<std::pair<QString, std::shared_ptr<FilterArena>>> m_subscriptionArenas;
+
+    /// Filters created by this container, such as the copies of hiding filters with exceptions applied, which are
+    /// freed along with the container
+    FilterArena m_localFilters;
+
+    /// Scripts that each insert a chunk of the global adblock stylesheet into a page
+    std::vector<QString> m_stylesheetScripts;
+
+    /// Hashmap of the domain-specific hiding and custom stylesheet filters to their escaped CSS, which is computed once
+    /// so that the stylesheet of each domain can be composed without escaping it again
+    QHash<const Filter*, QString> m_escapedStyleRules;
 
     /// Container of important blocking filters that are checked before allow filters on network requests
-    std::deque<Filter*> m_importantBlockFilters;
+    FilterBucket m_importantBlockFilters;
 
     /// Container of filters that block content
-    std::deque<Filter*> m_blockFilters;
+    FilterBucket m_blockFilters;
 
-    /// Container of filters that block content based on a partial string match (needle in haystack)
-    std::deque<Filter*> m_blockFiltersByPattern;
+    /// Container of filters that block content based on a case-insensitive partial string match (needle in haystack)
+    std::vector<Filter*> m_blockFiltersByPattern;
 
-    /// Hashmap of filters that are of the Domain category (||some.domain.com^ style filter rules)
-    QHash<QString, std::deque<Filter*>> m_blockFiltersByDomain;
+    /// Multi-pattern matcher of the evaluation strings in m_blockFiltersByPattern, where each pattern identifier
+    /// is the index of its filter in that container
+    AhoCorasick m_patternMatcher;
+
+    /// Hashmap of filters that are of the Domain category (||some.domain.com^ style filter rules), keyed
+    /// by the \ref DomainSet::hashDomain hash of the full host name they apply to
+    QHash<quint64, std::vector<Filter*>> m_blockFiltersByDomain;
 
     /// Container of filters that whitelist content
-    std::vector<Filter*> m_allowFilters;
+    FilterBucket m_allowFilters;
 
-    /// Container of filters that have domain-specific stylesheet rules
-    std::vector<Filter*> m_domainStyleFilters;
+    /// Index of filters that have domain-specific stylesheet rules, with any exceptions already applied
+    CosmeticFilterIndex m_domainStyleFilters;
 
-    /// Container of filters that have domain-specific javascript rules
-    std::vector<Filter*> m_domainJSFilters;
+    /// Index of filters that have domain-specific javascript rules
+    CosmeticFilterIndex m_domainJSFilters;
 
-    /// Container of filters that have custom stylesheet values (:style filter option)
-    std::vector<Filter*> m_customStyleFilters;
+    /// Index of filters that have custom stylesheet values (:style filter option)
+    CosmeticFilterIndex m_customStyleFilters;
 
     /// Container of domain-specific filters for which the generic element hiding rules do not apply
-    std::vector<Filter*> m_genericHideFilters;
+    FilterBucket m_genericHideFilters;
 
     /// Container of filters that set the content security policy for a matching domain
-    std::vector<Filter*> m_cspFilters;
+    FilterBucket m_cspFilters;
+
+    /// Important blocking filters with the inline-script option. These are also placed in m_importantBlockFilters,
+    /// and are kept apart so that a page can be checked for inline script filters without searching the others
+    FilterBucket m_importantInlineScriptFilters;
+
+    /// Blocking filters with the inline-script option, which are also placed in the other blocking filter containers
+    FilterBucket m_inlineScriptFilters;
 };
 
 }
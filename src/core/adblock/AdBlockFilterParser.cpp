@@ -26,6 +26,213 @@ QHash<QString, ElementType> eOptionMap = {
     { QStringLiteral("other"), ElementType::Other }
 };
 
+/// Returns the length of the quantifier at the given position of a regular expression, or 0 if there is no
+/// quantifier at that position. The minimum number of repetitions allowed by the quantifier is stored in minCount
+static int getQuantifierLength(const QString &pattern, int pos, int &minCount)
+{
+    if (pos >= pattern.size())
+        return 0;
+
+    int length = 1;
+    const QChar c = pattern.at(pos);
+    if (c == QLatin1Char('*') || c == QLatin1Char('?'))
+        minCount = 0;
+    else if (c == QLatin1Char('+'))
+        minCount = 1;
+    else if (c == QLatin1Char('{'))
+    {
+        // A brace that does not begin a {n}, {n,} or {n,m} quantifier is a literal character
+        const int end = pattern.indexOf(QLatin1Char('}'), pos);
+        if (end < 0)
+            return 0;
+
+        const QStringRef bounds = pattern.midRef(pos + 1, end - pos - 1);
+        const int comma = bounds.indexOf(QLatin1Char(','));
+
+        bool ok = false;
+        minCount = bounds.left(comma).toInt(&ok);
+        if (!ok)
+            return 0;
+        if (comma >= 0 && comma + 1 < bounds.size())
+        {
+            bounds.mid(comma + 1).toInt(&ok);
+            if (!ok)
+                return 0;
+        }
+
+        length = end - pos + 1;
+    }
+    else
+        return 0;
+
+    // Lazy or possessive quantifier
+    if (pos + length < pattern.size() && (pattern.at(pos + length) == QLatin1Char('?') || pattern.at(pos + length) == QLatin1Char('+')))
+        ++length;
+
+    return length;
+}
+
+/// Returns the position following the end of the character class that starts at the given position, or -1 if the class is not closed
+static int skipCharacterClass(const QString &pattern, int pos)
+{
+    const int size = pattern.size();
+    int i = pos + 1;
+    if (i < size && pattern.at(i) == QLatin1Char('^'))
+        ++i;
+
+    // A closing bracket at the start of the class is a literal character
+    if (i < size && pattern.at(i) == QLatin1Char(']'))
+        ++i;
+
+    while (i < size)
+    {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char('\\'))
+            i += 2;
+        else if (c == QLatin1Char('[') && i + 1 < size && pattern.at(i + 1) == QLatin1Char(':'))
+        {
+            const int end = pattern.indexOf(QLatin1String(":]"), i + 2);
+            if (end < 0)
+                return -1;
+            i = end + 2;
+        }
+        else if (c == QLatin1Char(']'))
+            return i + 1;
+        else
+            ++i;
+    }
+    return -1;
+}
+
+/// Returns the position following the end of the group that starts at the given position, or -1 if the group is not closed
+static int skipGroup(const QString &pattern, int pos)
+{
+    const int size = pattern.size();
+    int depth = 0;
+    int i = pos;
+    while (i < size)
+    {
+        const QChar c = pattern.at(i);
+        if (c == QLatin1Char('\\'))
+        {
+            i += 2;
+            continue;
+        }
+
+        if (c == QLatin1Char('['))
+        {
+            i = skipCharacterClass(pattern, i);
+            if (i < 0)
+                return -1;
+            continue;
+        }
+
+        if (c == QLatin1Char('('))
+            ++depth;
+        else if (c == QLatin1Char(')') && --depth == 0)
+            return i + 1;
+        ++i;
+    }
+    return -1;
+}
+
+/// Returns the position following the end of the escape sequence that starts with the backslash at the given position,
+/// including any operand of the sequence (ex: \x2f, \x{2f}, \p{L}, \cA, \012, \k<name>), or -1 if the operand is not closed
+static int skipEscapeSequence(const QString &pattern, int pos)
+{
+    const int size = pattern.size();
+    if (pos + 1 >= size)
+        return -1;
+
+    const QChar escaped = pattern.at(pos + 1);
+    int i = pos + 2;
+
+    auto skipTo = [&pattern, &i](QChar closing) {
+        const int end = pattern.indexOf(closing, i + 1);
+        return end < 0 ? -1 : end + 1;
+    };
+
+    switch (escaped.unicode())
+    {
+        case 'x':
+        {
+            if (i < size && pattern.at(i) == QLatin1Char('{'))
+                return skipTo(QLatin1Char('}'));
+
+            for (int numDigits = 0; numDigits < 2 && i < size; ++numDigits)
+            {
+                const QChar digit = pattern.at(i).toLower();
+                if (!digit.isDigit() && (digit < QLatin1Char('a') || digit > QLatin1Char('f')))
+                    break;
+                ++i;
+            }
+            return i;
+        }
+        case 'o':
+        case 'N':
+            return (i < size && pattern.at(i) == QLatin1Char('{')) ? skipTo(QLatin1Char('}')) : i;
+        case 'p':
+        case 'P':
+        {
+            // Unicode properties are either a single letter, or a name in braces
+            if (i >= size)
+                return -1;
+            return pattern.at(i) == QLatin1Char('{') ? skipTo(QLatin1Char('}')) : i + 1;
+        }
+        case 'c':
+            return i < size ? i + 1 : -1;
+        case 'g':
+        case 'k':
+        {
+            // Back-references by name or number: \g{...}, \g<...>, \g'...', \k{...}, \k<...>, \k'...', \g-1, \g2
+            if (i < size)
+            {
+                const QChar opening = pattern.at(i);
+                if (opening == QLatin1Char('{'))
+                    return skipTo(QLatin1Char('}'));
+                if (opening == QLatin1Char('<'))
+                    return skipTo(QLatin1Char('>'));
+                if (opening == QLatin1Char('\''))
+                    return skipTo(QLatin1Char('\''));
+                if (opening == QLatin1Char('-') || opening == QLatin1Char('+'))
+                    ++i;
+            }
+            while (i < size && pattern.at(i).isDigit())
+                ++i;
+            return i;
+        }
+        default:
+        {
+            // Octal escapes and numbered back-references may span several digits
+            if (escaped.isDigit())
+            {
+                while (i < size && pattern.at(i).isDigit())
+                    ++i;
+            }
+            return i;
+        }
+    }
+}
+
+/// Returns true if the regular expression sets any options inline, ex: (?i) or (?x:...), which may change
+/// the way literal characters are matched
+static bool hasInlineOptions(const QString &pattern)
+{
+    int pos = pattern.indexOf(QLatin1String("(?"));
+    while (pos >= 0)
+    {
+        int i = pos + 2;
+        while (i < pattern.size() && (pattern.at(i).isLetter() || pattern.at(i) == QLatin1Char('-')))
+            ++i;
+
+        if (i > pos + 2 && i < pattern.size() && (pattern.at(i) == QLatin1Char(')') || pattern.at(i) == QLatin1Char(':')))
+            return true;
+
+        pos = pattern.indexOf(QLatin1String("(?"), pos + 2);
+    }
+    return false;
+}
+
 FilterParser::FilterParser(AdBlockManager *adBlockManager) :
     m_adBlockManager(adBlockManager)
 {
@@ -34,16 +241,23 @@ FilterParser::FilterParser(AdBlockManager *adBlockManager) :
 std::unique_ptr<Filter> FilterParser::makeFilter(QString rule) const
 {
     auto filter = std::make_unique<Filter>(rule);
+    parseFilter(*filter);
+    return filter;
+}
+
+void FilterParser::parseFilter(Filter &filter) const
+{
+    QString rule = filter.m_ruleString;
 
     // Make sure filter is able to be parsed
     if (rule.isEmpty() || rule.startsWith(QLatin1Char('!')))
-        return filter;
+        return;
 
-    Filter *filterPtr = filter.get();
+    Filter *filterPtr = &filter;
 
     // Check if CSS rule
     if (isStylesheetRule(rule, filterPtr))
-        return filter;
+        return;
 
     // Check if the rule is an exception
     if (rule.startsWith(QStringLiteral("@@")))
@@ -74,8 +288,10 @@ std::unique_ptr<Filter> FilterParser::makeFilter(QString rule) const
 
         QRegularExpression::PatternOptions options =
                 (filterPtr->m_matchCase ? QRegularExpression::NoPatternOption : QRegularExpression::CaseInsensitiveOption);
-        filterPtr->m_regExp = std::make_unique<QRegularExpression>(rule, options);
-        return filter;
+        filterPtr->m_regExpPattern = rule;
+        filterPtr->m_regExpOptions = options;
+        filterPtr->m_regExpLiteral = getRegExpLiteral(rule, filterPtr->m_matchCase);
+        return;
     }
 
     // Remove any leading wildcard
@@ -92,7 +308,7 @@ std::unique_ptr<Filter> FilterParser::makeFilter(QString rule) const
         rule = rule.mid(2);
         filterPtr->m_evalString = rule.left(rule.size() - 1);
         filterPtr->m_category = FilterCategory::Domain;
-        return filter;
+        return;
     }
 
     // Check if a regular expression might be needed
@@ -106,7 +322,7 @@ std::unique_ptr<Filter> FilterParser::makeFilter(QString rule) const
 
         if (!filterPtr->m_matchCase)
             filterPtr->m_evalString = filterPtr->m_evalString.toLower();
-        return filter;
+        return;
     }
 
     // String start match
@@ -130,11 +346,15 @@ std::unique_ptr<Filter> FilterParser::makeFilter(QString rule) const
     // Ad block format -> regular expression conversion
     if (maybeRegExp || rule.contains(QChar('|')))
     {
+        filterPtr->m_evalString = rule;
+
         QRegularExpression::PatternOptions options =
                 (filterPtr->m_matchCase ? QRegularExpression::NoPatternOption : QRegularExpression::CaseInsensitiveOption);
-        filterPtr->m_regExp = std::make_unique<QRegularExpression>(parseRegExp(rule), options);
+        filterPtr->m_regExpPattern = parseRegExp(rule);
+        filterPtr->m_regExpOptions = options;
+        filterPtr->m_regExpLiteral = getPatternLiteral(rule, filterPtr->m_matchCase);
         filterPtr->m_category = FilterCategory::RegExp;
-        return filter;
+        return;
     }
 
     // Set evaluation string based on the processed rule string
@@ -151,14 +371,7 @@ std::unique_ptr<Filter> FilterParser::makeFilter(QString rule) const
 
     // If no category set by now, it is a string contains type
     if (filterPtr->getCategory() == FilterCategory::None)
-    {
         filterPtr->m_category = FilterCategory::StringContains;
-
-        // Pre-calculate hash of evaluation string for Rabin-Karp string matching
-        filterPtr->hashEvalString();
-    }
-
-    return filter;
 }
 
 bool FilterParser::isDomainRule(const QString &rule) const
@@ -779,4 +992,130 @@ QString FilterParser::parseRegExp(const QString &regExpString) const
     return replacement;
 }
 
+QString FilterParser::getRegExpLiteral(const QString &pattern, bool matchCase) const
+{
+    if (hasInlineOptions(pattern))
+        return QString();
+
+    QString best, current;
+    auto endRun = [&best, &current]() {
+        if (current.size() > best.size())
+            best = current;
+        current.clear();
+    };
+
+    const int size = pattern.size();
+    int i = 0;
+    while (i < size)
+    {
+        const QChar c = pattern.at(i);
+        QChar literal;
+        bool isLiteral = false;
+        int next = i + 1;
+
+        switch (c.unicode())
+        {
+            case '\\':
+            {
+                if (i + 1 >= size)
+                    return QString();
+
+                // Escaped letters and digits are character types, assertions, back-references, quoting sequences
+                // or character codes, while any other escaped character is a literal. The operand of an escape
+                // sequence, such as the digits of \x2f, is a part of the sequence and not a literal of its own
+                const QChar escaped = pattern.at(i + 1);
+                if (escaped == QLatin1Char('Q'))
+                    return QString();
+
+                if (escaped.isLetterOrNumber())
+                {
+                    next = skipEscapeSequence(pattern, i);
+                    if (next < 0)
+                        return QString();
+                    endRun();
+                }
+                else
+                {
+                    literal = escaped;
+                    isLiteral = true;
+                    next = i + 2;
+                }
+                break;
+            }
+            case '[':
+            {
+                next = skipCharacterClass(pattern, i);
+                if (next < 0)
+                    return QString();
+                endRun();
+                break;
+            }
+            case '(':
+            {
+                // Groups may be optional or contain alternations, so their contents are not used
+                next = skipGroup(pattern, i);
+                if (next < 0)
+                    return QString();
+                endRun();
+                break;
+            }
+            case '|':
+                // An alternation outside of a group means no part of the expression is required
+                return QString();
+            case '.':
+            case '^':
+            case '$':
+            case ')':
+            case '*':
+            case '+':
+            case '?':
+                endRun();
+                break;
+            default:
+                literal = c;
+                isLiteral = true;
+                break;
+        }
+
+        int minCount = 1;
+        const int quantifierLength = getQuantifierLength(pattern, next, minCount);
+        if (isLiteral)
+        {
+            if (quantifierLength > 0 && minCount == 0)
+                endRun();
+            else
+            {
+                current.append(literal);
+
+                // A repeated character may be followed by more copies of itself, ending the literal run
+                if (quantifierLength > 0)
+                    endRun();
+            }
+        }
+
+        i = next + quantifierLength;
+    }
+    endRun();
+
+    return matchCase ? best : best.toLower();
+}
+
+QString FilterParser::getPatternLiteral(const QString &pattern, bool matchCase) const
+{
+    QString best;
+    int start = 0;
+    const int size = pattern.size();
+    for (int i = 0; i <= size; ++i)
+    {
+        if (i < size && pattern.at(i) != QLatin1Char('*') && pattern.at(i) != QLatin1Char('^') && pattern.at(i) != QLatin1Char('|'))
+            continue;
+
+        if (i - start > best.size())
+            best = pattern.mid(start, i - start);
+        start = i + 1;
+    }
+
+    return matchCase ? best : best.toLower();
+}
+
 }
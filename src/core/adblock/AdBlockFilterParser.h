@@ -68,6 +68,10 @@ class FilterParser
     /// Instantiates and returns an Filter given a filter rule
     std::unique_ptr<Filter> makeFilter(QString rule) const;
 
+    /// Parses the rule string held by the given filter, setting its category, options and evaluation data in place.
+    /// Used to fill filters that are constructed directly in their final container.
+    void parseFilter(Filter &filter) const;
+
 private:
     /// Returns true if the given rule string is able to be interpreted as a domain anchor rule with no regular expressions.
     /// Example [will return true]: ||my.adserver.com^
@@ -106,6 +110,13 @@ class FilterParser
     /// Parses the given AdBlock Plus -formatted regular expression, returning the equivalent string used for a QRegularExpression
     QString parseRegExp(const QString &regExpString) const;
 
+    /// Returns the longest string that must appear in any URL matched by the given regular expression,
+    /// or an empty string if no such string could be determined
+    QString getRegExpLiteral(const QString &pattern, bool matchCase) const;
+
+    /// Returns the longest string that must appear in any URL matched by the given AdBlock Plus -formatted pattern
+    QString getPatternLiteral(const QString &pattern, bool matchCase) const;
+
 private:
     /// Pointer to the ad blocker
     AdBlockManager *m_adBlockManager;
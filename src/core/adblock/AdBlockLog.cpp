@@ -1,82 +1,336 @@
 #include "AdBlockLog.h"
 
-#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+#include <QHash>
 
 namespace adblock
 {
 
+static_assert((AdBlockLog::Capacity & (AdBlockLog::Capacity - 1)) == 0, "The capacity of the log must be a power of two");
+static_assert((AdBlockLog::MaxRules & (AdBlockLog::MaxRules - 1)) == 0, "The size of the filter table must be a power of two");
+
+/// Source of the identifier of each log
+static std::atomic<quint64> nextLogId { 1 };
+
+/**
+ * @brief The page that the current thread has most recently added an entry for. Requests are logged
+ *        in bursts from the same page, so the page is nearly always found here without taking a lock
+ */
+struct PageHint
+{
+    /// Identifier of the log that the hint belongs to, or 0 if the hint is not set
+    quint64 LogId = 0;
+
+    /// URL of the page, sharing its data with the page entry of the log
+    QUrl Url;
+
+    /// Index of the page entry
+    quint32 Page = 0;
+
+    /// Generation of the page entry when the hint was set. The hint is stale if the generation has changed
+    quint32 Generation = 0;
+};
+
+static thread_local PageHint pageHint;
+
 AdBlockLog::AdBlockLog(QObject *parent) :
     QObject(parent),
-    m_entries(),
-    m_timerId(0)
+    m_logId(nextLogId.fetch_add(1, std::memory_order_relaxed)),
+    m_slots(new LogSlot[Capacity]),
+    m_nextSequence(0),
+    m_pages(new PageEntry[MaxPages]),
+    m_pageHandles(),
+    m_pageLock(),
+    m_rules(new RuleEntry[MaxRules])
 {
-    // Prune logs every 30 minutes
-    m_timerId = startTimer(1000 * 60 * 30);
 }
 
 AdBlockLog::~AdBlockLog()
 {
-    killTimer(m_timerId);
 }
 
 void AdBlockLog::addEntry(FilterAction action, const QUrl &firstPartyUrl, const QUrl &requestUrl,
-              ElementType resourceType, const QString &rule, const QDateTime &timestamp)
+              ElementType resourceType, const Filter *filter, quint64 generation)
 {
-    auto it = m_entries.find(firstPartyUrl);
-    if (it != m_entries.end())
-        it->push_back({ action, firstPartyUrl, requestUrl, resourceType, rule, timestamp });
-    else
-        m_entries[firstPartyUrl] = { { action, firstPartyUrl, requestUrl, resourceType, rule, timestamp } };
+    const quint64 sequence = m_nextSequence.fetch_add(1, std::memory_order_relaxed);
+    const qint64 timestamp = QDateTime::currentMSecsSinceEpoch();
+
+    addRuleAction(filter, generation, action);
+    QUrl pageUrl = addPageAction(firstPartyUrl, sequence, action);
+
+    // Drop the record if the slot is held by another thread, or a newer record has already taken it because
+    // this thread was delayed. The counters above have still been incremented
+    LogSlot &slot = m_slots[sequence & (Capacity - 1)];
+    quint64 state = slot.State.load(std::memory_order_relaxed);
+    if ((state & 1) != 0 || (state >> 1) > sequence
+            || !slot.State.compare_exchange_strong(state, state | 1, std::memory_order_acquire, std::memory_order_relaxed))
+        return;
+
+    slot.Timestamp = timestamp;
+    slot.ResourceType = resourceType;
+    slot.Action = action;
+    slot.FirstPartyUrl.swap(pageUrl);
+    slot.RequestUrl = requestUrl;
+    slot.Rule = filter->getRule();
+
+    slot.State.store((sequence + 1) << 1, std::memory_order_release);
+}
+
+void AdBlockLog::loadStarted(const QUrl &firstPartyUrl)
+{
+    std::unique_lock<std::shared_mutex> lock(m_pageLock);
+    const quint32 page = registerPage(firstPartyUrl);
+    m_pages[page].Counters.reset();
+}
+
+LogCounts AdBlockLog::getPageCounts(const QUrl &firstPartyUrl) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_pageLock);
+    auto it = m_pageHandles.constFind(firstPartyUrl);
+    if (it != m_pageHandles.constEnd())
+        return m_pages[*it].Counters.load();
+
+    return { 0, 0, 0 };
 }
 
 std::vector<LogEntry> AdBlockLog::getAllEntries() const
 {
-    // Combine all entries
-    std::vector<LogEntry> entries;
-    for (auto it = m_entries.cbegin(); it != m_entries.cend(); ++it)
+    return getEntries(nullptr);
+}
+
+std::vector<LogEntry> AdBlockLog::getEntriesFor(const QUrl &firstPartyUrl) const
+{
+    return getEntries(&firstPartyUrl);
+}
+
+std::vector<PageLogStatistics> AdBlockLog::getPageStatistics() const
+{
+    std::vector<PageLogStatistics> result;
+
+    std::shared_lock<std::shared_mutex> lock(m_pageLock);
+    result.reserve(static_cast<std::size_t>(m_pageHandles.size()));
+    for (auto it = m_pageHandles.cbegin(); it != m_pageHandles.cend(); ++it)
     {
-        for (const LogEntry &logEntry : *it)
-            entries.push_back(logEntry);
+        const PageEntry &page = m_pages[it.value()];
+        result.push_back({ page.Url, page.Counters.load() });
     }
 
-    // Sort entries from newest to oldest
-    std::sort(entries.begin(), entries.end(), [](const LogEntry &a, const LogEntry &b){
-        return a.Timestamp < b.Timestamp;
-    });
+    return result;
+}
 
-    return entries;
+std::vector<FilterLogStatistics> AdBlockLog::getFilterStatistics() const
+{
+    std::vector<FilterLogStatistics> result;
+    QHash<QString, std::size_t> ruleIndices;
+
+    for (std::size_t i = 0; i < MaxRules; ++i)
+    {
+        // Hold the entry while its rule is copied, so that it is not reused for another filter in the meantime.
+        // Entries that are being claimed or read by another thread are skipped
+        RuleEntry &entry = m_rules[i];
+        quint64 state = entry.State.load(std::memory_order_relaxed);
+        if ((state & 3) != RuleReady
+                || !entry.State.compare_exchange_strong(state, (state & ~quint64(3)) | RuleReading,
+                                                        std::memory_order_acquire, std::memory_order_relaxed))
+            continue;
+
+        const QString rule = entry.Rule;
+        const LogCounts counts = entry.Counters.load();
+        entry.State.store(state, std::memory_order_release);
+
+        // Combine the counters of a rule that was counted in more than one generation
+        auto it = ruleIndices.constFind(rule);
+        if (it == ruleIndices.constEnd())
+        {
+            ruleIndices.insert(rule, result.size());
+            result.push_back({ rule, counts });
+            continue;
+        }
+
+        LogCounts &total = result[*it].Counts;
+        total.NumAllowed += counts.NumAllowed;
+        total.NumBlocked += counts.NumBlocked;
+        total.NumRedirected += counts.NumRedirected;
+    }
+
+    return result;
 }
 
-const std::vector<LogEntry> &AdBlockLog::getEntriesFor(const QUrl &firstPartyUrl)
+QUrl AdBlockLog::addPageAction(const QUrl &firstPartyUrl, quint64 sequence, FilterAction action)
 {
-    auto it = m_entries.find(firstPartyUrl);
-    if (it != m_entries.end())
+    auto addAction = [&](quint32 page) {
+        PageEntry &entry = m_pages[page];
+        entry.Counters.increment(action);
+
+        // Concurrent entries may finish in any order, so only move the sequence number forward
+        quint64 lastSequence = entry.LastSequence.load(std::memory_order_relaxed);
+        while (lastSequence < sequence
+               && !entry.LastSequence.compare_exchange_weak(lastSequence, sequence, std::memory_order_relaxed))
+        {
+        }
+    };
+
+    // Count the entry without a lock if the page is the one this thread logged last, and its entry has not
+    // been given to another page since. The URLs are compared by value, which does not hash them
+    PageHint &hint = pageHint;
+    if (hint.LogId == m_logId
+            && m_pages[hint.Page].Generation.load(std::memory_order_acquire) == hint.Generation
+            && hint.Url == firstPartyUrl)
+    {
+        addAction(hint.Page);
+        return hint.Url;
+    }
+
+    // Look up the page, and remember it for the next entries of this thread
+    auto setHint = [&](quint32 page) {
+        const PageEntry &entry = m_pages[page];
+        hint.LogId = m_logId;
+        hint.Url = entry.Url;
+        hint.Page = page;
+        hint.Generation = entry.Generation.load(std::memory_order_relaxed);
+        addAction(page);
+    };
+
+    {
+        std::shared_lock<std::shared_mutex> lock(m_pageLock);
+        auto it = m_pageHandles.constFind(firstPartyUrl);
+        if (it != m_pageHandles.constEnd())
+        {
+            setHint(*it);
+            return hint.Url;
+        }
+    }
+
+    // The page was not registered through loadStarted(), register it now
+    std::unique_lock<std::shared_mutex> lock(m_pageLock);
+    setHint(registerPage(firstPartyUrl));
+    return hint.Url;
+}
+
+quint32 AdBlockLog::registerPage(const QUrl &firstPartyUrl)
+{
+    auto it = m_pageHandles.constFind(firstPartyUrl);
+    if (it != m_pageHandles.constEnd())
         return *it;
 
-    std::vector<LogEntry> entriesForUrl;
-    it = m_entries.insert(firstPartyUrl, entriesForUrl);
-    return *it;
+    // Reuse the entry of the page with the oldest records, which are the first to leave the ring buffer
+    quint32 page = 0;
+    quint64 oldestSequence = std::numeric_limits<quint64>::max();
+    for (quint32 i = 0; i < static_cast<quint32>(MaxPages); ++i)
+    {
+        const PageEntry &entry = m_pages[i];
+        if (entry.Generation.load(std::memory_order_relaxed) == 0)
+        {
+            page = i;
+            break;
+        }
+
+        const quint64 lastSequence = entry.LastSequence.load(std::memory_order_relaxed);
+        if (lastSequence < oldestSequence)
+        {
+            page = i;
+            oldestSequence = lastSequence;
+        }
+    }
+
+    PageEntry &entry = m_pages[page];
+    quint32 generation = entry.Generation.load(std::memory_order_relaxed);
+    if (generation != 0)
+        m_pageHandles.remove(entry.Url);
+
+    // Invalidate the page hints of other threads before the counters are reset. An entry counted by a thread
+    // that checked its hint just before this point is counted for the new page
+    if (++generation == 0)
+        generation = 1;
+    entry.Generation.store(generation, std::memory_order_release);
+
+    entry.Url = firstPartyUrl;
+    entry.LastSequence.store(m_nextSequence.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    entry.Counters.reset();
+
+    m_pageHandles.insert(firstPartyUrl, page);
+    return page;
 }
 
-void AdBlockLog::timerEvent(QTimerEvent */*event*/)
+void AdBlockLog::addRuleAction(const Filter *filter, quint64 generation, FilterAction action)
 {
-    pruneLogs();
+    // Filters are allocated in blocks, so the low bits of their addresses are mixed into the index of the entry
+    const quint64 address = static_cast<quint64>(reinterpret_cast<quintptr>(filter));
+    std::size_t index = static_cast<std::size_t>((address * 0x9E3779B97F4A7C15ULL) >> 32) & (MaxRules - 1);
+
+    for (std::size_t probe = 0; probe < MaxRuleProbes; ++probe, index = (index + 1) & (MaxRules - 1))
+    {
+        RuleEntry &entry = m_rules[index];
+        quint64 state = entry.State.load(std::memory_order_acquire);
+        const quint64 entryGeneration = state >> 2;
+
+        // The key of an entry that is being claimed may not have been written yet. If it has not, the filter
+        // may be given a second entry further along, and the two are combined by getFilterStatistics()
+        if (entryGeneration == generation)
+        {
+            if (entry.Key.load(std::memory_order_acquire) == filter)
+            {
+                entry.Counters.increment(action);
+                return;
+            }
+            continue;
+        }
+
+        // Claim the entry if it is free, or belongs to an older generation of filters and is not being read
+        if (entryGeneration > generation || (state & 3) == RuleReading || (state & 3) == RuleClaiming
+                || !entry.State.compare_exchange_strong(state, (generation << 2) | RuleClaiming,
+                                                        std::memory_order_acquire, std::memory_order_relaxed))
+            continue;
+
+        // The counters carry over when the same rule is reloaded in a newer generation
+        const QString &rule = filter->getRule();
+        if (entry.Rule != rule)
+        {
+            entry.Counters.reset();
+            entry.Rule = rule;
+        }
+
+        entry.Key.store(filter, std::memory_order_release);
+        entry.Counters.increment(action);
+        entry.State.store((generation << 2) | RuleReady, std::memory_order_release);
+        return;
+    }
+
+    // No entry within reach belongs to the filter or can be reused. The entry is still logged, but the filter is not counted
 }
 
-void AdBlockLog::pruneLogs()
+std::vector<LogEntry> AdBlockLog::getEntries(const QUrl *firstPartyUrl) const
 {
-    const quint64 pruneThreshold = 1000 * 60 * 30;
-    const QDateTime now = QDateTime::currentDateTime();
-    auto removeCheck = [&](const LogEntry &logEntry) {
-        return static_cast<quint64>(logEntry.Timestamp.msecsTo(now)) >= pruneThreshold;
-    };
+    std::vector<LogEntry> entries;
+
+    const quint64 endSequence = m_nextSequence.load(std::memory_order_relaxed);
+    const quint64 beginSequence = endSequence > Capacity ? endSequence - Capacity : 0;
+    entries.reserve(static_cast<std::size_t>(endSequence - beginSequence));
 
-    for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+    // Copy the entries out of the ring buffer, holding each slot only for the duration of its copy. The URLs and
+    // rule of a slot are implicitly shared, so they cannot be copied optimistically while a writer may replace them.
+    // Slots that are being written, or have been dropped or overwritten, are skipped
+    for (quint64 sequence = beginSequence; sequence < endSequence; ++sequence)
     {
-        std::vector<LogEntry> &entries = *it;
-        auto newEnd = std::remove_if(entries.begin(), entries.end(), removeCheck);
-        entries.erase(newEnd, entries.end());
+        LogSlot &slot = m_slots[sequence & (Capacity - 1)];
+        quint64 state = (sequence + 1) << 1;
+        if (slot.State.load(std::memory_order_relaxed) != state
+                || !slot.State.compare_exchange_strong(state, state | 1, std::memory_order_acquire, std::memory_order_relaxed))
+            continue;
+
+        if (firstPartyUrl == nullptr || slot.FirstPartyUrl == *firstPartyUrl)
+        {
+            entries.push_back({ slot.Action, slot.FirstPartyUrl, slot.RequestUrl, slot.ResourceType,
+                                slot.Rule, QDateTime::fromMSecsSinceEpoch(slot.Timestamp) });
+        }
+
+        slot.State.store(state, std::memory_order_release);
     }
+
+    return entries;
 }
 
 }
@@ -3,12 +3,18 @@
 
 #include "AdBlockFilter.h"
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+
 #include <QDateTime>
 #include <QHash>
+#include <QObject>
+#include <QString>
 #include <QUrl>
 
-#include <vector>
-
 namespace adblock
 {
 
@@ -46,11 +52,67 @@ struct LogEntry
     QDateTime Timestamp;
 };
 
+/**
+ * @struct LogCounts
+ * @brief Number of network requests that had each type of \ref FilterAction applied to them
+ * @ingroup AdBlock
+ */
+struct LogCounts
+{
+    /// Number of requests that were allowed by an exception filter
+    quint32 NumAllowed;
+
+    /// Number of requests that were blocked
+    quint32 NumBlocked;
+
+    /// Number of requests that were redirected to a resource
+    quint32 NumRedirected;
+};
+
+/**
+ * @struct PageLogStatistics
+ * @brief Number of network requests affected by the ad block filters on a page
+ * @ingroup AdBlock
+ */
+struct PageLogStatistics
+{
+    /// URL of the page
+    QUrl FirstPartyUrl;
+
+    /// Requests affected by the filters since the page was last loaded
+    LogCounts Counts;
+};
+
+/**
+ * @struct FilterLogStatistics
+ * @brief Number of network requests affected by an ad block filter
+ * @ingroup AdBlock
+ */
+struct FilterLogStatistics
+{
+    /// Rule of the filter
+    QString Rule;
+
+    /// Requests affected by the filter since the log was created
+    LogCounts Counts;
+};
+
 /**
  * @class AdBlockLog
  * @brief This class stores information about any recent network requests that were affected by
  *        an \ref AdBlockFilter
  * @ingroup AdBlock
+ *
+ * The log is a ring buffer of compact records with a fixed capacity, so that memory use stays
+ * flat however long the browser is running. Records share the data of the page URL and filter
+ * rule of a request instead of holding copies of their strings. The number of requests affected
+ * on each of the most recently used pages, and by each filter, are counted alongside the records
+ * in tables of a fixed size. Entries may be added from any thread without taking a lock in the
+ * common case, and the log may be read while entries are being added.
+ *
+ * Slots of the ring buffer and entries of the filter table are claimed with a compare-exchange on
+ * their state. Neither side ever waits for the other: a record whose slot is held by another thread
+ * is dropped, and a reader skips slots that are being written.
  */
 class AdBlockLog : public QObject
 {
@@ -69,33 +131,188 @@ class AdBlockLog : public QObject
      * @param firstPartyUrl The source from which the request was made
      * @param requestUrl The resource that was requested
      * @param resourceType The type or types associated with the requested resource
-     * @param rule The filter rule that was applied to the request
-     * @param timestamp The time of the network action
+     * @param filter The filter that was applied to the request
+     * @param generation Generation of the filter container that the filter belongs to
      */
     void addEntry(FilterAction action, const QUrl &firstPartyUrl, const QUrl &requestUrl,
-                  ElementType resourceType, const QString &rule, const QDateTime &timestamp);
+                  ElementType resourceType, const Filter *filter, quint64 generation);
+
+    /// Resets the counters of the page with the given URL, which is beginning to load
+    void loadStarted(const QUrl &firstPartyUrl);
 
-    /// Returns all log entries
+    /// Returns the number of requests affected on the page with the given URL since it was last loaded
+    LogCounts getPageCounts(const QUrl &firstPartyUrl) const;
+
+    /// Returns a snapshot of all log entries in the buffer, from oldest to newest
     std::vector<LogEntry> getAllEntries() const;
 
-    /// Returns all log entries associated with the given first party request url, or
-    /// an empty container if no entries are found
-    const std::vector<LogEntry> &getEntriesFor(const QUrl &firstPartyUrl);
+    /// Returns a snapshot of the log entries associated with the given first party request url,
+    /// from oldest to newest, or an empty container if no entries are found
+    std::vector<LogEntry> getEntriesFor(const QUrl &firstPartyUrl) const;
+
+    /// Returns a snapshot of the counters of each page that is being tracked by the log
+    std::vector<PageLogStatistics> getPageStatistics() const;
+
+    /// Returns a snapshot of the counters of each filter rule that has been applied to a request. Counters of
+    /// the same rule in different filter container generations are combined
+    std::vector<FilterLogStatistics> getFilterStatistics() const;
+
+    /// Maximum number of entries held by the log. Must be a power of two
+    static constexpr std::size_t Capacity = 4096;
 
-protected:
-    /// Called on a regular interval to prune older log entries
-    void timerEvent(QTimerEvent *event) override;
+    /// Maximum number of pages for which counters are kept
+    static constexpr std::size_t MaxPages = 256;
 
-private Q_SLOTS:
-    /// Removes any entries from the logs that are more than 30 minutes old
-    void pruneLogs();
+    /// Maximum number of filters for which counters are kept. Must be a power of two. Entries of filters from
+    /// an older filter container generation are reused by the filters of a newer one
+    static constexpr std::size_t MaxRules = 2048;
+
+    /// Maximum number of entries of the filter table searched for a filter. When none of them belongs to the
+    /// filter or can be reused, the request is still logged, but not counted
+    static constexpr std::size_t MaxRuleProbes = 16;
 
 private:
-    /// Hashmap of first party URLs associated with requests, to containers of their associated log entries
-    QHash<QUrl, std::vector<LogEntry>> m_entries;
+    /// Atomic counters of the number of requests that had each type of action applied to them
+    struct ActionCounters
+    {
+        /// Counters, indexed by the value of each \ref FilterAction
+        std::array<std::atomic<quint32>, 3> Counts;
+
+        /// Increments the counter of the given action
+        void increment(FilterAction action)
+        {
+            Counts[static_cast<std::size_t>(action)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// Sets each counter to zero
+        void reset()
+        {
+            for (std::atomic<quint32> &count : Counts)
+                count.store(0, std::memory_order_relaxed);
+        }
+
+        /// Returns the current values of the counters
+        LogCounts load() const
+        {
+            return { Counts[static_cast<std::size_t>(FilterAction::Allow)].load(std::memory_order_relaxed),
+                     Counts[static_cast<std::size_t>(FilterAction::Block)].load(std::memory_order_relaxed),
+                     Counts[static_cast<std::size_t>(FilterAction::Redirect)].load(std::memory_order_relaxed) };
+        }
+    };
+
+    /// A position in the ring buffer
+    struct LogSlot
+    {
+        /// Sequence number of the record in the slot plus one, shifted left by one bit. Zero if the slot has not
+        /// been written. The lowest bit is set while the slot is held by a writer or a reader
+        std::atomic<quint64> State { 0 };
+
+        /// Time of the entry, in milliseconds since the epoch
+        qint64 Timestamp = 0;
+
+        /// The type or types associated with the requested resource
+        ElementType ResourceType = ElementType::None;
+
+        /// The action that was done to the request
+        FilterAction Action = FilterAction::Allow;
+
+        /// URL of the page. Shares the data of the URL held by the page counters, so it is not copied for each entry
+        QUrl FirstPartyUrl;
+
+        /// URL of the request. Request URLs are nearly always distinct, so the slot shares the data of the URL
+        /// it was given
+        QUrl RequestUrl;
+
+        /// Rule of the filter, sharing the data of the rule string of the filter
+        QString Rule;
+    };
+
+    /// A page that is tracked by the log
+    struct PageEntry
+    {
+        /// URL of the page
+        QUrl Url;
+
+        /// Incremented each time the entry is reused for a different page. Zero if the entry has never been used
+        std::atomic<quint32> Generation { 0 };
+
+        /// Sequence number of the most recent record on the page, used to choose the entry to be reused for a new page
+        std::atomic<quint64> LastSequence { 0 };
+
+        /// Counters of the requests affected on the page since it was last loaded
+        ActionCounters Counters {};
+    };
+
+    /// States of an entry in the filter table
+    enum RuleState : quint64
+    {
+        /// The entry is being claimed for a filter, and its rule is being written
+        RuleClaiming = 1,
+
+        /// The entry holds the counters of a filter
+        RuleReady = 2,
+
+        /// The rule of the entry is being copied by a reader. The counters may still be incremented
+        RuleReading = 3
+    };
+
+    /// Counters of a filter that has been applied to at least one request
+    struct RuleEntry
+    {
+        /// Generation of the filter container of the filter, shifted left by two bits, combined with the
+        /// \ref RuleState of the entry. Zero if the entry is free
+        std::atomic<quint64> State { 0 };
+
+        /// Filter that the entry was claimed for. Filters of different generations may share an address,
+        /// so the key is only compared with filters of the same generation as the entry
+        std::atomic<const Filter*> Key { nullptr };
+
+        /// Rule of the filter. The entry keeps the data of the rule string alive after the filter is freed
+        QString Rule;
+
+        /// Counters of the requests affected by the filter
+        ActionCounters Counters {};
+    };
+
+    /// Increments the counter of the action on the given page, registering the page if it is not being tracked,
+    /// and returns the URL of the page as held by the log
+    QUrl addPageAction(const QUrl &firstPartyUrl, quint64 sequence, FilterAction action);
+
+    /// Returns the entry of the page with the given URL, replacing the least recently used page if it is
+    /// not being tracked. Must be called while holding an exclusive lock on m_pageLock
+    quint32 registerPage(const QUrl &firstPartyUrl);
+
+    /// Increments the counter of the given filter for the action, claiming an entry for the filter if it
+    /// has not been counted before
+    void addRuleAction(const Filter *filter, quint64 generation, FilterAction action);
+
+    /// Returns a snapshot of the log entries in the buffer. If firstPartyUrl is not null, only the entries
+    /// of that page are returned
+    std::vector<LogEntry> getEntries(const QUrl *firstPartyUrl) const;
+
+private:
+    /// Identifies the log in the page hints of each thread, which outlive any one log
+    const quint64 m_logId;
+
+    /// Ring buffer of the log records, with Capacity slots
+    std::unique_ptr<LogSlot[]> m_slots;
+
+    /// Sequence number of the next record to be added to the buffer
+    std::atomic<quint64> m_nextSequence;
+
+    /// Pages tracked by the log, with MaxPages entries
+    std::unique_ptr<PageEntry[]> m_pages;
+
+    /// Hashmap of page URLs to their index in m_pages
+    QHash<QUrl, quint32> m_pageHandles;
+
+    /// Guards the URLs of the page entries and m_pageHandles. Entries for a page that a thread has logged
+    /// most recently are counted without the lock; other entries take it while looking up their page
+    mutable std::shared_mutex m_pageLock;
 
-    /// Unique identifier of the log pruning timer
-    int m_timerId;
+    /// Open addressed table of the counters of each filter, with MaxRules entries. Entries are claimed
+    /// with a compare-exchange on their state, and are reused once a newer generation of filters is counted
+    std::unique_ptr<RuleEntry[]> m_rules;
 };
 
 }
@@ -1,5 +1,7 @@
 #include "AdBlockLogTableModel.h"
 
+#include <utility>
+
 #include <QString>
 
 namespace adblock
@@ -162,10 +164,10 @@ QString LogTableModel::elementTypeToString(ElementType type) const
     return result;
 }
 
-void LogTableModel::setLogEntries(const std::vector<LogEntry> &entries)
+void LogTableModel::setLogEntries(std::vector<LogEntry> entries)
 {
     beginResetModel();
-    m_logEntries = entries;
+    m_logEntries = std::move(entries);
     endResetModel();
 }
 
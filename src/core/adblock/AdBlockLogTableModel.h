@@ -31,8 +31,8 @@ class LogTableModel : public QAbstractTableModel
     /// Returns the data associated at the index with the given role
     QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
 
-    /// Sets the log entry data to be shown in the table
-    void setLogEntries(const std::vector<LogEntry> &entries);
+    /// Sets the log entry data to be shown in the table, taking ownership of a snapshot from the \ref AdBlockLog
+    void setLogEntries(std::vector<LogEntry> entries);
 
 private:
     /// Returns the element typemask as a formatted string ("type1[, type2, ..., typeN]")
@@ -5,15 +5,26 @@
 #include "Bitfield.h"
 #include "InternalDownloadItem.h"
 #include "DownloadManager.h"
+#include "NetworkAccessManager.h"
+#include "RequestContext.h"
 #include "SchemeRegistry.h"
+#include "StringPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
 
 #include <QDir>
 #include <QDirIterator>
 #include <QFile>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
 #include <QNetworkRequest>
+#include <QSet>
+#include <QThreadPool>
+#include <QtConcurrent>
 #include <QtGlobal>
 
 #include <QDebug>
@@ -23,24 +34,37 @@ namespace adblock
 
 AdBlockManager::AdBlockManager(const ViperServiceLocator &serviceLocator, QObject *parent) :
     QObject(parent),
-    m_filterContainer(),
+    m_filterContainer(std::make_shared<const FilterContainer>()),
     m_downloadManager(nullptr),
+    m_networkAccessManager(nullptr),
+    m_subscriptionUpdater(nullptr),
+    m_subscriptionsUpdated(false),
     m_enabled(true),
     m_configFile(),
     m_subscriptionDir(),
     m_cosmeticJSTemplate(),
     m_subscriptions(),
-    m_resourceMap(),
-    m_resourceContentTypeMap(),
+    m_resources(),
     m_domainStylesheetCache(24),
     m_jsInjectionCache(24),
     m_emptyStr(),
+    m_emptyScripts(),
     m_adBlockModel(nullptr),
     m_log(nullptr),
-    m_requestHandler(nullptr)
+    m_requestHandler(nullptr),
+    m_filterLoadPool(nullptr),
+    m_filterLoadWatcher(nullptr),
+    m_filterLoadJob(nullptr),
+    m_filterReloadPending(false),
+    m_userFiltersModified(false)
 {
     setObjectName(QLatin1String("AdBlockManager"));
 
+    m_filterLoadPool = new QThreadPool(this);
+
+    m_filterLoadWatcher = new QFutureWatcher<void>(this);
+    connect(m_filterLoadWatcher, &QFutureWatcher<void>::finished, this, &AdBlockManager::onFiltersLoaded);
+
     m_downloadManager = serviceLocator.getServiceAs<DownloadManager>("DownloadManager");
 
     if (Settings *settings = serviceLocator.getServiceAs<Settings>("Settings"))
@@ -48,6 +72,7 @@ AdBlockManager::AdBlockManager(const ViperServiceLocator &serviceLocator, QObjec
         m_enabled = settings->getValue(BrowserSetting::AdBlockPlusEnabled).toBool();
         m_configFile = settings->getPathValue(BrowserSetting::AdBlockPlusConfig);
         m_subscriptionDir = settings->getPathValue(BrowserSetting::AdBlockPlusDataDir);
+        Filter::setProfilingEnabled(settings->getValue(BrowserSetting::AdBlockProfilingEnabled).toBool());
 
         // Subscribe to settings event notifications
         connect(settings, &Settings::settingChanged, this, &AdBlockManager::onSettingChanged);
@@ -65,12 +90,18 @@ AdBlockManager::AdBlockManager(const ViperServiceLocator &serviceLocator, QObjec
     m_log = new AdBlockLog(this);
 
     // Instantiate the network request handler
-    m_requestHandler = new RequestHandler(m_filterContainer, m_log, this);
+    m_requestHandler = new RequestHandler(m_log, this);
 }
 
 AdBlockManager::~AdBlockManager()
 {
+    // The loading thread refers to the resource map
+    m_filterLoadWatcher->waitForFinished();
+
     save();
+
+    if (Filter::isProfilingEnabled())
+        saveProfileReport();
 }
 
 void AdBlockManager::setEnabled(bool value)
@@ -80,52 +111,90 @@ void AdBlockManager::setEnabled(bool value)
 
     m_enabled = value;
 
-    // Clear filters regardless of state, and re-extract
-    // filter data from subscriptions if being set to enabled
-    clearFilters();
+    // Clear filters if being disabled, or re-extract filter data from subscriptions if being set to enabled
     if (value)
         extractFilters();
+    else
+        clearFilters();
 }
 
 void AdBlockManager::updateSubscriptions()
 {
-    if (!m_enabled)
+    if (!m_enabled || !m_networkAccessManager)
         return;
 
-    // Try updating the subscription if its next_update is hit
-    // Check if subscription should be updated
-    for (size_t i = 0; i < m_subscriptions.size(); ++i)
+    if (!m_subscriptionUpdater)
+    {
+        m_subscriptionUpdater = new SubscriptionUpdater(m_networkAccessManager, SubscriptionUpdater::DefaultMaxConcurrentDownloads, this);
+        connect(m_subscriptionUpdater, &SubscriptionUpdater::updateFinished, this, &AdBlockManager::onSubscriptionUpdateFinished);
+        connect(m_subscriptionUpdater, &SubscriptionUpdater::finished, this, &AdBlockManager::onSubscriptionUpdatesFinished);
+    }
+
+    // Check each subscription whose next update is due. The checks are conditional requests, so lists that have
+    // not changed since they were last downloaded are neither downloaded nor parsed again
+    const QDateTime now = QDateTime::currentDateTime();
+    for (const Subscription &subscription : m_subscriptions)
     {
-        Subscription *subPtr = &(m_subscriptions[i]);
-        if (!subPtr)
+        const QDateTime &updateTime = subscription.getNextUpdate();
+        if (updateTime.isNull() || updateTime >= now)
             continue;
-        const QDateTime &updateTime = subPtr->getNextUpdate();
-        QDateTime now = QDateTime::currentDateTime();
-        if (!updateTime.isNull() && updateTime < now)
-        {
-            const QUrl &srcUrl = subPtr->getSourceUrl();
-            if (srcUrl.isValid() && !srcUrl.isLocalFile())
-            {
-                QNetworkRequest request;
-                request.setUrl(srcUrl);
-
-                InternalDownloadItem *item = m_downloadManager->downloadInternal(request, m_subscriptionDir, false, true);
-                connect(item, &InternalDownloadItem::downloadFinished, [item, now, subPtr](const QString &filePath) {
-                    if (filePath != subPtr->getFilePath())
-                    {
-                        QFile oldFile(subPtr->getFilePath());
-                        oldFile.remove();
-                        subPtr->setFilePath(filePath);
-                    }
-                    item->deleteLater();
-                    subPtr->setLastUpdate(now);
-                    subPtr->setNextUpdate(now.addDays(7));
-                });
-            }
-        }
+
+        const QUrl &srcUrl = subscription.getSourceUrl();
+        if (!srcUrl.isValid() || srcUrl.isLocalFile())
+            continue;
+
+        SubscriptionUpdate update;
+        update.SourceUrl = srcUrl;
+        update.FilePath = subscription.getFilePath();
+        update.EntityTag = subscription.getEntityTag();
+        update.LastModified = subscription.getSourceLastModified();
+        m_subscriptionUpdater->addUpdate(update);
+    }
+}
+
+void AdBlockManager::onSubscriptionUpdateFinished(const SubscriptionUpdate &update)
+{
+    // A failed update leaves the subscription as it was, so it is tried again at the next update check
+    if (update.Status == SubscriptionUpdateStatus::Failed)
+        return;
+
+    auto it = std::find_if(m_subscriptions.begin(), m_subscriptions.end(), [&update](const Subscription &s) {
+        return s.getFilePath() == update.FilePath;
+    });
+    if (it == m_subscriptions.end())
+    {
+        // The subscription was removed while it was being updated
+        if (update.Status == SubscriptionUpdateStatus::Updated)
+            QFile::remove(update.FilePath);
+        return;
+    }
+
+    // Lists declare how often they should be updated with an "! Expires:" comment. This is read again
+    // when an updated list is loaded, and the previous value is used until then
+    const QDateTime now = QDateTime::currentDateTime();
+    const int expireDays = it->getExpireDays();
+    it->setLastUpdate(now);
+    it->setNextUpdate(now.addDays(expireDays > 0 ? expireDays : 7));
+
+    if (update.Status == SubscriptionUpdateStatus::Updated)
+    {
+        it->setEntityTag(update.EntityTag);
+        it->setSourceLastModified(update.LastModified);
+        m_subscriptionsUpdated = true;
     }
 }
 
+void AdBlockManager::onSubscriptionUpdatesFinished()
+{
+    if (!m_subscriptionsUpdated)
+        return;
+
+    m_subscriptionsUpdated = false;
+
+    // Only the updated subscriptions are loaded again, reusing the filters of their unchanged rules
+    extractFilters();
+}
+
 void AdBlockManager::installResource(const QUrl &url)
 {
     if (!url.isValid())
@@ -163,7 +232,6 @@ void AdBlockManager::installSubscription(const QUrl &url)
             m_adBlockModel->endInsertRows();
 
         // Reload filters
-        clearFilters();
         extractFilters();
     });
 }
@@ -171,9 +239,7 @@ void AdBlockManager::installSubscription(const QUrl &url)
 void AdBlockManager::createUserSubscription()
 {
     // Associate new subscription with file "custom.txt"
-    QString userFile = m_subscriptionDir;
-    userFile.append(QDir::separator());
-    userFile.append(QLatin1String("custom.txt"));
+    const QString userFile = getUserFilePath();
     QString userFileUrl = QString("file://%1").arg(QFileInfo(userFile).absoluteFilePath());
 
     Subscription subscription(userFile);
@@ -212,18 +278,17 @@ AdBlockModel *AdBlockManager::getModel()
     return m_adBlockModel;
 }
 
-const QString &AdBlockManager::getStylesheet(const URL &url) const
+std::vector<QString> AdBlockManager::getStylesheetScripts(const URL &url) const
 {
-    // Check generic hide filters
-    QString requestUrl = url.toString(URL::FullyEncoded).toLower();
-    QString secondLevelDomain = url.getSecondLevelDomain();
-    if (secondLevelDomain.isEmpty())
-        secondLevelDomain = url.host();
+    std::shared_ptr<const FilterContainer> filterContainer = getFilterContainer();
 
-    if (m_filterContainer.hasGenericHideFilter(requestUrl, secondLevelDomain))
-        return m_emptyStr;
+    // Check generic hide filters
+    const RequestContext context(url, url, ElementType::Other);
+    if (filterContainer->hasGenericHideFilter(context))
+        return {};
 
-    return m_filterContainer.getCombinedFilterStylesheet();
+    // The scripts are built with the filter container, and their data is shared rather than copied
+    return filterContainer->getStylesheetScripts();
 }
 
 const QString &AdBlockManager::getDomainStylesheet(const URL &url)
@@ -259,50 +324,53 @@ const QString &AdBlockManager::getDomainStylesheet(const URL &url)
                                        "doc.head.appendChild(sheet);\n"
                                    "})();");
 
+    std::shared_ptr<const FilterContainer> filterContainer = getFilterContainer();
+
+    // Compose the stylesheet from the CSS of each filter, which was escaped when the filter container was built
     QString stylesheet;
+    QSet<QString> selectors;
     int numStylesheetRules = 0;
-    std::vector<Filter*> domainBasedHidingFilters = m_filterContainer.getDomainBasedHidingFilters(domain);
+    std::vector<Filter*> domainBasedHidingFilters = filterContainer->getDomainBasedHidingFilters(domain);
     for (Filter *filter : domainBasedHidingFilters)
     {
-        stylesheet.append(filter->getEvalString() + QChar(','));
-        if (numStylesheetRules > 1000)
+        const QString &selector = filterContainer->getEscapedStyleRule(filter);
+        if (selector.isEmpty() || selectors.contains(selector))
+            continue;
+        selectors.insert(selector);
+
+        if (numStylesheetRules > 0)
+            stylesheet.append(QLatin1Char(','));
+        stylesheet.append(selector);
+
+        if (++numStylesheetRules > 1000)
         {
-            stylesheet = stylesheet.left(stylesheet.size() - 1);
             stylesheet.append(QLatin1String("{ display: none !important; } "));
             numStylesheetRules = 0;
         }
-        else
-            ++numStylesheetRules;
     }
 
     if (numStylesheetRules > 0)
-    {
-        stylesheet = stylesheet.left(stylesheet.size() - 1);
         stylesheet.append(QLatin1String("{ display: none !important; } "));
-    }
 
     // Check for custom stylesheet rules
-    domainBasedHidingFilters = m_filterContainer.getDomainBasedCustomHidingFilters(domain);
+    domainBasedHidingFilters = filterContainer->getDomainBasedCustomHidingFilters(domain);
     for (Filter *filter : domainBasedHidingFilters)
     {
-        stylesheet.append(filter->getEvalString());
+        stylesheet.append(filterContainer->getEscapedStyleRule(filter));
     }
 
     if (!stylesheet.isEmpty())
-    {
-        stylesheet = stylesheet.replace(QLatin1String("'"), QLatin1String("\\'"));
         stylesheet = styleScript.arg(stylesheet);
-    }
 
     // Insert the stylesheet into cache
     m_domainStylesheetCache.put(domainStdStr, stylesheet);
     return m_domainStylesheetCache.get(domainStdStr);
 }
 
-const QString &AdBlockManager::getDomainJavaScript(const URL &url)
+const DomainScripts &AdBlockManager::getDomainJavaScript(const URL &url)
 {
     if (!m_enabled)
-        return m_emptyStr;
+        return m_emptyScripts;
 
     const static QString cspScript = QStringLiteral("(function() {\n"
                                        "var doc = document;\n"
@@ -329,8 +397,6 @@ const QString &AdBlockManager::getDomainJavaScript(const URL &url)
     if (domain.isEmpty())
         domain = url.getSecondLevelDomain();
 
-    QString requestUrl = url.toString(QUrl::FullyEncoded).toLower();
-
     // Check for cache hit
     std::string requestHostStdStr = url.host().toLower().toStdString();
     if (requestHostStdStr.empty())
@@ -339,22 +405,26 @@ const QString &AdBlockManager::getDomainJavaScript(const URL &url)
     if (m_jsInjectionCache.has(requestHostStdStr))
         return m_jsInjectionCache.get(requestHostStdStr);
 
+    std::shared_ptr<const FilterContainer> filterContainer = getFilterContainer();
+
     QString javascript;
     std::vector<QString> cspDirectives;
 
-    std::vector<Filter*> domainBasedScripts = m_filterContainer.getDomainBasedScriptInjectionFilters(domain);
+    std::vector<Filter*> domainBasedScripts = filterContainer->getDomainBasedScriptInjectionFilters(domain);
     for (Filter *filter : domainBasedScripts)
         javascript.append(filter->getEvalString());
 
-    const Filter *inlineScriptBlockingRule = m_filterContainer.findInlineScriptBlockingFilter(requestUrl, domain);
+    const RequestContext inlineScriptContext(url, url, ElementType::InlineScript);
+    const Filter *inlineScriptBlockingRule = filterContainer->findInlineScriptBlockingFilter(inlineScriptContext);
     if (inlineScriptBlockingRule != nullptr)
         cspDirectives.push_back(QLatin1String("script-src 'unsafe-eval' * blob: data:"));
 
-    std::vector<Filter*> cspFilters = m_filterContainer.getMatchingCSPFilters(requestUrl, domain);
+    const RequestContext cspContext(url, url, ElementType::CSP);
+    std::vector<Filter*> cspFilters = filterContainer->getMatchingCSPFilters(cspContext);
     for (Filter *filter : cspFilters)
         cspDirectives.push_back(filter->getContentSecurityPolicy());
 
-    QString result;
+    DomainScripts result;
     if (!cspDirectives.empty())
     {
         QString cspConcatenated;
@@ -370,8 +440,21 @@ const QString &AdBlockManager::getDomainJavaScript(const URL &url)
 
     if (!javascript.isEmpty())
     {
-        result = m_cosmeticJSTemplate;
-        result.replace(QLatin1String("{{ADBLOCK_INTERNAL}}"), javascript);
+        result.UserScript = m_cosmeticJSTemplate;
+        result.UserScript.replace(QLatin1String("{{ADBLOCK_INTERNAL}}"), javascript);
+
+        // The page script places the user script in a template literal, which is inserted into the DOM as a script tag
+        const static QString mutationScript = QStringLiteral("function selfInject() { "
+                                         "try { let script = document.createElement('script'); "
+                                         "script.appendChild(document.createTextNode(`%1`)); "
+                                         "if (document.head || document.documentElement) { (document.head || document.documentElement).appendChild(script); } "
+                                         "else { setTimeout(selfInject, 100); } "
+                                         " } catch(exc) { console.error('Could not run mutation script: ' + exc); } } selfInject();");
+        QString escapedScript = result.UserScript;
+        escapedScript.replace(QLatin1String("\\"), QLatin1String("\\\\"));
+        escapedScript.replace(QLatin1String("`"), QLatin1String("\\`"));
+        escapedScript.replace(QLatin1String("${"), QLatin1String("\\${"));
+        result.PageScript = mutationScript.arg(escapedScript);
     }
 
     m_jsInjectionCache.put(requestHostStdStr, result);
@@ -383,7 +466,8 @@ bool AdBlockManager::shouldBlockRequest(QWebEngineUrlRequestInfo &info, const QU
     if (!m_enabled || SchemeRegistry::isSchemeWhitelisted(info.requestUrl().scheme().toLower()))
         return false;
 
-    return m_requestHandler->shouldBlockRequest(info, firstPartyUrl);
+    std::shared_ptr<const FilterContainer> filterContainer = getFilterContainer();
+    return m_requestHandler->shouldBlockRequest(*filterContainer, info, firstPartyUrl);
 }
 
 quint64 AdBlockManager::getRequestsBlockedCount() const
@@ -398,12 +482,12 @@ int AdBlockManager::getNumberAdsBlocked(const QUrl &url) const
 
 QString AdBlockManager::getResource(const QString &key) const
 {
-    return m_resourceMap.value(key);
+    return QString::fromUtf8(m_resources.getResource(key).Data);
 }
 
-QString AdBlockManager::getResourceContentType(const QString &key) const
+Resource AdBlockManager::getDecodedResource(const QString &key) const
 {
-    return m_resourceContentTypeMap.value(key);
+    return m_resources.getResource(key);
 }
 
 int AdBlockManager::getNumSubscriptions() const
@@ -446,6 +530,7 @@ void AdBlockManager::removeSubscription(int index)
         if (!subFile.remove())
             qDebug() << "[Advertisement Blocker]: Could not remove subscription file " << subFile.fileName();
     }
+    it->removeCacheFile();
 
     m_subscriptions.erase(it);
 
@@ -457,27 +542,22 @@ void AdBlockManager::reloadSubscriptions()
     m_domainStylesheetCache.clear();
     m_jsInjectionCache.clear();
 
-    clearFilters();
+    // The current filters remain in use until they are replaced by the reloaded filters
     extractFilters();
 }
 
-QString AdBlockManager::getSecondLevelDomain(const QUrl &url) const
+void AdBlockManager::reloadUserFilters()
 {
-    const QString topLevelDomain = url.topLevelDomain();
-    const QString host = url.host();
-
-    if (topLevelDomain.isEmpty() || host.isEmpty())
-        return QString();
-
-    QString domain = host.left(host.size() - topLevelDomain.size());
-
-    if (domain.count(QChar('.')) == 0)
-        return host;
-
-    while (domain.count(QChar('.')) != 0)
-        domain = domain.mid(domain.indexOf(QChar('.')) + 1);
+    m_userFiltersModified = true;
+    reloadSubscriptions();
+}
 
-    return domain + topLevelDomain;
+QString AdBlockManager::getUserFilePath() const
+{
+    QString userFile = m_subscriptionDir;
+    userFile.append(QDir::separator());
+    userFile.append(QLatin1String("custom.txt"));
+    return userFile;
 }
 
 void AdBlockManager::loadDynamicTemplate()
@@ -496,7 +576,7 @@ void AdBlockManager::loadUBOResources()
     if (!resourceDir.exists())
         resourceDir.mkpath(QStringLiteral("."));
 
-    // Iterate through files in directory, loading into m_resourceMap
+    // Iterate through files in directory, loading into the resource map
     QDirIterator resourceItr(resourceDir.absolutePath(), QDir::Files);
     while (resourceItr.hasNext())
     {
@@ -506,53 +586,7 @@ void AdBlockManager::loadUBOResources()
 
 void AdBlockManager::loadResourceFile(const QString &path)
 {
-    QFile f(path);
-    if (!f.exists() || !f.open(QIODevice::ReadOnly))
-        return;
-
-    bool readingValue = false;
-    QString currentKey, mimeType;
-    QByteArray currentValue;
-    QList<QByteArray> contents = f.readAll().split('\n');
-    f.close();
-    for (int i = 0; i < contents.size(); ++i)
-    {
-        const QByteArray &line = contents.at(i);
-        if ((!readingValue && line.isEmpty()) || line.startsWith('#'))
-            continue;
-
-        // Extract key from line if not loading a value associated with a key
-        if (!readingValue)
-        {
-            int sepIdx = line.indexOf(' ');
-            if (sepIdx < 0)
-                currentKey = line;
-            else
-            {
-                currentKey = line.left(sepIdx);
-                mimeType = line.mid(sepIdx + 1);
-                m_resourceContentTypeMap.insert(currentKey, mimeType);
-            }
-            readingValue = true;
-        }
-        else
-        {
-            // Append currentValue with line if not empty.
-            if (!line.isEmpty())
-            {
-                currentValue.append(line);
-                if (mimeType.contains(QLatin1String("javascript")))
-                    currentValue.append('\n');
-            }
-            else
-            {
-                // Insert key-value pair into map once an empty line is reached and search for next key
-                m_resourceMap.insert(currentKey, QString(currentValue));
-                currentValue.clear();
-                readingValue = false;
-            }
-        }
-    }
+    m_resources.loadFile(path);
 }
 
 void AdBlockManager::onSettingChanged(BrowserSetting setting, const QVariant &value)
@@ -561,6 +595,10 @@ void AdBlockManager::onSettingChanged(BrowserSetting setting, const QVariant &va
     {
         setEnabled(value.toBool());
     }
+    else if (setting == BrowserSetting::AdBlockProfilingEnabled)
+    {
+        Filter::setProfilingEnabled(value.toBool());
+    }
 }
 
 void AdBlockManager::loadSubscriptions()
@@ -620,26 +658,299 @@ void AdBlockManager::loadSubscriptions()
         if (!source.isEmpty())
             subscription.setSourceUrl(QUrl(source));
 
+        // Get the validators of the last download of the subscription, used to make its updates conditional
+        subscription.setEntityTag(subscriptionObj.value(QLatin1String("etag")).toString());
+        subscription.setSourceLastModified(subscriptionObj.value(QLatin1String("http_last_modified")).toString());
+
         m_subscriptions.push_back(std::move(subscription));
     }
 
     extractFilters();
 }
 
+void AdBlockManager::setNetworkAccessManager(NetworkAccessManager *networkAccessManager)
+{
+    m_networkAccessManager = networkAccessManager;
+}
+
+std::shared_ptr<const FilterContainer> AdBlockManager::getFilterContainer() const
+{
+    return std::atomic_load(&m_filterContainer);
+}
+
+void AdBlockManager::setFilterContainer(std::shared_ptr<const FilterContainer> filterContainer)
+{
+    std::atomic_store(&m_filterContainer, std::move(filterContainer));
+}
+
 void AdBlockManager::clearFilters()
 {
-    m_filterContainer.clearFilters();
+    setFilterContainer(std::make_shared<const FilterContainer>());
+}
+
+/**
+ * @brief Calls the given function with each index from 0 to count - 1, on the calling thread and on the other
+ *        threads of the given pool. The calling thread is expected to be one of the threads of the pool
+ */
+template <typename Function>
+static void runInParallel(QThreadPool *pool, std::size_t count, Function &&function)
+{
+    std::atomic<std::size_t> nextIndex(0);
+    auto worker = [&nextIndex, count, &function]() {
+        for (std::size_t index = nextIndex++; index < count; index = nextIndex++)
+            function(index);
+    };
+
+    const std::size_t maxHelpers = static_cast<std::size_t>(std::max(pool->maxThreadCount() - 1, 0));
+    const std::size_t numHelpers = std::min(maxHelpers, count > 0 ? count - 1 : 0);
+
+    std::vector< QFuture<void> > helpers;
+    helpers.reserve(numHelpers);
+    for (std::size_t i = 0; i < numHelpers; ++i)
+        helpers.push_back(QtConcurrent::run(pool, worker));
+
+    // Work on the calling thread as well, so that every index is handled even if no helper has started yet
+    worker();
+
+    for (QFuture<void> &helper : helpers)
+        helper.waitForFinished();
 }
 
 void AdBlockManager::extractFilters()
 {
-    for (Subscription &s : m_subscriptions)
+    if (m_filterLoadJob)
+    {
+        m_filterReloadPending = true;
+        return;
+    }
+
+    // Load copies of the subscriptions, so they can still be viewed and modified while the filters are loading.
+    // Each copy shares the filters already loaded for its subscription, which are only loaded again if the
+    // subscription file has changed since then
+    auto job = std::make_shared<FilterLoadJob>();
+    job->Subscriptions.reserve(m_subscriptions.size());
+    for (const Subscription &s : m_subscriptions)
+    {
+        Subscription sub(s.getFilePath());
+        sub.setEnabled(s.isEnabled());
+        sub.setLastUpdate(s.getLastUpdate());
+        sub.m_expireDays = s.m_expireDays;
+        sub.m_name = s.m_name;
+        sub.m_filterArena = s.m_filterArena;
+        sub.m_loadedLastModified = s.m_loadedLastModified;
+        sub.m_loadedFileSize = s.m_loadedFileSize;
+        sub.m_loadedChecksum = s.m_loadedChecksum;
+        job->Subscriptions.push_back(std::move(sub));
+    }
+
+    // The user's filters may have been edited without changing the size or modification time of their file
+    if (m_userFiltersModified)
+        job->CheckedFilePath = getUserFilePath();
+
+    m_filterLoadJob = job;
+    m_filterReloadPending = false;
+    m_userFiltersModified = false;
+
+    m_filterLoadWatcher->setFuture(QtConcurrent::run(m_filterLoadPool, [this, job]() {
+        // Domain names and option values repeat across subscriptions, so they are interned in a pool
+        // shared by the whole load. The pool is released once loading is done, leaving one copy of each string
+        StringPool stringPool;
+
+        // Read each subscription file and split it into ranges of lines. Nothing is left to parse if the
+        // subscription is disabled, or if its filters are already up to date
+        std::vector<Subscription> &subscriptions = job->Subscriptions;
+        std::vector<char> isLoading(subscriptions.size(), 0);
+        runInParallel(m_filterLoadPool, subscriptions.size(), [&](std::size_t index) {
+            Subscription &s = subscriptions[index];
+            isLoading[index] = s.beginLoad(this, &stringPool, s.getFilePath() == job->CheckedFilePath) ? 1 : 0;
+        });
+
+        // Parse the ranges of every subscription as one list of work items, so that a large subscription is
+        // spread across all of the threads rather than the one that read its file
+        std::vector< std::pair<Subscription*, std::size_t> > workItems;
+        for (std::size_t i = 0; i < subscriptions.size(); ++i)
+        {
+            if (!isLoading[i])
+                continue;
+
+            Subscription *s = &subscriptions[i];
+            for (std::size_t rangeIndex = 0, numRanges = s->getNumPendingRanges(); rangeIndex < numRanges; ++rangeIndex)
+                workItems.push_back(std::make_pair(s, rangeIndex));
+        }
+
+        runInParallel(m_filterLoadPool, workItems.size(), [&workItems](std::size_t index) {
+            workItems[index].first->parsePendingRange(workItems[index].second);
+        });
+
+        runInParallel(m_filterLoadPool, subscriptions.size(), [&](std::size_t index) {
+            if (isLoading[index])
+                subscriptions[index].finishLoad();
+        });
+
+        job->Container = std::make_shared<const FilterContainer>(job->Subscriptions);
+    }));
+}
+
+void AdBlockManager::onFiltersLoaded()
+{
+    std::shared_ptr<FilterLoadJob> job;
+    job.swap(m_filterLoadJob);
+    if (!job)
+        return;
+
+    // Copy the results of the load back into the subscriptions that still exist
+    for (Subscription &loaded : job->Subscriptions)
     {
-        // calling load() does nothing if subscription is disabled
-        s.load(this);
+        for (Subscription &s : m_subscriptions)
+        {
+            if (s.getFilePath() != loaded.getFilePath())
+                continue;
+
+            s.m_filterArena = std::move(loaded.m_filterArena);
+            s.m_loadedLastModified = loaded.m_loadedLastModified;
+            s.m_loadedFileSize = loaded.m_loadedFileSize;
+            s.m_loadedChecksum = loaded.m_loadedChecksum;
+            if (!loaded.m_name.isEmpty())
+                s.m_name = loaded.m_name;
+            if (loaded.getNextUpdate().isValid())
+                s.setNextUpdate(loaded.getNextUpdate());
+            s.m_expireDays = loaded.m_expireDays;
+            break;
+        }
     }
 
-    m_filterContainer.extractFilters(m_subscriptions);
+    if (m_enabled && job->Container)
+    {
+        m_domainStylesheetCache.clear();
+        m_jsInjectionCache.clear();
+
+        setFilterContainer(std::move(job->Container));
+    }
+
+    // Subscriptions were changed while loading, load them again
+    if (m_filterReloadPending)
+        extractFilters();
+}
+
+/// Returns the name of the given request type, as used in filter options
+static QString getRequestTypeName(ElementType type)
+{
+    switch (type)
+    {
+        case ElementType::Script:           return QStringLiteral("script");
+        case ElementType::Image:            return QStringLiteral("image");
+        case ElementType::Stylesheet:       return QStringLiteral("stylesheet");
+        case ElementType::Object:           return QStringLiteral("object");
+        case ElementType::XMLHTTPRequest:   return QStringLiteral("xmlhttprequest");
+        case ElementType::ObjectSubrequest: return QStringLiteral("object-subrequest");
+        case ElementType::Subdocument:      return QStringLiteral("subdocument");
+        case ElementType::Ping:             return QStringLiteral("ping");
+        case ElementType::WebSocket:        return QStringLiteral("websocket");
+        case ElementType::WebRTC:           return QStringLiteral("webrtc");
+        case ElementType::Document:         return QStringLiteral("document");
+        case ElementType::Other:            return QStringLiteral("other");
+        default:
+            return QString("0x%1").arg(static_cast<quint64>(type), 0, 16);
+    }
+}
+
+/// Returns the JSON form of the profiling counters of a filter
+static QJsonObject getFilterProfileObject(const FilterProfile &profile)
+{
+    QJsonObject filterObj;
+    filterObj.insert(QLatin1String("rule"), profile.Rule);
+    filterObj.insert(QLatin1String("subscription"), profile.Subscription);
+    filterObj.insert(QLatin1String("evaluations"), static_cast<qint64>(profile.NumEvaluations));
+    filterObj.insert(QLatin1String("matches"), static_cast<qint64>(profile.NumMatches));
+    filterObj.insert(QLatin1String("time_ns"), profile.EvaluationTime);
+    return filterObj;
+}
+
+QJsonObject AdBlockManager::getProfileReport(int maxCostliestFilters) const
+{
+    std::shared_ptr<const FilterContainer> filterContainer = getFilterContainer();
+    std::vector<FilterProfile> profiles = filterContainer->getFilterProfiles();
+
+    // Time spent matching each type of request
+    QJsonArray requestTypes;
+    for (const RequestTypeProfile &typeProfile : m_requestHandler->getRequestTypeProfiles())
+    {
+        QJsonObject typeObj;
+        typeObj.insert(QLatin1String("type"), getRequestTypeName(typeProfile.Type));
+        typeObj.insert(QLatin1String("requests"), static_cast<qint64>(typeProfile.NumRequests));
+        typeObj.insert(QLatin1String("time_ns"), typeProfile.MatchTime);
+        typeObj.insert(QLatin1String("mean_time_ns"), typeProfile.MatchTime / static_cast<qint64>(typeProfile.NumRequests));
+        requestTypes.append(typeObj);
+    }
+
+    // Totals of each subscription, and the rules that never matched a request. Profiles are grouped by subscription
+    QJsonArray subscriptions, unmatchedFilters;
+    QJsonObject subscriptionObj;
+    qint64 numFilters = 0, numEvaluations = 0, numMatches = 0, evaluationTime = 0, numUnmatched = 0;
+    auto appendSubscription = [&]() {
+        if (numFilters == 0)
+            return;
+
+        subscriptionObj.insert(QLatin1String("filters"), numFilters);
+        subscriptionObj.insert(QLatin1String("evaluations"), numEvaluations);
+        subscriptionObj.insert(QLatin1String("matches"), numMatches);
+        subscriptionObj.insert(QLatin1String("time_ns"), evaluationTime);
+        subscriptionObj.insert(QLatin1String("unmatched_filters"), numUnmatched);
+        subscriptions.append(subscriptionObj);
+        numFilters = numEvaluations = numMatches = evaluationTime = numUnmatched = 0;
+    };
+
+    for (std::size_t i = 0; i < profiles.size(); ++i)
+    {
+        const FilterProfile &profile = profiles[i];
+        if (i == 0 || profile.Subscription != profiles[i - 1].Subscription)
+        {
+            appendSubscription();
+            subscriptionObj = QJsonObject();
+            subscriptionObj.insert(QLatin1String("name"), profile.Subscription);
+        }
+
+        ++numFilters;
+        numEvaluations += profile.NumEvaluations;
+        numMatches += profile.NumMatches;
+        evaluationTime += profile.EvaluationTime;
+
+        if (profile.NumMatches == 0)
+        {
+            ++numUnmatched;
+            unmatchedFilters.append(getFilterProfileObject(profile));
+        }
+    }
+    appendSubscription();
+
+    // Filters that took the most time to evaluate
+    const std::size_t numCostliest = std::min(profiles.size(), static_cast<std::size_t>(std::max(maxCostliestFilters, 0)));
+    std::partial_sort(profiles.begin(), profiles.begin() + static_cast<std::ptrdiff_t>(numCostliest), profiles.end(),
+                      [](const FilterProfile &a, const FilterProfile &b) {
+        return a.EvaluationTime > b.EvaluationTime;
+    });
+
+    QJsonArray costliestFilters;
+    for (std::size_t i = 0; i < numCostliest && profiles[i].NumEvaluations > 0; ++i)
+        costliestFilters.append(getFilterProfileObject(profiles[i]));
+
+    QJsonObject reportObj;
+    reportObj.insert(QLatin1String("created"), QDateTime::currentDateTime().toString(Qt::ISODate));
+    reportObj.insert(QLatin1String("request_types"), requestTypes);
+    reportObj.insert(QLatin1String("subscriptions"), subscriptions);
+    reportObj.insert(QLatin1String("costliest_filters"), costliestFilters);
+    reportObj.insert(QLatin1String("unmatched_filters"), unmatchedFilters);
+    return reportObj;
+}
+
+void AdBlockManager::saveProfileReport() const
+{
+    QFile reportFile(QString("%1%2%3").arg(m_subscriptionDir).arg(QDir::separator()).arg(QLatin1String("filter_profile.json")));
+    if (!reportFile.open(QIODevice::WriteOnly))
+        return;
+
+    reportFile.write(QJsonDocument(getProfileReport()).toJson());
+    reportFile.close();
 }
 
 void AdBlockManager::save()
@@ -656,7 +967,8 @@ void AdBlockManager::save()
     //     "/path/to/subscription2.txt": { subscription object 2 }
     // }
     // Subscription object format: { "enabled": (true|false), "last_update": (timestamp),
-    //                               "next_update": (timestamp), "source": "origin_url" }
+    //                               "next_update": (timestamp), "source": "origin_url",
+    //                               "etag": "ETag header", "http_last_modified": "Last-Modified header" }
     QJsonObject configObj;
     configObj.insert(QLatin1String("requests_blocked"), QJsonValue(QString::number(m_requestHandler->getTotalNumberOfBlockedRequests())));
     for (auto it = m_subscriptions.cbegin(); it != m_subscriptions.cend(); ++it)
@@ -671,6 +983,8 @@ void AdBlockManager::save()
         subscriptionObj.insert(QLatin1String("next_update"), QJsonValue::fromVariant(QVariant(it->getNextUpdate().toMSecsSinceEpoch() / 1000ULL)));
 #endif
         subscriptionObj.insert(QLatin1String("source"), it->getSourceUrl().toString(QUrl::FullyEncoded));
+        subscriptionObj.insert(QLatin1String("etag"), it->getEntityTag());
+        subscriptionObj.insert(QLatin1String("http_last_modified"), it->getSourceLastModified());
 
         configObj.insert(it->getFilePath(), QJsonValue(subscriptionObj));
     }
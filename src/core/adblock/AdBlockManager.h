@@ -5,21 +5,29 @@
 #include "AdBlockFilterContainer.h"
 #include "AdBlockSubscription.h"
 #include "LRUCache.h"
+#include "ResourceStore.h"
 #include "ServiceLocator.h"
+#include "SubscriptionUpdater.h"
 #include "Settings.h"
 #include "ISettingsObserver.h"
 #include "URL.h"
 
+#include <QFutureWatcher>
 #include <QHash>
+#include <QJsonObject>
 #include <QObject>
 #include <QString>
 #include <QWebEngineUrlRequestInfo>
 
+#include <atomic>
 #include <deque>
+#include <memory>
 #include <vector>
 
 class BrowserApplication;
 class DownloadManager;
+class NetworkAccessManager;
+class QThreadPool;
 
 namespace adblock
 {
@@ -32,6 +40,21 @@ namespace adblock
  * An implementation of the AdBlockPlus and uBlock Origin style content filtering system
  */
 
+/**
+ * @struct DomainScripts
+ * @brief The scripts that apply the script injection and content security policy filters of a domain to its pages
+ * @ingroup AdBlock
+ */
+struct DomainScripts
+{
+    /// Script that is run in the user world of each frame of a page
+    QString UserScript;
+
+    /// The user script, wrapped in a script that adds it to the DOM of the page as a script element.
+    /// Empty if the user script is empty
+    QString PageScript;
+};
+
 /**
  * @class AdBlockManager
  * @ingroup AdBlock
@@ -63,16 +86,17 @@ class AdBlockManager : public QObject, public ISettingsObserver
     /// Returns the model that is used to view and modify ad block subscriptions
     AdBlockModel *getModel();
 
-    /// Returns the base stylesheet for elements to be blocked. If the given url matches a generichide filter, this will return an empty string
-    const QString &getStylesheet(const URL &url) const;
+    /// Returns the scripts that add the base stylesheet for elements to be blocked to a page, one for each chunk of the
+    /// stylesheet. If the given url matches a generichide filter, this will return an empty container
+    std::vector<QString> getStylesheetScripts(const URL &url) const;
 
     /// Returns the domain-specific blocking stylesheet, or an empty string if not applicable
     const QString &getDomainStylesheet(const URL &url);
 
-    /// Returns the domain-specific blocking javascript, or an empty string if not applicable
-    const QString &getDomainJavaScript(const URL &url);
+    /// Returns the domain-specific blocking javascript, or empty scripts if not applicable
+    const DomainScripts &getDomainJavaScript(const URL &url);
 
-    /// Returns true if the given request should be blocked, false if else
+    /// Returns true if the given request should be blocked, false if else. May be called from any thread
     bool shouldBlockRequest(QWebEngineUrlRequestInfo &info, const QUrl &firstPartyUrl);
 
     /// Returns the total number of network requests that have been blocked by the ad blocking system
@@ -81,14 +105,25 @@ class AdBlockManager : public QObject, public ISettingsObserver
     /// Returns the number of ads that were blocked on the page with the given URL during its last page load
     int getNumberAdsBlocked(const QUrl &url) const;
 
-    /// Searches for and returns the value from the resource map that is associated with the given key. Returns an empty string if not found
+    /// Searches for and returns the value from the resource map that is associated with the given key, as text.
+    /// Returns an empty string if not found
     QString getResource(const QString &key) const;
 
-    /// Returns the content type of the resource with the given key. Returns an empty string if the key is not found
-    QString getResourceContentType(const QString &key) const;
+    /// Returns the decoded data and MIME type of the resource with the given key, sharing the data held by the
+    /// resource map. The data of the returned resource is empty if the key is not found. May be called from any thread
+    Resource getDecodedResource(const QString &key) const;
+
+    /**
+     * @brief Builds a report of the profiling counters recorded while \ref Filter::isProfilingEnabled was true
+     * @param maxCostliestFilters Maximum number of filters to list by the time spent evaluating them
+     * @return A JSON object containing the time spent matching each type of request, the totals of each subscription,
+     *         the costliest filters, and the filters that have never matched a request
+     */
+    QJsonObject getProfileReport(int maxCostliestFilters = 100) const;
 
 public Q_SLOTS:
-    /// Attempt to update ad block subscriptions
+    /// Checks each subscription whose next update is due for a new version of its list, reloading the filters once
+    /// every check has finished if any list had changed
     void updateSubscriptions();
 
     /**
@@ -112,6 +147,10 @@ public Q_SLOTS:
     /// Reloads the filter list subscriptions
     void reloadSubscriptions();
 
+    /// Reloads the filter list subscriptions after the user has edited their own filter rules. The contents of the
+    /// user's subscription file are compared even if its size and modification time have not changed
+    void reloadUserFilters();
+
 // Called by AdBlockModel:
 protected:
     /// Returns the number of subscriptions used by the ad block manager
@@ -131,6 +170,9 @@ public Q_SLOTS:
     /// Loads active subscriptions
     void loadSubscriptions();
 
+    /// Sets the network access manager that subscription updates are downloaded with
+    void setNetworkAccessManager(NetworkAccessManager *networkAccessManager);
+
 private Q_SLOTS:
     /// Loads the uBlock Origin-style resource file into the resource map
     void loadResourceFile(const QString &path);
@@ -138,34 +180,78 @@ private Q_SLOTS:
     /// Listens for any settings changes that affect the advertisement blocking system (ex: enable/disable ad block)
     void onSettingChanged(BrowserSetting setting, const QVariant &value) override;
 
-private:
-    /// Returns the second-level domain string of the given url
-    QString getSecondLevelDomain(const QUrl &url) const;
+    /// Called when the background thread has finished loading the filters, replacing the filter container in use
+    void onFiltersLoaded();
 
+    /// Records the result of a subscription update, scheduling the next update of the subscription if it succeeded
+    void onSubscriptionUpdateFinished(const SubscriptionUpdate &update);
+
+    /// Called once every subscription update has finished. Reloads the filters if any subscription file was replaced
+    void onSubscriptionUpdatesFinished();
+
+private:
     /// Loads the AdBlock JavaScript template for dynamic filters
     void loadDynamicTemplate();
 
     /// Load uBlock Origin-style resources file(s) from m_subscriptionDir/resources folder
     void loadUBOResources();
 
+    /// Returns the filter container that is currently in use
+    std::shared_ptr<const FilterContainer> getFilterContainer() const;
+
+    /// Replaces the filter container that is in use. Requests being examined with the previous container
+    /// will finish with it, and it is released after the last of them completes
+    void setFilterContainer(std::shared_ptr<const FilterContainer> filterContainer);
+
     /// Clears current filter data
     void clearFilters();
 
-    /// Extracts pointers to filters from subscriptions into the appropriate containers
+    /// Returns the path of the subscription file that holds the user's own filter rules
+    QString getUserFilePath() const;
+
+    /// Loads the filters of each subscription whose file has changed since it was last loaded in a background thread,
+    /// and replaces the filter container with one built from the filters of every enabled subscription once finished.
+    /// If filters are already being loaded, they will be loaded again afterwards
     void extractFilters();
 
     /// Saves subscription information to disk, called by destructor
     void save();
 
+    /// Writes the profiling report to the ad block data directory, called by destructor while profiling is enabled
+    void saveProfileReport() const;
+
 private:
-    /// Stores the union of all subscription list filters
-    FilterContainer m_filterContainer;
+    /// Subscriptions and the filter container built from them by a background load
+    struct FilterLoadJob
+    {
+        /// Copies of the subscriptions being loaded, which take the place of the originals until the load is finished
+        std::vector<Subscription> Subscriptions;
+
+        /// Filter container built from the loaded subscriptions
+        std::shared_ptr<const FilterContainer> Container;
 
-    /// Download manager, required to update subscription lists
+        /// Path of a subscription file whose contents are compared with the version its filters were loaded from,
+        /// even if its size and modification time have not changed. Empty if there is no such file
+        QString CheckedFilePath;
+    };
+
+    /// Stores the union of all subscription list filters. Only accessed through \ref getFilterContainer and \ref setFilterContainer
+    std::shared_ptr<const FilterContainer> m_filterContainer;
+
+    /// Download manager, required to install subscription lists
     DownloadManager *m_downloadManager;
 
+    /// Network access manager, required to update subscription lists
+    NetworkAccessManager *m_networkAccessManager;
+
+    /// Downloads new versions of subscription lists. Created by the first update
+    SubscriptionUpdater *m_subscriptionUpdater;
+
+    /// True if a subscription file was replaced by the updates that are in progress
+    bool m_subscriptionsUpdated;
+
     /// True if AdBlock is enabled, false if disabled
-    bool m_enabled;
+    std::atomic_bool m_enabled;
 
     /// JSON configuration file path
     QString m_configFile;
@@ -179,21 +265,22 @@ private Q_SLOTS:
     /// Container of content blocking subscriptions
     std::vector<Subscription> m_subscriptions;
 
-    /// Resources available to filters by referencing the key. Available for redirect options as well as script injections
-    QHash<QString, QString> m_resourceMap;
-
-    /// Mapping of resource names, from the resource map, to their respective content types
-    QHash<QString, QString> m_resourceContentTypeMap;
+    /// Resources available to filters by referencing the key. Available for redirect options as well as script injections.
+    /// Read by the filter loading thread and the network thread
+    ResourceStore m_resources;
 
     /// A cache of the most recently used domain-specific stylesheets
     LRUCache<std::string, QString> m_domainStylesheetCache;
 
     /// A cache of the most recently used javascript injection scripts for specific URLs
-    LRUCache<std::string, QString> m_jsInjectionCache;
+    LRUCache<std::string, DomainScripts> m_jsInjectionCache;
 
     /// Empty string, used when getDomainStylesheet returns nothing
     QString m_emptyStr;
 
+    /// Empty scripts, used when getDomainJavaScript returns nothing
+    DomainScripts m_emptyScripts;
+
     /// Ad Block model, used to indirectly view and modify subscriptions in the user interface
     AdBlockModel *m_adBlockModel;
 
@@ -202,6 +289,21 @@ private Q_SLOTS:
 
     /// Performs network request matching to filters, and keeps count of the number of blocked requests (total + per URL)
     RequestHandler *m_requestHandler;
+
+    /// Threads that load the filters, kept apart from the global thread pool used by the rest of the browser
+    QThreadPool *m_filterLoadPool;
+
+    /// Watches the progress of the background filter load
+    QFutureWatcher<void> *m_filterLoadWatcher;
+
+    /// State of the background filter load that is in progress, or a nullptr if filters are not being loaded
+    std::shared_ptr<FilterLoadJob> m_filterLoadJob;
+
+    /// True if the filters should be loaded again after the current background load finishes
+    bool m_filterReloadPending;
+
+    /// True if the user has edited their own filter rules since the filters were last loaded
+    bool m_userFiltersModified;
 };
 
 }
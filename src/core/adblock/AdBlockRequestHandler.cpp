@@ -2,192 +2,167 @@
 #include "AdBlockLog.h"
 #include "AdBlockManager.h"
 #include "AdBlockRequestHandler.h"
-#include "URL.h"
 
-#include <QDateTime>
+#include <QElapsedTimer>
 #include <QUrl>
 
 namespace adblock
 {
 
-RequestHandler::RequestHandler(FilterContainer &filterContainer, AdBlockLog *log, QObject *parent) :
+RequestHandler::RequestHandler(AdBlockLog *log, QObject *parent) :
     QObject(parent),
-    m_filterContainer(filterContainer),
     m_log(log),
     m_numRequestsBlocked(0),
-    m_pageAdBlockCount()
+    m_verdictCache(),
+    m_requestTypeCounters()
 {
 }
 
 void RequestHandler::loadStarted(const QUrl &url)
 {
-    m_pageAdBlockCount[url] = 0;
+    m_log->loadStarted(url);
 }
 
 int RequestHandler::getNumberAdsBlocked(const QUrl &url) const
 {
-    auto it = m_pageAdBlockCount.find(url);
-    if (it != m_pageAdBlockCount.end())
-        return *it;
-
-    return 0;
+    const LogCounts counts = m_log->getPageCounts(url);
+    return static_cast<int>(counts.NumBlocked + counts.NumRedirected);
 }
 
 quint64 RequestHandler::getTotalNumberOfBlockedRequests() const
 {
-    return m_numRequestsBlocked;
+    return m_numRequestsBlocked.load(std::memory_order_relaxed);
 }
 
 void RequestHandler::setTotalNumberOfBlockedRequests(quint64 count)
 {
-    m_numRequestsBlocked = count;
+    m_numRequestsBlocked.store(count, std::memory_order_relaxed);
 }
 
-bool RequestHandler::shouldBlockRequest(QWebEngineUrlRequestInfo &info, const QUrl &firstPartyUrl)
+void RequestHandler::incrementBlockCount()
 {
-    // Get request URL and the originating URL
-    const QUrl requestUrl = info.requestUrl();
-    const QString requestUrlStr = info.requestUrl().toString(QUrl::FullyEncoded).toLower();
-
-    //const URL firstPartyUrlWrapper { firstPartyUrl };
-    const URL requestUrlWrapper { requestUrl };
-
-    const QString baseUrl = firstPartyUrl.host().toLower();
-    //QString baseUrl = firstPartyUrlWrapper.getSecondLevelDomain().toLower();
-    //if (baseUrl.isEmpty())
-    //    baseUrl = firstPartyUrl.host().toLower();
+    m_numRequestsBlocked.fetch_add(1, std::memory_order_relaxed);
+}
 
-    // Get request domain
-    QString domain = requestUrl.host().toLower();
-    if (domain.startsWith(QLatin1String("www.")))
-        domain = domain.mid(4);
+bool RequestHandler::shouldBlockRequest(const FilterContainer &filterContainer, QWebEngineUrlRequestInfo &info, const QUrl &firstPartyUrl)
+{
+    // Normalize the request once, converting the QWebEngine request type to the AdBlockFilter request type
+    const RequestContext context(info.requestUrl(), firstPartyUrl, info.resourceType());
 
-    if (domain.isEmpty())
-        domain = requestUrlWrapper.getSecondLevelDomain();
+    const Verdict verdict = getVerdict(filterContainer, context);
 
-    // Convert QWebEngine request type to AdBlockFilter request type
-    ElementType elemType = getRequestType(info, firstPartyUrl);
+    // Let the request proceed if it did not match a blocking filter
+    const Filter *matchingFilter = verdict.MatchedFilter;
+    if (matchingFilter == nullptr)
+        return false;
 
-    // Compare to filters
-    Filter *matchingBlockFilter = m_filterContainer.findImportantBlockingFilter(baseUrl, requestUrlStr, domain, elemType);
-    if (matchingBlockFilter != nullptr)
+    const QUrl &requestUrl = context.getUrl();
+    const ElementType elemType = context.getElementType();
+    switch (verdict.Action)
     {
-        ++m_numRequestsBlocked;
-        ++m_pageAdBlockCount[firstPartyUrl];
-
-        if (matchingBlockFilter->isRedirect())
-        {
-            info.redirect(QUrl(QString("blocked:%1").arg(matchingBlockFilter->getRedirectName())));
-            m_log->addEntry(FilterAction::Redirect, firstPartyUrl, requestUrl, elemType, matchingBlockFilter->getRule(), QDateTime::currentDateTime());
+        case FilterAction::Allow:
+            m_log->addEntry(FilterAction::Allow, firstPartyUrl, requestUrl, elemType, matchingFilter, verdict.Generation);
             return false;
-        }
+        case FilterAction::Redirect:
+            incrementBlockCount();
+            info.redirect(QUrl(QString("blocked:%1").arg(matchingFilter->getRedirectName())));
+            m_log->addEntry(FilterAction::Redirect, firstPartyUrl, requestUrl, elemType, matchingFilter, verdict.Generation);
+            return false;
+        case FilterAction::Block:
+        default:
+            incrementBlockCount();
+            m_log->addEntry(FilterAction::Block, firstPartyUrl, requestUrl, elemType, matchingFilter, verdict.Generation);
+            return true;
+    }
+}
 
-        m_log->addEntry(FilterAction::Block, firstPartyUrl, requestUrl, elemType, matchingBlockFilter->getRule(), QDateTime::currentDateTime());
-        return true;
+Verdict RequestHandler::getVerdict(const FilterContainer &filterContainer, const RequestContext &context)
+{
+    QElapsedTimer timer;
+    const bool isProfiling = Filter::isProfilingEnabled();
+    if (isProfiling)
+        timer.start();
+
+    // Reuse the verdict of an identical request, if it was made with the same filters
+    const QString &baseUrl = context.getFirstPartyHost();
+    const QString &requestUrl = context.getUrlString();
+    const ElementType typeMask = context.getElementType();
+    const quint64 verdictKey = VerdictCache::getKey(baseUrl, requestUrl, typeMask);
+    Verdict verdict {};
+    if (!m_verdictCache.find(verdictKey, baseUrl, requestUrl, typeMask, filterContainer.getGeneration(), verdict))
+    {
+        verdict = matchFilters(filterContainer, context);
+        m_verdictCache.insert(verdictKey, baseUrl, requestUrl, typeMask, verdict);
     }
 
-    matchingBlockFilter = m_filterContainer.findBlockingRequestFilter(requestUrlWrapper.getSecondLevelDomain(), baseUrl, requestUrlStr, domain, elemType);
+    if (isProfiling)
+        addRequestTypeProfile(context.getElementType(), timer.nsecsElapsed());
 
-    // Stop here if we did not find a blocking filter - let the request proceed
-    if (matchingBlockFilter == nullptr)
-        return false;
+    return verdict;
+}
 
-    if (Filter *filter = m_filterContainer.findWhitelistingFilter(baseUrl, requestUrlStr, domain, elemType))
+const VerdictCache &RequestHandler::getVerdictCache() const
+{
+    return m_verdictCache;
+}
+
+std::vector<RequestTypeProfile> RequestHandler::getRequestTypeProfiles() const
+{
+    std::vector<RequestTypeProfile> result;
+    for (std::size_t i = 0; i < NumElementTypes; ++i)
     {
-        m_log->addEntry(FilterAction::Allow, firstPartyUrl, requestUrl, elemType, filter->getRule(), QDateTime::currentDateTime());
-        return false;
+        const RequestTypeCounters &counters = m_requestTypeCounters[i];
+        const quint64 numRequests = counters.NumRequests.load(std::memory_order_relaxed);
+        if (numRequests > 0)
+            result.push_back({ static_cast<ElementType>(1ULL << i), numRequests, counters.MatchTime.load(std::memory_order_relaxed) });
     }
+    return result;
+}
 
-    // If we reach this point, then the matching block filter is applied to the request
-    ++m_numRequestsBlocked;
-    ++m_pageAdBlockCount[firstPartyUrl];
+void RequestHandler::addRequestTypeProfile(ElementType elemType, qint64 elapsedTime)
+{
+    // The party of the request is not a type of its own, so the request is counted under its lowest remaining type bit
+    const quint64 typeBits = static_cast<quint64>(elemType & ~ElementType::ThirdParty);
+    if (typeBits == 0)
+        return;
 
-    if (matchingBlockFilter->isRedirect())
-    {
-        info.redirect(QUrl(QString("blocked:%1").arg(matchingBlockFilter->getRedirectName())));
-        m_log->addEntry(FilterAction::Redirect, firstPartyUrl, requestUrl, elemType, matchingBlockFilter->getRule(), QDateTime::currentDateTime());
-        return false;
-    }
+    std::size_t index = 0;
+    while ((typeBits & (1ULL << index)) == 0)
+        ++index;
 
-    m_log->addEntry(FilterAction::Block, firstPartyUrl, requestUrl, elemType, matchingBlockFilter->getRule(), QDateTime::currentDateTime());
-    return true;
+    if (index >= NumElementTypes)
+        return;
+
+    RequestTypeCounters &counters = m_requestTypeCounters[index];
+    counters.NumRequests.fetch_add(1, std::memory_order_relaxed);
+    counters.MatchTime.fetch_add(elapsedTime, std::memory_order_relaxed);
 }
 
-ElementType RequestHandler::getRequestType(const QWebEngineUrlRequestInfo &info, const QUrl &firstPartyUrl) const
+Verdict RequestHandler::matchFilters(const FilterContainer &filterContainer, const RequestContext &context) const
 {
-    const URL firstPartyUrlWrapper { firstPartyUrl };
-    const URL requestUrl { info.requestUrl() };
-    const QString requestUrlStr = requestUrl.toString(QUrl::FullyEncoded).toLower();
+    Verdict verdict { FilterAction::Allow, nullptr, filterContainer.getGeneration() };
 
-    ElementType elemType = ElementType::None;
-    switch (info.resourceType())
+    // Compare to filters
+    Filter *matchingBlockFilter = filterContainer.findImportantBlockingFilter(context);
+    if (matchingBlockFilter == nullptr)
     {
-        case QWebEngineUrlRequestInfo::ResourceTypeMainFrame:
-            elemType |= ElementType::Document;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeSubFrame:
-            elemType |= ElementType::Subdocument;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeStylesheet:
-            elemType |= ElementType::Stylesheet;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeScript:
-            elemType |= ElementType::Script;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeImage:
-            elemType |= ElementType::Image;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeSubResource:
-            if (requestUrlStr.endsWith(QLatin1String("htm"))
-                || requestUrlStr.endsWith(QLatin1String("html"))
-                || requestUrlStr.endsWith(QLatin1String("xml")))
-            {
-                elemType |= ElementType::Subdocument;
-            }
-            else
-                elemType |= ElementType::Other;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeXhr:
-            elemType |= ElementType::XMLHTTPRequest;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypePing:
-            elemType |= ElementType::Ping;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypePluginResource:
-            elemType |= ElementType::ObjectSubrequest;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeObject:
-            elemType |= ElementType::Object;
-            break;
-        case QWebEngineUrlRequestInfo::ResourceTypeFontResource:
-        case QWebEngineUrlRequestInfo::ResourceTypeMedia:
-        case QWebEngineUrlRequestInfo::ResourceTypeWorker:
-        case QWebEngineUrlRequestInfo::ResourceTypeSharedWorker:
-        case QWebEngineUrlRequestInfo::ResourceTypeServiceWorker:
-        case QWebEngineUrlRequestInfo::ResourceTypePrefetch:
-        case QWebEngineUrlRequestInfo::ResourceTypeFavicon:
-        case QWebEngineUrlRequestInfo::ResourceTypeCspReport:
-        default:
-            elemType |= ElementType::Other;
-            break;
+        matchingBlockFilter = filterContainer.findBlockingRequestFilter(context);
+
+        // Stop here if we did not find a blocking filter - let the request proceed
+        if (matchingBlockFilter == nullptr)
+            return verdict;
+
+        if (Filter *filter = filterContainer.findWhitelistingFilter(context))
+        {
+            verdict.MatchedFilter = filter;
+            return verdict;
+        }
     }
 
-    // Check for websocket
-    // Doesn't seem to work though. If only we could check for the presence of
-    // request headers such as Sec-WebSocket-Key or Sec-WebSocket-Version, then
-    // we could detect websocket requests..
-    const QString requestScheme = requestUrl.scheme();
-    if (requestScheme.compare(QStringLiteral("ws")) == 0 || requestScheme.compare(QStringLiteral("wss")) == 0)
-        elemType |= ElementType::WebSocket;
-
-    // Check for third party request type
-    if (firstPartyUrlWrapper.isEmpty()
-            || (firstPartyUrlWrapper.toString().compare(QLatin1String(".")) == 0)
-            || (firstPartyUrlWrapper.toString().compare(QLatin1String("data;,")) == 0)
-            || (requestUrl.getSecondLevelDomain() != firstPartyUrlWrapper.getSecondLevelDomain()))
-        elemType |= ElementType::ThirdParty;
-
-    return elemType;
+    // If we reach this point, then the matching block filter is applied to the request
+    verdict.Action = matchingBlockFilter->isRedirect() ? FilterAction::Redirect : FilterAction::Block;
+    verdict.MatchedFilter = matchingBlockFilter;
+    return verdict;
 }
 
 }
@@ -4,11 +4,14 @@
 #include "AdBlockFilter.h"
 #include "AdBlockFilterContainer.h"
 #include "AdBlockSubscription.h"
+#include "RequestContext.h"
+#include "VerdictCache.h"
 
-#include <deque>
+#include <array>
+#include <atomic>
+#include <memory>
 #include <vector>
 
-#include <QHash>
 #include <QObject>
 #include <QString>
 #include <QWebEngineUrlRequestInfo>
@@ -18,10 +21,28 @@ namespace adblock
 
 class AdBlockLog;
 
+/**
+ * @struct RequestTypeProfile
+ * @brief Number of network requests of one element type that were matched against the filters while
+ *        profiling was enabled, and the time spent matching them
+ * @ingroup AdBlock
+ */
+struct RequestTypeProfile
+{
+    /// Element type of the requests
+    ElementType Type;
+
+    /// Number of requests of the type
+    quint64 NumRequests;
+
+    /// Cumulative time, in nanoseconds, spent matching the requests
+    qint64 MatchTime;
+};
+
 /**
  * @class RequestHandler
  * @brief Examines network requests to see if they should be blocked, whitelisted or redirected based
- *        on a filter rule
+ *        on a filter rule. Requests may be examined from any thread.
  * @ingroup AdBlock
  */
 class RequestHandler : public QObject
@@ -32,7 +53,7 @@ class RequestHandler : public QObject
 
 public:
     /// Constructs the request handler with the given parent
-    explicit RequestHandler(FilterContainer &filterContainer, AdBlockLog *log, QObject *parent);
+    explicit RequestHandler(AdBlockLog *log, QObject *parent);
 
     /// Returns the number of ads that were blocked on the page with the given URL during its last page load
     int getNumberAdsBlocked(const QUrl &url) const;
@@ -40,8 +61,24 @@ class RequestHandler : public QObject
     /// Returns the total number of network requests that have been blocked by the ad blocking system
     quint64 getTotalNumberOfBlockedRequests() const;
 
-    /// Returns true if the given request should be blocked, false if else
-    bool shouldBlockRequest(QWebEngineUrlRequestInfo &info, const QUrl &firstPartyUrl);
+    /// Returns true if the given request should be blocked by the filters in the given container, false if else
+    bool shouldBlockRequest(const FilterContainer &filterContainer, QWebEngineUrlRequestInfo &info, const QUrl &firstPartyUrl);
+
+    /**
+     * @brief Matches a request against the filters in the given container, reusing the verdict of an identical request
+     *        if one is cached. Unlike \ref shouldBlockRequest, the request is neither logged nor counted as blocked
+     * @param filterContainer Filters to match the request against
+     * @param context Normalized form of the network request
+     * @return The verdict on the request
+     */
+    Verdict getVerdict(const FilterContainer &filterContainer, const RequestContext &context);
+
+    /// Returns the cache of recent request verdicts, which keeps count of its hits, misses and evictions
+    const VerdictCache &getVerdictCache() const;
+
+    /// Returns the number of requests of each element type that were matched while \ref Filter::isProfilingEnabled
+    /// was true, and the time spent matching them. Types with no profiled requests are omitted
+    std::vector<RequestTypeProfile> getRequestTypeProfiles() const;
 
 protected:
     /// Sets the counter that stores the total number of network requests that have been blocked
@@ -51,21 +88,42 @@ class RequestHandler : public QObject
     void loadStarted(const QUrl &url);
 
 private:
-    /// Returns the \ref ElementType of the network request, which is used to check for filter option/type matches
-    ElementType getRequestType(const QWebEngineUrlRequestInfo &info, const QUrl &firstPartyUrl) const;
+    /// Increments the total number of blocked requests. The number of requests blocked on each page is kept by the log
+    void incrementBlockCount();
+
+    /// Matches the request against the filters in the given container, returning the verdict on the request
+    Verdict matchFilters(const FilterContainer &filterContainer, const RequestContext &context) const;
+
+    /// Adds a request of the given element type(s), which took the given number of nanoseconds to match, to the
+    /// profile of its primary type
+    void addRequestTypeProfile(ElementType elemType, qint64 elapsedTime);
 
 private:
-    /// Reference to the filter container
-    FilterContainer &m_filterContainer;
+    /// Number of bits used by the \ref ElementType values
+    static constexpr std::size_t NumElementTypes = 22;
 
+    /// Profiling counters of the requests of one element type
+    struct RequestTypeCounters
+    {
+        /// Number of requests of the type
+        std::atomic<quint64> NumRequests { 0 };
+
+        /// Cumulative time, in nanoseconds, spent matching the requests
+        std::atomic<qint64> MatchTime { 0 };
+    };
+
+private:
     /// Logging instance
     AdBlockLog *m_log;
 
     /// Stores the number of network requests that have been blocked by the ad block system
-    quint64 m_numRequestsBlocked;
+    std::atomic<quint64> m_numRequestsBlocked;
+
+    /// Recent verdicts on network requests, keyed by the first-party host, request URL and element type
+    VerdictCache m_verdictCache;
 
-    /// Hash map of URLs to the number of requests that were blocked on that given URL
-    QHash<QUrl, int> m_pageAdBlockCount;
+    /// Profiling counters of each request type, indexed by the position of the type's bit in \ref ElementType
+    std::array<RequestTypeCounters, NumElementTypes> m_requestTypeCounters;
 };
 
 }
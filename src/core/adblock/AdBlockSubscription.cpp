@@ -1,14 +1,75 @@
 #include "AdBlockSubscription.h"
 #include "AdBlockFilterParser.h"
+#include "StringPool.h"
 
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDir>
 #include <QFile>
-#include <QTextStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtConcurrent>
 #include <QDebug>
 
 namespace adblock
 {
 
+const quint32 Subscription::CacheVersion = 5;
+
+const qint64 Subscription::ParseRangeSize = 256 * 1024;
+
+/// Marks the start of a compiled filter cache file
+static const quint32 CacheMagic = 0x56464331; // "VFC1"
+
+/// State of a load between \ref Subscription::beginLoad and \ref Subscription::finishLoad
+struct Subscription::PendingLoad
+{
+    /// Constructs the state of a load of the given subscription file
+    PendingLoad(const QString &filePath, AdBlockManager *adBlockManager, StringPool *stringPool) :
+        File(filePath),
+        FileContents(),
+        FileSize(0),
+        LastModified(0),
+        Parser(adBlockManager),
+        Pool(stringPool),
+        PreviousFilters(),
+        PreviousRules(),
+        Ranges()
+    {
+    }
+
+    /// Subscription file, kept open while its mapped contents are being parsed
+    QFile File;
+
+    /// Contents of the subscription file, if it could not be mapped into memory
+    QByteArray FileContents;
+
+    /// Size of the subscription file, in bytes
+    qint64 FileSize;
+
+    /// Last modification time of the subscription file, in milliseconds since the epoch
+    qint64 LastModified;
+
+    /// Parser of the rules that were added or changed
+    const FilterParser Parser;
+
+    /// Optional pool used to intern the strings of each filter
+    StringPool *Pool;
+
+    /// Filters of the previous version of the file, which are reused for any of its rules that have not changed
+    std::shared_ptr<FilterArena> PreviousFilters;
+
+    /// Filters of the previous version of the file, keyed by their rule
+    QHash<QString, const Filter*> PreviousRules;
+
+    /// Ranges of lines of the file, to be parsed in parallel
+    std::vector<LineRange> Ranges;
+};
+
 Subscription::Subscription() :
     m_enabled(true),
     m_filePath(),
@@ -16,7 +77,14 @@ Subscription::Subscription() :
     m_sourceUrl(),
     m_lastUpdate(),
     m_nextUpdate(),
-    m_filters()
+    m_expireDays(0),
+    m_entityTag(),
+    m_sourceLastModified(),
+    m_filterArena(),
+    m_loadedLastModified(-1),
+    m_loadedFileSize(-1),
+    m_loadedChecksum(),
+    m_pendingLoad()
 {
 }
 
@@ -27,7 +95,14 @@ Subscription::Subscription(const QString &dataFile) :
     m_sourceUrl(),
     m_lastUpdate(),
     m_nextUpdate(),
-    m_filters()
+    m_expireDays(0),
+    m_entityTag(),
+    m_sourceLastModified(),
+    m_filterArena(),
+    m_loadedLastModified(-1),
+    m_loadedFileSize(-1),
+    m_loadedChecksum(),
+    m_pendingLoad()
 {
 }
 
@@ -38,7 +113,14 @@ Subscription::Subscription(Subscription &&other) noexcept :
     m_sourceUrl(other.m_sourceUrl),
     m_lastUpdate(other.m_lastUpdate),
     m_nextUpdate(other.m_nextUpdate),
-    m_filters(std::move(other.m_filters))
+    m_expireDays(other.m_expireDays),
+    m_entityTag(other.m_entityTag),
+    m_sourceLastModified(other.m_sourceLastModified),
+    m_filterArena(std::move(other.m_filterArena)),
+    m_loadedLastModified(other.m_loadedLastModified),
+    m_loadedFileSize(other.m_loadedFileSize),
+    m_loadedChecksum(other.m_loadedChecksum),
+    m_pendingLoad(std::move(other.m_pendingLoad))
 {
 }
 
@@ -52,7 +134,14 @@ Subscription &Subscription::operator =(Subscription &&other) noexcept
         m_sourceUrl = other.m_sourceUrl;
         m_lastUpdate = other.m_lastUpdate;
         m_nextUpdate = other.m_nextUpdate;
-        m_filters = std::move(other.m_filters);
+        m_expireDays = other.m_expireDays;
+        m_entityTag = other.m_entityTag;
+        m_sourceLastModified = other.m_sourceLastModified;
+        m_filterArena = std::move(other.m_filterArena);
+        m_loadedLastModified = other.m_loadedLastModified;
+        m_loadedFileSize = other.m_loadedFileSize;
+        m_loadedChecksum = other.m_loadedChecksum;
+        m_pendingLoad = std::move(other.m_pendingLoad);
     }
 
     return *this;
@@ -92,33 +181,229 @@ const QDateTime &Subscription::getNextUpdate() const
     return m_nextUpdate;
 }
 
-void Subscription::load(AdBlockManager *adBlockManager)
+int Subscription::getExpireDays() const
 {
-    if (!m_enabled || m_filePath.isEmpty())
+    return m_expireDays;
+}
+
+const QString &Subscription::getEntityTag() const
+{
+    return m_entityTag;
+}
+
+const QString &Subscription::getSourceLastModified() const
+{
+    return m_sourceLastModified;
+}
+
+/// Returns true if the filter embeds the contents of a script resource, which may change independently of the filter rule
+static bool hasInjectedScript(const Filter &filter)
+{
+    return filter.getCategory() == FilterCategory::StylesheetJS
+            && (filter.getRule().contains(QLatin1String("script:inject(")) || filter.getRule().contains(QLatin1String("+js(")));
+}
+
+void Subscription::load(AdBlockManager *adBlockManager, StringPool *stringPool, bool checkContents)
+{
+    if (!beginLoad(adBlockManager, stringPool, checkContents))
         return;
 
+    std::vector<std::size_t> rangeIndices(getNumPendingRanges());
+    std::iota(rangeIndices.begin(), rangeIndices.end(), std::size_t(0));
+    QtConcurrent::blockingMap(rangeIndices, [this](std::size_t index) {
+        parsePendingRange(index);
+    });
+
+    finishLoad();
+}
+
+bool Subscription::beginLoad(AdBlockManager *adBlockManager, StringPool *stringPool, bool checkContents)
+{
+    m_pendingLoad.reset();
+
+    if (!m_enabled || m_filePath.isEmpty())
+        return false;
+
     // Load subscription file
-    QFile subFile(m_filePath);
+    auto pendingLoad = std::make_unique<PendingLoad>(m_filePath, adBlockManager, stringPool);
+    QFile &subFile = pendingLoad->File;
     if (!subFile.exists() || !subFile.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 fileSize = subFile.size();
+    const qint64 lastModified = QFileInfo(subFile).lastModified().toMSecsSinceEpoch();
+
+    // Use the compiled filters from the last parse when the filters are first loaded. The cache is matched to
+    // the file by its size and modification time, so that the file does not need to be read at all
+    const bool filtersLoaded = m_loadedLastModified >= 0;
+    if (!filtersLoaded && loadCache(adBlockManager, stringPool, fileSize, lastModified))
+    {
+        m_loadedLastModified = lastModified;
+        m_loadedFileSize = fileSize;
+        return false;
+    }
+
+    // Keep the filters as they are if the file has the same size and modification time as when they were loaded,
+    // without reading the file, unless its contents are to be checked
+    if (filtersLoaded && !checkContents && fileSize == m_loadedFileSize && lastModified == m_loadedLastModified)
+        return false;
+
+    // Map the file into memory, falling back to reading it if the file cannot be mapped. The file stays open
+    // until the load is finished, so that its ranges of lines can be parsed from the mapped memory
+    const char *data = nullptr;
+    qint64 dataSize = fileSize;
+    if (uchar *mappedData = (fileSize > 0 ? subFile.map(0, fileSize) : nullptr))
+        data = reinterpret_cast<const char*>(mappedData);
+    else
+    {
+        pendingLoad->FileContents = subFile.readAll();
+        data = pendingLoad->FileContents.constData();
+        dataSize = pendingLoad->FileContents.size();
+    }
+    const char *dataEnd = data + dataSize;
+
+    // Keep the filters as they are if the contents of the file have not changed since they were loaded, as when
+    // an update downloads the same version of a list
+    const QByteArray checksum = QCryptographicHash::hash(QByteArray::fromRawData(data, static_cast<int>(dataSize)),
+                                                         QCryptographicHash::Md5);
+    if (filtersLoaded && checksum == m_loadedChecksum)
+    {
+        // Match the cache to the current size and modification time of the file, so it is used on the next start
+        if (lastModified != m_loadedLastModified || fileSize != m_loadedFileSize)
+        {
+            m_loadedLastModified = lastModified;
+            m_loadedFileSize = fileSize;
+            saveCache(fileSize, lastModified, m_expireDays);
+        }
+        return false;
+    }
+
+    // Filters of the previous version of the file, which are reused for any of its rules that have not changed
+    pendingLoad->PreviousFilters.swap(m_filterArena);
+
+    m_loadedLastModified = lastModified;
+    m_loadedFileSize = fileSize;
+    m_loadedChecksum = checksum;
+
+    // Skip the byte order mark, if present
+    if (dataEnd - data >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+        data += 3;
+
+    // Split the file into ranges of whole lines, to be parsed in parallel
+    std::vector<LineRange> &ranges = pendingLoad->Ranges;
+    for (const char *rangeBegin = data; rangeBegin < dataEnd;)
+    {
+        const char *rangeEnd = (dataEnd - rangeBegin > ParseRangeSize) ? rangeBegin + ParseRangeSize : dataEnd;
+        rangeEnd = static_cast<const char*>(std::memchr(rangeEnd, '\n', static_cast<std::size_t>(dataEnd - rangeEnd)));
+        rangeEnd = (rangeEnd != nullptr) ? rangeEnd + 1 : dataEnd;
+
+        LineRange range;
+        range.Begin = rangeBegin;
+        range.End = rangeEnd;
+        range.ExpireDays = 0;
+        ranges.push_back(std::move(range));
+
+        rangeBegin = rangeEnd;
+    }
+
+    // Look up the rules of the previous version by their text, so that only the lines that were added or
+    // changed since then are parsed
+    QHash<QString, const Filter*> &previousRules = pendingLoad->PreviousRules;
+    if (const std::shared_ptr<FilterArena> &previousFilters = pendingLoad->PreviousFilters)
+    {
+        previousRules.reserve(static_cast<int>(previousFilters->size()));
+        for (const Filter *filter : previousFilters->getFilters())
+        {
+            if (!hasInjectedScript(*filter))
+                previousRules.insert(filter->getRule(), filter);
+        }
+    }
+
+    pendingLoad->FileSize = fileSize;
+    pendingLoad->LastModified = lastModified;
+    m_pendingLoad = std::move(pendingLoad);
+    return true;
+}
+
+std::size_t Subscription::getNumPendingRanges() const
+{
+    return m_pendingLoad ? m_pendingLoad->Ranges.size() : 0;
+}
+
+void Subscription::parsePendingRange(std::size_t index)
+{
+    PendingLoad &pendingLoad = *m_pendingLoad;
+    parseRange(pendingLoad.Parser, pendingLoad.Pool, pendingLoad.PreviousRules, pendingLoad.Ranges[index]);
+}
+
+void Subscription::finishLoad()
+{
+    if (!m_pendingLoad)
         return;
 
-    m_filters.clear();
+    // Release the file and the previous filters once the new filters have been taken out of the ranges
+    std::unique_ptr<PendingLoad> pendingLoad;
+    pendingLoad.swap(m_pendingLoad);
 
-    FilterParser parser(adBlockManager);
+    // Merge the results in order of the ranges, so the filters are in the same order as in the file
+    std::vector< std::vector<Filter> > filterBlocks;
+    filterBlocks.reserve(pendingLoad->Ranges.size());
+
+    int expireDays = 0;
+    for (LineRange &range : pendingLoad->Ranges)
+    {
+        filterBlocks.push_back(std::move(range.Filters));
+
+        if (m_name.isEmpty())
+            m_name = range.Name;
+
+        if (range.ExpireDays > 0)
+            expireDays = range.ExpireDays;
+    }
+    setFilters(std::move(filterBlocks));
+
+    // Add the number of days to the last update and set as next update
+    if (expireDays > 0)
+        setExpiration(expireDays);
+
+    // Set name to filename if it was not specified in data region of file
+    if (m_name.isEmpty())
+    {
+        int sepIdx = m_filePath.lastIndexOf(QDir::separator());
+        m_name = m_filePath.mid(sepIdx + 1);
+    }
+
+    saveCache(pendingLoad->FileSize, pendingLoad->LastModified, expireDays);
+}
+
+void Subscription::parseRange(const FilterParser &parser, StringPool *stringPool, const QHash<QString, const Filter*> &previousFilters, LineRange &range)
+{
+    // Reserve room for a filter on every line, so the filters of the range are allocated at once
+    range.Filters.reserve(static_cast<std::size_t>(std::count(range.Begin, range.End, '\n')) + 1);
 
     QString line;
-    QTextStream stream(&subFile);
-    while (stream.readLineInto(&line))
+    for (const char *lineBegin = range.Begin; lineBegin < range.End;)
     {
+        const char *lineEnd = static_cast<const char*>(std::memchr(lineBegin, '\n', static_cast<std::size_t>(range.End - lineBegin)));
+        if (lineEnd == nullptr)
+            lineEnd = range.End;
+
+        const char *nextLine = (lineEnd < range.End) ? lineEnd + 1 : range.End;
+        if (lineEnd > lineBegin && *(lineEnd - 1) == '\r')
+            --lineEnd;
+
+        line = QString::fromUtf8(lineBegin, static_cast<int>(lineEnd - lineBegin));
+        lineBegin = nextLine;
+
         // Check for metadata
         if (line.startsWith(QChar('!')))
         {
             // Subscription name
-            if (m_name.isEmpty())
+            if (range.Name.isEmpty())
             {
                 int titleIdx = line.indexOf(QStringLiteral("Title:"));
                 if (titleIdx > 0)
-                    m_name = line.mid(titleIdx + 7);
+                    range.Name = line.mid(titleIdx + 7);
             }
 
             // Check for next update
@@ -129,12 +414,8 @@ void Subscription::load(AdBlockManager *adBlockManager)
                 QString numDayStr = line.mid(10, numDaysIdx - 10).trimmed();
                 bool ok;
                 int numDays = numDayStr.toInt(&ok, 10);
-                if (!ok || numDays == 0)
-                    continue;
-
-                // Add the number of days to the last update and set as next update
-                QDateTime updateDate = getLastUpdate();
-                m_nextUpdate = updateDate.addDays(numDays);
+                if (ok && numDays != 0)
+                    range.ExpireDays = numDays;
             }
 
             continue;
@@ -142,15 +423,159 @@ void Subscription::load(AdBlockManager *adBlockManager)
         else if (line.isEmpty() || line.compare(QStringLiteral("#")) == 0 || line.startsWith(QStringLiteral("# ")) || line.startsWith(QStringLiteral("[Adblock")))
             continue;
 
-        m_filters.push_back(parser.makeFilter(line));
+        auto previousFilter = previousFilters.constFind(line);
+        if (previousFilter != previousFilters.constEnd())
+            range.Filters.push_back(**previousFilter);
+        else
+        {
+            range.Filters.emplace_back(line);
+            parser.parseFilter(range.Filters.back());
+        }
+
+        if (stringPool != nullptr)
+            range.Filters.back().internStrings(*stringPool);
     }
+}
 
-    // Set name to filename if it was not specified in data region of file
+void Subscription::setFilters(std::vector< std::vector<Filter> > &&filterBlocks)
+{
+    std::size_t numFilters = 0;
+    for (const std::vector<Filter> &block : filterBlocks)
+        numFilters += block.size();
+
+    auto arena = std::make_shared<FilterArena>();
+    arena->reserve(numFilters);
+    for (std::vector<Filter> &block : filterBlocks)
+        arena->addBlock(std::move(block));
+
+    m_filterArena = std::move(arena);
+}
+
+void Subscription::removeCacheFile() const
+{
+    QFile cacheFile(getCacheFilePath());
+    if (cacheFile.exists() && !cacheFile.remove())
+        qDebug() << "[Advertisement Blocker]: Could not remove filter cache file " << cacheFile.fileName();
+}
+
+QString Subscription::getCacheFilePath() const
+{
+    QFileInfo fileInfo(m_filePath);
+    return QString("%1%2cache%2%3.bin").arg(fileInfo.absolutePath()).arg(QDir::separator()).arg(fileInfo.fileName());
+}
+
+bool Subscription::loadCache(AdBlockManager *adBlockManager, StringPool *stringPool, qint64 fileSize, qint64 lastModified)
+{
+    QFile cacheFile(getCacheFilePath());
+    if (!cacheFile.exists() || !cacheFile.open(QIODevice::ReadOnly))
+        return false;
+
+    // Read the compiled filters directly from the mapped file, without copying it into memory first
+    const qint64 cacheSize = cacheFile.size();
+    uchar *cacheData = cacheFile.map(0, cacheSize);
+    if (cacheData == nullptr)
+        return false;
+
+    const QByteArray cacheBytes = QByteArray::fromRawData(reinterpret_cast<const char*>(cacheData), static_cast<int>(cacheSize));
+    QDataStream stream(cacheBytes);
+    stream.setVersion(QDataStream::Qt_5_9);
+
+    quint32 magic = 0, version = 0;
+    qint64 cachedFileSize = -1, cachedLastModified = 0;
+    QByteArray checksum;
+    stream >> magic >> version >> cachedFileSize >> cachedLastModified >> checksum;
+    if (stream.status() != QDataStream::Ok
+            || magic != CacheMagic
+            || version != CacheVersion
+            || cachedFileSize != fileSize
+            || cachedLastModified != lastModified)
+    {
+        cacheFile.unmap(cacheData);
+        return false;
+    }
+
+    QString name;
+    qint32 expireDays = 0;
+    quint32 numFilters = 0;
+    stream >> name >> expireDays >> numFilters;
+
+    // Script injection filters embed the contents of their resource, which may have changed since the cache was written
+    FilterParser parser(adBlockManager);
+
+    std::vector<Filter> filters;
+    filters.reserve(static_cast<std::size_t>(std::min(static_cast<qint64>(numFilters), cacheSize / 16)));
+    for (quint32 i = 0; i < numFilters && stream.status() == QDataStream::Ok; ++i)
+    {
+        filters.emplace_back(QString());
+        Filter &filter = filters.back();
+        stream >> filter;
+
+        if (hasInjectedScript(filter))
+        {
+            filter = Filter(filter.getRule());
+            parser.parseFilter(filter);
+        }
+
+        if (stringPool != nullptr)
+            filter.internStrings(*stringPool);
+    }
+
+    const bool ok = stream.status() == QDataStream::Ok;
+    cacheFile.unmap(cacheData);
+
+    if (!ok)
+        return false;
+
+    std::vector< std::vector<Filter> > filterBlocks;
+    filterBlocks.push_back(std::move(filters));
+    setFilters(std::move(filterBlocks));
+    m_loadedChecksum = checksum;
     if (m_name.isEmpty())
+        m_name = name;
+    if (expireDays > 0)
+        setExpiration(expireDays);
+
+    return true;
+}
+
+void Subscription::saveCache(qint64 fileSize, qint64 lastModified, int expireDays) const
+{
+    QFileInfo cacheInfo(getCacheFilePath());
+    QDir cacheDir = cacheInfo.absoluteDir();
+    if (!cacheDir.exists() && !cacheDir.mkpath(QStringLiteral(".")))
+        return;
+
+    QSaveFile cacheFile(cacheInfo.absoluteFilePath());
+    if (!cacheFile.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream stream(&cacheFile);
+    stream.setVersion(QDataStream::Qt_5_9);
+    stream << CacheMagic
+           << CacheVersion
+           << fileSize
+           << lastModified
+           << m_loadedChecksum
+           << m_name
+           << static_cast<qint32>(expireDays)
+           << static_cast<quint32>(m_filterArena ? m_filterArena->size() : 0);
+
+    if (m_filterArena)
     {
-        int sepIdx = m_filePath.lastIndexOf(QDir::separator());
-        m_name = m_filePath.mid(sepIdx + 1);
+        for (const Filter *filter : m_filterArena->getFilters())
+            stream << *filter;
     }
+
+    if (stream.status() != QDataStream::Ok || !cacheFile.commit())
+        qDebug() << "[Advertisement Blocker]: Could not write filter cache file " << cacheFile.fileName();
+}
+
+void Subscription::setExpiration(int expireDays)
+{
+    m_expireDays = expireDays;
+
+    QDateTime updateDate = getLastUpdate();
+    m_nextUpdate = updateDate.addDays(expireDays);
 }
 
 void Subscription::setLastUpdate(const QDateTime &date)
@@ -168,23 +593,30 @@ void Subscription::setSourceUrl(const QUrl &source)
     m_sourceUrl = source;
 }
 
+void Subscription::setEntityTag(const QString &entityTag)
+{
+    m_entityTag = entityTag;
+}
+
+void Subscription::setSourceLastModified(const QString &lastModified)
+{
+    m_sourceLastModified = lastModified;
+}
+
 size_t Subscription::getNumFilters() const
 {
     if (!m_enabled)
         return 0;
 
-    return m_filters.size();
+    return m_filterArena ? m_filterArena->size() : 0;
 }
 
-Filter *Subscription::getFilter(size_t index)
+std::shared_ptr<FilterArena> Subscription::getFilterArena() const
 {
     if (!m_enabled)
         return nullptr;
 
-    if (index >= m_filters.size())
-        return nullptr;
-
-    return m_filters[index].get();
+    return m_filterArena;
 }
 
 const QString &Subscription::getFilePath() const
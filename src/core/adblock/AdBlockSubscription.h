@@ -2,10 +2,13 @@
 #define ADBLOCKSUBSCRIPTION_H
 
 #include "AdBlockFilter.h"
+#include "FilterArena.h"
 
 #include <memory>
 #include <vector>
+#include <QByteArray>
 #include <QDateTime>
+#include <QHash>
 #include <QString>
 #include <QUrl>
 
@@ -13,6 +16,8 @@ namespace adblock
 {
 
 class AdBlockManager;
+class FilterParser;
+class StringPool;
 
 /**
  * @class Subscription
@@ -70,10 +75,34 @@ class Subscription
     /// Returns the time of the next update
     const QDateTime &getNextUpdate() const;
 
-protected:
-    /// Loads the filters from the subscription file
-    void load(AdBlockManager *adBlockManager);
+    /// Returns the number of days between updates declared by the "! Expires:" metadata of the subscription file,
+    /// or 0 if the file does not declare it or its filters have not been loaded
+    int getExpireDays() const;
+
+    /// Returns the entity tag (ETag header) of the response that the subscription file was downloaded from, if any
+    const QString &getEntityTag() const;
+
+    /// Returns the value of the Last-Modified header of the response that the subscription file was downloaded from, if any
+    const QString &getSourceLastModified() const;
+
+    /**
+     * @brief Loads the filters from the subscription file. Nothing is done if the filters were already loaded from
+     *        a file of the same size and modification time, or if the contents of the file have the same MD5 checksum
+     *        as those the filters were loaded from. If the file has changed since its filters were loaded, the filters
+     *        of any rules that are still present in the file are reused rather than parsed again
+     * @param adBlockManager Pointer to the ad block manager, used to look up the resources of script injection filters.
+     *        If this is a nullptr, script injection filters are loaded without their scripts
+     * @param stringPool Optional pool used to share the rules, domain names and option values of the filters with
+     *        those of other subscriptions that are loaded with the same pool
+     * @param checkContents If true, the checksum of the file is compared even if its size and modification time
+     *        have not changed, as an edit within the resolution of the file system's timestamps can leave both as they were
+     */
+    void load(AdBlockManager *adBlockManager, StringPool *stringPool = nullptr, bool checkContents = false);
 
+    /// Returns the number of filters that belong to the subscription
+    size_t getNumFilters() const;
+
+protected:
     /// Sets the time of the last update of the subscription file
     void setLastUpdate(const QDateTime &date);
 
@@ -83,11 +112,17 @@ class Subscription
     /// Sets the source URL of the subscription file. Used for updates
     void setSourceUrl(const QUrl &source);
 
-    /// Returns the number of filters that belong to the subscription
-    size_t getNumFilters() const;
+    /// Sets the entity tag of the response that the subscription file was downloaded from. Sent with the next update
+    /// in an If-None-Match header
+    void setEntityTag(const QString &entityTag);
 
-    /// Returns the filter at the given index
-    Filter *getFilter(size_t index);
+    /// Sets the Last-Modified header value of the response that the subscription file was downloaded from. Sent with
+    /// the next update in an If-Modified-Since header
+    void setSourceLastModified(const QString &lastModified);
+
+    /// Returns the arena that owns the filters of the subscription, or a nullptr if the subscription is disabled
+    /// or its filters have not been loaded
+    std::shared_ptr<FilterArena> getFilterArena() const;
 
     /// Returns the absolute path of the subscription file
     const QString &getFilePath() const;
@@ -95,6 +130,91 @@ class Subscription
     /// Updates the path of the subscription file - called after completion of an update if the file name is different
     void setFilePath(const QString &filePath);
 
+    /// Deletes the compiled filter cache of the subscription file, if it exists
+    void removeCacheFile() const;
+
+private:
+    /// A range of whole lines in the subscription file, and the filters and metadata parsed from them
+    struct LineRange
+    {
+        /// Start of the first line in the range
+        const char *Begin;
+
+        /// End of the last line in the range
+        const char *End;
+
+        /// Filters created from the rules in the range, in order of appearance
+        std::vector<Filter> Filters;
+
+        /// Subscription name given by the first title metadata line in the range, if any
+        QString Name;
+
+        /// Number of days given by the last expiration metadata line in the range, or 0 if not found
+        int ExpireDays;
+    };
+
+    /// State of a load that is in progress
+    struct PendingLoad;
+
+    /**
+     * @brief Begins loading the filters from the subscription file, as done by \ref load. If the file must be parsed,
+     *        it is split into ranges of lines, which are then parsed by \ref parsePendingRange, possibly on different
+     *        threads, before the load is completed by \ref finishLoad
+     * @return True if the ranges of the file must be parsed and the load finished, false if the load is already complete
+     */
+    bool beginLoad(AdBlockManager *adBlockManager, StringPool *stringPool, bool checkContents);
+
+    /// Returns the number of ranges of lines to be parsed by the load in progress
+    std::size_t getNumPendingRanges() const;
+
+    /// Parses the range of lines at the given index. Different ranges may be parsed at the same time
+    void parsePendingRange(std::size_t index);
+
+    /// Takes the filters that were parsed from each range of lines, completing the load in progress
+    void finishLoad();
+
+    /**
+     * @brief Parses the filter rules and metadata contained in the given range of lines
+     * @param parser Filter parser
+     * @param stringPool Optional pool used to intern the strings of each filter
+     * @param previousFilters Filters loaded from the previous version of the subscription file, keyed by their rule.
+     *        A rule found in this hashmap is copied from the previous filter instead of being parsed again
+     * @param range Range of lines to be parsed
+     */
+    static void parseRange(const FilterParser &parser, StringPool *stringPool, const QHash<QString, const Filter*> &previousFilters, LineRange &range);
+
+    /// Takes ownership of the given blocks of filters, which become the filters of the subscription in order.
+    /// The blocks are moved into a new arena, which is freed once no filter container refers to it
+    void setFilters(std::vector< std::vector<Filter> > &&filterBlocks);
+
+    /// Returns the path of the compiled filter cache associated with the subscription file
+    QString getCacheFilePath() const;
+
+    /**
+     * @brief Attempts to load the filters from the compiled filter cache
+     * @param adBlockManager Pointer to the ad block manager, used to re-create script injection filters
+     * @param stringPool Optional pool used to intern the strings of the filters
+     * @param fileSize Size of the subscription file, in bytes
+     * @param lastModified Last modification time of the subscription file, in milliseconds since the epoch
+     * @return True if the cache was written for a file of the same size and modification time and its filters
+     *         were loaded, along with the checksum of the file, false if else
+     */
+    bool loadCache(AdBlockManager *adBlockManager, StringPool *stringPool, qint64 fileSize, qint64 lastModified);
+
+    /// Writes the filters of the subscription to the compiled filter cache, along with the size, modification
+    /// time and checksum of the subscription file they were parsed from
+    void saveCache(qint64 fileSize, qint64 lastModified, int expireDays) const;
+
+    /// Sets the time of the next update to be the given number of days after the last update, and remembers the
+    /// number of days for the updates that follow
+    void setExpiration(int expireDays);
+
+    /// Version of the compiled filter cache format. Must be incremented whenever the serialized form of a \ref Filter changes
+    static const quint32 CacheVersion;
+
+    /// Approximate number of bytes in each range of lines that are parsed in parallel
+    static const qint64 ParseRangeSize;
+
 private:
     /// True if subscription is enabled, false if else
     bool m_enabled;
@@ -114,8 +234,31 @@ class Subscription
     /// Time when the subscription should be updated
     QDateTime m_nextUpdate;
 
-    /// Container of AdBlock Filters that belong to the subscription
-    std::vector< std::unique_ptr<Filter> > m_filters;
+    /// Number of days between updates declared by the subscription file, or 0 if not declared
+    int m_expireDays;
+
+    /// Entity tag of the response that the subscription file was downloaded from
+    QString m_entityTag;
+
+    /// Last-Modified header value of the response that the subscription file was downloaded from
+    QString m_sourceLastModified;
+
+    /// Arena of the AdBlock Filters that belong to the subscription. Ownership is shared with any
+    /// \ref FilterContainer built from the subscription, so that it stays valid after a reload
+    std::shared_ptr<FilterArena> m_filterArena;
+
+    /// Last modification time, in milliseconds since the epoch, of the version of the subscription file
+    /// that the filters were loaded from. Set to -1 if the filters have not been loaded
+    qint64 m_loadedLastModified;
+
+    /// Size in bytes of the version of the subscription file that the filters were loaded from
+    qint64 m_loadedFileSize;
+
+    /// MD5 checksum of the contents of the subscription file that the filters were loaded from
+    QByteArray m_loadedChecksum;
+
+    /// State of the load in progress, or a nullptr if the subscription is not being loaded
+    std::unique_ptr<PendingLoad> m_pendingLoad;
 };
 
 }
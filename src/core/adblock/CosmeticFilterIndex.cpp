@@ -0,0 +1,67 @@
+#include "CosmeticFilterIndex.h"
+
+#include "DomainSet.h"
+
+#include <algorithm>
+
+namespace adblock
+{
+
+void CosmeticFilterIndex::add(Filter *filter)
+{
+    const uint32_t position = static_cast<uint32_t>(m_filters.size());
+    m_filters.push_back(filter);
+
+    if (filter->m_domainBlacklist.empty())
+    {
+        m_genericFilters.push_back(position);
+        return;
+    }
+
+    filter->m_domainBlacklist.forEachDomain([&](const QString &domain) {
+        m_filtersByDomain[DomainSet::hashDomain(domain)].push_back(position);
+    });
+}
+
+bool CosmeticFilterIndex::empty() const
+{
+    return m_filters.empty();
+}
+
+std::size_t CosmeticFilterIndex::size() const
+{
+    return m_filters.size();
+}
+
+std::vector<Filter*> CosmeticFilterIndex::findMatches(const QString &domain) const
+{
+    std::vector<Filter*> result;
+    if (m_filters.empty() || domain.isEmpty())
+        return result;
+
+    std::vector<uint32_t> candidates = m_genericFilters;
+    if (!m_filtersByDomain.isEmpty())
+    {
+        DomainSet::forEachMatchingKey(domain, [&](quint64 hash) {
+            auto it = m_filtersByDomain.constFind(hash);
+            if (it != m_filtersByDomain.constEnd())
+                candidates.insert(candidates.end(), it->cbegin(), it->cend());
+            return false;
+        });
+
+        // A filter is found once for each of its domains that matched the host
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    }
+
+    // Confirm each candidate, which also applies the filter's domain whitelist
+    for (uint32_t position : candidates)
+    {
+        Filter *filter = m_filters[position];
+        if (filter->isDomainStyleMatch(domain))
+            result.push_back(filter);
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef COSMETICFILTERINDEX_H
+#define COSMETICFILTERINDEX_H
+
+#include "AdBlockFilter.h"
+
+#include <cstdint>
+#include <vector>
+
+#include <QHash>
+#include <QString>
+
+namespace adblock
+{
+
+/**
+ * @class CosmeticFilterIndex
+ * @ingroup AdBlock
+ * @brief Indexes cosmetic filters (element hiding, custom stylesheet and script injection rules) by
+ *        each of the domains they are applied to, so that finding the filters of a page costs one
+ *        lookup per label of the page's host plus the number of matching filters.
+ *
+ * Filters that have no domain blacklist apply to every domain not in their whitelist, and are
+ * placed in a generic bucket that is checked for every host.
+ */
+class CosmeticFilterIndex
+{
+public:
+    /// Default constructor
+    CosmeticFilterIndex() = default;
+
+    /// Adds a filter to the index
+    void add(Filter *filter);
+
+    /// Returns true if the index contains no filters, false if else
+    bool empty() const;
+
+    /// Returns the number of filters in the index
+    std::size_t size() const;
+
+    /// Returns the filters that apply to the given domain, in the order they were added to the index
+    std::vector<Filter*> findMatches(const QString &domain) const;
+
+private:
+    /// All filters belonging to the index, in order of insertion
+    std::vector<Filter*> m_filters;
+
+    /// Hashmap of \ref DomainSet::hashDomain domain hashes to the positions of the filters that apply to that domain
+    QHash<quint64, std::vector<uint32_t>> m_filtersByDomain;
+
+    /// Positions of the filters with no domain blacklist
+    std::vector<uint32_t> m_genericFilters;
+};
+
+}
+
+#endif // COSMETICFILTERINDEX_H
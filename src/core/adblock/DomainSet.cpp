@@ -0,0 +1,117 @@
+#include "DomainSet.h"
+#include "PublicSuffixList.h"
+#include "StringPool.h"
+
+namespace adblock
+{
+
+void DomainSet::insert(const QString &domain)
+{
+    QMultiHash<quint64, QString> &index = domain.endsWith(QLatin1Char('.')) ? m_entities : m_domains;
+
+    const quint64 hash = hashDomain(domain);
+    if (!index.contains(hash, domain))
+        index.insert(hash, domain);
+}
+
+void DomainSet::unite(const DomainSet &other)
+{
+    for (auto it = other.m_domains.cbegin(); it != other.m_domains.cend(); ++it)
+        insert(it.value());
+    for (auto it = other.m_entities.cbegin(); it != other.m_entities.cend(); ++it)
+        insert(it.value());
+}
+
+void DomainSet::intern(StringPool &stringPool)
+{
+    for (auto it = m_domains.begin(); it != m_domains.end(); ++it)
+        it.value() = stringPool.intern(it.value());
+    for (auto it = m_entities.begin(); it != m_entities.end(); ++it)
+        it.value() = stringPool.intern(it.value());
+}
+
+bool DomainSet::empty() const
+{
+    return m_domains.isEmpty() && m_entities.isEmpty();
+}
+
+int DomainSet::size() const
+{
+    return m_domains.size() + m_entities.size();
+}
+
+bool DomainSet::matches(const QString &host) const
+{
+    if (!m_domains.isEmpty() && matches(m_domains, host, host.size()))
+        return true;
+
+    if (m_entities.isEmpty())
+        return false;
+
+    // Entities are compared to the host without its public suffix, and without its top-level domain,
+    // keeping the '.' that preceded the suffix
+    const int entityLength = getEntityLength(host);
+    if (entityLength > 0 && matches(m_entities, host, entityLength))
+        return true;
+
+    const int withoutTldLength = host.lastIndexOf(QLatin1Char('.')) + 1;
+    return withoutTldLength > 0 && withoutTldLength != entityLength && matches(m_entities, host, withoutTldLength);
+}
+
+quint64 DomainSet::hashDomain(const QString &domain)
+{
+    quint64 hash = HashSeed;
+    for (int i = domain.size() - 1; i >= 0; --i)
+        hash = hashChar(hash, domain.at(i));
+    return hash;
+}
+
+int DomainSet::getEntityLength(const QString &host)
+{
+    // Same as RequestContext::getEntityDomain, the public suffix follows the first label of the registrable domain
+    const int registrableDomainPosition = PublicSuffixList::getRegistrableDomainPosition(QStringRef(&host));
+    if (registrableDomainPosition < 0)
+        return 0;
+
+    return host.indexOf(QLatin1Char('.'), registrableDomainPosition) + 1;
+}
+
+bool DomainSet::matches(const QMultiHash<quint64, QString> &index, const QString &host, int length)
+{
+    return forEachSuffix(host.constData(), length, [&](int pos, quint64 hash) {
+        for (auto it = index.constFind(hash); it != index.cend() && it.key() == hash; ++it)
+        {
+            if (QStringRef(&host, pos, length - pos) == it.value())
+                return true;
+        }
+        return false;
+    });
+}
+
+QDataStream &operator<<(QDataStream &out, const DomainSet &domainSet)
+{
+    out << static_cast<quint32>(domainSet.size());
+    for (auto it = domainSet.m_domains.cbegin(); it != domainSet.m_domains.cend(); ++it)
+        out << it.value();
+    for (auto it = domainSet.m_entities.cbegin(); it != domainSet.m_entities.cend(); ++it)
+        out << it.value();
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, DomainSet &domainSet)
+{
+    domainSet = DomainSet();
+
+    quint32 numDomains = 0;
+    in >> numDomains;
+
+    QString domain;
+    for (quint32 i = 0; i < numDomains && in.status() == QDataStream::Ok; ++i)
+    {
+        in >> domain;
+        domainSet.insert(domain);
+    }
+    return in;
+}
+
+}
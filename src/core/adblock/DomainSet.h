@@ -0,0 +1,160 @@
+#ifndef DOMAINSET_H
+#define DOMAINSET_H
+
+#include <utility>
+
+#include <QDataStream>
+#include <QMultiHash>
+#include <QString>
+#include <QStringRef>
+
+namespace adblock
+{
+
+class StringPool;
+
+/**
+ * @class DomainSet
+ * @ingroup AdBlock
+ * @brief A set of domains, indexed by the hash of each domain's labels in reverse order. Checking
+ *        whether a host or any of its parent domains belongs to the set costs one lookup per label
+ *        of the host, regardless of the size of the set.
+ *
+ * Entity domains, which end with a '.' (ex: "google." for google.com, google.co.uk, ...),
+ * are matched against the host without its public suffix, as found by the \ref PublicSuffixList,
+ * and against the host without its top-level domain. This is the same comparison that is made
+ * for the entity filters of network requests.
+ */
+class DomainSet
+{
+    friend QDataStream &operator<<(QDataStream &out, const DomainSet &domainSet);
+    friend QDataStream &operator>>(QDataStream &in, DomainSet &domainSet);
+
+public:
+    /// Constructs an empty domain set
+    DomainSet() = default;
+
+    /// Adds the domain to the set
+    void insert(const QString &domain);
+
+    /// Adds each of the domains in the other set to this set
+    void unite(const DomainSet &other);
+
+    /// Replaces each domain in the set with its interned copy from the string pool
+    void intern(StringPool &stringPool);
+
+    /// Returns true if the set contains no domains, false if else
+    bool empty() const;
+
+    /// Returns the number of domains in the set
+    int size() const;
+
+    /// Returns true if the host, or any of its parent domains, is in the set
+    bool matches(const QString &host) const;
+
+    /// Returns the hash of the given domain, which is also the key of the domain in a \ref forEachSuffix iteration
+    static quint64 hashDomain(const QString &domain);
+
+    /**
+     * @brief Iterates over the host and each of its parent domains, from the top-level domain down to the host itself
+     * @param host Host name to be iterated over, ex: "ads.example.com"
+     * @param callback Invoked with the position of the domain in the host, and the hash of the domain.
+     *        Returning true from the callback stops the iteration.
+     * @return True if the iteration was stopped by the callback, false if else
+     */
+    template<typename Callback>
+    static bool forEachSuffix(const QString &host, Callback &&callback)
+    {
+        return forEachSuffix(host.constData(), host.size(), std::forward<Callback>(callback));
+    }
+
+    /// Iterates over the host and each of its parent domains, where the host is a part of another string
+    template<typename Callback>
+    static bool forEachSuffix(const QStringRef &host, Callback &&callback)
+    {
+        return forEachSuffix(host.unicode(), host.size(), std::forward<Callback>(callback));
+    }
+
+    /**
+     * @brief Iterates over the hash of every domain or entity domain that would match the host when stored in a set
+     * @param host Host name to be iterated over, ex: "ads.example.com"
+     * @param callback Invoked with each hash. Returning true from the callback stops the iteration.
+     * @return True if the iteration was stopped by the callback, false if else
+     */
+    template<typename Callback>
+    static bool forEachMatchingKey(const QString &host, Callback &&callback)
+    {
+        auto onSuffix = [&callback](int, quint64 hash) { return callback(hash); };
+        if (forEachSuffix(host.constData(), host.size(), onSuffix))
+            return true;
+
+        const int entityLength = getEntityLength(host);
+        if (entityLength > 0 && forEachSuffix(host.constData(), entityLength, onSuffix))
+            return true;
+
+        const int withoutTldLength = host.lastIndexOf(QLatin1Char('.')) + 1;
+        return withoutTldLength > 0 && withoutTldLength != entityLength
+                && forEachSuffix(host.constData(), withoutTldLength, onSuffix);
+    }
+
+    /// Invokes the callback with each domain in the set, including entity domains
+    template<typename Callback>
+    void forEachDomain(Callback &&callback) const
+    {
+        for (auto it = m_domains.cbegin(); it != m_domains.cend(); ++it)
+            callback(it.value());
+        for (auto it = m_entities.cbegin(); it != m_entities.cend(); ++it)
+            callback(it.value());
+    }
+
+private:
+    /// Iterates over the domains contained within the first length characters of the host
+    template<typename Callback>
+    static bool forEachSuffix(const QChar *host, int length, Callback &&callback)
+    {
+        quint64 hash = HashSeed;
+        for (int i = length - 1; i >= 0; --i)
+        {
+            hash = hashChar(hash, host[i]);
+            if (i == 0 || host[i - 1] == QLatin1Char('.'))
+            {
+                if (callback(i, hash))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    /// Returns true if the given index contains a domain equal to the host from the given position onwards
+    static bool matches(const QMultiHash<quint64, QString> &index, const QString &host, int length);
+
+    /// Returns the length of the host without its public suffix, including the '.' that precedes the suffix
+    /// (ex: 11 for "www.google.co.uk"). Returns 0 if the host has no registrable domain
+    static int getEntityLength(const QString &host);
+
+    /// Returns the updated hash after prepending the given character to a domain
+    static inline quint64 hashChar(quint64 hash, QChar c)
+    {
+        return (hash ^ c.unicode()) * 1099511628211ULL;
+    }
+
+    /// Initial value of a domain hash (FNV-1a offset basis)
+    static constexpr quint64 HashSeed = 14695981039346656037ULL;
+
+private:
+    /// Hashmap of domain hashes to the domains in the set
+    QMultiHash<quint64, QString> m_domains;
+
+    /// Hashmap of domain hashes to the entity domains in the set, which are stored with their trailing '.'
+    QMultiHash<quint64, QString> m_entities;
+};
+
+/// Writes the domains in the set to the stream
+QDataStream &operator<<(QDataStream &out, const DomainSet &domainSet);
+
+/// Reads the domains of a set from the stream
+QDataStream &operator>>(QDataStream &in, DomainSet &domainSet);
+
+}
+
+#endif // DOMAINSET_H
@@ -0,0 +1,50 @@
+#include "FilterArena.h"
+
+#include <utility>
+
+namespace adblock
+{
+
+void FilterArena::addBlock(std::vector<Filter> &&filters)
+{
+    if (filters.empty())
+        return;
+
+    m_blocks.push_back(std::move(filters));
+
+    // Moving the block into the list keeps its storage, so the pointers to its filters remain valid
+    std::vector<Filter> &block = m_blocks.back();
+    m_filters.reserve(m_filters.size() + block.size());
+    for (Filter &filter : block)
+        m_filters.push_back(&filter);
+}
+
+Filter *FilterArena::addCopy(const Filter &filter)
+{
+    std::vector<Filter> block;
+    block.push_back(filter);
+    addBlock(std::move(block));
+    return m_filters.back();
+}
+
+void FilterArena::reserve(std::size_t numFilters)
+{
+    m_filters.reserve(numFilters);
+}
+
+std::size_t FilterArena::size() const
+{
+    return m_filters.size();
+}
+
+Filter *FilterArena::at(std::size_t index) const
+{
+    return m_filters[index];
+}
+
+const std::vector<Filter*> &FilterArena::getFilters() const
+{
+    return m_filters;
+}
+
+}
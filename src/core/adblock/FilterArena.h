@@ -0,0 +1,62 @@
+#ifndef FILTERARENA_H
+#define FILTERARENA_H
+
+#include "AdBlockFilter.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace adblock
+{
+
+/**
+ * @class FilterArena
+ * @ingroup AdBlock
+ * @brief Owns a set of filters that are allocated in a few large blocks and released together.
+ *
+ * Each block is a contiguous array of filters that is never resized once added to the arena, so
+ * the address of a filter stays the same for the lifetime of the arena. A subscription stores the
+ * filters of its file in one arena, which is shared with each \ref FilterContainer generation that
+ * is built from it, and freed in one step when the last of them is destroyed.
+ */
+class FilterArena
+{
+public:
+    /// Constructs an empty arena
+    FilterArena() = default;
+
+    /// Copy constructor (forbid)
+    FilterArena(const FilterArena &other) = delete;
+
+    /// Copy assignment operator (forbid)
+    FilterArena &operator =(const FilterArena &other) = delete;
+
+    /// Moves the given block of filters into the arena, after the filters that were previously added
+    void addBlock(std::vector<Filter> &&filters);
+
+    /// Adds a copy of the given filter to the arena, returning a pointer to the copy
+    Filter *addCopy(const Filter &filter);
+
+    /// Reserves room for the given number of filters, so that they can be added without reallocating the index
+    void reserve(std::size_t numFilters);
+
+    /// Returns the number of filters in the arena
+    std::size_t size() const;
+
+    /// Returns the filter at the given index, in the order the filters were added to the arena
+    Filter *at(std::size_t index) const;
+
+    /// Returns each of the filters in the arena, in the order they were added
+    const std::vector<Filter*> &getFilters() const;
+
+private:
+    /// Blocks of filters owned by the arena
+    std::vector< std::vector<Filter> > m_blocks;
+
+    /// Pointer to each filter in the blocks, in order of their addition
+    std::vector<Filter*> m_filters;
+};
+
+}
+
+#endif // FILTERARENA_H
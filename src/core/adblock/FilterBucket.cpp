@@ -1 +1,409 @@
 #include "FilterBucket.h"
+#include "RequestContext.h"
+
+#include <algorithm>
+#include <array>
+
+namespace adblock
+{
+
+FilterMask::FilterMask(const Filter *filter) :
+    m_value(compactTypes(filter->m_blockedTypes))
+{
+    m_value |= compactTypes(filter->m_allowedTypes) << 15;
+
+    // Element types that are not kept in compact form, other than those ignored by the type match
+    // (ElementType::MatchCase and ElementType::Collapse)
+    const ElementType ignoredTypes = ElementType::MatchCase | ElementType::Collapse;
+    if (((filter->m_blockedTypes & ~ignoredTypes) & ~expandTypes(TypeBits)) != ElementType::None)
+        m_value |= OtherTypesBit;
+
+    if (filter->m_disabled)
+        m_value |= DisabledBit;
+}
+
+void FilterBucket::add(Filter *filter)
+{
+    m_filters.push_back(filter);
+}
+
+void FilterBucket::build()
+{
+    m_tokenBuckets.clear();
+    m_genericBucket.clear();
+    m_regExpBucket.clear();
+    m_combinedRegExp = QRegularExpression();
+
+    // Tokens found in almost every URL, which make for very poor index keys
+    static const std::array<const char*, 10> commonTokens = {
+        "com", "http", "https", "icon", "images", "img", "js", "net", "news", "www"
+    };
+
+    std::vector<std::vector<filter_token_t>> filterTokens(m_filters.size());
+    std::unordered_map<filter_token_t, std::size_t> tokenCounts;
+
+    for (std::size_t i = 0; i < m_filters.size(); ++i)
+    {
+        std::vector<filter_token_t> &tokens = filterTokens[i];
+        getFilterTokens(m_filters[i], tokens);
+
+        std::sort(tokens.begin(), tokens.end());
+        tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+        for (filter_token_t token : tokens)
+            ++tokenCounts[token];
+    }
+
+    // Penalize the common tokens so they are only used when a filter has no alternative
+    for (const char *commonToken : commonTokens)
+    {
+        filter_token_t hash = TokenHashSeed;
+        for (const char *c = commonToken; *c; ++c)
+            hash = hashTokenChar(hash, QLatin1Char(*c));
+
+        auto it = tokenCounts.find(hash);
+        if (it != tokenCounts.end())
+            it->second += m_filters.size();
+    }
+
+    // Place each filter in the bucket of its rarest token
+    for (std::size_t i = 0; i < m_filters.size(); ++i)
+    {
+        const std::vector<filter_token_t> &tokens = filterTokens[i];
+        const uint32_t position = static_cast<uint32_t>(i);
+        if (tokens.empty())
+        {
+            m_genericBucket.add(position, m_filters[i]);
+            continue;
+        }
+
+        filter_token_t bestToken = tokens.at(0);
+        std::size_t bestCount = tokenCounts[bestToken];
+        for (std::size_t j = 1; j < tokens.size(); ++j)
+        {
+            const std::size_t count = tokenCounts[tokens[j]];
+            if (count < bestCount)
+            {
+                bestToken = tokens[j];
+                bestCount = count;
+            }
+        }
+
+        m_tokenBuckets[bestToken].add(position, m_filters[i]);
+    }
+
+    combineRegExpFilters();
+}
+
+void FilterBucket::clear()
+{
+    m_filters.clear();
+    m_tokenBuckets.clear();
+    m_genericBucket.clear();
+    m_regExpBucket.clear();
+    m_combinedRegExp = QRegularExpression();
+}
+
+bool FilterBucket::empty() const
+{
+    return m_filters.empty();
+}
+
+std::size_t FilterBucket::size() const
+{
+    return m_filters.size();
+}
+
+std::size_t FilterBucket::getMemoryUsage() const
+{
+    std::size_t result = m_filters.capacity() * sizeof(Filter*)
+            + m_genericBucket.getMemoryUsage()
+            + m_regExpBucket.getMemoryUsage();
+
+    // Each token is stored in a hash node along with its list, and the table holds a pointer to each node
+    result += m_tokenBuckets.bucket_count() * sizeof(void*);
+    for (const std::pair<const filter_token_t, FilterList> &bucket : m_tokenBuckets)
+        result += sizeof(void*) + sizeof(bucket) + bucket.second.getMemoryUsage();
+
+    return result;
+}
+
+Filter *FilterBucket::findMatch(const RequestContext &context) const
+{
+    const QString &requestUrl = context.getUrlString();
+    if (!m_tokenBuckets.empty())
+    {
+        const QChar *data = requestUrl.constData();
+        const int length = requestUrl.size();
+
+        int i = 0;
+        while (i < length)
+        {
+            if (!isTokenChar(data[i]))
+            {
+                ++i;
+                continue;
+            }
+
+            filter_token_t hash = TokenHashSeed;
+            while (i < length && isTokenChar(data[i]))
+                hash = hashTokenChar(hash, data[i++]);
+
+            auto it = m_tokenBuckets.find(hash);
+            if (it == m_tokenBuckets.end())
+                continue;
+
+            if (Filter *filter = findMatch(it->second, context))
+                return filter;
+        }
+    }
+
+    if (Filter *filter = findMatch(m_genericBucket, context))
+        return filter;
+
+    if (!m_regExpBucket.empty() && m_combinedRegExp.match(requestUrl).hasMatch())
+        return findMatch(m_regExpBucket, context);
+
+    return nullptr;
+}
+
+std::vector<Filter*> FilterBucket::findAllMatches(const RequestContext &context) const
+{
+    std::vector<Filter*> result;
+
+    const QString &requestUrl = context.getUrlString();
+    if (!m_tokenBuckets.empty())
+    {
+        // A token may appear more than once in the URL, but its filters are only checked the first time
+        std::vector<const FilterList*> visitedBuckets;
+
+        const QChar *data = requestUrl.constData();
+        const int length = requestUrl.size();
+
+        int i = 0;
+        while (i < length)
+        {
+            if (!isTokenChar(data[i]))
+            {
+                ++i;
+                continue;
+            }
+
+            filter_token_t hash = TokenHashSeed;
+            while (i < length && isTokenChar(data[i]))
+                hash = hashTokenChar(hash, data[i++]);
+
+            auto it = m_tokenBuckets.find(hash);
+            if (it == m_tokenBuckets.end())
+                continue;
+
+            const FilterList *bucket = &it->second;
+            if (std::find(visitedBuckets.begin(), visitedBuckets.end(), bucket) != visitedBuckets.end())
+                continue;
+
+            visitedBuckets.push_back(bucket);
+            findAllMatches(*bucket, context, result);
+        }
+    }
+
+    findAllMatches(m_genericBucket, context, result);
+
+    if (!m_regExpBucket.empty() && m_combinedRegExp.match(requestUrl).hasMatch())
+        findAllMatches(m_regExpBucket, context, result);
+
+    return result;
+}
+
+Filter *FilterBucket::findMatch(const FilterList &filters, const RequestContext &context) const
+{
+    const ElementType typeMask = context.getElementType();
+    const std::size_t numFilters = filters.size();
+    for (std::size_t i = 0; i < numFilters; ++i)
+    {
+        if (!filters.Masks[i].isMatch(typeMask))
+            continue;
+
+        Filter *filter = m_filters[filters.Positions[i]];
+        if (filter->isMatch(context))
+            return filter;
+    }
+
+    return nullptr;
+}
+
+void FilterBucket::findAllMatches(const FilterList &filters, const RequestContext &context, std::vector<Filter*> &result) const
+{
+    const ElementType typeMask = context.getElementType();
+    const std::size_t numFilters = filters.size();
+    for (std::size_t i = 0; i < numFilters; ++i)
+    {
+        if (!filters.Masks[i].isMatch(typeMask))
+            continue;
+
+        Filter *filter = m_filters[filters.Positions[i]];
+        if (filter->isMatch(context))
+            result.push_back(filter);
+    }
+}
+
+void FilterBucket::getFilterTokens(const Filter *filter, std::vector<filter_token_t> &tokens) const
+{
+    // Regular expressions written in their own syntax have no evaluation string, and are indexed by the literal
+    // string found in the expression instead. The characters around that string are unknown, so it is not anchored
+    const bool isLiteral = filter->m_category == FilterCategory::RegExp && filter->m_evalString.isEmpty();
+    const QString &pattern = isLiteral ? filter->m_regExpLiteral : filter->m_evalString;
+    if (filter->m_matchAll || pattern.isEmpty())
+        return;
+
+    // Determine whether the first and last characters of the pattern are anchored to
+    // a token boundary in any URL that would match the filter
+    int start = 0, end = pattern.size();
+    bool leftAnchored = false, rightAnchored = false;
+    switch (filter->m_category)
+    {
+        case FilterCategory::Domain:
+            leftAnchored = rightAnchored = true;
+            break;
+        case FilterCategory::StringStartMatch:
+            leftAnchored = true;
+            break;
+        case FilterCategory::StringEndMatch:
+            rightAnchored = true;
+            break;
+        case FilterCategory::StringExactMatch:
+            leftAnchored = rightAnchored = true;
+            break;
+        case FilterCategory::DomainStart:
+        case FilterCategory::StringContains:
+            break;
+        case FilterCategory::RegExp:
+        {
+            if (isLiteral)
+                break;
+
+            // Only regular expressions converted from AdBlock Plus syntax retain their original pattern
+            if (pattern.startsWith(QLatin1String("||")))
+            {
+                start = 2;
+                leftAnchored = true;
+            }
+            else if (pattern.startsWith(QLatin1Char('|')))
+            {
+                start = 1;
+                leftAnchored = true;
+            }
+
+            if (end - 1 > start && pattern.at(end - 1) == QLatin1Char('|'))
+            {
+                --end;
+                rightAnchored = true;
+            }
+            break;
+        }
+        default:
+            return;
+    }
+
+    int tokenStart = -1;
+    filter_token_t hash = TokenHashSeed;
+    for (int i = start; i <= end; ++i)
+    {
+        if (i < end && isTokenChar(pattern.at(i)))
+        {
+            if (tokenStart < 0)
+            {
+                tokenStart = i;
+                hash = TokenHashSeed;
+            }
+            hash = hashTokenChar(hash, pattern.at(i));
+            continue;
+        }
+
+        if (tokenStart >= 0)
+        {
+            const bool leftBounded = (tokenStart == start) ? leftAnchored : isTokenBoundary(pattern.at(tokenStart - 1));
+            const bool rightBounded = (i == end) ? rightAnchored : isTokenBoundary(pattern.at(i));
+            if (leftBounded && rightBounded)
+                tokens.push_back(hash);
+
+            tokenStart = -1;
+        }
+    }
+}
+
+bool FilterBucket::isTokenBoundary(QChar c) const
+{
+    // Wildcards may expand into more token characters, and non-ASCII characters are percent-encoded in request URLs
+    return c.unicode() < 128 && c != QLatin1Char('*') && !isTokenChar(c);
+}
+
+/// Returns true if the regular expression behaves the same when placed in a group of a larger expression,
+/// meaning it does not refer to any groups by number or name, and does not use recursion or control verbs
+static bool isCombinableRegExp(const QString &pattern)
+{
+    for (int i = 0; i + 1 < pattern.size(); ++i)
+    {
+        const QChar c = pattern.at(i), next = pattern.at(i + 1);
+        if (c == QLatin1Char('\\'))
+        {
+            if (next.isDigit() || next == QLatin1Char('g') || next == QLatin1Char('k'))
+                return false;
+            ++i;
+        }
+        else if (c == QLatin1Char('(') && next == QLatin1Char('*'))
+            return false;
+        else if (c == QLatin1Char('(') && next == QLatin1Char('?') && i + 2 < pattern.size())
+        {
+            const QChar groupType = pattern.at(i + 2);
+            if (groupType == QLatin1Char('P') || groupType == QLatin1Char('\'') || groupType == QLatin1Char('|')
+                    || groupType == QLatin1Char('R') || groupType == QLatin1Char('&') || groupType == QLatin1Char('(')
+                    || groupType == QLatin1Char('+') || groupType.isDigit())
+                return false;
+            if (groupType == QLatin1Char('<') && i + 3 < pattern.size() && pattern.at(i + 3).isLetter())
+                return false;
+        }
+    }
+    return true;
+}
+
+void FilterBucket::combineRegExpFilters()
+{
+    QString combinedPattern;
+    FilterList genericFilters;
+    for (uint32_t position : m_genericBucket.Positions)
+    {
+        const Filter *filter = m_filters[position];
+        if (filter->m_category != FilterCategory::RegExp
+                || filter->m_regExpOptions != QRegularExpression::CaseInsensitiveOption
+                || !isCombinableRegExp(filter->m_regExpPattern))
+        {
+            genericFilters.add(position, filter);
+            continue;
+        }
+
+        if (!combinedPattern.isEmpty())
+            combinedPattern.append(QLatin1Char('|'));
+        combinedPattern.append(QLatin1String("(?:")).append(filter->m_regExpPattern).append(QLatin1Char(')'));
+        m_regExpBucket.add(position, filter);
+    }
+
+    if (m_regExpBucket.size() < 2)
+    {
+        m_regExpBucket.clear();
+        return;
+    }
+
+    m_combinedRegExp = QRegularExpression(combinedPattern, QRegularExpression::CaseInsensitiveOption);
+    if (!m_combinedRegExp.isValid())
+    {
+        m_regExpBucket.clear();
+        m_combinedRegExp = QRegularExpression();
+        return;
+    }
+
+    // Compile the expression now, rather than on the thread of the first request to use it
+    m_combinedRegExp.optimize();
+    m_genericBucket = std::move(genericFilters);
+}
+
+}
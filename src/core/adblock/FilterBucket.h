@@ -2,48 +2,273 @@
 #define FILTERBUCKET_H
 
 #include "AdBlockFilter.h"
+
 #include <cstdint>
+#include <unordered_map>
+#include <vector>
 
-/*
-  35 // fedcba9876543210
-  36 //       |    | |||
-  37 //       |    | |||
-  38 //       |    | |||
-  39 //       |    | |||
-  40 //       |    | ||+---- bit    0: [BlockAction | AllowAction]
-  41 //       |    | |+----- bit    1: `important`
-  42 //       |    | +------ bit 2- 3: party [0 - 3]
-  43 //       |    +-------- bit 4- 8: type [0 - 31]
-  44 //       +------------- bit 9-15: unused
-*/
+#include <QRegularExpression>
+#include <QString>
 
 namespace adblock
 {
 
-using filter_mask_t = uint16_t;
-/*
+/**
+ * Packed form of the options of a network filter that can be checked against a request without
+ * reading the filter itself:
+ *
+ *   bits  0-14: request types blocked by the filter, in the compact form described below
+ *   bits 15-29: request types allowed by the filter, in the same form
+ *   bit     30: set if the filter blocks any other element type (ex: popup, elemhide), which
+ *               keeps it from matching a request that has none of the filter's request types
+ *   bit     31: set if the filter is disabled
+ *
+ * The compact form keeps the element types that a request can have: bits 0-10 are the types from
+ * \ref ElementType::Script to \ref ElementType::Document, followed by \ref ElementType::CSP,
+ * \ref ElementType::InlineScript, \ref ElementType::Other and \ref ElementType::ThirdParty.
+ */
+using filter_mask_t = uint32_t;
+
+/**
+ * @class FilterMask
+ * @ingroup AdBlock
+ * @brief Holds the packed options of a network filter. Masks are stored in their own array in each list of a
+ *        \ref FilterBucket, so that candidates can be rejected by request type and party with a few
+ *        bitmask tests before the filter itself is loaded into the cache.
+ */
 class FilterMask
 {
-private:
-    filter_mask_t m_value;
-
 public:
-    constexpr FilterMask() noexcept : m_value() {}
-    constexpr FilterMask(filter_mask_t value) noexcept : m_value(value) {}
+    /// Constructs a mask that rejects every request
+    constexpr FilterMask() noexcept : m_value(DisabledBit) {}
+
+    /// Constructs the packed mask of the given filter
+    explicit FilterMask(const Filter *filter);
+
+    /// Returns the packed value of the mask
+    constexpr filter_mask_t get() const noexcept { return m_value; }
+
+    /// Returns true if a request of the given element type(s) passes the type and party options of the filter.
+    /// This is equivalent to \ref Filter::isOptionMatch, without the checks of the filter's domain options
+    inline bool isMatch(ElementType typeMask) const
+    {
+        if (m_value & DisabledBit)
+            return false;
+
+        // Any element type that is not kept by the compact form has the same effect on the match
+        ElementType blockedTypes = expandTypes(m_value & TypeBits);
+        if (m_value & OtherTypesBit)
+            blockedTypes = blockedTypes | ElementType::GenericBlock;
+
+        const ElementType allowedTypes = expandTypes((m_value >> 15) & TypeBits);
+
+        if (typeMask == ElementType::InlineScript && (blockedTypes & ElementType::InlineScript) == ElementType::None)
+            return false;
+
+        const bool isThirdParty = (typeMask & ElementType::ThirdParty) != ElementType::None;
+        if ((blockedTypes & ElementType::ThirdParty) != ElementType::None && !isThirdParty)
+            return false;
+        if ((allowedTypes & ElementType::ThirdParty) != ElementType::None && isThirdParty)
+            return false;
+
+        return Filter::isElementTypeMatch(allowedTypes, blockedTypes, typeMask);
+    }
 
-    FilterMask(const FilterMask &) = default;
-    FilterMask(FilterMask &&) = default;
+    /// Returns the compact form of the given element types, keeping only the types that a request can have
+    static constexpr filter_mask_t compactTypes(ElementType types) noexcept
+    {
+        return static_cast<filter_mask_t>((static_cast<uint64_t>(types) & 0x7FFULL)
+                                          | ((static_cast<uint64_t>(types) >> 8) & 0x3800ULL)
+                                          | ((static_cast<uint64_t>(types) >> 1) & 0x4000ULL));
+    }
 
-    FilterMask &operator=(const FilterMask &) = default;
-    FilterMask &operator=(FilterMask &&) = default;
+    /// Returns the element types of the given compact form
+    static constexpr ElementType expandTypes(filter_mask_t compact) noexcept
+    {
+        return static_cast<ElementType>((static_cast<uint64_t>(compact) & 0x7FFULL)
+                                        | ((static_cast<uint64_t>(compact) & 0x3800ULL) << 8)
+                                        | ((static_cast<uint64_t>(compact) & 0x4000ULL) << 1));
+    }
 
-    constexpr const filter_mask_t &get() const noexcept { return m_value; }
+private:
+    /// Bits of a mask that hold one set of element types in compact form
+    static constexpr filter_mask_t TypeBits = 0x7FFFU;
+
+    /// Bit that is set for filters that block an element type which is not kept in compact form
+    static constexpr filter_mask_t OtherTypesBit = 1U << 30;
+
+    /// Bit that is set for disabled filters
+    static constexpr filter_mask_t DisabledBit = 1U << 31;
+
+private:
+    /// Packed value of the mask
+    filter_mask_t m_value;
 };
-*/
+
+/// Hash of a token (a maximal run of [a-z0-9%] characters) from a filter pattern or request URL
+using filter_token_t = uint32_t;
+
+/**
+ * @class FilterBucket
+ * @ingroup AdBlock
+ * @brief Indexes network filters by the rarest token found in their evaluation string, so that
+ *        a request only has to be compared against the filters that share a token with its URL.
+ *
+ * A token is only used as a key if the filter pattern guarantees that it will appear as a complete
+ * token in any URL it matches (ex: it is bounded by separator characters or anchors, not by a
+ * wildcard). Filters without such a token are placed in a generic bucket that is always checked.
+ * The regular expressions of the generic filters are also combined into a single expression, so
+ * that one evaluation can rule out all of them for most requests.
+ */
 class FilterBucket
 {
 public:
+    /// Default constructor
     FilterBucket() = default;
+
+    /// Adds a filter to the bucket. The index must be rebuilt with \ref build before the filter will be found by \ref findMatch
+    void add(Filter *filter);
+
+    /// Removes any filters for which the predicate returns true. The index must be rebuilt with \ref build afterwards
+    template<typename Predicate>
+    void removeIf(Predicate predicate)
+    {
+        for (auto it = m_filters.begin(); it != m_filters.end();)
+        {
+            if (predicate(*it))
+                it = m_filters.erase(it);
+            else
+                ++it;
+        }
+        m_tokenBuckets.clear();
+        m_genericBucket.clear();
+        m_regExpBucket.clear();
+        m_combinedRegExp = QRegularExpression();
+    }
+
+    /// Assigns each filter to the bucket of its least common token
+    void build();
+
+    /// Removes all filters from the bucket
+    void clear();
+
+    /// Returns true if the bucket contains no filters, false if else
+    bool empty() const;
+
+    /// Returns the number of filters in the bucket
+    std::size_t size() const;
+
+    /// Returns the number of bytes allocated by the index of the bucket, not counting the filters themselves
+    std::size_t getMemoryUsage() const;
+
+    /**
+     * @brief Searches the filters sharing a token with the request URL, returning the first match
+     * @param context Normalized form of the network request
+     * @return A pointer to the first matching filter rule, or a nullptr if not found
+     */
+    Filter *findMatch(const RequestContext &context) const;
+
+    /**
+     * @brief Searches the filters sharing a token with the request URL, returning every match
+     * @param context Normalized form of the network request
+     * @return The matching filter rules, in no particular order
+     */
+    std::vector<Filter*> findAllMatches(const RequestContext &context) const;
+
+    /// Returns true if the given character can be part of a token
+    static inline bool isTokenChar(QChar c)
+    {
+        const ushort u = c.unicode();
+        return (u >= 'a' && u <= 'z') || (u >= '0' && u <= '9') || (u >= 'A' && u <= 'Z') || u == '%';
+    }
+
+    /// Returns the updated token hash after appending the given character to a token
+    static inline filter_token_t hashTokenChar(filter_token_t hash, QChar c)
+    {
+        ushort u = c.unicode();
+        if (u >= 'A' && u <= 'Z')
+            u += 32;
+        return (hash ^ static_cast<filter_token_t>(u)) * 16777619U;
+    }
+
+    /// Initial value of a token hash (FNV-1a offset basis)
+    static constexpr filter_token_t TokenHashSeed = 2166136261U;
+
+private:
+    /// A list of filters in structure-of-arrays form, where the mask of each filter is stored at the same index as
+    /// the position of the filter in m_filters. Each entry takes 8 bytes, the same as a list of filter pointers
+    struct FilterList
+    {
+        /// Packed options of each filter
+        std::vector<FilterMask> Masks;
+
+        /// Position of each filter in m_filters
+        std::vector<uint32_t> Positions;
+
+        /// Adds the filter at the given position of m_filters to the list
+        void add(uint32_t position, const Filter *filter)
+        {
+            Masks.emplace_back(filter);
+            Positions.push_back(position);
+        }
+
+        /// Removes all filters from the list
+        void clear()
+        {
+            Masks.clear();
+            Positions.clear();
+        }
+
+        /// Returns true if the list is empty, false if else
+        bool empty() const
+        {
+            return Positions.empty();
+        }
+
+        /// Returns the number of filters in the list
+        std::size_t size() const
+        {
+            return Positions.size();
+        }
+
+        /// Returns the number of bytes allocated by the list
+        std::size_t getMemoryUsage() const
+        {
+            return Masks.capacity() * sizeof(FilterMask) + Positions.capacity() * sizeof(uint32_t);
+        }
+    };
+
+    /// Returns the first filter in the list that matches the request, or a nullptr if not found
+    Filter *findMatch(const FilterList &filters, const RequestContext &context) const;
+
+    /// Appends each filter in the list that matches the request to the result
+    void findAllMatches(const FilterList &filters, const RequestContext &context, std::vector<Filter*> &result) const;
+
+    /// Appends the hash of each token in the filter's pattern that can safely be used as an index key
+    void getFilterTokens(const Filter *filter, std::vector<filter_token_t> &tokens) const;
+
+    /// Returns true if the given pattern character marks the edge of a token that will also be found in matching URLs
+    bool isTokenBoundary(QChar c) const;
+
+    /// Moves the filters of the generic bucket that have a regular expression which can be embedded in
+    /// a larger expression into the regular expression bucket, and compiles their combined expression
+    void combineRegExpFilters();
+
+private:
+    /// All filters belonging to the bucket
+    std::vector<Filter*> m_filters;
+
+    /// Hashmap of token hashes to the filters that were indexed by that token
+    std::unordered_map<filter_token_t, FilterList> m_tokenBuckets;
+
+    /// Filters with no usable token, which are checked against every request
+    FilterList m_genericBucket;
+
+    /// Filters with no usable token, which are only checked when the combined regular expression matches the request
+    FilterList m_regExpBucket;
+
+    /// Alternation of the regular expressions of each filter in m_regExpBucket
+    QRegularExpression m_combinedRegExp;
 };
 
 }
@@ -0,0 +1,191 @@
+#include "PublicSuffixList.h"
+#include "RequestContext.h"
+
+namespace adblock
+{
+
+/// Returns true if the given character may appear in the scheme of a URL
+static bool isSchemeChar(QChar c)
+{
+    const ushort value = c.unicode();
+    return (value >= 'a' && value <= 'z')
+            || (value >= '0' && value <= '9')
+            || value == '+' || value == '-' || value == '.';
+}
+
+RequestContext::RequestContext(const QUrl &requestUrl, const QUrl &firstPartyUrl, QWebEngineUrlRequestInfo::ResourceType resourceType) :
+    RequestContext(requestUrl, firstPartyUrl, ElementType::None)
+{
+    m_elementType = getResourceElementType(resourceType);
+
+    // Check for websocket
+    // Doesn't seem to work though. If only we could check for the presence of
+    // request headers such as Sec-WebSocket-Key or Sec-WebSocket-Version, then
+    // we could detect websocket requests..
+    const QStringRef scheme = getScheme();
+    if (scheme == QLatin1String("ws") || scheme == QLatin1String("wss"))
+        m_elementType |= ElementType::WebSocket;
+
+    if (m_thirdParty)
+        m_elementType |= ElementType::ThirdParty;
+}
+
+RequestContext::RequestContext(const QUrl &requestUrl, const QUrl &firstPartyUrl, ElementType elementType) :
+    m_url(requestUrl),
+    m_urlString(requestUrl.toString(QUrl::FullyEncoded).toLower()),
+    m_schemeLength(0),
+    m_hostPosition(0),
+    m_hostLength(0),
+    m_domainPosition(0),
+    m_registrableDomainPosition(-1),
+    m_firstPartyHost(firstPartyUrl.host(QUrl::FullyEncoded).toLower()),
+    m_thirdParty(false),
+    m_elementType(elementType)
+{
+    parseUrls(firstPartyUrl);
+}
+
+void RequestContext::parseUrls(const QUrl &firstPartyUrl)
+{
+    // The URL string has the form scheme:[//[userinfo@]host[:port]][path][?query][#fragment]
+    const QChar *data = m_urlString.constData();
+    const int length = m_urlString.size();
+
+    int i = 0;
+    while (i < length && isSchemeChar(data[i]))
+        ++i;
+    if (i > 0 && i < length && data[i] == QLatin1Char(':'))
+        m_schemeLength = i++;
+    else
+        i = 0;
+
+    m_hostPosition = i;
+    if (i + 1 < length && data[i] == QLatin1Char('/') && data[i + 1] == QLatin1Char('/'))
+    {
+        const int authorityStart = i + 2;
+        int authorityEnd = authorityStart;
+        while (authorityEnd < length && data[authorityEnd] != QLatin1Char('/')
+               && data[authorityEnd] != QLatin1Char('?') && data[authorityEnd] != QLatin1Char('#'))
+            ++authorityEnd;
+
+        int hostStart = authorityStart;
+        for (int j = authorityStart; j < authorityEnd; ++j)
+        {
+            if (data[j] == QLatin1Char('@'))
+                hostStart = j + 1;
+        }
+
+        int hostEnd = authorityEnd;
+        if (hostStart < authorityEnd && data[hostStart] == QLatin1Char('['))
+        {
+            // IPv6 addresses are enclosed in brackets, which are not a part of the host
+            ++hostStart;
+            hostEnd = hostStart;
+            while (hostEnd < authorityEnd && data[hostEnd] != QLatin1Char(']'))
+                ++hostEnd;
+        }
+        else
+        {
+            for (int j = hostStart; j < authorityEnd; ++j)
+            {
+                if (data[j] == QLatin1Char(':'))
+                {
+                    hostEnd = j;
+                    break;
+                }
+            }
+        }
+
+        m_hostPosition = hostStart;
+        m_hostLength = hostEnd - hostStart;
+    }
+
+    const QStringRef host = getHost();
+    m_domainPosition = m_hostPosition;
+    if (host.startsWith(QLatin1String("www.")))
+        m_domainPosition += 4;
+
+    const int registrableDomainPosition = PublicSuffixList::getRegistrableDomainPosition(host);
+    if (registrableDomainPosition >= 0)
+        m_registrableDomainPosition = m_hostPosition + registrableDomainPosition;
+
+    // Check for third party request type
+    if (firstPartyUrl.isEmpty())
+    {
+        m_thirdParty = true;
+        return;
+    }
+
+    if (m_firstPartyHost.isEmpty())
+    {
+        const QString firstPartyUrlStr = firstPartyUrl.toString();
+        if (firstPartyUrlStr.compare(QLatin1String(".")) == 0 || firstPartyUrlStr.compare(QLatin1String("data;,")) == 0)
+        {
+            m_thirdParty = true;
+            return;
+        }
+    }
+
+    const QStringRef firstPartyHost(&m_firstPartyHost);
+    const int firstPartyDomainPosition = PublicSuffixList::getRegistrableDomainPosition(firstPartyHost);
+    const QStringRef firstPartyDomain = firstPartyDomainPosition >= 0 ? firstPartyHost.mid(firstPartyDomainPosition) : QStringRef();
+    m_thirdParty = getRegistrableDomain() != firstPartyDomain;
+}
+
+QStringRef RequestContext::getEntityDomain() const
+{
+    if (m_registrableDomainPosition < 0)
+        return QStringRef();
+
+    // The public suffix follows the first label of the registrable domain
+    const int suffixPosition = m_urlString.indexOf(QLatin1Char('.'), m_registrableDomainPosition) + 1;
+    if (suffixPosition <= m_domainPosition)
+        return QStringRef();
+
+    return QStringRef(&m_urlString, m_domainPosition, suffixPosition - m_domainPosition);
+}
+
+ElementType RequestContext::getResourceElementType(QWebEngineUrlRequestInfo::ResourceType resourceType) const
+{
+    switch (resourceType)
+    {
+        case QWebEngineUrlRequestInfo::ResourceTypeMainFrame:
+            return ElementType::Document;
+        case QWebEngineUrlRequestInfo::ResourceTypeSubFrame:
+            return ElementType::Subdocument;
+        case QWebEngineUrlRequestInfo::ResourceTypeStylesheet:
+            return ElementType::Stylesheet;
+        case QWebEngineUrlRequestInfo::ResourceTypeScript:
+            return ElementType::Script;
+        case QWebEngineUrlRequestInfo::ResourceTypeImage:
+            return ElementType::Image;
+        case QWebEngineUrlRequestInfo::ResourceTypeSubResource:
+            if (m_urlString.endsWith(QLatin1String("htm"))
+                || m_urlString.endsWith(QLatin1String("html"))
+                || m_urlString.endsWith(QLatin1String("xml")))
+            {
+                return ElementType::Subdocument;
+            }
+            return ElementType::Other;
+        case QWebEngineUrlRequestInfo::ResourceTypeXhr:
+            return ElementType::XMLHTTPRequest;
+        case QWebEngineUrlRequestInfo::ResourceTypePing:
+            return ElementType::Ping;
+        case QWebEngineUrlRequestInfo::ResourceTypePluginResource:
+            return ElementType::ObjectSubrequest;
+        case QWebEngineUrlRequestInfo::ResourceTypeObject:
+            return ElementType::Object;
+        case QWebEngineUrlRequestInfo::ResourceTypeFontResource:
+        case QWebEngineUrlRequestInfo::ResourceTypeMedia:
+        case QWebEngineUrlRequestInfo::ResourceTypeWorker:
+        case QWebEngineUrlRequestInfo::ResourceTypeSharedWorker:
+        case QWebEngineUrlRequestInfo::ResourceTypeServiceWorker:
+        case QWebEngineUrlRequestInfo::ResourceTypePrefetch:
+        case QWebEngineUrlRequestInfo::ResourceTypeFavicon:
+        case QWebEngineUrlRequestInfo::ResourceTypeCspReport:
+        default:
+            return ElementType::Other;
+    }
+}
+
+}
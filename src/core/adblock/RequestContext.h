@@ -0,0 +1,123 @@
+#ifndef REQUESTCONTEXT_H
+#define REQUESTCONTEXT_H
+
+#include "AdBlockFilter.h"
+
+#include <QString>
+#include <QStringRef>
+#include <QUrl>
+#include <QWebEngineUrlRequestInfo>
+
+namespace adblock
+{
+
+/**
+ * @class RequestContext
+ * @ingroup AdBlock
+ * @brief The normalized form of a network request, which is computed once per request and then
+ *        passed to each of the filters that the request is matched against.
+ *
+ * The request URL is converted to its fully encoded, lower case form a single time, and its scheme,
+ * host and domains are kept as offsets into that string rather than as strings of their own. Matching
+ * a context against the filters does not allocate any memory, with the exception of the evaluation of
+ * regular expressions that the URL was not able to rule out beforehand.
+ */
+class RequestContext
+{
+public:
+    /**
+     * @brief Constructs the context of a network request
+     * @param requestUrl URL of the network request
+     * @param firstPartyUrl URL of the page that made the request
+     * @param resourceType Type of the requested resource, used to determine the \ref ElementType of the request
+     */
+    RequestContext(const QUrl &requestUrl, const QUrl &firstPartyUrl, QWebEngineUrlRequestInfo::ResourceType resourceType);
+
+    /**
+     * @brief Constructs the context of a request with the given element type(s). The party of the request is not
+     *        added to the element types, which is used when checking a page itself against the filters
+     * @param requestUrl URL of the request
+     * @param firstPartyUrl URL of the page that made the request
+     * @param elementType Element type(s) associated with the request
+     */
+    RequestContext(const QUrl &requestUrl, const QUrl &firstPartyUrl, ElementType elementType);
+
+    /// Returns the URL of the request
+    const QUrl &getUrl() const { return m_url; }
+
+    /// Returns the URL of the request, fully encoded and in lower case
+    const QString &getUrlString() const { return m_urlString; }
+
+    /// Returns the scheme of the request URL
+    QStringRef getScheme() const { return QStringRef(&m_urlString, 0, m_schemeLength); }
+
+    /// Returns the host of the request URL
+    QStringRef getHost() const { return QStringRef(&m_urlString, m_hostPosition, m_hostLength); }
+
+    /// Returns the host of the request URL without its "www." prefix, if any
+    QStringRef getDomain() const { return QStringRef(&m_urlString, m_domainPosition, m_hostPosition + m_hostLength - m_domainPosition); }
+
+    /// Returns the registrable domain (second-level domain) of the request URL, or an empty string if it has none
+    QStringRef getRegistrableDomain() const
+    {
+        if (m_registrableDomainPosition < 0)
+            return QStringRef();
+        return QStringRef(&m_urlString, m_registrableDomainPosition, m_hostPosition + m_hostLength - m_registrableDomainPosition);
+    }
+
+    /// Returns the domain of the request without its public suffix, keeping the '.' that preceded the suffix
+    /// (ex: "ads.google." for ads.google.co.uk), or an empty string if the host has no registrable domain.
+    /// Entity filters, such as ||google.^, are compared to this form of the domain
+    QStringRef getEntityDomain() const;
+
+    /// Returns the host of the page that made the request, in lower case
+    const QString &getFirstPartyHost() const { return m_firstPartyHost; }
+
+    /// Returns true if the request was made to a different site than that of the page that made the request
+    bool isThirdParty() const { return m_thirdParty; }
+
+    /// Returns the element type(s) associated with the request
+    ElementType getElementType() const { return m_elementType; }
+
+private:
+    /// Finds the scheme, host and domains of the request in the URL string, and determines the party of the request
+    void parseUrls(const QUrl &firstPartyUrl);
+
+    /// Returns the element type of a request for a resource of the given type
+    ElementType getResourceElementType(QWebEngineUrlRequestInfo::ResourceType resourceType) const;
+
+private:
+    /// URL of the request
+    QUrl m_url;
+
+    /// URL of the request, fully encoded and in lower case. The other parts of the request URL refer to this string
+    QString m_urlString;
+
+    /// Length of the scheme at the start of m_urlString
+    int m_schemeLength;
+
+    /// Position of the host in m_urlString
+    int m_hostPosition;
+
+    /// Length of the host
+    int m_hostLength;
+
+    /// Position of the host without its "www." prefix in m_urlString
+    int m_domainPosition;
+
+    /// Position of the registrable domain in m_urlString, or -1 if the host does not have one
+    int m_registrableDomainPosition;
+
+    /// Host of the page that made the request, in lower case
+    QString m_firstPartyHost;
+
+    /// True if the registrable domains of the request and its page are different
+    bool m_thirdParty;
+
+    /// Element type(s) associated with the request
+    ElementType m_elementType;
+};
+
+}
+
+#endif // REQUESTCONTEXT_H
@@ -0,0 +1,143 @@
+#include "ResourceStore.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include <QFile>
+
+namespace adblock
+{
+
+bool ResourceStore::loadFile(const QString &path)
+{
+    QFile f(path);
+    if (!f.exists() || !f.open(QIODevice::ReadOnly))
+        return false;
+
+    const QByteArray contents = f.readAll();
+    f.close();
+
+    load(contents);
+    return true;
+}
+
+void ResourceStore::load(const QByteArray &contents)
+{
+    // Resources are listed as a line with their name and MIME type, followed by their value and an empty line
+    QHash<QString, Resource> resources;
+
+    QString name;
+    QByteArray mimeType, value;
+    bool readingValue = false, isBase64 = false, isScript = false;
+
+    auto addResource = [&]() {
+        value.squeeze();
+        resources.insert(name, Resource { isBase64 ? QByteArray::fromBase64(value) : value, mimeType });
+        value = QByteArray();
+        readingValue = false;
+    };
+
+    const char *data = contents.constData();
+    const int length = contents.size();
+    int position = 0;
+    while (position < length)
+    {
+        int lineEnd = contents.indexOf('\n', position);
+        if (lineEnd < 0)
+            lineEnd = length;
+
+        const char *line = data + position;
+        int lineLength = lineEnd - position;
+        if (lineLength > 0 && line[lineLength - 1] == '\r')
+            --lineLength;
+
+        position = lineEnd + 1;
+
+        if ((!readingValue && lineLength == 0) || (lineLength > 0 && line[0] == '#'))
+            continue;
+
+        // Extract the name and type of the resource if not reading the value of a resource
+        if (!readingValue)
+        {
+            const char *separator = static_cast<const char*>(std::memchr(line, ' ', static_cast<std::size_t>(lineLength)));
+            const int nameLength = separator != nullptr ? static_cast<int>(separator - line) : lineLength;
+            name = QString::fromLatin1(line, nameLength);
+            mimeType = separator != nullptr ? QByteArray(separator + 1, lineLength - nameLength - 1) : QByteArray();
+
+            const int base64Position = mimeType.indexOf(";base64");
+            isBase64 = base64Position >= 0;
+            if (isBase64)
+                mimeType.truncate(base64Position);
+
+            isScript = mimeType.contains("javascript");
+            readingValue = true;
+        }
+        else if (lineLength > 0)
+        {
+            value.append(line, lineLength);
+            if (isScript)
+                value.append('\n');
+        }
+        else
+        {
+            addResource();
+        }
+    }
+
+    if (readingValue)
+        addResource();
+
+    std::unique_lock<std::shared_mutex> lock(m_lock);
+    for (auto it = resources.cbegin(); it != resources.cend(); ++it)
+        m_resources.insert(it.key(), it.value());
+}
+
+Resource ResourceStore::getResource(const QString &name) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_lock);
+    return m_resources.value(name);
+}
+
+int ResourceStore::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_lock);
+    return m_resources.size();
+}
+
+ResourceDevice::ResourceDevice(const QByteArray &data, QObject *parent) :
+    QIODevice(parent),
+    m_data(data)
+{
+}
+
+bool ResourceDevice::open(OpenMode mode)
+{
+    if (mode & QIODevice::WriteOnly)
+        return false;
+
+    // The data is already in memory, so reads are not buffered by QIODevice
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+qint64 ResourceDevice::size() const
+{
+    return m_data.size();
+}
+
+qint64 ResourceDevice::readData(char *data, qint64 maxSize)
+{
+    const qint64 length = std::min(maxSize, static_cast<qint64>(m_data.size()) - pos());
+    if (length <= 0)
+        return 0;
+
+    std::memcpy(data, m_data.constData() + pos(), static_cast<std::size_t>(length));
+    return length;
+}
+
+qint64 ResourceDevice::writeData(const char *, qint64)
+{
+    return -1;
+}
+
+}
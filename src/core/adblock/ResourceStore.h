@@ -0,0 +1,96 @@
+#ifndef RESOURCESTORE_H
+#define RESOURCESTORE_H
+
+#include <shared_mutex>
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QString>
+
+namespace adblock
+{
+
+/**
+ * @struct Resource
+ * @ingroup AdBlock
+ * @brief A uBlock Origin style resource, which filters may redirect requests to or inject into pages
+ */
+struct Resource
+{
+    /// Contents of the resource, already decoded if it was stored in base64
+    QByteArray Data;
+
+    /// MIME type of the resource, without any ";base64" suffix
+    QByteArray MimeType;
+};
+
+/**
+ * @class ResourceStore
+ * @ingroup AdBlock
+ * @brief Holds the resources loaded from uBlock Origin style resource files.
+ *
+ * Each resource is decoded once, when its file is loaded, and is never modified afterwards.
+ * Lookups return the resource by value, sharing its data with the store instead of copying it.
+ * Resources may be looked up from any thread, including while a resource file is being loaded.
+ */
+class ResourceStore
+{
+public:
+    /// Default constructor
+    ResourceStore() = default;
+
+    /// Loads each resource in the file with the given path, replacing any existing resources of the same name.
+    /// Returns false if the file could not be read
+    bool loadFile(const QString &path);
+
+    /// Parses each resource in the given contents of a resource file, replacing any existing resources of the same name
+    void load(const QByteArray &contents);
+
+    /// Returns the resource with the given name, or a resource with no data if not found
+    Resource getResource(const QString &name) const;
+
+    /// Returns the number of resources in the store
+    int size() const;
+
+private:
+    /// Resources, keyed by their name
+    QHash<QString, Resource> m_resources;
+
+    /// Guards the resources. Lookups take a shared lock, while resource files are loaded with an exclusive lock
+    mutable std::shared_mutex m_lock;
+};
+
+/**
+ * @class ResourceDevice
+ * @ingroup AdBlock
+ * @brief A read-only, unbuffered device over the data of a \ref Resource. The data is shared with the
+ *        resource rather than copied, so that a request can be replied to without duplicating its resource.
+ */
+class ResourceDevice : public QIODevice
+{
+public:
+    /// Constructs the device over the given data. The device must be opened before it is read
+    explicit ResourceDevice(const QByteArray &data, QObject *parent = nullptr);
+
+    /// Opens the device in read-only, unbuffered mode. Returns false if any other mode is requested
+    bool open(OpenMode mode) override;
+
+    /// Returns the size of the data
+    qint64 size() const override;
+
+protected:
+    /// Copies up to maxSize bytes of the data, from the current position, into the given buffer
+    qint64 readData(char *data, qint64 maxSize) override;
+
+    /// Returns -1, as the device cannot be written to
+    qint64 writeData(const char *data, qint64 maxSize) override;
+
+private:
+    /// Data of the resource
+    const QByteArray m_data;
+};
+
+}
+
+#endif // RESOURCESTORE_H
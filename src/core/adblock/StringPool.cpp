@@ -0,0 +1,35 @@
+#include "StringPool.h"
+
+#include <QHash>
+
+namespace adblock
+{
+
+QString StringPool::intern(const QString &str)
+{
+    if (str.isEmpty())
+        return str;
+
+    Shard &shard = m_shards[qHash(str) % NumShards];
+    std::lock_guard<std::mutex> _(shard.Mutex);
+
+    auto it = shard.Strings.constFind(str);
+    if (it != shard.Strings.constEnd())
+        return *it;
+
+    shard.Strings.insert(str);
+    return str;
+}
+
+int StringPool::size() const
+{
+    int result = 0;
+    for (const Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> _(shard.Mutex);
+        result += shard.Strings.size();
+    }
+    return result;
+}
+
+}
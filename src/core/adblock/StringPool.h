@@ -0,0 +1,56 @@
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <array>
+#include <mutex>
+
+#include <QSet>
+#include <QString>
+
+namespace adblock
+{
+
+/**
+ * @class StringPool
+ * @ingroup AdBlock
+ * @brief Interns strings that are repeated across many filters, such as domain names and filter
+ *        option values. Each interned string shares the data of the first equal string that was
+ *        added to the pool, so every copy of a domain refers to a single allocation.
+ *
+ * The pool is split into shards with their own locks, so that filter lists can be parsed in parallel.
+ * Interned strings remain valid after the pool is destroyed.
+ */
+class StringPool
+{
+public:
+    /// Constructs an empty string pool
+    StringPool() = default;
+
+    /// Returns the pooled string that is equal to the given string, adding the string to the pool if not found
+    QString intern(const QString &str);
+
+    /// Returns the number of distinct strings in the pool
+    int size() const;
+
+    /// Number of shards in the pool
+    static constexpr std::size_t NumShards = 16;
+
+private:
+    /// A portion of the pool, containing the strings that map to the shard
+    struct Shard
+    {
+        /// Guards the strings of the shard
+        mutable std::mutex Mutex;
+
+        /// Distinct strings belonging to the shard
+        QSet<QString> Strings;
+    };
+
+private:
+    /// Shards of the pool
+    std::array<Shard, NumShards> m_shards;
+};
+
+}
+
+#endif // STRINGPOOL_H
@@ -0,0 +1,140 @@
+#include "SubscriptionUpdater.h"
+
+#include <algorithm>
+
+#include <QFile>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSaveFile>
+
+namespace adblock
+{
+
+SubscriptionUpdater::SubscriptionUpdater(QNetworkAccessManager *networkAccessManager, int maxConcurrentDownloads, QObject *parent) :
+    QObject(parent),
+    m_networkAccessManager(networkAccessManager),
+    m_maxConcurrentDownloads(std::max(maxConcurrentDownloads, 1)),
+    m_pendingUpdates(),
+    m_activeFilePaths()
+{
+}
+
+void SubscriptionUpdater::addUpdate(const SubscriptionUpdate &update)
+{
+    if (hasUpdate(update.FilePath))
+        return;
+
+    m_pendingUpdates.push_back(update);
+    startPendingUpdates();
+}
+
+bool SubscriptionUpdater::hasUpdate(const QString &filePath) const
+{
+    auto matchesPath = [&filePath](const QString &path) { return path == filePath; };
+    if (std::any_of(m_activeFilePaths.begin(), m_activeFilePaths.end(), matchesPath))
+        return true;
+
+    return std::any_of(m_pendingUpdates.begin(), m_pendingUpdates.end(), [&filePath](const SubscriptionUpdate &update) {
+        return update.FilePath == filePath;
+    });
+}
+
+bool SubscriptionUpdater::isRunning() const
+{
+    return !m_activeFilePaths.empty() || !m_pendingUpdates.empty();
+}
+
+int SubscriptionUpdater::getNumActiveDownloads() const
+{
+    return static_cast<int>(m_activeFilePaths.size());
+}
+
+void SubscriptionUpdater::startPendingUpdates()
+{
+    while (!m_pendingUpdates.empty() && getNumActiveDownloads() < m_maxConcurrentDownloads)
+    {
+        SubscriptionUpdate update = m_pendingUpdates.front();
+        m_pendingUpdates.pop_front();
+        startUpdate(update);
+    }
+}
+
+void SubscriptionUpdater::startUpdate(const SubscriptionUpdate &update)
+{
+    QNetworkRequest request(update.SourceUrl);
+    request.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::NoLessSafeRedirectPolicy);
+
+    // The validators only describe the file if it still exists, otherwise the whole list must be downloaded again
+    if (QFile::exists(update.FilePath))
+    {
+        if (!update.EntityTag.isEmpty())
+            request.setRawHeader(QByteArrayLiteral("If-None-Match"), update.EntityTag.toLatin1());
+        if (!update.LastModified.isEmpty())
+            request.setRawHeader(QByteArrayLiteral("If-Modified-Since"), update.LastModified.toLatin1());
+    }
+
+    m_activeFilePaths.push_back(update.FilePath);
+
+    QNetworkReply *reply = m_networkAccessManager->get(request);
+    connect(reply, &QNetworkReply::finished, this, [this, reply, update]() {
+        onReplyFinished(reply, update);
+    });
+}
+
+void SubscriptionUpdater::onReplyFinished(QNetworkReply *reply, SubscriptionUpdate update)
+{
+    reply->deleteLater();
+
+    const int statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (statusCode == 304)
+    {
+        update.Status = SubscriptionUpdateStatus::NotModified;
+    }
+    else if (reply->error() == QNetworkReply::NoError && (statusCode == 200 || statusCode == 0))
+    {
+        // An empty list is more likely to be a broken response than a real update, so the old file is kept
+        const QByteArray contents = reply->readAll();
+        if (!contents.isEmpty() && writeFile(update.FilePath, contents))
+        {
+            update.EntityTag = QString::fromLatin1(reply->rawHeader(QByteArrayLiteral("ETag")));
+            update.LastModified = QString::fromLatin1(reply->rawHeader(QByteArrayLiteral("Last-Modified")));
+            update.Status = SubscriptionUpdateStatus::Updated;
+        }
+        else
+        {
+            update.Status = SubscriptionUpdateStatus::Failed;
+        }
+    }
+    else
+    {
+        update.Status = SubscriptionUpdateStatus::Failed;
+    }
+
+    auto it = std::find(m_activeFilePaths.begin(), m_activeFilePaths.end(), update.FilePath);
+    if (it != m_activeFilePaths.end())
+        m_activeFilePaths.erase(it);
+
+    emit updateFinished(update);
+
+    startPendingUpdates();
+    if (!isRunning())
+        emit finished();
+}
+
+bool SubscriptionUpdater::writeFile(const QString &filePath, const QByteArray &contents) const
+{
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    if (file.write(contents) != contents.size())
+    {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+}
@@ -0,0 +1,124 @@
+#ifndef SUBSCRIPTIONUPDATER_H
+#define SUBSCRIPTIONUPDATER_H
+
+#include <deque>
+
+#include <QObject>
+#include <QString>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+namespace adblock
+{
+
+/// Result of an update to a subscription file
+enum class SubscriptionUpdateStatus
+{
+    /// The source of the subscription had changed, and the file was replaced by the new version
+    Updated,
+
+    /// The source of the subscription has not changed since the file was downloaded
+    NotModified,
+
+    /// The source could not be reached, or did not return a usable response. The file is left as it was
+    Failed
+};
+
+/**
+ * @struct SubscriptionUpdate
+ * @ingroup AdBlock
+ * @brief Describes the update of a single subscription file, and its result once the update has finished
+ */
+struct SubscriptionUpdate
+{
+    /// URL that the subscription file is downloaded from
+    QUrl SourceUrl;
+
+    /// Path of the subscription file on disk
+    QString FilePath;
+
+    /// Entity tag of the last response for the file. Sent as the If-None-Match header, and replaced by the
+    /// entity tag of the new response once the update has finished
+    QString EntityTag;
+
+    /// Last-Modified header of the last response for the file. Sent as the If-Modified-Since header, and
+    /// replaced by the header of the new response once the update has finished
+    QString LastModified;
+
+    /// Result of the update. Only meaningful once the update has finished
+    SubscriptionUpdateStatus Status = SubscriptionUpdateStatus::Failed;
+};
+
+/**
+ * @class SubscriptionUpdater
+ * @ingroup AdBlock
+ * @brief Downloads new versions of subscription files with conditional requests.
+ *
+ * Each update sends the validators of the previous download of its file, so that the server can reply with
+ * 304 Not Modified instead of sending a list that has not changed. Only a complete response replaces the
+ * subscription file, which is written atomically. Updates run in parallel, up to a fixed number at a time.
+ */
+class SubscriptionUpdater : public QObject
+{
+    Q_OBJECT
+
+public:
+    /// Default number of subscriptions that are downloaded at the same time
+    static constexpr int DefaultMaxConcurrentDownloads = 4;
+
+    /// Constructs the updater, which sends its requests through the given network access manager
+    explicit SubscriptionUpdater(QNetworkAccessManager *networkAccessManager,
+                                 int maxConcurrentDownloads = DefaultMaxConcurrentDownloads,
+                                 QObject *parent = nullptr);
+
+    /// Queues the given update, starting it right away if fewer than the maximum number of downloads are active
+    void addUpdate(const SubscriptionUpdate &update);
+
+    /// Returns true if the subscription file with the given path is being updated, or is waiting to be updated
+    bool hasUpdate(const QString &filePath) const;
+
+    /// Returns true if any update is active or waiting to start
+    bool isRunning() const;
+
+    /// Returns the number of downloads that are active
+    int getNumActiveDownloads() const;
+
+Q_SIGNALS:
+    /// Emitted when an update has finished, with its result
+    void updateFinished(const adblock::SubscriptionUpdate &update);
+
+    /// Emitted once every queued update has finished
+    void finished();
+
+private:
+    /// Starts pending updates until the maximum number of downloads are active
+    void startPendingUpdates();
+
+    /// Sends the request of the given update
+    void startUpdate(const SubscriptionUpdate &update);
+
+    /// Handles the reply to the request of the given update
+    void onReplyFinished(QNetworkReply *reply, SubscriptionUpdate update);
+
+    /// Writes the given contents to the subscription file of the update. Returns true on success
+    bool writeFile(const QString &filePath, const QByteArray &contents) const;
+
+private:
+    /// Network access manager
+    QNetworkAccessManager *m_networkAccessManager;
+
+    /// Maximum number of downloads that are active at once
+    int m_maxConcurrentDownloads;
+
+    /// Updates that have not been started yet
+    std::deque<SubscriptionUpdate> m_pendingUpdates;
+
+    /// Paths of the subscription files that are being downloaded
+    std::deque<QString> m_activeFilePaths;
+};
+
+}
+
+#endif // SUBSCRIPTIONUPDATER_H
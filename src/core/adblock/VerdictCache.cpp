@@ -0,0 +1,106 @@
+#include "VerdictCache.h"
+
+namespace adblock
+{
+
+VerdictCache::VerdictCache(std::size_t shardCapacity) :
+    m_shardCapacity(shardCapacity),
+    m_shards(),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0)
+{
+    for (std::unique_ptr<Shard> &shard : m_shards)
+        shard = std::make_unique<Shard>(shardCapacity);
+}
+
+quint64 VerdictCache::getKey(const QString &baseUrl, const QString &requestUrl, ElementType typeMask)
+{
+    // 64-bit FNV-1a over both strings, separated by a character that cannot appear in a host name
+    quint64 hash = 14695981039346656037ULL;
+    auto hashString = [&hash](const QString &str) {
+        const QChar *data = str.constData();
+        for (int i = 0; i < str.size(); ++i)
+            hash = (hash ^ data[i].unicode()) * 1099511628211ULL;
+    };
+
+    hashString(baseUrl);
+    hash = (hash ^ static_cast<quint64>(' ')) * 1099511628211ULL;
+    hashString(requestUrl);
+    hash ^= static_cast<quint64>(typeMask) * 0x9E3779B97F4A7C15ULL;
+
+    // Mix the bits so the shard index and hashmap buckets are evenly distributed
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool VerdictCache::find(quint64 key, const QString &baseUrl, const QString &requestUrl, ElementType typeMask, quint64 generation,
+                        Verdict &verdict)
+{
+    Shard &shard = getShard(key);
+    {
+        std::lock_guard<std::mutex> _(shard.Mutex);
+        if (shard.Entries.has(key))
+        {
+            // The key may be shared by another request, whose verdict must not be applied to this one
+            const Entry &entry = shard.Entries.get(key);
+            if (entry.RequestVerdict.Generation == generation
+                    && entry.Type == typeMask
+                    && entry.RequestUrl == requestUrl
+                    && entry.BaseUrl == baseUrl)
+            {
+                verdict = entry.RequestVerdict;
+                m_hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void VerdictCache::insert(quint64 key, const QString &baseUrl, const QString &requestUrl, ElementType typeMask, const Verdict &verdict)
+{
+    Shard &shard = getShard(key);
+
+    std::lock_guard<std::mutex> _(shard.Mutex);
+    const bool isEvicting = shard.Entries.size() >= m_shardCapacity && !shard.Entries.has(key);
+    shard.Entries.put(key, Entry{ verdict, baseUrl, requestUrl, typeMask });
+
+    if (isEvicting)
+        m_evictions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void VerdictCache::clear()
+{
+    for (std::unique_ptr<Shard> &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> _(shard->Mutex);
+        shard->Entries.clear();
+    }
+}
+
+quint64 VerdictCache::getHitCount() const
+{
+    return m_hits.load(std::memory_order_relaxed);
+}
+
+quint64 VerdictCache::getMissCount() const
+{
+    return m_misses.load(std::memory_order_relaxed);
+}
+
+quint64 VerdictCache::getEvictionCount() const
+{
+    return m_evictions.load(std::memory_order_relaxed);
+}
+
+VerdictCache::Shard &VerdictCache::getShard(quint64 key)
+{
+    return *m_shards[static_cast<std::size_t>(key >> 60) % NumShards];
+}
+
+}
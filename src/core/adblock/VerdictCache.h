@@ -0,0 +1,130 @@
+#ifndef VERDICTCACHE_H
+#define VERDICTCACHE_H
+
+#include "AdBlockFilter.h"
+#include "AdBlockLog.h"
+#include "LRUCache.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include <QString>
+
+namespace adblock
+{
+
+/// The outcome of matching a network request against the filters of a \ref FilterContainer
+struct Verdict
+{
+    /// Action applied to the request. Ignored if no filter matched the request
+    FilterAction Action;
+
+    /// Filter that determined the action, or a nullptr if the request did not match any blocking filter
+    Filter *MatchedFilter;
+
+    /// Generation of the filter container that produced the verdict
+    quint64 Generation;
+};
+
+/**
+ * @class VerdictCache
+ * @ingroup AdBlock
+ * @brief A bounded cache of recent request verdicts, keyed by a hash of the first-party host, the
+ *        request URL and its element type. The cache is split into shards with their own locks, so
+ *        requests from different threads rarely contend with each other.
+ *
+ * Each verdict is stored along with the request it was made for, and is only returned for that same
+ * request. Requests whose keys collide replace each other's verdicts rather than share them.
+ *
+ * Verdicts refer to filters owned by the filter container that produced them, and are only returned
+ * for lookups made with the same container generation.
+ */
+class VerdictCache
+{
+public:
+    /// Constructs the verdict cache, with the given maximum number of entries in each shard
+    explicit VerdictCache(std::size_t shardCapacity = 256);
+
+    /// Returns the key of the request with the given first-party host, URL and element type
+    static quint64 getKey(const QString &baseUrl, const QString &requestUrl, ElementType typeMask);
+
+    /// Searches the cache for a verdict on the request with the given key, first-party host, URL and element type,
+    /// that was made by the filter container of the given generation. Returns true and sets the verdict if found,
+    /// false if else
+    bool find(quint64 key, const QString &baseUrl, const QString &requestUrl, ElementType typeMask, quint64 generation,
+              Verdict &verdict);
+
+    /// Stores the verdict of the request with the given key, first-party host, URL and element type
+    void insert(quint64 key, const QString &baseUrl, const QString &requestUrl, ElementType typeMask, const Verdict &verdict);
+
+    /// Removes all verdicts from the cache
+    void clear();
+
+    /// Returns the number of lookups that found a verdict
+    quint64 getHitCount() const;
+
+    /// Returns the number of lookups that did not find a verdict, including those that found an outdated verdict
+    quint64 getMissCount() const;
+
+    /// Returns the number of verdicts that were removed to make room for newer verdicts
+    quint64 getEvictionCount() const;
+
+    /// Number of shards in the cache
+    static constexpr std::size_t NumShards = 16;
+
+private:
+    /// A cached verdict, along with the request that it was made for
+    struct Entry
+    {
+        /// Verdict on the request
+        Verdict RequestVerdict;
+
+        /// First-party host of the request
+        QString BaseUrl;
+
+        /// URL of the request
+        QString RequestUrl;
+
+        /// Element type of the request
+        ElementType Type;
+    };
+
+    /// A portion of the cache, containing the verdicts of keys that map to the shard
+    struct Shard
+    {
+        /// Constructs the shard with the given capacity
+        explicit Shard(std::size_t capacity) : Mutex(), Entries(capacity) {}
+
+        /// Guards the entries of the shard
+        std::mutex Mutex;
+
+        /// Most recently used verdicts
+        LRUCache<quint64, Entry> Entries;
+    };
+
+    /// Returns the shard that the given key belongs to
+    Shard &getShard(quint64 key);
+
+private:
+    /// Maximum number of verdicts in each shard
+    std::size_t m_shardCapacity;
+
+    /// Shards of the cache
+    std::array<std::unique_ptr<Shard>, NumShards> m_shards;
+
+    /// Number of lookups that found a verdict
+    std::atomic<quint64> m_hits;
+
+    /// Number of lookups that did not find a verdict
+    std::atomic<quint64> m_misses;
+
+    /// Number of verdicts that were evicted from the cache
+    std::atomic<quint64> m_evictions;
+};
+
+}
+
+#endif // VERDICTCACHE_H
@@ -123,6 +123,7 @@ BrowserApplication::BrowserApplication(BrowserIPC *ipc, int &argc, char **argv)
 
     m_downloadMgr->setNetworkAccessManager(m_networkAccessMgr);
     m_faviconMgr->setNetworkAccessManager(m_networkAccessMgr);
+    m_adBlockManager->setNetworkAccessManager(m_networkAccessMgr);
 
     // Setup user agent manager before settings
     m_userAgentMgr = new UserAgentManager(m_settings);
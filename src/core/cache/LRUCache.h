@@ -65,6 +65,12 @@ class LRUCache
         }
     }
 
+    /// Returns the number of key-value pairs in the cache
+    size_t size() const
+    {
+        return m_list.size();
+    }
+
     /// Clears the cache
     void clear()
     {
@@ -18,10 +18,19 @@ HistoryManager::HistoryManager(const ViperServiceLocator &serviceLocator, Databa
     m_recentItems(),
     m_storagePolicy(HistoryStoragePolicy::Remember),
     m_historyStore(nullptr),
-    m_lastVisitId(0)
+    m_lastVisitId(0),
+    m_visitFlushTimer(),
+    m_isStoreLoaded(false)
 {
     setObjectName(QLatin1String("HistoryManager"));
 
+    // Visits are written in batches, at most one flush interval after the first visit of the batch was added
+    m_visitFlushTimer.setSingleShot(true);
+    m_visitFlushTimer.setInterval(static_cast<int>(HistoryStore::VisitFlushInterval));
+    connect(&m_visitFlushTimer, &QTimer::timeout, this, [this](){
+        m_taskScheduler.post(&HistoryStore::flushVisits, std::ref(m_historyStore));
+    });
+
     if (Settings *settings = serviceLocator.getServiceAs<Settings>("Settings"))
     {
         m_storagePolicy = static_cast<HistoryStoragePolicy>(settings->getValue(BrowserSetting::HistoryStoragePolicy).toInt());
@@ -33,6 +42,7 @@ HistoryManager::HistoryManager(const ViperServiceLocator &serviceLocator, Databa
 
     m_taskScheduler.onInit([this](){
         m_historyStore = static_cast<HistoryStore*>(m_taskScheduler.getWorker("HistoryStore"));
+        m_isStoreLoaded.store(m_historyStore != nullptr, std::memory_order_release);
     });
 
     m_taskScheduler.post([this](){
@@ -118,6 +128,9 @@ void HistoryManager::addVisit(const QUrl &url, const QString &title, const QDate
     m_taskScheduler.post(&HistoryStore::addVisit, std::ref(m_historyStore), QUrl(url), QString(title),
                          QDateTime(visitTime), QUrl(requestedUrl), wasTypedByUser);
 
+    if (!m_visitFlushTimer.isActive())
+        m_visitFlushTimer.start();
+
     if (!CommonUtil::doUrlsMatch(requestedUrl, url))
     {
         QDateTime visit = visitTime.addSecs(-1);
@@ -164,6 +177,14 @@ void HistoryManager::addVisitToLocalStore(const QUrl &url, const QString &title,
     }
 }
 
+std::vector<HistoryEntry> HistoryManager::getPendingEntries() const
+{
+    if (!m_isStoreLoaded.load(std::memory_order_acquire))
+        return {};
+
+    return m_historyStore->getPendingEntries();
+}
+
 void HistoryManager::getHistoryBetween(const QDateTime &startDate, const QDateTime &endDate, std::function<void(std::vector<URLRecord>)> callback)
 {
     m_taskScheduler.post([this, startDate, endDate, callback](){
@@ -243,17 +264,3 @@ void HistoryManager::loadMostVisitedEntries(int limit, std::function<void(std::v
         callback(m_historyStore->loadMostVisitedEntries(limit));
     });
 }
-
-void HistoryManager::loadWordDatabase(std::function<void(std::map<int, QString>)> callback)
-{
-    m_taskScheduler.post([this, callback](){
-        callback(m_historyStore->getWords());
-    });
-}
-
-void HistoryManager::loadHistoryWordMapping(std::function<void(std::map<int, std::vector<int>>)> callback)
-{
-    m_taskScheduler.post([this, callback](){
-        callback(m_historyStore->getEntryWordMapping());
-    });
-}
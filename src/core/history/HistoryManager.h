@@ -14,8 +14,10 @@
 #include <QIcon>
 #include <QList>
 #include <QMetaType>
+#include <QTimer>
 #include <QUrl>
 
+#include <atomic>
 #include <deque>
 #include <unordered_map>
 #include <vector>
@@ -69,6 +71,11 @@ class HistoryManager : public QObject, public ISettingsObserver
     /// Adds an entry to the history data store, given the URL, page title, time of visit, and the requested URL
     void addVisit(const QUrl &url, const QString &title, const QDateTime &visitTime, const QUrl &requestedUrl, bool wasTypedByUser);
 
+    /// Returns the entries of the visits that the \ref HistoryStore is holding in memory, which readers with their own
+    /// connection to the history database do not see yet. May be called from any thread, and does not wait for the
+    /// task scheduler
+    std::vector<HistoryEntry> getPendingEntries() const;
+
     /// Loads a list of all \ref URLRecord visited between the given start date and end dates, passing them on to
     /// the callback once the data has been fetched
     void getHistoryBetween(const QDateTime &startDate, const QDateTime &endDate, std::function<void(std::vector<URLRecord>)> callback);
@@ -102,13 +109,6 @@ class HistoryManager : public QObject, public ISettingsObserver
     /// determine which web pages' thumbnails to retrieve for the "New Tab" page
     void loadMostVisitedEntries(int limit, std::function<void(std::vector<WebPageInformation>)> callback);
 
-    /// Loads the word table into a map, returning the data in the callback function. Used by the
-    /// URL suggestion worker when recommending matches based on user input
-    void loadWordDatabase(std::function<void(std::map<int, QString>)> callback);
-
-    /// Loads a mapping of history entries to the lists of their corresponding words
-    void loadHistoryWordMapping(std::function<void(std::map<int, std::vector<int>>)> callback);
-
 Q_SIGNALS:
     /// Emitted when a page has been visited
     void pageVisited(const QUrl &url, const QString &title);
@@ -148,6 +148,13 @@ private Q_SLOTS:
 
     /// Unique id of the most recent entry in the database
     uint64_t m_lastVisitId;
+
+    /// Started by the first visit after a flush. Once it times out, the visits that the \ref HistoryStore
+    /// is holding in memory are written to the database
+    QTimer m_visitFlushTimer;
+
+    /// Set once the \ref HistoryStore has been loaded, making it safe to read its waiting visits from other threads
+    std::atomic_bool m_isStoreLoaded;
 };
 
 #endif // HISTORYMANAGER_H
@@ -1,30 +1,59 @@
 #include "CommonUtil.h"
 #include "HistoryStore.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
 #include <QDateTime>
 #include <QUrl>
 #include <QDebug>
 
+/// Weight of a visit to a URL that the user typed into the URL bar, relative to the weight of any other visit
+static constexpr double typedVisitWeight = 2.0;
+
+/// Frecency score of an entry without any visits
+static constexpr double noFrecency = -std::numeric_limits<double>::infinity();
+
+/// Adds a visit of the given weight, made at the given time (in milliseconds since the epoch), to the frecency score of an entry
+static double addVisitToFrecency(double frecency, qint64 visitTime, double weight)
+{
+    // The score is the base 2 logarithm of the sum of the visit weights, each doubled for every half-life between the
+    // epoch and the visit. Adding to it in the logarithmic domain keeps the sum from overflowing
+    const double visitScore = static_cast<double>(visitTime) / HistoryStore::FrecencyHalfLife + std::log2(weight);
+    if (std::isinf(frecency))
+        return visitScore;
+
+    const double highScore = std::max(frecency, visitScore);
+    return highScore + std::log2(std::exp2(frecency - highScore) + std::exp2(visitScore - highScore));
+}
+
 HistoryStore::HistoryStore(const QString &databaseFile) :
     DatabaseWorker(databaseFile),
     m_lastVisitID(0),
-    m_statements()
+    m_statements(),
+    m_pendingVisits(),
+    m_pendingLock()
 {
     m_database.execute("PRAGMA foreign_keys=\"0\"");
 }
 
 HistoryStore::~HistoryStore()
 {
+    // The worker thread has stopped by now, so this is the last chance to write the waiting visits
+    flushVisits();
+
     m_statements.clear();
 }
 
 void HistoryStore::clearAllHistory()
 {
-    if (!exec(QLatin1String("DELETE FROM URLWords")))
-        qWarning() << "In HistoryStore::clearAllHistory - Unable to clear History Word Mapping table.";
-
-    if (!exec(QLatin1String("DELETE FROM Words")))
-        qWarning() << "In HistoryStore::clearAllHistory - Unable to clear History Word table.";
+    // Waiting visits would be removed along with the rest of the history, so they are not written at all
+    {
+        std::lock_guard<std::mutex> lock(m_pendingLock);
+        m_pendingVisits.clear();
+    }
 
     if (!exec(QLatin1String("DELETE FROM History")))
         qWarning() << "In HistoryStore::clearAllHistory - Unable to clear History table.";
@@ -35,29 +64,24 @@ void HistoryStore::clearAllHistory()
 
 void HistoryStore::clearHistoryFrom(const QDateTime &start)
 {
-    auto stmt = m_database.prepare(R"(DELETE FROM Visits WHERE Date >= ?)");
-    stmt << start;
-    if (!stmt.execute())
-        qWarning() << "In HistoryStore::clearHistoryFrom - Unable to clear history.";
+    flushVisits();
 
-    if (!m_database.execute("DELETE FROM History WHERE VisitID NOT IN (SELECT DISTINCT VisitID FROM Visits)"))
+    if (!removeVisitsBetween(start.toMSecsSinceEpoch(), std::numeric_limits<qint64>::max()))
         qWarning() << "In HistoryStore::clearHistoryFrom - Unable to clear history.";
 }
 
 void HistoryStore::clearHistoryInRange(std::pair<QDateTime, QDateTime> range)
 {
-    auto stmt = m_database.prepare(R"(DELETE FROM Visits WHERE Date >= ? AND Date <= ?)");
-    stmt << range.first
-         << range.second;
-    if (!stmt.execute())
-        qWarning() << "In HistoryStore::clearHistoryInRange - Unable to clear history.";
+    flushVisits();
 
-    if (!m_database.execute("DELETE FROM History WHERE VisitID NOT IN (SELECT DISTINCT VisitID FROM Visits)"))
-        qWarning() << "In HistoryStore::clearHistoryInRange - Unable to clear history. ";
+    if (!removeVisitsBetween(range.first.toMSecsSinceEpoch(), range.second.toMSecsSinceEpoch()))
+        qWarning() << "In HistoryStore::clearHistoryInRange - Unable to clear history.";
 }
 
-bool HistoryStore::contains(const QUrl &url) const
+bool HistoryStore::contains(const QUrl &url)
 {
+    flushVisits();
+
     auto stmt = m_database.prepare(R"(SELECT VisitID FROM History WHERE URL = ?)");
     stmt << url;
     return stmt.next();
@@ -65,6 +89,8 @@ bool HistoryStore::contains(const QUrl &url) const
 
 HistoryEntry HistoryStore::getEntry(const QUrl &url)
 {
+    flushVisits();
+
     HistoryEntry result;
     result.URL = url;
     result.VisitID = -1;
@@ -80,6 +106,8 @@ HistoryEntry HistoryStore::getEntry(const QUrl &url)
 
 std::vector<VisitEntry> HistoryStore::getVisits(const HistoryEntry &record)
 {
+    flushVisits();
+
     std::vector<VisitEntry> result;
 
     auto stmt = m_database.prepare(R"(SELECT Date FROM Visits WHERE VisitID = ? ORDER BY Date ASC)");
@@ -96,12 +124,13 @@ std::vector<VisitEntry> HistoryStore::getVisits(const HistoryEntry &record)
 
 std::deque<HistoryEntry> HistoryStore::getRecentItems()
 {
+    flushVisits();
+
     std::deque<HistoryEntry> result;
 
-    auto stmt = m_database.prepare(R"(SELECT Visits.VisitID, History.URL, History.Title,
-     History.URLTypedCount, 1, Visits.Date FROM Visits
-     INNER JOIN History ON Visits.VisitID = History.VisitID
-     ORDER BY Visits.Date DESC LIMIT 15;)");
+    // Read through the index on the last visit time, rather than sorting every visit
+    auto stmt = m_database.prepare(R"(SELECT VisitID, URL, Title, URLTypedCount, VisitCount, LastVisit FROM History
+     ORDER BY LastVisit DESC LIMIT 15;)");
 
     while (stmt.next())
     {
@@ -113,13 +142,15 @@ std::deque<HistoryEntry> HistoryStore::getRecentItems()
     return result;
 }
 
-std::vector<URLRecord> HistoryStore::getHistoryFrom(const QDateTime &startDate) const
+std::vector<URLRecord> HistoryStore::getHistoryFrom(const QDateTime &startDate)
 {
     return getHistoryBetween(startDate, QDateTime::currentDateTime());
 }
 
-std::vector<URLRecord> HistoryStore::getHistoryBetween(const QDateTime &startDate, const QDateTime &endDate) const
+std::vector<URLRecord> HistoryStore::getHistoryBetween(const QDateTime &startDate, const QDateTime &endDate)
 {
+    flushVisits();
+
     std::vector<URLRecord> result;
 
     if (!startDate.isValid() || !endDate.isValid())
@@ -169,11 +200,11 @@ std::vector<URLRecord> HistoryStore::getHistoryBetween(const QDateTime &startDat
     return result;
 }
 
-int HistoryStore::getTimesVisitedHost(const QUrl &url) const
+int HistoryStore::getTimesVisitedHost(const QUrl &url)
 {
-    auto query = m_database.prepare(R"(SELECT COUNT(NumVisits) FROM (SELECT VisitID, COUNT(VisitID) AS NumVisits
-                                    FROM Visits GROUP BY VisitID ) WHERE VisitID IN (SELECT VisitID FROM History
-                                    WHERE URL LIKE ?))");
+    flushVisits();
+
+    auto query = m_database.prepare(R"(SELECT COUNT(VisitID) FROM History WHERE URL LIKE ? AND VisitCount > 0)");
     std::string param = QString("%%1%").arg(url.host().remove(QRegularExpression("^www\\.")).toLower()).toStdString();
     query << param;
     if (query.next())
@@ -186,121 +217,155 @@ int HistoryStore::getTimesVisitedHost(const QUrl &url) const
     return 0;
 }
 
-int HistoryStore::getTimesVisited(const QUrl &url) const
+int HistoryStore::getTimesVisited(const QUrl &url)
 {
-    auto query = m_database.prepare(R"(SELECT h.VisitID, v.NumVisits FROM History AS h
-                                    INNER JOIN (SELECT VisitID, COUNT(VisitID) AS NumVisits
-                                    FROM Visits GROUP BY VisitID) AS v
-                                    ON h.VisitID = v.VisitID WHERE h.URL = ?)");
+    flushVisits();
+
+    auto query = m_database.prepare(R"(SELECT VisitCount FROM History WHERE URL = ?)");
     query << url;
     if (query.next())
     {
-        int visitId = 0,
-            numVisits = 0;
-        query >> visitId
-              >> numVisits;
+        int numVisits = 0;
+        query >> numVisits;
         return numVisits;
     }
 
     return 0;
 }
 
-std::map<int, QString> HistoryStore::getWords() const
+void HistoryStore::addVisit(const QUrl &url, const QString &title, const QDateTime &visitTime, const QUrl &requestedUrl, bool wasTypedByUser)
 {
-    std::map<int, QString> result;
-
-    auto stmt = m_database.prepare(R"(SELECT WordID, Word FROM Words ORDER BY WordID ASC)");
-    if (stmt.execute())
     {
-        while (stmt.next())
-        {
-            int wordId = 0;
-            QString word;
-
-            stmt >> wordId
-                 >> word;
-            result.insert(std::make_pair(wordId, word));
-        }
+        std::lock_guard<std::mutex> lock(m_pendingLock);
+        m_pendingVisits.push_back(PendingVisit{ url, title, visitTime, requestedUrl, wasTypedByUser });
     }
 
-    return result;
+    if (m_pendingVisits.size() >= MaxPendingVisits)
+        flushVisits();
 }
 
-std::map<int, std::vector<int>> HistoryStore::getEntryWordMapping() const
+void HistoryStore::flushVisits()
 {
-    std::map<int, std::vector<int>> result;
+    // Only this thread modifies the waiting visits, so they are read without the lock. They stay in the list
+    // until they are committed, so that readers of the waiting visits do not miss them while they are written
+    if (m_pendingVisits.empty())
+        return;
 
-    auto queryDistinctHistoryId = m_database.prepare(R"(SELECT DISTINCT(HistoryID) FROM URLWords ORDER BY HistoryID ASC)");
-    auto queryHistoryWordMapping =
-            m_database.prepare(R"(SELECT WordID FROM URLWords WHERE HistoryID = ?)");
+    // The whole batch is committed at once. Each visit is saved within its own savepoint, so that a visit
+    // which cannot be saved is undone on its own, along with the changes it made to the aggregates of its entry
+    if (!m_database.beginTransaction())
+    {
+        qWarning() << "HistoryStore::flushVisits - could not begin transaction.";
+        return;
+    }
 
-    while (queryDistinctHistoryId.next())
+    for (const PendingVisit &visit : m_pendingVisits)
     {
-        int historyId = 0;
-        queryDistinctHistoryId >> historyId;
-        //queryDistinctHistoryId.value(0).toInt();
-
-        std::vector<int> wordIds;
-        queryHistoryWordMapping.reset();
-        queryHistoryWordMapping << historyId;
-        while (queryHistoryWordMapping.next())
+        m_database.execute("SAVEPOINT PendingVisit");
+
+        if (saveVisit(visit.URL, visit.Title, visit.VisitTime, visit.RequestedURL, visit.WasTypedByUser))
+        {
+            m_database.execute("RELEASE PendingVisit");
+        }
+        else
         {
-            int wordId = 0;
-            queryHistoryWordMapping >> wordId;
-            wordIds.push_back(wordId);
+            qWarning() << "HistoryStore::flushVisits - could not save visit to database.";
+            m_database.execute("ROLLBACK TO PendingVisit");
+            m_database.execute("RELEASE PendingVisit");
         }
+    }
 
-        if (!wordIds.empty())
-            result.insert(std::make_pair(historyId, wordIds));
+    // If the batch cannot be committed, its visits are kept and written by the next flush
+    if (!m_database.commitTransaction())
+    {
+        qWarning() << "HistoryStore::flushVisits - could not commit visits to database, they will be written with the next batch.";
+        m_database.rollbackTransaction();
+        return;
     }
 
-    return result;
+    std::lock_guard<std::mutex> lock(m_pendingLock);
+    m_pendingVisits.clear();
 }
 
-void HistoryStore::addVisit(const QUrl &url, const QString &title, const QDateTime &visitTime, const QUrl &requestedUrl, bool wasTypedByUser)
+std::vector<HistoryEntry> HistoryStore::getPendingEntries() const
 {
-    auto existingEntry = getEntry(url);
-    qulonglong visitId = existingEntry.VisitID >= 0 ? static_cast<qulonglong>(existingEntry.VisitID) : ++m_lastVisitID;
-    if (existingEntry.VisitID >= 0)
+    std::vector<HistoryEntry> result;
+
+    std::lock_guard<std::mutex> lock(m_pendingLock);
+    for (const PendingVisit &visit : m_pendingVisits)
     {
-        if (wasTypedByUser)
-            existingEntry.URLTypedCount++;
+        auto it = std::find_if(result.begin(), result.end(), [&visit](const HistoryEntry &entry) {
+            return entry.URL == visit.URL;
+        });
 
-        existingEntry.Title = title;
+        if (it == result.end())
+        {
+            HistoryEntry entry;
+            entry.VisitID = -1;
+            entry.URL = visit.URL;
+            it = result.insert(result.end(), std::move(entry));
+        }
+
+        it->Title = visit.Title;
+        it->NumVisits++;
+        if (visit.WasTypedByUser)
+            it->URLTypedCount++;
+        if (!it->LastVisit.isValid() || it->LastVisit < visit.VisitTime)
+            it->LastVisit = visit.VisitTime;
+    }
 
-        sqlite::PreparedStatement &stmtUpdate = m_statements.at(Statement::UpdateHistoryRecord);
-        stmtUpdate.reset();
-        stmtUpdate << existingEntry;
+    return result;
+}
 
-        if (!stmtUpdate.execute())
-            qWarning() << "HistoryStore::addVisit - could not save entry to database.";
+bool HistoryStore::saveVisit(const QUrl &url, const QString &title, const QDateTime &visitTime, const QUrl &requestedUrl, bool wasTypedByUser)
+{
+    HistoryEntry entry;
+    entry.VisitID = -1;
+    double frecency = noFrecency;
+
+    sqlite::PreparedStatement &stmtEntry = m_statements.at(Statement::GetHistoryRecord);
+    stmtEntry.reset();
+    stmtEntry << url;
+    if (stmtEntry.next())
+    {
+        stmtEntry >> entry
+                  >> frecency;
     }
-    else
+
+    const bool isNewEntry = entry.VisitID < 0;
+    if (isNewEntry)
     {
-        const int urlTypedCount = wasTypedByUser ? 1 : 0;
+        entry.VisitID = static_cast<int>(++m_lastVisitID);
+        entry.URL = url;
+    }
 
-        sqlite::PreparedStatement &stmtNew = m_statements.at(Statement::CreateHistoryRecord);
-        stmtNew.reset();
+    if (wasTypedByUser)
+        entry.URLTypedCount++;
 
-        stmtNew << visitId
-                << url
-                << title
-                << urlTypedCount;
+    entry.Title = title;
+    entry.NumVisits++;
+    if (!entry.LastVisit.isValid() || entry.LastVisit < visitTime)
+        entry.LastVisit = visitTime;
+    frecency = addVisitToFrecency(frecency, visitTime.toMSecsSinceEpoch(), wasTypedByUser ? typedVisitWeight : 1.0);
 
-        if (stmtNew.execute())
-            tokenizeAndSaveUrl(static_cast<int>(visitId), url, title);
-        else
-            qWarning() << "HistoryStore::addVisit - could not save entry to database.";
-    }
+    sqlite::PreparedStatement &stmtSave = m_statements.at(isNewEntry ? Statement::CreateHistoryRecord : Statement::UpdateHistoryRecord);
+    stmtSave.reset();
+    stmtSave << entry
+             << entry.NumVisits
+             << entry.LastVisit
+             << frecency;
+    if (!stmtSave.execute())
+        return false;
 
     sqlite::PreparedStatement &stmtVisit = m_statements.at(Statement::CreateVisitRecord);
     stmtVisit.reset();
 
-    stmtVisit << visitId
-              << visitTime;
+    stmtVisit << entry.VisitID
+              << visitTime
+              << static_cast<int>(wasTypedByUser);
 
     if (!stmtVisit.execute())
-        qWarning() << "HistoryStore::addVisit - could not save visit to database.";
+        return false;
 
     if (!CommonUtil::doUrlsMatch(url, requestedUrl, true))
     {
@@ -308,8 +373,10 @@ void HistoryStore::addVisit(const QUrl &url, const QString &title, const QDateTi
         if (!requestDateTime.isValid())
             requestDateTime = visitTime;
 
-        addVisit(requestedUrl, title, requestDateTime, requestedUrl, wasTypedByUser);
+        return saveVisit(requestedUrl, title, requestDateTime, requestedUrl, wasTypedByUser);
     }
+
+    return true;
 }
 
 uint64_t HistoryStore::getLastVisitId() const
@@ -317,30 +384,6 @@ uint64_t HistoryStore::getLastVisitId() const
     return m_lastVisitID;
 }
 
-void HistoryStore::tokenizeAndSaveUrl(int visitId, const QUrl &url, const QString &title)
-{
-    QStringList urlWords = CommonUtil::tokenizePossibleUrl(url.toString().toUpper());
-
-    if (!title.startsWith(QLatin1String("http"), Qt::CaseInsensitive))
-        urlWords = urlWords + title.toUpper().split(QLatin1Char(' '), QString::SkipEmptyParts);
-
-    sqlite::PreparedStatement &stmtInsertWord = m_statements.at(Statement::CreateWordRecord);
-    sqlite::PreparedStatement &stmtAssociateWord = m_statements.at(Statement::CreateUrlWordRecord);
-
-    for (const QString &word : urlWords)
-    {
-        stmtInsertWord.reset();
-        stmtAssociateWord.reset();
-
-        stmtInsertWord << word;
-        stmtInsertWord.execute();
-
-        stmtAssociateWord << visitId
-                          << word;
-        stmtAssociateWord.execute();
-    }
-}
-
 bool HistoryStore::hasProperStructure()
 {
     // Verify existence of Visits and History tables
@@ -350,34 +393,24 @@ bool HistoryStore::hasProperStructure()
 void HistoryStore::setup()
 {
     if (!exec(QLatin1String("CREATE TABLE IF NOT EXISTS History(VisitID INTEGER PRIMARY KEY AUTOINCREMENT, URL TEXT UNIQUE NOT NULL, Title TEXT, "
-                                  "URLTypedCount INTEGER DEFAULT 0)")))
+                                  "URLTypedCount INTEGER DEFAULT 0, VisitCount INTEGER DEFAULT 0, LastVisit INTEGER DEFAULT 0, "
+                                  "Frecency REAL DEFAULT 0)")))
     {
         qWarning() << "In HistoryStore::setup - unable to create history table.";
     }
 
-    if (!exec(QLatin1String("CREATE TABLE IF NOT EXISTS Visits(VisitID INTEGER NOT NULL, Date INTEGER NOT NULL, "
+    if (!exec(QLatin1String("CREATE TABLE IF NOT EXISTS Visits(VisitID INTEGER NOT NULL, Date INTEGER NOT NULL, Typed INTEGER, "
                                   "FOREIGN KEY(VisitID) REFERENCES History(VisitID) ON DELETE CASCADE, PRIMARY KEY(VisitID, Date))")))
     {
         qWarning() << "In HistoryStore::setup - unable to create visit table.";
     }
-
-    if (!exec(QLatin1String("CREATE TABLE IF NOT EXISTS Words(WordID INTEGER PRIMARY KEY AUTOINCREMENT, Word TEXT COLLATE NOCASE UNIQUE NOT NULL)")))
-    {
-        qWarning() << "In HistoryStore::setup - unable to create words table.";
-    }
-
-    if (!exec(QLatin1String("CREATE TABLE IF NOT EXISTS URLWords(HistoryID INTEGER NOT NULL, WordID INTEGER NOT NULL, "
-                                  "FOREIGN KEY(HistoryID) REFERENCES History(VisitID) ON DELETE CASCADE, "
-                                  "FOREIGN KEY(WordID) REFERENCES Words(WordID) ON DELETE CASCADE, PRIMARY KEY(HistoryID, WordID))")))
-    {
-        qWarning() << "In HistoryStore::setup - unable to create url-word association table.";
-    }
 }
 
 void HistoryStore::load()
 {
-    purgeOldEntries();
     checkForUpdate();
+    purgeOldEntries();
+    setupSearchIndex();
 
     if (!exec(QLatin1String("CREATE INDEX IF NOT EXISTS Visit_ID_Index ON Visits(VisitID)")))
         qWarning() << "In HistoryStore::load - unable to create index on the visit ID column of the visit table.";
@@ -385,25 +418,29 @@ void HistoryStore::load()
     if (!exec(QLatin1String("CREATE INDEX IF NOT EXISTS Visit_Date_Index ON Visits(Date)")))
         qWarning() << "In HistoryStore::load - unable to create index on the date column of the visit table.";
 
-    if (!exec(QLatin1String("CREATE INDEX IF NOT EXISTS Word_Index ON Words(Word COLLATE NOCASE)")))
-        qWarning() << "In HistoryStore::load - unable to create index on the word column of the words table.";
+    // Covers the most visited entries of the new tab page, which are read from the index without touching the table
+    if (!exec(QLatin1String("CREATE INDEX IF NOT EXISTS History_VisitCount_Index ON History(VisitCount DESC, URL, Title)")))
+        qWarning() << "In HistoryStore::load - unable to create index on the visit count column of the history table.";
+
+    if (!exec(QLatin1String("CREATE INDEX IF NOT EXISTS History_Frecency_Index ON History(Frecency DESC)")))
+        qWarning() << "In HistoryStore::load - unable to create index on the frecency column of the history table.";
+
+    if (!exec(QLatin1String("CREATE INDEX IF NOT EXISTS History_LastVisit_Index ON History(LastVisit DESC)")))
+        qWarning() << "In HistoryStore::load - unable to create index on the last visit column of the history table.";
 
     // Create and cache our prepared statements
     auto cacheStatement = [this](Statement statement, const std::string &sql) {
         m_statements.insert(std::make_pair(statement, m_database.prepare(sql)));
     };
 
-    cacheStatement(Statement::CreateHistoryRecord, R"(INSERT INTO History(VisitID, URL, Title, URLTypedCount) VALUES(?, ?, ?, ?))");
-    cacheStatement(Statement::UpdateHistoryRecord, R"(INSERT OR REPLACE INTO History(VisitID, URL, Title, URLTypedCount) VALUES(?, ?, ?, ?))");
-    cacheStatement(Statement::CreateVisitRecord, R"(INSERT INTO Visits(VisitID, Date) VALUES (?, ?))");
-    cacheStatement(Statement::CreateWordRecord, R"(INSERT OR IGNORE INTO Words(Word) VALUES (?))");
-    cacheStatement(Statement::CreateUrlWordRecord, R"(INSERT OR IGNORE INTO URLWords(HistoryID, WordID) VALUES (?, (SELECT WordID FROM Words WHERE Word = ?)))");
-    cacheStatement(Statement::GetHistoryRecord, "SELECT History.VisitID, History.URL, History.Title, History.URLTypedCount, V.NumVisits, "
-                                                " V.RecentVisit FROM History INNER JOIN"
-                                                " (SELECT VisitID, MAX(Date) AS RecentVisit, COUNT(Date) AS NumVisits "
-                                                " FROM Visits GROUP BY VisitID) AS V"
-                                                " ON History.VisitID = V.VisitID "
-                                                " WHERE History.URL = ?");
+    // Entries are updated in place rather than replaced, so that the triggers of the search index see the change as an update
+    cacheStatement(Statement::CreateHistoryRecord, R"(INSERT INTO History(VisitID, URL, Title, URLTypedCount, VisitCount, LastVisit, Frecency)
+                                                   VALUES(?, ?, ?, ?, ?, ?, ?))");
+    cacheStatement(Statement::UpdateHistoryRecord, R"(UPDATE History SET URL = ?2, Title = ?3, URLTypedCount = ?4, VisitCount = ?5,
+                                                   LastVisit = ?6, Frecency = ?7 WHERE VisitID = ?1)");
+    cacheStatement(Statement::CreateVisitRecord, R"(INSERT INTO Visits(VisitID, Date, Typed) VALUES (?, ?, ?))");
+    cacheStatement(Statement::GetHistoryRecord, R"(SELECT VisitID, URL, Title, URLTypedCount, VisitCount, LastVisit, Frecency
+                                                FROM History WHERE URL = ?)");
 
     // Clear history entries that are not referenced by any specific visits
     if (!m_database.execute("DELETE FROM History WHERE VisitID NOT IN (SELECT DISTINCT VisitID FROM Visits)"))
@@ -416,13 +453,31 @@ void HistoryStore::load()
 
 void HistoryStore::checkForUpdate()
 {
+    // Visits recorded by earlier versions do not say whether they were typed, and are left with a null Typed column
+    bool hasTypedColumn = false;
+    auto stmtVisits = m_database.prepare(R"(PRAGMA table_info(Visits))");
+    while (stmtVisits.next())
+    {
+        int cid = 0;
+        QString colName;
+
+        stmtVisits >> cid
+                   >> colName;
+
+        if (colName.compare(QLatin1String("Typed")) == 0)
+            hasTypedColumn = true;
+    }
+
+    if (!hasTypedColumn && !exec(QLatin1String("ALTER TABLE Visits ADD Typed INTEGER")))
+        qDebug() << "Error updating visit table with typed column";
+
     // Check if table structure needs update before loading
     auto stmt = m_database.prepare(R"(PRAGMA table_info(History))");
     if (!stmt.execute())
         return;
 
-    bool hasUrlTypeCountColumn = false;
-    const QString urlTypeCountColumn("URLTypedCount");
+    bool hasUrlTypeCountColumn = false, hasVisitAggregateColumns = false;
+    const QString urlTypeCountColumn("URLTypedCount"), visitCountColumn("VisitCount");
 
     while (stmt.next())
     {
@@ -433,10 +488,9 @@ void HistoryStore::checkForUpdate()
              >> colName;
 
         if (colName.compare(urlTypeCountColumn) == 0)
-        {
             hasUrlTypeCountColumn = true;
-            break;
-        }
+        else if (colName.compare(visitCountColumn) == 0)
+            hasVisitAggregateColumns = true;
     }
 
     if (!hasUrlTypeCountColumn)
@@ -444,39 +498,238 @@ void HistoryStore::checkForUpdate()
         if (!exec(QLatin1String("ALTER TABLE History ADD URLTypedCount INTEGER DEFAULT 0")))
             qDebug() << "Error updating history table with url typed count column";
     }
+
+    // Returns the IDs of the history entries selected by the given query
+    auto getVisitIds = [this](const char *sql) {
+        std::vector<int> visitIds;
+        auto query = m_database.prepare(sql);
+        while (query.next())
+        {
+            int visitId = 0;
+            query >> visitId;
+            visitIds.push_back(visitId);
+        }
+        return visitIds;
+    };
+
+    // Add the visit aggregate columns and compute them from the existing visits in a single transaction. If the
+    // migration fails or is interrupted, the table is left without the columns and is migrated on the next load
+    if (!hasVisitAggregateColumns)
+    {
+        m_database.beginTransaction();
+
+        if (!exec(QLatin1String("ALTER TABLE History ADD VisitCount INTEGER DEFAULT 0"))
+                || !exec(QLatin1String("ALTER TABLE History ADD LastVisit INTEGER DEFAULT 0"))
+                || !exec(QLatin1String("ALTER TABLE History ADD Frecency REAL DEFAULT 0")))
+        {
+            qDebug() << "Error updating history table with visit aggregate columns";
+            m_database.rollbackTransaction();
+            return;
+        }
+
+        if (!refreshVisitAggregates(getVisitIds("SELECT VisitID FROM History")) || !m_database.commitTransaction())
+        {
+            qDebug() << "Error computing the visit aggregates of the history table";
+            m_database.rollbackTransaction();
+        }
+        return;
+    }
+
+    // Earlier versions added the columns outside of the transaction that computed their values, so an interrupted
+    // migration could leave entries with visits but no aggregates. Compute them again for any such entry
+    const std::vector<int> visitIds =
+            getVisitIds("SELECT VisitID FROM History WHERE VisitCount = 0 AND VisitID IN (SELECT VisitID FROM Visits)");
+    if (!visitIds.empty())
+    {
+        m_database.beginTransaction();
+        if (refreshVisitAggregates(visitIds))
+            m_database.commitTransaction();
+        else
+            m_database.rollbackTransaction();
+    }
+}
+
+void HistoryStore::setupSearchIndex()
+{
+    // The word tables of older versions are no longer read or written, whether or not the full-text index can be created
+    if (!exec(QLatin1String("DROP TABLE IF EXISTS URLWords")) || !exec(QLatin1String("DROP TABLE IF EXISTS Words")))
+        qWarning() << "In HistoryStore::setupSearchIndex - unable to remove the word tables.";
+
+    if (hasTable(QLatin1String("HistorySearch")))
+        return;
+
+    // The index refers to the rows of the History table instead of storing its own copy of the text. The trigram
+    // tokenizer indexes every three character sequence, so that a search term can match any part of a URL or title
+    m_database.beginTransaction();
+
+    if (!exec(QLatin1String("CREATE VIRTUAL TABLE HistorySearch USING fts5(URL, Title, content='History', "
+                            "content_rowid='VisitID', tokenize='trigram')")))
+    {
+        qWarning() << "In HistoryStore::setupSearchIndex - unable to create the full-text search table. SQLite 3.34 or "
+                      "later, with FTS5, is required for history search. URL suggestions will scan the history table instead.";
+        m_database.rollbackTransaction();
+        return;
+    }
+
+    const bool createdTriggers =
+            exec(QLatin1String("CREATE TRIGGER IF NOT EXISTS HistorySearch_Insert AFTER INSERT ON History BEGIN "
+                               "INSERT INTO HistorySearch(rowid, URL, Title) VALUES (new.VisitID, new.URL, new.Title); END"))
+            && exec(QLatin1String("CREATE TRIGGER IF NOT EXISTS HistorySearch_Delete AFTER DELETE ON History BEGIN "
+                                  "INSERT INTO HistorySearch(HistorySearch, rowid, URL, Title) "
+                                  "VALUES ('delete', old.VisitID, old.URL, old.Title); END"))
+            && exec(QLatin1String("CREATE TRIGGER IF NOT EXISTS HistorySearch_Update AFTER UPDATE OF URL, Title ON History "
+                                  "WHEN old.URL IS NOT new.URL OR old.Title IS NOT new.Title BEGIN "
+                                  "INSERT INTO HistorySearch(HistorySearch, rowid, URL, Title) "
+                                  "VALUES ('delete', old.VisitID, old.URL, old.Title); "
+                                  "INSERT INTO HistorySearch(rowid, URL, Title) VALUES (new.VisitID, new.URL, new.Title); END"));
+    if (!createdTriggers)
+    {
+        qWarning() << "In HistoryStore::setupSearchIndex - unable to create the triggers of the full-text search table.";
+        m_database.rollbackTransaction();
+        return;
+    }
+
+    // Index the existing entries
+    if (!exec(QLatin1String("INSERT INTO HistorySearch(HistorySearch) VALUES ('rebuild')")))
+    {
+        qWarning() << "In HistoryStore::setupSearchIndex - unable to index the existing history entries.";
+        m_database.rollbackTransaction();
+        return;
+    }
+
+    m_database.commitTransaction();
 }
 
 void HistoryStore::purgeOldEntries()
 {
     // Clear visits that are 4+ months old
-    quint64 purgeDate = static_cast<quint64>(QDateTime::currentMSecsSinceEpoch());
-    const quint64 tmp = quint64{10368000000};
+    qint64 purgeDate = QDateTime::currentMSecsSinceEpoch();
+    const qint64 tmp = qint64{10368000000};
     if (purgeDate > tmp)
     {
         purgeDate -= tmp;
 
-        auto stmt = m_database.prepare(R"(DELETE FROM Visits WHERE Date < ?)");
-        stmt << purgeDate;
-        if (!stmt.execute())
+        if (!removeVisitsBetween(0, purgeDate - 1))
         {
             qWarning() << "HistoryStore - Could not purge old history entries.";
         }
     }
 }
 
+bool HistoryStore::removeVisitsBetween(qint64 start, qint64 end)
+{
+    if (!m_database.beginTransaction())
+        return false;
+
+    // Find the entries that the visits belong to before removing them, so that only their aggregates are computed again
+    std::vector<int> visitIds;
+    auto queryVisitIds = m_database.prepare(R"(SELECT DISTINCT VisitID FROM Visits WHERE Date >= ? AND Date <= ?)");
+    queryVisitIds << start
+                  << end;
+    while (queryVisitIds.next())
+    {
+        int visitId = 0;
+        queryVisitIds >> visitId;
+        visitIds.push_back(visitId);
+    }
+
+    auto stmt = m_database.prepare(R"(DELETE FROM Visits WHERE Date >= ? AND Date <= ?)");
+    stmt << start
+         << end;
+    if (!stmt.execute() || !refreshVisitAggregates(visitIds))
+    {
+        m_database.rollbackTransaction();
+        return false;
+    }
+
+    return m_database.commitTransaction();
+}
+
+bool HistoryStore::refreshVisitAggregates(const std::vector<int> &visitIds)
+{
+    auto queryVisits = m_database.prepare(R"(SELECT Date, IFNULL(Typed, -1) FROM Visits WHERE VisitID = ?)");
+    auto queryTypedCount = m_database.prepare(R"(SELECT URLTypedCount FROM History WHERE VisitID = ?)");
+    auto updateEntry = m_database.prepare(R"(UPDATE History SET VisitCount = ?, LastVisit = ?, Frecency = ? WHERE VisitID = ?)");
+    auto removeEntry = m_database.prepare(R"(DELETE FROM History WHERE VisitID = ?)");
+
+    std::vector<std::pair<qint64, int>> visits;
+    for (int visitId : visitIds)
+    {
+        visits.clear();
+        int numTypedVisits = 0, numUnknownVisits = 0;
+
+        queryVisits.reset();
+        queryVisits << visitId;
+        while (queryVisits.next())
+        {
+            qint64 visitTime = 0;
+            int typed = 0;
+            queryVisits >> visitTime
+                        >> typed;
+            visits.push_back({ visitTime, typed });
+
+            if (typed > 0)
+                ++numTypedVisits;
+            else if (typed < 0)
+                ++numUnknownVisits;
+        }
+
+        if (visits.empty())
+        {
+            removeEntry.reset();
+            removeEntry << visitId;
+            if (!removeEntry.execute())
+                return false;
+            continue;
+        }
+
+        // Visits recorded before the typed flag was stored are given the share of the entry's typed count
+        // that the flagged visits do not account for, so they keep the same weight as they had in saveVisit
+        double unknownVisitWeight = 1.0;
+        if (numUnknownVisits > 0)
+        {
+            int urlTypedCount = 0;
+            queryTypedCount.reset();
+            queryTypedCount << visitId;
+            if (queryTypedCount.next())
+                queryTypedCount >> urlTypedCount;
+
+            const double typedShare = static_cast<double>(std::max(urlTypedCount - numTypedVisits, 0)) / numUnknownVisits;
+            unknownVisitWeight += (typedVisitWeight - 1.0) * std::min(typedShare, 1.0);
+        }
+
+        qint64 lastVisit = 0;
+        double frecency = noFrecency;
+        for (const std::pair<qint64, int> &visit : visits)
+        {
+            const double weight = visit.second > 0 ? typedVisitWeight : (visit.second < 0 ? unknownVisitWeight : 1.0);
+            lastVisit = std::max(lastVisit, visit.first);
+            frecency = addVisitToFrecency(frecency, visit.first, weight);
+        }
+
+        updateEntry.reset();
+        updateEntry << static_cast<int>(visits.size())
+                    << lastVisit
+                    << frecency
+                    << visitId;
+        if (!updateEntry.execute())
+            return false;
+    }
+
+    return true;
+}
+
 std::vector<WebPageInformation> HistoryStore::loadMostVisitedEntries(int limit)
 {
+    flushVisits();
+
     std::vector<WebPageInformation> result;
     if (limit <= 0)
         return result;
 
     auto stmt =
-            m_database.prepare(R"(SELECT v.VisitID, COUNT(v.VisitID) AS NumVisits, h.URL, h.Title
-                               FROM Visits AS v
-                               JOIN History AS h
-                                 ON v.VisitID = h.VisitID
-                               GROUP BY v.VisitID
-                               ORDER BY NumVisits DESC LIMIT ?)");
+            m_database.prepare(R"(SELECT VisitID, VisitCount, URL, Title FROM History
+                               ORDER BY VisitCount DESC LIMIT ?)");
     stmt << limit;
     if (!stmt.execute())
     {
@@ -16,11 +16,18 @@
 
 #include <deque>
 #include <map>
+#include <mutex>
 #include <vector>
 
 /**
  * @class HistoryStore
- * @brief Maintains the state of the browsing history that belongs to a user profile
+ * @brief Maintains the state of the browsing history that belongs to a user profile.
+ *
+ * Visits are not written to the database as soon as they are added. They are held in memory and written
+ * together, in a single transaction, once enough of them are waiting or when \ref flushVisits is called.
+ * Every other method writes the waiting visits before it reads or modifies the history, so callers always
+ * see the visits they added. Readers with their own connection to the database can fetch the waiting visits
+ * from any thread through \ref getPendingEntries.
  */
 class HistoryStore : public DatabaseWorker
 {
@@ -28,15 +35,25 @@ class HistoryStore : public DatabaseWorker
 
     enum class Statement
     {
-        CreateHistoryRecord,  /// INSERT OR REPLACE INTO History(VisitID, URL, Title, URLTypedCount) VALUES(?, ?, ?, ?)
-        UpdateHistoryRecord,  /// UPDATE History SET Title = ?, URLTypedCount = ? WHERE VisitID = ?
-        CreateVisitRecord,    /// INSERT INTO Visits(VisitID, Date) VALUES (?, ?)
-        CreateWordRecord,     /// INSERT OR IGNORE INTO Words(Word) VALUES(?)
-        CreateUrlWordRecord,  /// INSERT OR IGNORE INTO URLWords(HistoryID, WordID) VALUES(?, (SELECT WordID FROM Words WHERE Word = ?))
-        GetHistoryRecord      /// SELECT History.VisitID, History.URL, History.Title, History.URLTypedCount, V.NumVisits, ...
+        CreateHistoryRecord,  /// INSERT INTO History(VisitID, URL, Title, URLTypedCount, VisitCount, LastVisit, Frecency) VALUES(?, ...)
+        UpdateHistoryRecord,  /// UPDATE History SET URL = ?2, Title = ?3, URLTypedCount = ?4, VisitCount = ?5, ... WHERE VisitID = ?1
+        CreateVisitRecord,    /// INSERT INTO Visits(VisitID, Date, Typed) VALUES (?, ?, ?)
+        GetHistoryRecord      /// SELECT VisitID, URL, Title, URLTypedCount, VisitCount, LastVisit, Frecency FROM History WHERE URL = ?
     };
 
 public:
+    /// Number of milliseconds after which the weight of a visit in the frecency score of its entry is halved.
+    /// The score stored in the Frecency column, minus the current time divided by the half-life, is the base 2
+    /// logarithm of the decayed sum of the entry's visit weights
+    static constexpr double FrecencyHalfLife = 30.0 * 24.0 * 60.0 * 60.0 * 1000.0;
+
+    /// Number of visits that may wait in memory before they are written to the database
+    static constexpr std::size_t MaxPendingVisits = 64;
+
+    /// Number of milliseconds that the first visit of a batch waits before the batch is written. Page visits are
+    /// usually several seconds apart, so the interval is long enough for a batch to hold a few of them
+    static constexpr qint64 VisitFlushInterval = 10000;
+
     /// Constructs the history manager, given the path to the history database
     explicit HistoryStore(const QString &databaseFile);
 
@@ -54,7 +71,7 @@ class HistoryStore : public DatabaseWorker
 
     /// Returns true if the history contains the given url, false if else. Will return
     /// false if private browsing mode is enabled
-    bool contains(const QUrl &url) const;
+    bool contains(const QUrl &url);
 
     /// Returns a history record corresponding to the given URL, or an empty record if it was not found in the
     /// database
@@ -63,34 +80,39 @@ class HistoryStore : public DatabaseWorker
     /// Returns the visits associated with a given \ref HistoryEntry
     std::vector<VisitEntry> getVisits(const HistoryEntry &record);
 
-    /// Returns a queue of recently visited items, with the most recent visits being at the front of the queue
+    /// Returns a queue of recently visited entries, each listed once, with the most recently visited entries being at
+    /// the front of the queue
     std::deque<HistoryEntry> getRecentItems();
 
     /// Loads and returns a list of all \ref HistoryEntry items visited from the given start date to the present
-    std::vector<URLRecord> getHistoryFrom(const QDateTime &startDate) const;
+    std::vector<URLRecord> getHistoryFrom(const QDateTime &startDate);
 
     /// Loads and returns a list of all \ref HistoryEntry items visited between the given start date and end dates
-    std::vector<URLRecord> getHistoryBetween(const QDateTime &startDate, const QDateTime &endDate) const;
+    std::vector<URLRecord> getHistoryBetween(const QDateTime &startDate, const QDateTime &endDate);
 
     /// Returns the number of times the user has visited the given website by its hostname
-    int getTimesVisitedHost(const QUrl &url) const;
+    int getTimesVisitedHost(const QUrl &url);
 
     /// Returns the number of times that the given URL has been visited
-    int getTimesVisited(const QUrl &url) const;
-
-    /// Returns all of the words stored in the words table
-    std::map<int, QString> getWords() const;
-
-    /// Returns a mapping of history entries to the list of word IDs associated with them
-    std::map<int, std::vector<int>> getEntryWordMapping() const;
+    int getTimesVisited(const QUrl &url);
 
     /// Fetches the set of most frequently visited web pages, up to the given limit. This is used to
     /// determine which web pages' thumbnails to retrieve for the "New Tab" page
     std::vector<WebPageInformation> loadMostVisitedEntries(int limit = 10);
 
-    /// Adds an entry to the history data store, given the URL, page title, time of visit, and the requested URL
+    /// Adds an entry to the history data store, given the URL, page title, time of visit, and the requested URL.
+    /// The visit is written along with the other waiting visits, once \ref MaxPendingVisits are waiting or when
+    /// the visits are flushed. The visit count, last visit time and frecency score of the entry are updated with it
     void addVisit(const QUrl &url, const QString &title, const QDateTime &visitTime, const QUrl &requestedUrl, bool wasTypedByUser);
 
+    /// Writes the visits that are waiting to be saved to the database, in a single transaction. If the transaction
+    /// cannot be committed, the visits are kept and written by the next flush
+    void flushVisits();
+
+    /// Returns an entry for each URL among the visits that are waiting to be written, holding the number of those
+    /// visits, the typed ones among them, the latest title and the time of the last visit. May be called from any thread
+    std::vector<HistoryEntry> getPendingEntries() const;
+
     /// Returns the last unique id of an entry in the visit database. This is an auto-incrementing value
     uint64_t getLastVisitId() const;
 
@@ -106,21 +128,64 @@ class HistoryStore : public DatabaseWorker
     void load() override;
 
 private:
-    /// Splits the given URL into distinct words, saving the association in the database
-    void tokenizeAndSaveUrl(int visitId, const QUrl &url, const QString &title);
-
     /// Called during the load() routine, this checks if any of the table structures need to be updated
     void checkForUpdate();
 
+    /// Creates the full-text index of the URLs and titles in the history table, along with the triggers that keep it
+    /// in sync with the table. The word tables of older versions are removed, as nothing reads them any more. If SQLite
+    /// lacks FTS5 or the trigram tokenizer, no index is created, and URL suggestions fall back to a LIKE scan of the
+    /// history table
+    void setupSearchIndex();
+
     /// Removes history items that are more than six months old
     void purgeOldEntries();
 
+    /// Saves a visit and the entry that it belongs to, along with the visit of the requested URL if it was redirected.
+    /// Must be called within a transaction. Returns false if any of the changes could not be saved
+    bool saveVisit(const QUrl &url, const QString &title, const QDateTime &visitTime, const QUrl &requestedUrl, bool wasTypedByUser);
+
+    /// Removes the visits made between the given times (in milliseconds since the epoch, inclusive) in a single transaction,
+    /// updating the visit aggregates of their entries. Returns false if the visits could not be removed
+    bool removeVisitsBetween(qint64 start, qint64 end);
+
+    /// Computes the visit count, last visit time and frecency score of the entries with the given IDs from their visits,
+    /// removing the entries that no longer have any visits. Typed visits are weighted as they are when saved, and visits
+    /// of earlier versions, which were not flagged, share the typed count of their entry. Returns false if any entry could
+    /// not be updated
+    bool refreshVisitAggregates(const std::vector<int> &visitIds);
+
 private:
+    /// A visit that has been added, but not yet written to the database
+    struct PendingVisit
+    {
+        /// URL of the visited page
+        QUrl URL;
+
+        /// Title of the page
+        QString Title;
+
+        /// Time of the visit
+        QDateTime VisitTime;
+
+        /// URL that was requested, before any redirects
+        QUrl RequestedURL;
+
+        /// True if the URL was typed by the user
+        bool WasTypedByUser;
+    };
+
     /// Stores the last visit ID that has been used to record browsing history. Auto increments for each new history item
     uint64_t m_lastVisitID;
 
     /// Cache of prepared statements
     std::map<Statement, sqlite::PreparedStatement> m_statements;
+
+    /// Visits waiting to be written to the database, in the order they were added
+    std::vector<PendingVisit> m_pendingVisits;
+
+    /// Guards the waiting visits against \ref getPendingEntries, which may be called from other threads. Only the
+    /// thread of the task scheduler modifies them
+    mutable std::mutex m_pendingLock;
 };
 
 #endif // HISTORYSTORE_H
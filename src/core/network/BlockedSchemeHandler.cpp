@@ -1,7 +1,7 @@
 #include "AdBlockManager.h"
 #include "BlockedSchemeHandler.h"
+#include "ResourceStore.h"
 
-#include <QBuffer>
 #include <QByteArray>
 #include <QUrl>
 #include <QWebEngineUrlRequestJob>
@@ -19,38 +19,25 @@ void BlockedSchemeHandler::requestStarted(QWebEngineUrlRequestJob *request)
     if (!m_adBlockManager)
         m_adBlockManager = m_serviceLocator.getServiceAs<adblock::AdBlockManager>("AdBlockManager");
 
-    QString resourceName = request->requestUrl().toString();
-    resourceName = resourceName.mid(8);
+    const QString resourceName = request->requestUrl().toString().mid(8);
 
-    QString mimeTypeStr = m_adBlockManager->getResourceContentType(resourceName);
-    const bool isB64 = mimeTypeStr.contains(QLatin1String(";base64"));
-    if (isB64)
-        mimeTypeStr = mimeTypeStr.left(mimeTypeStr.indexOf(QLatin1String(";base64")));
-
-    QByteArray mimeType;
-    mimeType.append(mimeTypeStr);
-
-    QByteArray resourceData;
-    resourceData.append(m_adBlockManager->getResource(resourceName));
-    if (isB64)
-        resourceData = QByteArray::fromBase64(resourceData);
-
-    if (resourceData.isEmpty())
+    // Resources are decoded when they are loaded, and their data is shared with the reply rather than copied
+    const adblock::Resource resource = m_adBlockManager->getDecodedResource(resourceName);
+    if (resource.Data.isEmpty())
     {
         request->fail(QWebEngineUrlRequestJob::UrlNotFound);
         return;
     }
 
-    QBuffer *buffer = new QBuffer;
-    buffer->setData(resourceData);
-    if (!buffer->open(QIODevice::ReadOnly))
+    adblock::ResourceDevice *device = new adblock::ResourceDevice(resource.Data);
+    if (!device->open(QIODevice::ReadOnly))
     {
-        delete buffer;
+        delete device;
         request->fail(QWebEngineUrlRequestJob::UrlNotFound);
         return;
     }
 
-    connect(request, &QObject::destroyed, buffer, &QBuffer::deleteLater);
+    connect(request, &QObject::destroyed, device, &QObject::deleteLater);
 
-    request->reply(mimeType, buffer);
+    request->reply(resource.MimeType, device);
 }
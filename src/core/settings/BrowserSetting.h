@@ -118,6 +118,9 @@ enum class BrowserSetting
     /// Determines whether or not the advertisement and malicious content blocking system is enabled
     AdBlockPlusEnabled,
 
+    /// Determines whether the ad block system profiles the evaluations of each filter, writing a report on exit
+    AdBlockProfilingEnabled,
+
     /// Port of the remote web inspector (for QtWebEngine versions < 5.11)
     InspectorPort,
 
@@ -38,7 +38,8 @@ Settings::Settings() :
         { BrowserSetting::FantasyFont, QLatin1String("FantasyFont") },                { BrowserSetting::FixedFont, QLatin1String("FixedFont") },
         { BrowserSetting::StandardFontSize, QLatin1String("StandardFontSize") },      { BrowserSetting::EnableAutoFill, QLatin1String("EnableAutoFill") },
         { BrowserSetting::CachePath, QLatin1String("CachePath") },                    { BrowserSetting::ThumbnailPath, QLatin1String("ThumbnailPath") },
-        { BrowserSetting::FavoritePagesFile, QLatin1String("FavoritePagesFile") },    { BrowserSetting::Version, QLatin1String("Version") }
+        { BrowserSetting::FavoritePagesFile, QLatin1String("FavoritePagesFile") },    { BrowserSetting::Version, QLatin1String("Version") },
+        { BrowserSetting::AdBlockProfilingEnabled, QLatin1String("AdBlockProfilingEnabled") }
     }
 {
     setObjectName(QLatin1String("Settings"));
@@ -134,6 +135,7 @@ void Settings::setDefaults()
     m_settings.setValue(QLatin1String("CustomUserAgent"), false);
     m_settings.setValue(QLatin1String("UserScriptsEnabled"), true);
     m_settings.setValue(QLatin1String("AdBlockPlusEnabled"), true);
+    m_settings.setValue(QLatin1String("AdBlockProfilingEnabled"), false);
 #if (QTWEBENGINECORE_VERSION < QT_VERSION_CHECK(5, 11, 0))
     m_settings.setValue(QLatin1String("InspectorPort"), 9477);
 #endif
@@ -1,6 +1,8 @@
 #include "BookmarkManager.h"
 #include "FastHash.h"
 #include "FaviconManager.h"
+#include "HistoryManager.h"
+#include "HistoryStore.h"
 #include "HistorySuggestor.h"
 #include "Settings.h"
 #include "URLRecord.h"
@@ -8,13 +10,9 @@
 #include "SQLiteWrapper.h"
 
 #include <algorithm>
-#include <numeric>
 #include <thread>
 
 #include <QDateTime>
-#include <QRandomGenerator>
-#include <QRegularExpression>
-#include <QSet>
 
 #include <QDebug>
 
@@ -22,6 +20,7 @@ void HistorySuggestor::setServiceLocator(const ViperServiceLocator &serviceLocat
 {
     m_bookmarkManager = serviceLocator.getServiceAs<BookmarkManager>("BookmarkManager");
     m_faviconManager  = serviceLocator.getServiceAs<FaviconManager>("FaviconManager");
+    m_historyManager  = serviceLocator.getServiceAs<HistoryManager>("HistoryManager");
 
     if (Settings *settings = serviceLocator.getServiceAs<Settings>("Settings"))
     {
@@ -34,15 +33,87 @@ void HistorySuggestor::setHistoryFile(const QString &historyDbFile)
     m_historyDatabaseFile = historyDbFile;
 }
 
+/// Columns of the history entries that are suggested
+static const char *const suggestionColumns =
+        "SELECT H.VisitID, H.URL, H.Title, H.URLTypedCount, H.VisitCount, H.LastVisit ";
+
+/// Finds the entries that match a full-text search expression. Matches are ranked by their bm25 score, in which
+/// URL matches count twice as much as title matches, scaled up by the frecency of the entry at the time given
+/// by the second parameter (see \ref HistoryStore::FrecencyHalfLife)
+static const std::string rankedFullTextQuery = std::string(suggestionColumns) +
+        "FROM HistorySearch INNER JOIN History AS H ON H.VisitID = HistorySearch.rowid "
+        "WHERE HistorySearch MATCH ? "
+        "ORDER BY bm25(HistorySearch, 2.0, 1.0) * (1.0 + max(0.0, H.Frecency - ?)) ASC LIMIT 25";
+
+/// Finds the entries that match a full-text search expression, in order of frecency
+static const std::string fullTextQuery = std::string(suggestionColumns) +
+        "FROM History AS H WHERE H.VisitID IN (SELECT rowid FROM HistorySearch WHERE HistorySearch MATCH ?) "
+        "ORDER BY H.Frecency DESC LIMIT 25";
+
+/// Counts the entries that match a full-text search expression, up to the limit given by the second parameter
+static const char *const countMatchesQuery =
+        "SELECT COUNT(*) FROM (SELECT rowid FROM HistorySearch WHERE HistorySearch MATCH ? LIMIT ?)";
+
+/// Number of full-text matches from which a search expression is treated as common. The bm25 score needs the number
+/// of entries containing each term, which means reading the whole index of a common term. The entries that contain
+/// common terms are instead found by scanning the history in order of frecency, which ends after a few entries
+static constexpr int maxRankedMatches = 1000;
+
+/// Minimum length of a term that can be found through the trigram index of the history
+static constexpr int minFullTextTermLength = 3;
+
+/// Returns the query that finds the entries whose URL or title contain each of the given number of terms. The entries
+/// are scanned in order of frecency, so the scan ends once enough of them have matched
+static std::string getSubstringQuery(int numTerms)
+{
+    std::string query = std::string(suggestionColumns) + "FROM History AS H WHERE ";
+    for (int i = 0; i < numTerms; ++i)
+    {
+        if (i > 0)
+            query.append("AND ");
+        query.append("(H.URL LIKE ? OR H.Title LIKE ?) ");
+    }
+    query.append("ORDER BY H.Frecency DESC LIMIT 25");
+    return query;
+}
+
+/// Returns true if the search term starts with the host of the given URL. The www prefix of the host is left out
+/// when the search term does not have it
+static bool isHostMatch(const QUrl &url, const QString &searchTerm)
+{
+    QString host = url.host().toUpper();
+    if (!searchTerm.startsWith(QLatin1String("WWW")) && host.startsWith(QLatin1String("WWW.")))
+        host.remove(0, 4);
+    return searchTerm.startsWith(host);
+}
+
+/// Returns the given term as an FTS5 string, which is matched as a sequence of characters rather than as query syntax
+static QString quoteFullTextTerm(QString term)
+{
+    term.replace(QChar('"'), QLatin1String("\"\""));
+    return QString("\"%1\"").arg(term);
+}
+
 std::vector<URLSuggestion> HistorySuggestor::getSuggestions(const std::atomic_bool &working,
                                                             const QString &searchTerm,
                                                             const QStringList &searchTermParts,
                                                             const FastHashParameters &/*hashParams*/)
 {
-    std::vector<URLSuggestion> result;
-
     if (!m_faviconManager)
-        return result;
+        return {};
+
+    std::vector<URLSuggestion> result = getDatabaseSuggestions(working, searchTerm, searchTermParts);
+    if (working.load())
+        addPendingSuggestions(result, searchTerm, searchTermParts);
+
+    return result;
+}
+
+std::vector<URLSuggestion> HistorySuggestor::getDatabaseSuggestions(const std::atomic_bool &working,
+                                                                    const QString &searchTerm,
+                                                                    const QStringList &searchTermParts)
+{
+    std::vector<URLSuggestion> result;
 
     if (!m_historyDb)
     {
@@ -52,79 +123,76 @@ std::vector<URLSuggestion> HistorySuggestor::getSuggestions(const std::atomic_bo
         m_historyDb = std::make_unique<sqlite::Database>(m_historyDatabaseFile.toStdString());
         if (!m_historyDb || !m_historyDb->isValid())
             return result;
+
+        // The full-text index is created by the history store, and may be missing if SQLite was built without it
+        auto stmt = m_historyDb->prepare(R"(SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'HistorySearch')");
+        int numTables = 0;
+        if (stmt.next())
+            stmt >> numTables;
+        m_hasSearchIndex = numTables > 0;
     }
 
-    // Factored into an entry's score
-    //const qint64 currentTime = QDateTime::currentDateTime().toSecsSinceEpoch();
+    // Without the index, or for terms too short to be in it, match the whole term against each entry
+    if (!m_hasSearchIndex || searchTerm.size() < minFullTextTermLength)
+        return getSubstringSuggestions(working, searchTerm, QStringList{ searchTerm }, MatchType::URL);
 
-    // Sort search words by their string length, in descending order
-    std::vector<QString> searchWords;
-    searchWords.reserve(static_cast<size_t>(searchTermParts.size()));
-    for (const QString &word : searchTermParts)
-        searchWords.push_back(word);
-
-    std::sort(searchWords.begin(), searchWords.end(), [](const QString &a, const QString &b) -> bool {
-        return a.length() > b.length();
-    });
-
-    auto stmt = m_historyDb->prepare(R"(SELECT H.VisitID, H.URL, H.Title, H.URLTypedCount, V.VisitCount, V.RecentVisit
-                           FROM History AS H INNER JOIN
-                           (SELECT VisitID, MAX(Date) AS RecentVisit, COUNT(Date) AS VisitCount FROM Visits GROUP BY VisitID) AS V
-                           ON H.VisitID = V.VisitID
-                           WHERE H.URL LIKE ? OR H.Title LIKE ?
-                           ORDER BY V.VisitCount DESC, H.URLTypedCount DESC LIMIT 25)");
-    const QString fullTermParam = QString("%%1%").arg(searchTerm);
-    stmt << fullTermParam
-         << fullTermParam;
-    if (stmt.execute())
+    // Match the full term first, as a sequence of characters in either the URL or the title
+    const QString fullTermExpression = quoteFullTextTerm(searchTerm);
+    if (hasManyMatches(fullTermExpression))
     {
-        auto fullTermResult = getSuggestionsFromQuery(working, searchTerm, MatchType::URL, stmt);
-        result.insert(result.end(), std::make_move_iterator(fullTermResult.begin()), std::make_move_iterator(fullTermResult.end()));
-        if (!working.load())
-            return result;
+        result = getSubstringSuggestions(working, searchTerm, QStringList{ searchTerm }, MatchType::URL);
     }
-
-    stmt = m_historyDb->prepare("SELECT DISTINCT(HistoryID) FROM URLWords WHERE WordID IN (SELECT WordID FROM Words WHERE Word LIKE ?) LIMIT 50");
-
-    QSet<QString> wordIds;
-    for (const QString &word : searchWords)
+    else
     {
-        QString wordBinding = word.size() > 3 ? QString("%%1%") : QString("%1%");
-        const std::string wordStdBinding = wordBinding.arg(word).toStdString();
-        stmt << wordStdBinding;
+        const double frecencyTime = static_cast<double>(QDateTime::currentMSecsSinceEpoch()) / HistoryStore::FrecencyHalfLife;
 
-        std::string wordId;
-        while (stmt.next())
-        {
-            stmt >> wordId;
-            wordIds.insert(QString::fromStdString(wordId));
-        }
+        auto stmt = m_historyDb->prepare(rankedFullTextQuery);
+        stmt << fullTermExpression
+             << frecencyTime;
+        if (stmt.execute())
+            result = getSuggestionsFromQuery(working, searchTerm, MatchType::URL, stmt);
     }
 
-    if (wordIds.isEmpty() || !working.load())
+    if (!working.load())
         return result;
 
-    QString wordIdString = std::accumulate(wordIds.begin() + 1, wordIds.end(), *wordIds.begin(), [](QString a, QString b) {
-        return std::move(a).append(QChar(',')).append(b);
-    });
-
-    const std::string wordBasedQuery = QString("SELECT H.VisitID, H.URL, H.Title, H.URLTypedCount, V.VisitCount, V.RecentVisit "
-                                               "FROM History AS H "
-                                               "INNER JOIN "
-                                               "(SELECT VisitID, MAX(Date) AS RecentVisit, COUNT(Date) AS VisitCount FROM Visits GROUP BY VisitID) AS V "
-                                               "ON H.VisitID = V.VisitID "
-                                               "WHERE H.VisitID IN ( %1 ) "
-                                               "ORDER BY V.VisitCount DESC, H.URLTypedCount DESC LIMIT 100")
-                                        .arg(wordIdString)
-                                        .toStdString();
-    stmt = m_historyDb->prepare(wordBasedQuery);
-    if (!stmt.execute())
+    // Then match entries containing each of the search words, in any order. Words that are too short
+    // for the index are left out, as they narrow down the matches of the longer words very little.
+    // These matches are not ranked by bm25, as the score would need the number of entries containing
+    // each of the words, even when few entries contain all of them
+    QStringList searchWords;
+    for (const QString &word : searchTermParts)
     {
-        qWarning() << "Could not fetch history matches for user input.";
+        if (word.size() >= minFullTextTermLength)
+            searchWords.push_back(word);
+    }
+
+    if (searchWords.isEmpty() || (searchWords.size() == 1 && searchTermParts.size() == 1))
         return result;
+
+    QStringList quotedWords;
+    for (const QString &word : searchWords)
+        quotedWords.push_back(quoteFullTextTerm(word));
+    const QString wordsExpression = quotedWords.join(QLatin1String(" AND "));
+
+    std::vector<URLSuggestion> wordQueryResult;
+    if (hasManyMatches(wordsExpression))
+    {
+        wordQueryResult = getSubstringSuggestions(working, searchTerm, searchWords, MatchType::SearchWords);
+    }
+    else
+    {
+        auto stmt = m_historyDb->prepare(fullTextQuery);
+        stmt << wordsExpression;
+        if (!stmt.execute())
+        {
+            qWarning() << "Could not fetch history matches for user input.";
+            return result;
+        }
+
+        wordQueryResult = getSuggestionsFromQuery(working, searchTerm, MatchType::SearchWords, stmt);
     }
 
-    auto wordQueryResult = getSuggestionsFromQuery(working, searchTerm, MatchType::SearchWords, stmt);
     if (!working.load())
         return result;
 
@@ -138,69 +206,83 @@ std::vector<URLSuggestion> HistorySuggestor::getSuggestions(const std::atomic_bo
             result.emplace_back(std::move(suggestion));
     }
 
-    //result.insert(result.end(), std::make_move_iterator(wordQueryResult.begin()), std::make_move_iterator(wordQueryResult.end()));
-
     return result;
+}
 
-    /*
-    QSqlQuery rawTermQuery(db);
-    rawTermQuery.prepare(QString("SELECT H.VisitID, H.URL, H.Title, H.URLTypedCount, V.VisitCount, V.RecentVisit "
-                                 "FROM History AS H "
-                                 "INNER JOIN "
-                                 "(SELECT VisitID, MAX(Date) AS RecentVisit, COUNT(Date) AS VisitCount FROM Visits GROUP BY VisitID) AS V "
-                                 "ON H.VisitID = V.VisitID "
-                                 "WHERE H.URL LIKE ? OR H.Title LIKE ? ) "
-                                 "ORDER BY V.VisitCount DESC, H.URLTypedCount DESC LIMIT 100"));
-    rawTermQuery.bindValue();
-
-    if (!rawTermQuery.exec())
+void HistorySuggestor::addPendingSuggestions(std::vector<URLSuggestion> &suggestions,
+                                             const QString &searchTerm,
+                                             const QStringList &searchTermParts)
+{
+    if (!m_historyManager)
+        return;
+
+    // The history store holds recent visits in memory before writing them, and the database is read through a
+    // connection of its own, so the waiting visits are matched here. They are read without waiting for the store
+    for (HistoryEntry &entry : m_historyManager->getPendingEntries())
     {
-        qWarning() << "Could not fetch history matches for user input. Error: " << rawTermQuery.lastError().text();
-        return result;
+        const QString url = entry.URL.toString();
+        auto isMatch = [&url, &entry](const QString &term) {
+            return url.contains(term, Qt::CaseInsensitive) || entry.Title.contains(term, Qt::CaseInsensitive);
+        };
+
+        MatchType matchType = MatchType::URL;
+        if (!isMatch(searchTerm))
+        {
+            if (searchTermParts.size() < 2 || !std::all_of(searchTermParts.begin(), searchTermParts.end(), isMatch))
+                continue;
+            matchType = MatchType::SearchWords;
+        }
+
+        // Entries already in the database are suggested once, with the waiting visits added to them
+        auto match = std::find_if(suggestions.begin(), suggestions.end(), [&url](const URLSuggestion &suggestion) {
+            return suggestion.URL == url;
+        });
+        if (match != suggestions.end())
+        {
+            match->VisitCount += entry.NumVisits;
+            match->URLTypedCount += entry.URLTypedCount;
+            if (match->LastVisit < entry.LastVisit)
+                match->LastVisit = entry.LastVisit;
+            continue;
+        }
+
+        std::vector<VisitEntry> emptyVisits;
+        URLRecord urlRecord{ std::move(entry), std::move(emptyVisits) };
+        URLSuggestion suggestion { urlRecord, m_faviconManager->getFavicon(urlRecord.getUrl()), matchType };
+        suggestion.IsHostMatch = isHostMatch(urlRecord.getUrl(), searchTerm);
+        suggestions.push_back(suggestion);
+    }
+}
+
+bool HistorySuggestor::hasManyMatches(const QString &expression)
+{
+    auto stmt = m_historyDb->prepare(countMatchesQuery);
+    stmt << expression
+         << maxRankedMatches;
+
+    int numMatches = 0;
+    if (stmt.next())
+        stmt >> numMatches;
+    return numMatches >= maxRankedMatches;
+}
+
+std::vector<URLSuggestion> HistorySuggestor::getSubstringSuggestions(const std::atomic_bool &working,
+                                                                     const QString &searchTerm,
+                                                                     const QStringList &terms,
+                                                                     MatchType queryMatchType)
+{
+    auto stmt = m_historyDb->prepare(getSubstringQuery(terms.size()));
+    for (const QString &term : terms)
+    {
+        const QString termParam = QString("%%1%").arg(term);
+        stmt << termParam
+             << termParam;
     }
-    */
-
-    // Old code below
-    /*
-                std::vector<QString> historyWords = getHistoryEntryWords(record.getVisitId());
-                for (const QString &searchWord : searchWords)
-                {
-                    auto wordIt = std::find_if(historyWords.begin(), historyWords.end(), [&searchWord](const QString &historyWord) -> bool {
-                       return historyWord.contains(searchWord);
-                    });
-
-                    if (wordIt == historyWords.end())
-                    {
-                        skipCurrentEntry = true;
-                        break;
-                    }
-                    else
-                    {
-                        const int histWordLen = wordIt->size();
-                        const int offset = wordIt->indexOf(searchWord);
-                        score += static_cast<float>(searchWord.size()) * (static_cast<float>(histWordLen - offset) / histWordLen);
-                    }
-                }
-
-                if (skipCurrentEntry)
-                    continue;
-
-                matchType = MatchType::SearchWords;
-                const float scoreTermRatio = score / static_cast<float>(searchTerm.size());
-                const float scoreUrlRatio = score / static_cast<float>(url.size());
-                // Grant up to additional 15 points for non-direct factors
-                // These are:
-                //   (1) Recency of last visit: Within last week? + 5pts
-                //   (2) Number of total visits: >= 25 visits ? + 10 pts, otherwise, (visitCount/25.0) * 10 for partial credit
-                float bonus = (currentTime - record.getLastVisit().toSecsSinceEpoch()) <= 604800LL ? 5.0f : 0.0f;
-                if (record.getNumVisits() >= 25)
-                    bonus += 10.0f;
-                else
-                    bonus += 10.0f * (static_cast<float>(record.getNumVisits()) / 25.0f);
-
-                percentWordScore = static_cast<int>((50.0f * scoreUrlRatio) + (50.0f * scoreTermRatio));
-            }
-    */
+
+    if (!stmt.execute())
+        return {};
+
+    return getSuggestionsFromQuery(working, searchTerm, queryMatchType, stmt);
 }
 
 std::vector<URLSuggestion> HistorySuggestor::getSuggestionsFromQuery(const std::atomic_bool &working,
@@ -211,10 +293,6 @@ std::vector<URLSuggestion> HistorySuggestor::getSuggestionsFromQuery(const std::
     const int maxToSuggest = 25;
     int numSuggested = 0;
 
-    // Strip www prefix from urls when user does not also have this in the search term
-    const QRegularExpression prefixExpr = QRegularExpression(QLatin1String("^WWW\\."));
-    const bool inputStartsWithWww = searchTerm.size() >= 3 && searchTerm.startsWith(QLatin1String("WWW"));
-
     const VisitEntry cutoffTime = QDateTime::currentDateTime().addSecs(-864000);
 
     std::vector<URLSuggestion> result;
@@ -237,10 +315,7 @@ std::vector<URLSuggestion> HistorySuggestor::getSuggestionsFromQuery(const std::
 
         URLSuggestion suggestion { urlRecord, m_faviconManager->getFavicon(urlRecord.getUrl()), queryMatchType };
 
-        QString suggestionHost = urlRecord.getUrl().host().toUpper();
-        if (!inputStartsWithWww)
-            suggestionHost = suggestionHost.replace(prefixExpr, QString());
-        suggestion.IsHostMatch = searchTerm.startsWith(suggestionHost);
+        suggestion.IsHostMatch = isHostMatch(urlRecord.getUrl(), searchTerm);
 
         //if (matchType == MatchType::SearchWords)
         //    suggestion.PercentMatch = percentWordScore;
@@ -8,6 +8,7 @@
 
 class BookmarkManager;
 class FaviconManager;
+class HistoryManager;
 
 namespace sqlite
 {
@@ -29,20 +30,42 @@ class HistorySuggestor final : public IURLSuggestor
     /// Default destructor
     ~HistorySuggestor() = default;
 
-    /// Injects the history manager and favicon manager dependencies
+    /// Injects the bookmark manager, favicon manager and history manager dependencies
     void setServiceLocator(const ViperServiceLocator &serviceLocator) override;
 
     /// Specifies which history database file the suggestor should use. If not set, the
     /// suggestor will use the application settings to get the value
     void setHistoryFile(const QString &historyDbFile);
 
-    /// Suggests history entries to the user, based on their text input
+    /// Suggests history entries to the user, based on their text input. Entries are found through the full-text
+    /// index of the history database. Matches of the full term are ranked by how well they match and how often they
+    /// have been visited, and matches of the separate words, or of common terms, by how often they have been visited
     std::vector<URLSuggestion> getSuggestions(const std::atomic_bool &working,
                                               const QString &searchTerm,
                                               const QStringList &searchTermParts,
                                               const FastHashParameters &hashParams) override;
 
 private:
+    /// Returns the suggestions found in the history database
+    std::vector<URLSuggestion> getDatabaseSuggestions(const std::atomic_bool &working,
+                                                      const QString &searchTerm,
+                                                      const QStringList &searchTermParts);
+
+    /// Adds the entries of the visits that the history store has not written yet, and which match the search term
+    /// or all of its parts, to the given suggestions
+    void addPendingSuggestions(std::vector<URLSuggestion> &suggestions,
+                               const QString &searchTerm,
+                               const QStringList &searchTermParts);
+
+    /// Returns true if too many entries match the given full-text search expression for them to be ranked by bm25
+    bool hasManyMatches(const QString &expression);
+
+    /// Returns the entries whose URL or title contain each of the given terms, in order of frecency
+    std::vector<URLSuggestion> getSubstringSuggestions(const std::atomic_bool &working,
+                                                       const QString &searchTerm,
+                                                       const QStringList &terms,
+                                                       MatchType queryMatchType);
+
     /// Returns a list of URL suggestions based on the result of a history suggestion query
     std::vector<URLSuggestion> getSuggestionsFromQuery(const std::atomic_bool &working,
                                                        const QString &searchTerm,
@@ -56,11 +79,17 @@ class HistorySuggestor final : public IURLSuggestor
     /// Gathers icons which are sent in the suggestion results
     FaviconManager *m_faviconManager;
 
+    /// Provides the visits that the history store holds in memory, which are not in the database yet
+    HistoryManager *m_historyManager { nullptr };
+
     /// History database handle
     std::unique_ptr<sqlite::Database> m_historyDb;
 
     /// Stores the location of the history database
     QString m_historyDatabaseFile;
+
+    /// True if the history database has a full-text index of its URLs and titles
+    bool m_hasSearchIndex { false };
 };
 
 #endif // HISTORYSUGGESTOR_H
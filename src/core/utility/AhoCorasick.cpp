@@ -0,0 +1,232 @@
+#include "AhoCorasick.h"
+
+#include <deque>
+
+AhoCorasick::AhoCorasick() :
+    m_nodes(),
+    m_transitions(),
+    m_children(),
+    m_asciiClasses(),
+    m_wideChars(),
+    m_classChars(),
+    m_numAsciiClasses(0),
+    m_nextPattern(),
+    m_numPatterns(0)
+{
+    clear();
+}
+
+int AhoCorasick::addPattern(const QString &pattern)
+{
+    if (pattern.isEmpty())
+        return -1;
+
+    // Restore the child lists if they were released by a previous call to build()
+    if (m_children.size() != m_nodes.size())
+    {
+        m_children.assign(m_nodes.size(), std::vector<std::pair<ushort, int32_t>>());
+        const int32_t numClasses = static_cast<int32_t>(m_classChars.size());
+        for (int32_t state = 0; state < static_cast<int32_t>(m_nodes.size()); ++state)
+        {
+            for (int32_t charClass = 1; charClass < numClasses; ++charClass)
+            {
+                const int32_t target = getTransition(state, charClass);
+                if (target >= 0)
+                    m_children[static_cast<std::size_t>(state)].push_back({ m_classChars[static_cast<std::size_t>(charClass)], target });
+            }
+        }
+    }
+
+    int32_t state = 0;
+    for (const QChar &ch : pattern)
+    {
+        const ushort c = foldCase(ch);
+
+        std::vector<std::pair<ushort, int32_t>> &children = m_children[static_cast<std::size_t>(state)];
+        auto it = std::find_if(children.cbegin(), children.cend(), [c](const std::pair<ushort, int32_t> &child) {
+            return child.first == c;
+        });
+        if (it != children.cend())
+        {
+            state = it->second;
+            continue;
+        }
+
+        const int32_t nextState = static_cast<int32_t>(m_nodes.size());
+        children.push_back({ c, nextState });
+        m_nodes.push_back({ 0, 0, -1, 0 });
+        m_children.emplace_back();
+        state = nextState;
+    }
+
+    // Prepend the pattern to the list of patterns ending at this state
+    const int32_t patternId = m_numPatterns++;
+    m_nextPattern.push_back(m_nodes[state].FirstPattern);
+    m_nodes[state].FirstPattern = patternId;
+
+    return static_cast<int>(patternId);
+}
+
+void AhoCorasick::build()
+{
+    buildTransitions();
+
+    // Breadth-first traversal, so that the failure link of a state is always computed before its children
+    std::deque<int32_t> queue;
+    for (const std::pair<ushort, int32_t> &child : m_children[0])
+    {
+        m_nodes[child.second].Fail = 0;
+        m_nodes[child.second].Output = 0;
+        queue.push_back(child.second);
+    }
+
+    while (!queue.empty())
+    {
+        const int32_t state = queue.front();
+        queue.pop_front();
+
+        for (const std::pair<ushort, int32_t> &child : m_children[static_cast<std::size_t>(state)])
+        {
+            const int32_t charClass = getCharClass(child.first);
+
+            int32_t fail = m_nodes[state].Fail;
+            for (;;)
+            {
+                const int32_t target = getTransition(fail, charClass);
+                if (target >= 0 && target != child.second)
+                {
+                    fail = target;
+                    break;
+                }
+                if (fail == 0)
+                    break;
+                fail = m_nodes[fail].Fail;
+            }
+
+            Node &childNode = m_nodes[child.second];
+            childNode.Fail = fail;
+            childNode.Output = m_nodes[fail].FirstPattern >= 0 ? fail : m_nodes[fail].Output;
+
+            queue.push_back(child.second);
+        }
+    }
+
+    m_children.clear();
+    m_children.shrink_to_fit();
+}
+
+void AhoCorasick::clear()
+{
+    m_nodes.clear();
+    m_transitions.clear();
+    m_children.clear();
+    m_asciiClasses.fill(0);
+    m_wideChars.clear();
+    m_classChars.assign(1, 0);
+    m_numAsciiClasses = 0;
+    m_nextPattern.clear();
+    m_numPatterns = 0;
+
+    // Root state
+    m_nodes.push_back({ 0, 0, -1, 0 });
+    m_children.emplace_back();
+}
+
+int AhoCorasick::size() const
+{
+    return static_cast<int>(m_numPatterns);
+}
+
+int32_t AhoCorasick::getTransition(int32_t state, int32_t charClass) const
+{
+    const std::size_t index = static_cast<std::size_t>(m_nodes[state].Base + charClass);
+    if (index >= m_transitions.size() || m_transitions[index].Check != state)
+        return -1;
+    return m_transitions[index].Target;
+}
+
+void AhoCorasick::buildTransitions()
+{
+    // Reduce the characters of the patterns to a dense alphabet. Class 0 is kept for all other characters
+    std::array<bool, 128> isAsciiUsed {};
+    m_wideChars.clear();
+    for (const std::vector<std::pair<ushort, int32_t>> &children : m_children)
+    {
+        for (const std::pair<ushort, int32_t> &child : children)
+        {
+            if (child.first < 128)
+                isAsciiUsed[child.first] = true;
+            else
+                m_wideChars.push_back(child.first);
+        }
+    }
+
+    std::sort(m_wideChars.begin(), m_wideChars.end());
+    m_wideChars.erase(std::unique(m_wideChars.begin(), m_wideChars.end()), m_wideChars.end());
+
+    m_asciiClasses.fill(0);
+    m_classChars.assign(1, 0);
+    for (ushort c = 0; c < 128; ++c)
+    {
+        if (!isAsciiUsed[c])
+            continue;
+
+        m_asciiClasses[c] = static_cast<int32_t>(m_classChars.size());
+        m_classChars.push_back(c);
+    }
+    m_numAsciiClasses = static_cast<int32_t>(m_classChars.size()) - 1;
+    m_classChars.insert(m_classChars.end(), m_wideChars.cbegin(), m_wideChars.cend());
+
+    const int32_t numClasses = static_cast<int32_t>(m_classChars.size());
+
+    // Place the children of each state at the first base where all of their entries are unused. Most states
+    // have a single child, so the search nearly always ends at the first unused entry
+    m_transitions.assign(static_cast<std::size_t>(numClasses), { -1, 0 });
+    std::size_t firstUnused = 1;
+    std::vector<int32_t> classes;
+    for (int32_t state = 0; state < static_cast<int32_t>(m_nodes.size()); ++state)
+    {
+        const std::vector<std::pair<ushort, int32_t>> &children = m_children[static_cast<std::size_t>(state)];
+        if (children.empty())
+        {
+            m_nodes[state].Base = 0;
+            continue;
+        }
+
+        classes.clear();
+        for (const std::pair<ushort, int32_t> &child : children)
+            classes.push_back(getCharClass(child.first));
+        std::sort(classes.begin(), classes.end());
+
+        while (firstUnused < m_transitions.size() && m_transitions[firstUnused].Check >= 0)
+            ++firstUnused;
+
+        int32_t base = std::max(static_cast<int32_t>(firstUnused) - classes.front(), 0);
+        for (;; ++base)
+        {
+            bool isFree = true;
+            for (int32_t charClass : classes)
+            {
+                const std::size_t index = static_cast<std::size_t>(base + charClass);
+                if (index < m_transitions.size() && m_transitions[index].Check >= 0)
+                {
+                    isFree = false;
+                    break;
+                }
+            }
+            if (isFree)
+                break;
+        }
+
+        // Every base is followed by a full alphabet of entries, so lookups never need a bounds check
+        const std::size_t requiredSize = static_cast<std::size_t>(base + numClasses);
+        if (m_transitions.size() < requiredSize)
+            m_transitions.resize(requiredSize, { -1, 0 });
+
+        m_nodes[state].Base = base;
+        for (const std::pair<ushort, int32_t> &child : children)
+            m_transitions[static_cast<std::size_t>(base + getCharClass(child.first))] = { state, child.second };
+    }
+
+    m_transitions.shrink_to_fit();
+}
@@ -0,0 +1,181 @@
+#ifndef AHOCORASICK_H
+#define AHOCORASICK_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <QString>
+
+/**
+ * @class AhoCorasick
+ * @brief An implementation of the Aho-Corasick multi-pattern string matching algorithm.
+ *        All patterns are compiled into a single automaton, which finds every pattern
+ *        contained in a haystack with one pass over the haystack. Matching is case
+ *        insensitive; patterns are expected to be given in lower case.
+ *
+ * Characters are reduced to an alphabet of the characters that appear in the patterns, and the
+ * transitions are stored in a double-array layout, so that following a transition is a single
+ * indexed load and a comparison.
+ */
+class AhoCorasick
+{
+    /// A state in the automaton
+    struct Node
+    {
+        /// State to fall back to when there is no transition for the next character
+        int32_t Fail;
+
+        /// Nearest state, following failure links, at which at least one pattern ends. 0 if there is none
+        int32_t Output;
+
+        /// Identifier of the first pattern that ends at this state, or -1 if no pattern ends here
+        int32_t FirstPattern;
+
+        /// Offset into the transition array, to which a character class is added to find the transition on that class
+        int32_t Base;
+    };
+
+    /// An entry of the double-array transition table
+    struct Transition
+    {
+        /// State that owns the transition, or -1 if the entry is unused
+        int32_t Check;
+
+        /// State reached by the transition
+        int32_t Target;
+    };
+
+public:
+    /// Constructs an empty automaton
+    AhoCorasick();
+
+    /// Adds a pattern to the automaton, returning its identifier. Empty patterns are ignored and return -1.
+    /// The automaton must be rebuilt with \ref build before the pattern will be found by \ref search
+    int addPattern(const QString &pattern);
+
+    /// Computes the transition table, and the failure and output links of the automaton
+    void build();
+
+    /// Removes all patterns from the automaton
+    void clear();
+
+    /// Returns the number of patterns in the automaton
+    int size() const;
+
+    /**
+     * @brief Searches the haystack for all of the patterns in the automaton
+     * @param haystack String to be searched
+     * @param callback Invoked with the identifier of each pattern found in the haystack, in order of
+     *        their end positions. Returning true from the callback stops the search.
+     * @return True if the search was stopped by the callback, false if else
+     */
+    template<typename Callback>
+    bool search(const QString &haystack, Callback &&callback) const
+    {
+        if (m_numPatterns == 0 || m_transitions.empty())
+            return false;
+
+        const QChar *data = haystack.constData();
+        const int length = haystack.size();
+
+        int32_t state = 0;
+        for (int i = 0; i < length; ++i)
+        {
+            // A character that is not in any pattern leads back to the root from every state
+            const int32_t charClass = getCharClass(foldCase(data[i]));
+            if (charClass == 0)
+            {
+                state = 0;
+                continue;
+            }
+
+            for (;;)
+            {
+                const Transition &transition = m_transitions[static_cast<std::size_t>(m_nodes[state].Base + charClass)];
+                if (transition.Check == state)
+                {
+                    state = transition.Target;
+                    break;
+                }
+                if (state == 0)
+                    break;
+                state = m_nodes[state].Fail;
+            }
+
+            int32_t outputState = m_nodes[state].FirstPattern >= 0 ? state : m_nodes[state].Output;
+            while (outputState != 0)
+            {
+                for (int32_t pattern = m_nodes[outputState].FirstPattern; pattern >= 0; pattern = m_nextPattern[pattern])
+                {
+                    if (callback(static_cast<int>(pattern)))
+                        return true;
+                }
+                outputState = m_nodes[outputState].Output;
+            }
+        }
+
+        return false;
+    }
+
+private:
+    /// Returns the lower case form of the character
+    static inline ushort foldCase(QChar c)
+    {
+        const ushort u = c.unicode();
+        if (u < 128)
+            return (u >= 'A' && u <= 'Z') ? static_cast<ushort>(u + 32) : u;
+        return c.toLower().unicode();
+    }
+
+    /// Returns the class of the (case folded) character, or 0 if the character does not appear in any pattern
+    inline int32_t getCharClass(ushort c) const
+    {
+        if (c < 128)
+            return m_asciiClasses[c];
+
+        auto it = std::lower_bound(m_wideChars.cbegin(), m_wideChars.cend(), c);
+        if (it == m_wideChars.cend() || *it != c)
+            return 0;
+        return m_numAsciiClasses + 1 + static_cast<int32_t>(it - m_wideChars.cbegin());
+    }
+
+    /// Returns the state reached from the given state by the character class, or -1 if there is no such transition
+    int32_t getTransition(int32_t state, int32_t charClass) const;
+
+    /// Places the transitions of each state into the double-array transition table
+    void buildTransitions();
+
+private:
+    /// States of the automaton, with the root state at index 0
+    std::vector<Node> m_nodes;
+
+    /// Double-array transition table. The transition of a state on a character class is found at the index of the
+    /// base of the state plus the class, and belongs to the state if its check value is the state
+    std::vector<Transition> m_transitions;
+
+    /// Children of each state as (character, state) pairs, released after building the automaton
+    std::vector<std::vector<std::pair<ushort, int32_t>>> m_children;
+
+    /// Class of each ASCII character, or 0 if the character does not appear in any pattern
+    std::array<int32_t, 128> m_asciiClasses;
+
+    /// Sorted non-ASCII characters that appear in the patterns. Their classes follow those of the ASCII characters
+    std::vector<ushort> m_wideChars;
+
+    /// Character of each class, with an unused entry for class 0
+    std::vector<ushort> m_classChars;
+
+    /// Number of classes of ASCII characters
+    int32_t m_numAsciiClasses;
+
+    /// For each pattern, the identifier of the next pattern that ends at the same state, or -1
+    std::vector<int32_t> m_nextPattern;
+
+    /// Number of patterns in the automaton
+    int32_t m_numPatterns;
+};
+
+#endif // AHOCORASICK_H
@@ -197,4 +197,32 @@ namespace CommonUtil
 
         return str.split(QLatin1Char(' '), QString::SkipEmptyParts);
     }
+
+    QString escapeJavaScriptString(const QString &str)
+    {
+        QString result;
+        result.reserve(str.size() + str.size() / 16);
+        for (const QChar c : str)
+        {
+            switch (c.unicode())
+            {
+                case '\\':
+                    result.append(QLatin1String("\\\\"));
+                    break;
+                case '\'':
+                    result.append(QLatin1String("\\'"));
+                    break;
+                case '\n':
+                    result.append(QLatin1String("\\n"));
+                    break;
+                case '\r':
+                    result.append(QLatin1String("\\r"));
+                    break;
+                default:
+                    result.append(c);
+                    break;
+            }
+        }
+        return result;
+    }
 }
@@ -52,6 +52,10 @@ namespace CommonUtil
     /// The string may or may not be a URL - depending on the caller - but
     /// URL tokenization rules are applied regardless
     QStringList tokenizePossibleUrl(QString str);
+
+    /// Escapes the backslashes, quotes and line breaks of the given string, so that it can be placed
+    /// within a single-quoted JavaScript string literal
+    QString escapeJavaScriptString(const QString &str);
 }
 
 #endif // COMMONUTIL_H
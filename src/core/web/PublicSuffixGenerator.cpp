@@ -0,0 +1,359 @@
+/**
+ * Compiles the rules of the Public Suffix List into the flat arrays that are read by \ref PublicSuffixList.
+ *
+ * Usage: PublicSuffixGenerator <public_suffix_list.dat> <output.cpp>
+ *
+ * The rules are placed in a trie of domain labels, starting from the top-level domain. The nodes of the trie are
+ * written in breadth-first order, so that the children of each node are stored next to each other and sorted by
+ * their label. Labels that are not ASCII are written in their punycode (ACE) form. This program is run at build
+ * time, and only depends on the standard library.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+/// Flags of a node in the compiled trie. These must match the flags of \ref PublicSuffixNode
+enum NodeFlag : uint8_t
+{
+    Terminal  = 0x01,
+    Wildcard  = 0x02,
+    Exception = 0x04
+};
+
+/// A node of the trie, which is the label of a domain that is part of at least one rule
+struct TrieNode
+{
+    /// Combination of \ref NodeFlag values
+    uint8_t Flags = 0;
+
+    /// Children of the node, sorted by their label
+    std::map<std::string, std::unique_ptr<TrieNode>> Children;
+};
+
+/// Decodes the UTF-8 string into a sequence of code points. Returns false if the string is not valid UTF-8
+bool decodeUtf8(const std::string &input, std::vector<uint32_t> &output)
+{
+    for (std::size_t i = 0; i < input.size();)
+    {
+        const unsigned char c = static_cast<unsigned char>(input[i]);
+        int numBytes = 0;
+        uint32_t codePoint = 0;
+        if (c < 0x80)
+        {
+            numBytes = 1;
+            codePoint = c;
+        }
+        else if ((c & 0xE0) == 0xC0)
+        {
+            numBytes = 2;
+            codePoint = c & 0x1F;
+        }
+        else if ((c & 0xF0) == 0xE0)
+        {
+            numBytes = 3;
+            codePoint = c & 0x0F;
+        }
+        else if ((c & 0xF8) == 0xF0)
+        {
+            numBytes = 4;
+            codePoint = c & 0x07;
+        }
+        else
+            return false;
+
+        if (i + static_cast<std::size_t>(numBytes) > input.size())
+            return false;
+
+        for (int j = 1; j < numBytes; ++j)
+        {
+            const unsigned char next = static_cast<unsigned char>(input[i + static_cast<std::size_t>(j)]);
+            if ((next & 0xC0) != 0x80)
+                return false;
+            codePoint = (codePoint << 6) | (next & 0x3F);
+        }
+
+        output.push_back(codePoint);
+        i += static_cast<std::size_t>(numBytes);
+    }
+    return true;
+}
+
+/// Adapts the bias of the punycode encoder after a code point is encoded (RFC 3492, section 6.1)
+uint32_t adaptPunycodeBias(uint32_t delta, uint32_t numPoints, bool firstTime)
+{
+    delta = firstTime ? delta / 700 : delta / 2;
+    delta += delta / numPoints;
+
+    uint32_t k = 0;
+    while (delta > ((36 - 1) * 26) / 2)
+    {
+        delta /= 36 - 1;
+        k += 36;
+    }
+    return k + (((36 - 1) + 1) * delta) / (delta + 38);
+}
+
+/// Returns the punycode digit of the given value
+char getPunycodeDigit(uint32_t value)
+{
+    return static_cast<char>(value < 26 ? 'a' + value : '0' + (value - 26));
+}
+
+/// Converts a domain label to its ASCII compatible encoding (RFC 3492). Labels that are already ASCII are returned as they are
+bool toAce(const std::string &label, std::string &output)
+{
+    std::vector<uint32_t> codePoints;
+    if (!decodeUtf8(label, codePoints))
+        return false;
+
+    output.clear();
+    for (uint32_t c : codePoints)
+    {
+        if (c < 0x80)
+            output.push_back(static_cast<char>(c));
+    }
+
+    const uint32_t numBasic = static_cast<uint32_t>(output.size());
+    if (numBasic == codePoints.size())
+        return true;
+
+    std::string encoded = output;
+    if (numBasic > 0)
+        encoded.push_back('-');
+
+    uint32_t n = 0x80, delta = 0, bias = 72, handled = numBasic;
+    while (handled < codePoints.size())
+    {
+        uint32_t next = UINT32_MAX;
+        for (uint32_t c : codePoints)
+        {
+            if (c >= n && c < next)
+                next = c;
+        }
+
+        delta += (next - n) * (handled + 1);
+        n = next;
+
+        for (uint32_t c : codePoints)
+        {
+            if (c < n)
+                ++delta;
+            if (c != n)
+                continue;
+
+            uint32_t q = delta;
+            for (uint32_t k = 36;; k += 36)
+            {
+                const uint32_t t = k <= bias ? 1 : (k >= bias + 26 ? 26 : k - bias);
+                if (q < t)
+                    break;
+                encoded.push_back(getPunycodeDigit(t + (q - t) % (36 - t)));
+                q = (q - t) / (36 - t);
+            }
+
+            encoded.push_back(getPunycodeDigit(q));
+            bias = adaptPunycodeBias(delta, handled + 1, handled == numBasic);
+            delta = 0;
+            ++handled;
+        }
+
+        ++delta;
+        ++n;
+    }
+
+    output = "xn--" + encoded;
+    return true;
+}
+
+/// Adds the rule on the given line of the list to the trie. Returns false if the rule could not be parsed
+bool addRule(TrieNode &root, std::string rule)
+{
+    uint8_t flag = Terminal;
+    if (!rule.empty() && rule.front() == '!')
+    {
+        flag = Exception;
+        rule.erase(0, 1);
+    }
+    else if (rule.size() > 2 && rule.compare(0, 2, "*.") == 0)
+    {
+        flag = Wildcard;
+        rule.erase(0, 2);
+    }
+
+    std::vector<std::string> labels;
+    std::stringstream stream(rule);
+    std::string label;
+    while (std::getline(stream, label, '.'))
+    {
+        std::string aceLabel;
+        if (label.empty() || label.size() > 63 || label.find('*') != std::string::npos || !toAce(label, aceLabel))
+            return false;
+
+        for (char &c : aceLabel)
+        {
+            if (c >= 'A' && c <= 'Z')
+                c = static_cast<char>(c - 'A' + 'a');
+        }
+        labels.push_back(aceLabel);
+    }
+
+    if (labels.empty())
+        return false;
+
+    TrieNode *node = &root;
+    for (auto it = labels.rbegin(); it != labels.rend(); ++it)
+    {
+        std::unique_ptr<TrieNode> &child = node->Children[*it];
+        if (!child)
+            child = std::make_unique<TrieNode>();
+        node = child.get();
+    }
+
+    node->Flags |= flag;
+    return true;
+}
+
+/// Writes the given string as a C++ string literal, split over lines of a reasonable length
+void writeStringLiteral(std::ostream &out, const std::string &value)
+{
+    for (std::size_t i = 0; i < value.size(); i += 96)
+        out << "    \"" << value.substr(i, 96) << "\"\n";
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <public_suffix_list.dat> <output.cpp>\n";
+        return 1;
+    }
+
+    std::ifstream input(argv[1]);
+    if (!input)
+    {
+        std::cerr << "Could not open " << argv[1] << "\n";
+        return 1;
+    }
+
+    // The root of the trie is the implicit "*" rule, which makes every top-level domain a public suffix
+    TrieNode root;
+    root.Flags = Wildcard;
+
+    std::string line;
+    int lineNumber = 0, numRules = 0;
+    while (std::getline(input, line))
+    {
+        ++lineNumber;
+
+        // Each rule is the first word of its line
+        const std::size_t end = line.find_first_of(" \t\r");
+        if (end != std::string::npos)
+            line.erase(end);
+
+        if (line.empty() || line.compare(0, 2, "//") == 0)
+            continue;
+
+        if (!addRule(root, line))
+        {
+            std::cerr << argv[1] << ":" << lineNumber << ": Invalid rule \"" << line << "\"\n";
+            return 1;
+        }
+        ++numRules;
+    }
+
+    // Lay out the nodes in breadth-first order, and the labels without duplicates
+    struct FlatNode
+    {
+        uint32_t LabelOffset;
+        uint32_t FirstChild;
+        uint16_t NumChildren;
+        uint8_t LabelLength;
+        uint8_t Flags;
+    };
+
+    std::vector<FlatNode> nodes;
+    std::string labels;
+    std::map<std::string, uint32_t> labelOffsets;
+
+    std::queue<const TrieNode*> pending;
+    nodes.push_back({ 0, 0, 0, 0, root.Flags });
+    pending.push(&root);
+    std::size_t nodeIndex = 0;
+    while (!pending.empty())
+    {
+        const TrieNode *node = pending.front();
+        pending.pop();
+
+        if (node->Children.size() > UINT16_MAX)
+        {
+            std::cerr << "Too many rules below a single domain\n";
+            return 1;
+        }
+
+        nodes[nodeIndex].FirstChild = static_cast<uint32_t>(nodes.size());
+        nodes[nodeIndex].NumChildren = static_cast<uint16_t>(node->Children.size());
+        for (const auto &child : node->Children)
+        {
+            auto it = labelOffsets.find(child.first);
+            if (it == labelOffsets.end())
+            {
+                it = labelOffsets.emplace(child.first, static_cast<uint32_t>(labels.size())).first;
+                labels.append(child.first);
+            }
+
+            nodes.push_back({ it->second, 0, 0, static_cast<uint8_t>(child.first.size()), child.second->Flags });
+            pending.push(child.second.get());
+        }
+        ++nodeIndex;
+    }
+
+    std::ostringstream out;
+    out << "// Generated by PublicSuffixGenerator from public_suffix_list.dat (" << numRules << " rules). Do not edit.\n\n"
+        << "#include \"PublicSuffixList.h\"\n\n"
+        << "const PublicSuffixNode PublicSuffixList::Nodes[] = {\n";
+    for (const FlatNode &node : nodes)
+    {
+        out << "    { " << node.LabelOffset << ", " << node.FirstChild << ", " << node.NumChildren << ", "
+            << static_cast<int>(node.LabelLength) << ", " << static_cast<int>(node.Flags) << " },\n";
+    }
+    out << "};\n\n"
+        << "const std::size_t PublicSuffixList::NumNodes = " << nodes.size() << ";\n\n"
+        << "const char PublicSuffixList::Labels[] =\n";
+    writeStringLiteral(out, labels);
+    out << ";\n";
+
+    // Leave the output untouched if nothing changed, so that it is not recompiled
+    const std::string output = out.str();
+    {
+        std::ifstream previous(argv[2], std::ios::binary);
+        if (previous)
+        {
+            std::stringstream previousContents;
+            previousContents << previous.rdbuf();
+            if (previousContents.str() == output)
+                return 0;
+        }
+    }
+
+    std::ofstream file(argv[2], std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cerr << "Could not write " << argv[2] << "\n";
+        return 1;
+    }
+    file << output;
+    return file ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#include "PublicSuffixList.h"
+
+/// Compares a label of a host with a label of the compiled list, returning a negative value if the host's label
+/// is ordered first, a positive value if it is ordered last, or zero if the labels are equal
+static int compareLabel(const QChar *label, int length, const char *other, int otherLength)
+{
+    const int commonLength = length < otherLength ? length : otherLength;
+    for (int i = 0; i < commonLength; ++i)
+    {
+        ushort c = label[i].unicode();
+        if (c >= 'A' && c <= 'Z')
+            c += 32;
+
+        const ushort otherChar = static_cast<unsigned char>(other[i]);
+        if (c != otherChar)
+            return c < otherChar ? -1 : 1;
+    }
+    return length - otherLength;
+}
+
+/// Returns true if the host is an IP address, which has no public suffix. IPv4 addresses are recognized by their
+/// last label, as top-level domains are never numeric
+static bool isIpAddress(const QChar *host, int length)
+{
+    bool isNumeric = true;
+    for (int i = length - 1; i >= 0; --i)
+    {
+        const QChar c = host[i];
+        if (c == QLatin1Char(':'))
+            return true;
+        if (c == QLatin1Char('.'))
+        {
+            if (isNumeric)
+                return true;
+
+            // Keep looking for a ':' in the rest of the host
+            isNumeric = false;
+            continue;
+        }
+        if (c.unicode() < '0' || c.unicode() > '9')
+            isNumeric = false;
+    }
+    return isNumeric;
+}
+
+int PublicSuffixList::getPublicSuffixPosition(const QStringRef &host)
+{
+    const QChar *data = host.unicode();
+    int length = host.size();
+
+    // Ignore the trailing dot of a fully qualified host
+    if (length > 0 && data[length - 1] == QLatin1Char('.'))
+        --length;
+
+    if (length == 0 || NumNodes == 0 || isIpAddress(data, length))
+        return -1;
+
+    // Walk down the trie from the top-level domain. The root node holds the implicit "*" rule,
+    // which makes any top-level domain a public suffix
+    int suffixPosition = -1;
+    const PublicSuffixNode *node = &Nodes[0];
+    int labelEnd = length;
+    while (labelEnd > 0)
+    {
+        int labelStart = labelEnd;
+        while (labelStart > 0 && data[labelStart - 1] != QLatin1Char('.'))
+            --labelStart;
+
+        // Empty labels are not valid
+        if (labelStart == labelEnd)
+            return -1;
+
+        // An exception rule makes the suffix end at the label that follows it
+        const PublicSuffixNode *child = findChild(*node, data + labelStart, labelEnd - labelStart);
+        if (child != nullptr && (child->Flags & Exception) != 0)
+        {
+            suffixPosition = labelEnd + 1;
+            break;
+        }
+
+        if ((node->Flags & Wildcard) != 0 || (child != nullptr && (child->Flags & Terminal) != 0))
+            suffixPosition = labelStart;
+
+        if (child == nullptr)
+            break;
+
+        node = child;
+        labelEnd = labelStart - 1;
+    }
+
+    return suffixPosition;
+}
+
+int PublicSuffixList::getRegistrableDomainPosition(const QStringRef &host)
+{
+    const int suffixPosition = getPublicSuffixPosition(host);
+    if (suffixPosition <= 0)
+        return -1;
+
+    // Include the label that precedes the public suffix
+    const QChar *data = host.unicode();
+    const int labelEnd = suffixPosition - 1;
+    int labelStart = labelEnd;
+    while (labelStart > 0 && data[labelStart - 1] != QLatin1Char('.'))
+        --labelStart;
+
+    return labelStart < labelEnd ? labelStart : -1;
+}
+
+QString PublicSuffixList::getRegistrableDomain(const QString &host)
+{
+    const int position = getRegistrableDomainPosition(QStringRef(&host));
+    if (position < 0)
+        return QString();
+
+    return host.mid(position);
+}
+
+const PublicSuffixNode *PublicSuffixList::findChild(const PublicSuffixNode &node, const QChar *label, int length)
+{
+    const PublicSuffixNode *first = Nodes + node.FirstChild;
+    int low = 0, high = static_cast<int>(node.NumChildren) - 1;
+    while (low <= high)
+    {
+        const int middle = low + (high - low) / 2;
+        const PublicSuffixNode &child = first[middle];
+        const int comparison = compareLabel(label, length, Labels + child.LabelOffset, child.LabelLength);
+        if (comparison == 0)
+            return &child;
+
+        if (comparison < 0)
+            high = middle - 1;
+        else
+            low = middle + 1;
+    }
+    return nullptr;
+}
@@ -0,0 +1,79 @@
+#ifndef PUBLICSUFFIXLIST_H
+#define PUBLICSUFFIXLIST_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <QString>
+#include <QStringRef>
+
+/**
+ * @struct PublicSuffixNode
+ * @brief A node of the compiled Public Suffix List, holding one domain label of at least one rule
+ */
+struct PublicSuffixNode
+{
+    /// Position of the node's label in the label data of the list
+    uint32_t LabelOffset;
+
+    /// Index of the node's first child. The children of a node are stored next to each other, sorted by their label
+    uint32_t FirstChild;
+
+    /// Number of children of the node
+    uint16_t NumChildren;
+
+    /// Length of the node's label
+    uint8_t LabelLength;
+
+    /// Combination of \ref PublicSuffixList::NodeFlag values
+    uint8_t Flags;
+};
+
+/**
+ * @class PublicSuffixList
+ * @brief Finds the public suffix (effective top-level domain) and the registrable domain of a host name, using the
+ *        rules of the Public Suffix List (https://publicsuffix.org/)
+ *
+ * The list is compiled into a trie of domain labels when the browser is built, and stored in flat arrays. A lookup
+ * visits one node per label of the host, starting from its top-level domain, and does not allocate any memory.
+ * Hosts are expected to be in lower case, with any internationalized labels in their ASCII compatible (punycode)
+ * form, which is the form given by QUrl::host(QUrl::FullyEncoded).
+ */
+class PublicSuffixList
+{
+public:
+    /// Flags of a \ref PublicSuffixNode
+    enum NodeFlag : uint8_t
+    {
+        Terminal  = 0x01,   /// A rule ends at the node
+        Wildcard  = 0x02,   /// Any label below the node is a public suffix ("*." rule)
+        Exception = 0x04    /// The node is not a public suffix, even if a wildcard rule says otherwise ("!" rule)
+    };
+
+    /// Returns the position of the public suffix in the given host, or -1 if the host does not have one,
+    /// as is the case with IP addresses
+    static int getPublicSuffixPosition(const QStringRef &host);
+
+    /// Returns the position of the registrable domain in the given host, which is its public suffix and the label
+    /// that precedes it. Returns -1 if the host does not have a registrable domain, or is a public suffix itself
+    static int getRegistrableDomainPosition(const QStringRef &host);
+
+    /// Returns the registrable domain of the given host (ex: websiteA.com; websiteB.co.uk), or an empty string if it has none
+    static QString getRegistrableDomain(const QString &host);
+
+private:
+    /// Returns the child of the node with the given label, or a nullptr if the node has no such child
+    static const PublicSuffixNode *findChild(const PublicSuffixNode &node, const QChar *label, int length);
+
+private:
+    /// Nodes of the compiled list, in breadth-first order. The first node is the root of the trie
+    static const PublicSuffixNode Nodes[];
+
+    /// Number of nodes in the compiled list
+    static const std::size_t NumNodes;
+
+    /// Labels of the nodes, which are referred to by their offset and length
+    static const char Labels[];
+};
+
+#endif // PUBLICSUFFIXLIST_H
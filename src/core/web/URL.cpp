@@ -1,3 +1,4 @@
+#include "PublicSuffixList.h"
 #include "URL.h"
 
 URL::URL() :
@@ -17,19 +18,13 @@ URL::URL(const QString &url, URL::ParsingMode parsingMode) :
 
 QString URL::getSecondLevelDomain() const
 {
-    const QString topLevelDomain = this->topLevelDomain();
-    const QString host = this->host();
+    // The public suffix list is compiled with internationalized labels in their ASCII compatible form
+    const QString host = this->host(QUrl::FullyEncoded).toLower();
+    const QString domain = PublicSuffixList::getRegistrableDomain(host);
 
-    if (topLevelDomain.isEmpty() || host.isEmpty())
-        return QString();
+    // Return the domain in the same form as QUrl::host()
+    if (domain.contains(QLatin1String("xn--")))
+        return QUrl::fromAce(domain.toLatin1());
 
-    QString domain = host.left(host.size() - topLevelDomain.size());
-
-    if (domain.count(QChar('.')) == 0)
-        return host;
-
-    while (domain.count(QChar('.')) != 0)
-        domain = domain.mid(domain.indexOf(QChar('.')) + 1);
-
-    return domain + topLevelDomain;
+    return domain;
 }
@@ -168,7 +168,8 @@ bool WebPage::acceptNavigationRequest(const QUrl &url, QWebEnginePage::Navigatio
     if (type != QWebEnginePage::NavigationTypeReload)
     {
         URL pageUrl(url);
-        m_mainFrameAdBlockScript = m_adBlockManager->getDomainJavaScript(pageUrl);
+        const adblock::DomainScripts &adBlockScripts = m_adBlockManager->getDomainJavaScript(pageUrl);
+        m_mainFrameAdBlockScript = adBlockScripts.PageScript;
 
         QWebEngineScriptCollection &scriptCollection = scripts();
         scriptCollection.clear();
@@ -176,27 +177,15 @@ bool WebPage::acceptNavigationRequest(const QUrl &url, QWebEnginePage::Navigatio
         for (auto &script : pageScripts)
             scriptCollection.insert(script);
 
-        if (!m_mainFrameAdBlockScript.isEmpty())
+        if (!adBlockScripts.UserScript.isEmpty())
         {
             QWebEngineScript adBlockScript;
-            adBlockScript.setSourceCode(m_mainFrameAdBlockScript);
+            adBlockScript.setSourceCode(adBlockScripts.UserScript);
             adBlockScript.setName(QLatin1String("viper-content-blocker-userworld"));
             adBlockScript.setRunsOnSubFrames(true);
             adBlockScript.setWorldId(QWebEngineScript::UserWorld);
             adBlockScript.setInjectionPoint(QWebEngineScript::DocumentCreation);
             scriptCollection.insert(adBlockScript);
-
-            // Inject into the DOM as a script tag
-            QString scriptAdjusted = m_mainFrameAdBlockScript;
-            m_mainFrameAdBlockScript.replace(QString("\\"), QString("\\\\"));
-            m_mainFrameAdBlockScript.replace(QString("${"), QString("\\${"));
-            const static QString mutationScript = QStringLiteral("function selfInject() { "
-                                             "try { let script = document.createElement('script'); "
-                                             "script.appendChild(document.createTextNode(`%1`)); "
-                                             "if (document.head || document.documentElement) { (document.head || document.documentElement).appendChild(script); } "
-                                             "else { setTimeout(selfInject, 100); } "
-                                             " } catch(exc) { console.error('Could not run mutation script: ' + exc); } } selfInject();");
-            m_mainFrameAdBlockScript = mutationScript.arg(m_mainFrameAdBlockScript);
         }
 
         const QString domainFilterStyle = m_adBlockManager->getDomainStylesheet(pageUrl);
@@ -394,9 +383,9 @@ void WebPage::onLoadFinished(bool ok)
 
     URL pageUrl(url());
 
-    QString adBlockStylesheet = m_adBlockManager->getStylesheet(pageUrl);
-    adBlockStylesheet.replace("'", "\\'");
-    runJavaScript(QString("document.body.insertAdjacentHTML('beforeend', '%1');").arg(adBlockStylesheet));
+    const std::vector<QString> stylesheetScripts = m_adBlockManager->getStylesheetScripts(pageUrl);
+    for (const QString &script : stylesheetScripts)
+        runJavaScript(script);
 
     if (!m_mainFrameAdBlockScript.isEmpty())
         runJavaScript(m_mainFrameAdBlockScript, QWebEngineScript::ApplicationWorld);
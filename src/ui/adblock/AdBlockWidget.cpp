@@ -99,7 +99,7 @@ void AdBlockWidget::editUserFilters()
 {
     CustomFilterEditor *editor = new CustomFilterEditor;
     connect(editor, &CustomFilterEditor::createUserSubscription, m_adBlockManager, &adblock::AdBlockManager::createUserSubscription);
-    connect(editor, &CustomFilterEditor::filtersModified, m_adBlockManager, &adblock::AdBlockManager::reloadSubscriptions);
+    connect(editor, &CustomFilterEditor::filtersModified, m_adBlockManager, &adblock::AdBlockManager::reloadUserFilters);
     editor->loadUserFilters();
     editor->show();
 }
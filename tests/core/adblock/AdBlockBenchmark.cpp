@@ -0,0 +1,447 @@
+#include "AdBlockFilterContainer.h"
+#include "AdBlockLog.h"
+#include "AdBlockRequestHandler.h"
+#include "AdBlockSubscription.h"
+#include "RequestContext.h"
+#include "StringPool.h"
+#include "VerdictCache.h"
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QUrl>
+#include <QWebEngineUrlRequestInfo>
+
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+using namespace adblock;
+
+/// A network request read from the request corpus
+struct CorpusRequest
+{
+    /// Line of the corpus file on which the request was found
+    int Line;
+
+    /// URL of the page that made the request
+    QUrl FirstPartyUrl;
+
+    /// URL of the requested resource
+    QUrl RequestUrl;
+
+    /// Type of the requested resource
+    QWebEngineUrlRequestInfo::ResourceType ResourceType;
+};
+
+/// Number of requests with each type of verdict
+struct VerdictCounts
+{
+    /// Requests that were blocked
+    int NumBlocked = 0;
+
+    /// Requests that were redirected to a resource
+    int NumRedirected = 0;
+
+    /// Requests that matched a blocking filter and were allowed by an exception filter
+    int NumAllowed = 0;
+
+    /// Requests that did not match any blocking filter
+    int NumUnmatched = 0;
+};
+
+/// Returns the resource type with the given name, using the type names of the WebExtensions webRequest API so
+/// that recorded request logs can be replayed as they are. Sets ok to false if the name is not recognized
+static QWebEngineUrlRequestInfo::ResourceType getResourceType(const QString &name, bool &ok)
+{
+    static const QHash<QString, QWebEngineUrlRequestInfo::ResourceType> resourceTypes = {
+        { QStringLiteral("main_frame"),     QWebEngineUrlRequestInfo::ResourceTypeMainFrame },
+        { QStringLiteral("sub_frame"),      QWebEngineUrlRequestInfo::ResourceTypeSubFrame },
+        { QStringLiteral("stylesheet"),     QWebEngineUrlRequestInfo::ResourceTypeStylesheet },
+        { QStringLiteral("script"),         QWebEngineUrlRequestInfo::ResourceTypeScript },
+        { QStringLiteral("image"),          QWebEngineUrlRequestInfo::ResourceTypeImage },
+        { QStringLiteral("imageset"),       QWebEngineUrlRequestInfo::ResourceTypeImage },
+        { QStringLiteral("font"),           QWebEngineUrlRequestInfo::ResourceTypeFontResource },
+        { QStringLiteral("object"),         QWebEngineUrlRequestInfo::ResourceTypeObject },
+        { QStringLiteral("plugin"),         QWebEngineUrlRequestInfo::ResourceTypePluginResource },
+        { QStringLiteral("xmlhttprequest"), QWebEngineUrlRequestInfo::ResourceTypeXhr },
+        { QStringLiteral("xhr"),            QWebEngineUrlRequestInfo::ResourceTypeXhr },
+        { QStringLiteral("fetch"),          QWebEngineUrlRequestInfo::ResourceTypeXhr },
+        { QStringLiteral("ping"),           QWebEngineUrlRequestInfo::ResourceTypePing },
+        { QStringLiteral("beacon"),         QWebEngineUrlRequestInfo::ResourceTypePing },
+        { QStringLiteral("media"),          QWebEngineUrlRequestInfo::ResourceTypeMedia },
+        { QStringLiteral("worker"),         QWebEngineUrlRequestInfo::ResourceTypeWorker },
+        { QStringLiteral("favicon"),        QWebEngineUrlRequestInfo::ResourceTypeFavicon },
+        { QStringLiteral("prefetch"),       QWebEngineUrlRequestInfo::ResourceTypePrefetch },
+        { QStringLiteral("csp_report"),     QWebEngineUrlRequestInfo::ResourceTypeCspReport },
+        { QStringLiteral("websocket"),      QWebEngineUrlRequestInfo::ResourceTypeSubResource },
+        { QStringLiteral("other"),          QWebEngineUrlRequestInfo::ResourceTypeSubResource }
+    };
+
+    auto it = resourceTypes.constFind(name.toLower());
+    ok = (it != resourceTypes.constEnd());
+    return ok ? it.value() : QWebEngineUrlRequestInfo::ResourceTypeSubResource;
+}
+
+/// Returns the name of the verdict, as written to golden files
+static QString getVerdictName(const Verdict &verdict)
+{
+    if (verdict.MatchedFilter == nullptr)
+        return QStringLiteral("none");
+
+    switch (verdict.Action)
+    {
+        case FilterAction::Allow:
+            return QStringLiteral("allow");
+        case FilterAction::Redirect:
+            return QStringLiteral("redirect");
+        case FilterAction::Block:
+        default:
+            return QStringLiteral("block");
+    }
+}
+
+/// Returns the peak resident memory of the process in bytes, or -1 if it cannot be determined on this platform
+static qint64 getPeakMemoryUsage()
+{
+#if defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if defined(Q_OS_MACOS)
+    return static_cast<qint64>(usage.ru_maxrss);
+#else
+    return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/// Formats a number of bytes in mebibytes
+static QString formatMemory(qint64 bytes)
+{
+    if (bytes < 0)
+        return QStringLiteral("unavailable");
+    return QString("%1 MiB").arg(static_cast<double>(bytes) / (1024.0 * 1024.0), 0, 'f', 1);
+}
+
+/// Formats a number of nanoseconds in milliseconds
+static QString formatMilliseconds(qint64 nanoseconds)
+{
+    return QString("%1 ms").arg(static_cast<double>(nanoseconds) / 1000000.0, 0, 'f', 2);
+}
+
+/// Reads the request corpus from the given file. Each line holds the first-party URL, request URL and resource type
+/// of a request, separated by tabs. Empty lines and lines starting with '#' are ignored. Returns false on error
+static bool loadCorpus(const QString &path, std::vector<CorpusRequest> &requests, QTextStream &err)
+{
+    QFile corpusFile(path);
+    if (!corpusFile.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        err << "Could not open request corpus " << path << "\n";
+        return false;
+    }
+
+    int lineNumber = 0;
+    while (!corpusFile.atEnd())
+    {
+        ++lineNumber;
+        const QString line = QString::fromUtf8(corpusFile.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith(QLatin1Char('#')))
+            continue;
+
+        const QStringList fields = line.split(QLatin1Char('\t'));
+        if (fields.size() != 3)
+        {
+            err << path << ":" << lineNumber << ": expected 3 tab-separated fields, found " << fields.size() << "\n";
+            return false;
+        }
+
+        bool ok = false;
+        CorpusRequest request { lineNumber, QUrl(fields.at(0)), QUrl(fields.at(1)), getResourceType(fields.at(2), ok) };
+        if (!ok)
+        {
+            err << path << ":" << lineNumber << ": unknown resource type \"" << fields.at(2) << "\"\n";
+            return false;
+        }
+
+        requests.push_back(std::move(request));
+    }
+
+    return true;
+}
+
+/// Reads the verdicts of a golden file, one per line, ignoring anything after the first tab of each line
+static bool loadGoldenFile(const QString &path, QStringList &verdicts, QTextStream &err)
+{
+    QFile goldenFile(path);
+    if (!goldenFile.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        err << "Could not open golden file " << path << "\n";
+        return false;
+    }
+
+    while (!goldenFile.atEnd())
+    {
+        const QString line = QString::fromUtf8(goldenFile.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith(QLatin1Char('#')))
+            continue;
+
+        verdicts.append(line.section(QLatin1Char('\t'), 0, 0));
+    }
+
+    return true;
+}
+
+/// Writes the verdict on each request, followed by the rule of the filter that determined it, to a golden file
+static bool saveGoldenFile(const QString &path, const std::vector<Verdict> &verdicts, QTextStream &err)
+{
+    QSaveFile goldenFile(path);
+    if (!goldenFile.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        err << "Could not write golden file " << path << "\n";
+        return false;
+    }
+
+    QTextStream stream(&goldenFile);
+    stream << "# Verdict on each request of the corpus, in order, and the rule that determined it\n";
+    for (const Verdict &verdict : verdicts)
+    {
+        stream << getVerdictName(verdict);
+        if (verdict.MatchedFilter != nullptr)
+            stream << "\t" << verdict.MatchedFilter->getRule();
+        stream << "\n";
+    }
+    stream.flush();
+
+    return goldenFile.commit();
+}
+
+/**
+ * Replays a corpus of network requests through the ad block filters, reporting the time taken to build the filters
+ * and to match each request, the peak memory of the process, and the number of requests with each verdict.
+ *
+ * Requests are matched in the same way as \ref RequestHandler::shouldBlockRequest, including the verdict cache,
+ * without logging them. Each pass over the corpus uses a new request handler, so the cache only helps with
+ * requests that are repeated within the corpus, as it would during a browsing session.
+ */
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("AdBlockBenchmark"));
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Replays a corpus of network requests through the ad block filters"));
+    parser.addHelpOption();
+
+    QCommandLineOption listOption(QStringLiteral("list"), QStringLiteral("Filter list to load. May be given more than once"), QStringLiteral("file"));
+    QCommandLineOption corpusOption(QStringLiteral("corpus"), QStringLiteral("Request corpus, with lines of <first-party URL>\\t<request URL>\\t<resource type>"), QStringLiteral("file"));
+    QCommandLineOption goldenOption(QStringLiteral("golden"), QStringLiteral("Golden file to compare the verdicts against"), QStringLiteral("file"));
+    QCommandLineOption writeGoldenOption(QStringLiteral("write-golden"), QStringLiteral("Writes the verdicts to a new golden file"), QStringLiteral("file"));
+    QCommandLineOption iterationsOption(QStringLiteral("iterations"), QStringLiteral("Number of passes over the corpus (default: 5)"), QStringLiteral("count"), QStringLiteral("5"));
+    parser.addOptions({ listOption, corpusOption, goldenOption, writeGoldenOption, iterationsOption });
+    parser.process(app);
+
+    const QStringList listPaths = parser.values(listOption);
+    const QString corpusPath = parser.value(corpusOption);
+    bool ok = false;
+    const int iterations = parser.value(iterationsOption).toInt(&ok);
+    if (listPaths.isEmpty() || corpusPath.isEmpty() || !ok || iterations < 1)
+    {
+        err << "A filter list, a request corpus and a positive number of iterations are required\n";
+        parser.showHelp(1);
+    }
+
+    std::vector<CorpusRequest> requests;
+    if (!loadCorpus(corpusPath, requests, err))
+        return 1;
+
+    // Load copies of the lists, so that the filter caches written next to them do not affect the original lists,
+    // and the first load of each list is always a full parse
+    QTemporaryDir listDir;
+    if (!listDir.isValid())
+    {
+        err << "Could not create a temporary directory for the filter lists\n";
+        return 1;
+    }
+
+    QStringList listCopies;
+    for (const QString &path : listPaths)
+    {
+        const QString copyPath = listDir.filePath(QString("%1-%2").arg(listCopies.size()).arg(QFileInfo(path).fileName()));
+        if (!QFile::copy(path, copyPath))
+        {
+            err << "Could not read filter list " << path << "\n";
+            return 1;
+        }
+        listCopies.append(copyPath);
+    }
+
+    QElapsedTimer timer;
+
+    std::vector<Subscription> subscriptions;
+    timer.start();
+    {
+        StringPool stringPool;
+        for (const QString &path : listCopies)
+        {
+            Subscription subscription(path);
+            subscription.load(nullptr, &stringPool);
+            subscriptions.push_back(std::move(subscription));
+        }
+    }
+    const qint64 parseTime = timer.nsecsElapsed();
+
+    timer.restart();
+    auto filterContainer = std::make_unique<const FilterContainer>(subscriptions);
+    const qint64 containerTime = timer.nsecsElapsed();
+
+    qint64 cachedLoadTime = 0;
+    {
+        std::vector<Subscription> cachedSubscriptions;
+        timer.restart();
+        StringPool stringPool;
+        for (const QString &path : listCopies)
+        {
+            Subscription subscription(path);
+            subscription.load(nullptr, &stringPool);
+            cachedSubscriptions.push_back(std::move(subscription));
+        }
+        cachedLoadTime = timer.nsecsElapsed();
+    }
+
+    const qint64 buildPeakMemory = getPeakMemoryUsage();
+
+    std::size_t numFilters = 0;
+    for (const Subscription &subscription : subscriptions)
+        numFilters += subscription.getNumFilters();
+
+    // Replay the corpus
+    std::vector<qint64> matchTimes;
+    matchTimes.reserve(requests.size() * static_cast<std::size_t>(iterations));
+
+    std::vector<Verdict> verdicts;
+    verdicts.reserve(requests.size());
+
+    AdBlockLog log;
+    for (int i = 0; i < iterations; ++i)
+    {
+        RequestHandler requestHandler(&log, nullptr);
+        for (const CorpusRequest &request : requests)
+        {
+            timer.restart();
+            const RequestContext context(request.RequestUrl, request.FirstPartyUrl, request.ResourceType);
+            const Verdict verdict = requestHandler.getVerdict(*filterContainer, context);
+            matchTimes.push_back(timer.nsecsElapsed());
+
+            if (i == 0)
+                verdicts.push_back(verdict);
+        }
+    }
+
+    const qint64 peakMemory = getPeakMemoryUsage();
+
+    VerdictCounts counts;
+    for (const Verdict &verdict : verdicts)
+    {
+        if (verdict.MatchedFilter == nullptr)
+            ++counts.NumUnmatched;
+        else if (verdict.Action == FilterAction::Allow)
+            ++counts.NumAllowed;
+        else if (verdict.Action == FilterAction::Redirect)
+            ++counts.NumRedirected;
+        else
+            ++counts.NumBlocked;
+    }
+
+    // Report the results
+    out << "Filter lists:      " << listPaths.size() << " (" << numFilters << " filters)\n"
+        << "Parse lists:       " << formatMilliseconds(parseTime) << "\n"
+        << "Load cached lists: " << formatMilliseconds(cachedLoadTime) << "\n"
+        << "Build container:   " << formatMilliseconds(containerTime) << "\n"
+        << "Filter index:      " << formatMemory(static_cast<qint64>(filterContainer->getFilterIndexMemoryUsage())) << "\n"
+        << "Requests:          " << requests.size() << " x " << iterations << " passes\n";
+
+    if (!matchTimes.empty())
+    {
+        const qint64 totalTime = std::accumulate(matchTimes.cbegin(), matchTimes.cend(), qint64(0));
+        std::sort(matchTimes.begin(), matchTimes.end());
+        auto percentile = [&matchTimes](double p) {
+            const std::size_t index = static_cast<std::size_t>(p * static_cast<double>(matchTimes.size() - 1) + 0.5);
+            return matchTimes[std::min(index, matchTimes.size() - 1)];
+        };
+
+        out << "ns/request:        mean " << (totalTime / static_cast<qint64>(matchTimes.size()))
+            << ", min " << matchTimes.front()
+            << ", p50 " << percentile(0.5)
+            << ", p90 " << percentile(0.9)
+            << ", p99 " << percentile(0.99)
+            << ", p99.9 " << percentile(0.999)
+            << ", max " << matchTimes.back() << "\n";
+    }
+
+    out << "Verdicts:          " << counts.NumBlocked << " blocked, " << counts.NumRedirected << " redirected, "
+        << counts.NumAllowed << " allowed by exception, " << counts.NumUnmatched << " unmatched\n"
+        << "Peak memory:       " << formatMemory(buildPeakMemory) << " after build, " << formatMemory(peakMemory) << " after replay\n";
+    out.flush();
+
+    if (parser.isSet(writeGoldenOption) && !saveGoldenFile(parser.value(writeGoldenOption), verdicts, err))
+        return 1;
+
+    if (!parser.isSet(goldenOption))
+        return 0;
+
+    QStringList goldenVerdicts;
+    if (!loadGoldenFile(parser.value(goldenOption), goldenVerdicts, err))
+        return 1;
+
+    if (goldenVerdicts.size() != static_cast<int>(verdicts.size()))
+    {
+        err << "Golden file has " << goldenVerdicts.size() << " verdicts, but the corpus has " << verdicts.size() << " requests\n";
+        return 1;
+    }
+
+    int numMismatches = 0;
+    for (std::size_t i = 0; i < verdicts.size(); ++i)
+    {
+        const QString verdictName = getVerdictName(verdicts[i]);
+        if (verdictName == goldenVerdicts.at(static_cast<int>(i)))
+            continue;
+
+        if (++numMismatches <= 20)
+        {
+            const CorpusRequest &request = requests[i];
+            err << corpusPath << ":" << request.Line << ": expected " << goldenVerdicts.at(static_cast<int>(i))
+                << ", got " << verdictName;
+            if (verdicts[i].MatchedFilter != nullptr)
+                err << " (" << verdicts[i].MatchedFilter->getRule() << ")";
+            err << " for " << request.RequestUrl.toString() << "\n";
+        }
+    }
+
+    if (numMismatches > 0)
+    {
+        err << numMismatches << " of " << verdicts.size() << " verdicts differ from the golden file\n";
+        return 1;
+    }
+
+    out << "Golden file:       all " << verdicts.size() << " verdicts match\n";
+    return 0;
+}
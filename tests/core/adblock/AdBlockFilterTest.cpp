@@ -1,13 +1,70 @@
 #include "AdBlockFilter.h"
 #include "AdBlockFilterParser.h"
+#include "AdBlockLog.h"
+#include "CosmeticFilterIndex.h"
+#include "AdBlockFilterContainer.h"
+#include "AdBlockRequestHandler.h"
+#include "AdBlockSubscription.h"
+#include "FilterArena.h"
+#include "FilterBucket.h"
+#include "RequestContext.h"
+#include "ResourceStore.h"
+#include "StringPool.h"
+#include "VerdictCache.h"
 
+#include <atomic>
+#include <cstdlib>
 #include <memory>
+#include <QByteArray>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
 #include <QString>
+#include <QTemporaryDir>
 #include <QtTest>
 #include <QUrl>
 
 using namespace adblock;
 
+#if defined(__GLIBC__)
+extern "C" void *__libc_malloc(std::size_t size);
+extern "C" void *__libc_calloc(std::size_t count, std::size_t size);
+extern "C" void *__libc_realloc(void *ptr, std::size_t size);
+
+/// True while the heap allocations of the test process are being counted
+static std::atomic_bool countingAllocations { false };
+
+/// Number of heap allocations made while countingAllocations was true
+static std::atomic<quint64> numAllocations { 0 };
+
+/// Increments the allocation counter if allocations are being counted
+static void countAllocation()
+{
+    if (countingAllocations.load(std::memory_order_relaxed))
+        numAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+// QString and operator new both allocate through malloc, which is replaced here to count heap allocations
+extern "C" void *malloc(std::size_t size) noexcept
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(std::size_t count, std::size_t size) noexcept
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, std::size_t size) noexcept
+{
+    countAllocation();
+    return __libc_realloc(ptr, size);
+}
+#endif
+
 class AdBlockFilterTest : public QObject
 {
     Q_OBJECT
@@ -15,12 +72,31 @@ class AdBlockFilterTest : public QObject
 public:
     AdBlockFilterTest();
 
-    QString getSecondLevelDomain(const QUrl &url) const;
-
 private Q_SLOTS:
     void testCosmeticFilterMatch();
     void testFilterOptionMatches();
     void testRedirectFilterMatch();
+    void testFilterBucketMatch();
+    void testEntityDomainFilters();
+    void testDomainFilterLookup_data();
+    void testDomainFilterLookup();
+    void testCosmeticFilterIndex();
+    void testRegExpPrefilter();
+    void testRegExpLiteralEscapes_data();
+    void testRegExpLiteralEscapes();
+    void testFilterMask();
+    void testStringPool();
+    void testFilterArena();
+    void testFilterSerialization();
+    void testVerdictCache();
+    void testLogRingBuffer();
+    void testFilterProfiling();
+    void testRequestContext();
+    void testRequestContextAllocations();
+    void testElementTypeQueries();
+    void testResourceStore();
+    void testStylesheetScripts();
+    void testSubscriptionReload();
 
 private:
     std::unique_ptr<Filter> domainCSSFilter;
@@ -46,25 +122,6 @@ AdBlockFilterTest::AdBlockFilterTest()
     blockScriptDomainRule = parser.makeFilter(QLatin1String("||mssl.fwmrm.net$script,domain=zerohedge.com"));
 }
 
-QString AdBlockFilterTest::getSecondLevelDomain(const QUrl &url) const
-{
-    const QString topLevelDomain = url.topLevelDomain();
-    const QString host = url.host();
-
-    if (topLevelDomain.isEmpty() || host.isEmpty())
-        return QString();
-
-    QString domain = host.left(host.size() - topLevelDomain.size());
-
-    if (domain.count(QChar('.')) == 0)
-        return host;
-
-    while (domain.count(QChar('.')) != 0)
-        domain = domain.mid(domain.indexOf(QChar('.')) + 1);
-
-    return domain + topLevelDomain;
-}
-
 void AdBlockFilterTest::testCosmeticFilterMatch()
 {
     QUrl shouldMatchUrl1 = QUrl::fromUserInput(QLatin1String("https://developers.slashdot.org/story/18/07/07/0342201/is-c-a-really-terrible-language"));
@@ -81,51 +138,955 @@ void AdBlockFilterTest::testCosmeticFilterMatch()
 void AdBlockFilterTest::testFilterOptionMatches()
 {
     QUrl allowedUrl = QUrl::fromUserInput(QLatin1String("https://subdomain.mycdn.com/videos/thumbnails/5.jpg"));
+    QUrl firstPartyUrl(QLatin1String("https://www.watchvid.com/watch?id=123456"));
 
-    QString requestUrl = allowedUrl.toString(QUrl::FullyEncoded).toLower();
-    QString firstPartyUrl = QLatin1String("https://www.watchvid.com/watch?id=123456");
+    // Perform document type and third party type checking
+    RequestContext context(allowedUrl, firstPartyUrl, ElementType::Image | ElementType::ThirdParty);
 
-    QString baseUrl = getSecondLevelDomain(QUrl(firstPartyUrl)).toLower();
+    QVERIFY2(allowDomainRule->isMatch(context), "Allow rule should match the request");
+    QVERIFY2(blockDomainRule->isMatch(context), "Block rule should match the request");
 
-    if (baseUrl.isEmpty())
-        baseUrl = QUrl(firstPartyUrl).host().toLower();
+    context = RequestContext(QUrl(QLatin1String("https://mssl.fwmrm.net/p/nbcu_live/AdManager.js")), QUrl(QLatin1String("https://zerohedge.com/")),
+                             ElementType::Script | ElementType::ThirdParty);
+    QVERIFY2(blockScriptDomainRule->isMatch(context), "Block rule should match the request");
 
-    ElementType elemType = ElementType::Image | ElementType::ThirdParty;
+    // A network filter that only excludes domains applies to the requests of every other page
+    FilterParser parser(nullptr);
+    std::unique_ptr<Filter> excludedDomainRule = parser.makeFilter(QLatin1String("||adserver.net^$script,domain=~adserver-owner.com|~partner.org"));
+    const QUrl scriptUrl(QLatin1String("https://cdn.adserver.net/ads.js"));
 
-    // Perform document type and third party type checking
-    QString domain = allowedUrl.host().toLower();
-    if (domain.startsWith(QLatin1String("www.")))
-        domain = domain.mid(4);
-    if (domain.isEmpty())
-        domain = getSecondLevelDomain(allowedUrl);
-
-    QVERIFY2(allowDomainRule->isMatch(baseUrl, requestUrl, domain, elemType), "Allow rule should match the request");
-    QVERIFY2(blockDomainRule->isMatch(baseUrl, requestUrl, domain, elemType), "Block rule should match the request");
-    
-    baseUrl = QLatin1String("zerohedge.com");
-    requestUrl = QLatin1String("https://mssl.fwmrm.net/p/nbcu_live/AdManager.js");
-    domain = QLatin1String("mssl.fwmrm.net");
-    elemType = ElementType::Script | ElementType::ThirdParty;
-    QVERIFY2(blockScriptDomainRule->isMatch(baseUrl, requestUrl, domain, elemType), "Block rule should match the request"); 
+    context = RequestContext(scriptUrl, QUrl(QLatin1String("https://news.example.org/")), ElementType::Script | ElementType::ThirdParty);
+    QVERIFY2(excludedDomainRule->isMatch(context), "Filter with only excluded domains should match requests of other pages");
+
+    context = RequestContext(scriptUrl, QUrl(QLatin1String("https://www.adserver-owner.com/")), ElementType::Script | ElementType::ThirdParty);
+    QVERIFY2(!excludedDomainRule->isMatch(context), "Filter should not match the requests of an excluded domain");
+
+    context = RequestContext(scriptUrl, QUrl(QLatin1String("https://shop.partner.org/")), ElementType::Script | ElementType::ThirdParty);
+    QVERIFY2(!excludedDomainRule->isMatch(context), "Filter should not match the requests of a subdomain of an excluded domain");
 }
 
 void AdBlockFilterTest::testRedirectFilterMatch()
 {
     QUrl requestUrl = QUrl::fromUserInput(QLatin1String("https://ssl.google-analytics.com/ga.js"));
-    QString requestUrlStr = requestUrl.toString(QUrl::FullyEncoded).toLower();
-
     QUrl firstPartyUrl = QUrl::fromUserInput(QLatin1String("https://unrelatedsite.com"));
 
-    QString baseUrl = getSecondLevelDomain(QUrl(firstPartyUrl)).toLower();
-    ElementType elemType = ElementType::Script | ElementType::ThirdParty;
+    const RequestContext context(requestUrl, firstPartyUrl, QWebEngineUrlRequestInfo::ResourceTypeScript);
+    QCOMPARE(context.getElementType(), ElementType::Script | ElementType::ThirdParty);
+
+    QVERIFY2(redirectScriptRule->isMatch(context), "Block rule should match the request");
+}
+
+void AdBlockFilterTest::testFilterBucketMatch()
+{
+    FilterParser parser(nullptr);
+    std::vector<std::unique_ptr<Filter>> filters;
+    filters.push_back(parser.makeFilter(QLatin1String("/banners/ad_")));
+    filters.push_back(parser.makeFilter(QLatin1String("||tracker.net^$third-party")));
+    filters.push_back(parser.makeFilter(QLatin1String("||cdn.example.com/*/pixel.gif")));
+    filters.push_back(parser.makeFilter(QLatin1String("-advert-")));
+
+    FilterBucket bucket;
+    for (auto &filter : filters)
+        bucket.add(filter.get());
+    bucket.build();
+
+    const QUrl firstPartyUrl(QLatin1String("https://example.org/"));
+    auto findMatch = [&](const char *requestUrl) {
+        return bucket.findMatch(RequestContext(QUrl(QLatin1String(requestUrl)), firstPartyUrl, ElementType::Image | ElementType::ThirdParty));
+    };
+
+    QCOMPARE(bucket.size(), filters.size());
+    QCOMPARE(findMatch("https://site.com/banners/ad_728.png"), filters.at(0).get());
+    QCOMPARE(findMatch("https://a.tracker.net/t?id=1"), filters.at(1).get());
+    QCOMPARE(findMatch("https://cdn.example.com/a/b/pixel.gif"), filters.at(2).get());
+    QCOMPARE(findMatch("https://news.site.com/img-advert-1.jpg"), filters.at(3).get());
+
+    QVERIFY2(findMatch("https://site.com/mybanners/ad.png") == nullptr,
+             "Filter bucket should not match a request without a filter's token");
+    QVERIFY2(findMatch("https://nottracker.net/t") == nullptr,
+             "Filter bucket should not match a request on a different domain");
+}
+
+void AdBlockFilterTest::testEntityDomainFilters()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QString listPath = dir.filePath(QLatin1String("filters.txt"));
+    QFile listFile(listPath);
+    QVERIFY(listFile.open(QIODevice::WriteOnly | QIODevice::Text));
+    listFile.write("[Adblock Plus 2.0]\n"
+                   "! Title: Entity filter test\n"
+                   "||google.^\n"
+                   "||tracker.co.uk^\n");
+    listFile.close();
+
+    std::vector<Subscription> subscriptions;
+    Subscription subscription(listPath);
+    subscription.load(nullptr);
+    subscriptions.push_back(std::move(subscription));
+    const FilterContainer filterContainer(subscriptions);
+
+    auto findFilter = [&filterContainer](const char *url) {
+        const QUrl requestUrl(QLatin1String(url));
+        return filterContainer.findBlockingRequestFilter(RequestContext(requestUrl, QUrl(QLatin1String("https://example.org/")), ElementType::Script));
+    };
+
+    // Entity filters apply to the domain under any public suffix
+    Filter *filter = findFilter("https://www.google.com/ads.js");
+    QVERIFY2(filter != nullptr, "Entity filter should match a domain with a single label public suffix");
+    QCOMPARE(filter->getRule(), QLatin1String("||google.^"));
+    QVERIFY2(findFilter("https://ads.google.co.uk/ads.js") != nullptr, "Entity filter should match a domain with a multi-label public suffix");
+    QVERIFY2(findFilter("https://google.evil.com/ads.js") == nullptr, "Entity filter should not match a different registrable domain");
+    QVERIFY2(findFilter("https://mygoogle.com/ads.js") == nullptr, "Entity filter should only match whole labels");
+
+    QVERIFY(findFilter("https://cdn.tracker.co.uk/t.js") != nullptr);
+    QVERIFY(findFilter("https://tracker.co.uk.example.com/t.js") == nullptr);
+}
+
+void AdBlockFilterTest::testDomainFilterLookup_data()
+{
+    QTest::addColumn<bool>("useIndex");
+    QTest::addColumn<QString>("requestUrl");
+
+    QTest::newRow("index hit") << true << QString("https://cdn.ads2500.example.com/ad.js");
+    QTest::newRow("index miss") << true << QString("https://www.unrelated-site.org/app.js");
+    QTest::newRow("linear hit") << false << QString("https://cdn.ads2500.example.com/ad.js");
+    QTest::newRow("linear miss") << false << QString("https://www.unrelated-site.org/app.js");
+}
+
+void AdBlockFilterTest::testDomainFilterLookup()
+{
+    QFETCH(bool, useIndex);
+    QFETCH(QString, requestUrl);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    FilterParser parser(nullptr);
+    std::vector<std::unique_ptr<Filter>> filters;
+
+    QByteArray list("[Adblock Plus 2.0]\n");
+    for (int i = 0; i < 5000; ++i)
+    {
+        const QString rule = QString("||ads%1.example.com^").arg(i);
+        filters.push_back(parser.makeFilter(rule));
+        list.append(rule.toUtf8()).append('\n');
+    }
+
+    const QString listPath = dir.filePath(QLatin1String("filters.txt"));
+    QFile listFile(listPath);
+    QVERIFY(listFile.open(QIODevice::WriteOnly | QIODevice::Text));
+    listFile.write(list);
+    listFile.close();
+
+    std::vector<Subscription> subscriptions;
+    Subscription subscription(listPath);
+    subscription.load(nullptr);
+    subscriptions.push_back(std::move(subscription));
+    const FilterContainer filterContainer(subscriptions);
+
+    const RequestContext context(QUrl(requestUrl), QUrl(QLatin1String("https://example.org/")), ElementType::Script);
+
+    // Linear scan over the domain filters, as done before they were indexed by the hash of their domain
+    auto findLinearMatch = [&filters, &context]() -> Filter* {
+        for (const std::unique_ptr<Filter> &filter : filters)
+        {
+            if (filter->isMatch(context))
+                return filter.get();
+        }
+        return nullptr;
+    };
+
+    Filter *expected = findLinearMatch();
+    Filter *result = nullptr;
+    if (useIndex)
+    {
+        QBENCHMARK {
+            result = filterContainer.findBlockingRequestFilter(context);
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            result = findLinearMatch();
+        }
+    }
+
+    // The filters of the container and of the linear scan are separate objects, so they are compared by their rule
+    QCOMPARE(result != nullptr, expected != nullptr);
+    if (result != nullptr)
+        QCOMPARE(result->getRule(), expected->getRule());
+}
+
+void AdBlockFilterTest::testCosmeticFilterIndex()
+{
+    FilterParser parser(nullptr);
+    std::vector<std::unique_ptr<Filter>> filters;
+    filters.push_back(parser.makeFilter(QLatin1String("example.com,~shop.example.com##.ad")));
+    filters.push_back(parser.makeFilter(QLatin1String("google.##.sponsored")));
+    filters.push_back(parser.makeFilter(QLatin1String("~news.org##.banner")));
+    filters.push_back(parser.makeFilter(QLatin1String("example.com,www.example.com##.promo")));
+
+    CosmeticFilterIndex index;
+    for (auto &filter : filters)
+        index.add(filter.get());
+
+    QCOMPARE(index.size(), filters.size());
+
+    std::vector<Filter*> expected = { filters.at(0).get(), filters.at(2).get(), filters.at(3).get() };
+    QVERIFY2(index.findMatches(QLatin1String("www.example.com")) == expected,
+             "Cosmetic filter index should find each filter of the host and its parent domains exactly once");
+
+    expected = { filters.at(2).get(), filters.at(3).get() };
+    QVERIFY2(index.findMatches(QLatin1String("shop.example.com")) == expected,
+             "Cosmetic filter index should not return filters whitelisted on the host");
+
+    expected = { filters.at(1).get(), filters.at(2).get() };
+    QVERIFY2(index.findMatches(QLatin1String("www.google.de")) == expected,
+             "Cosmetic filter index should match entity domains");
+    QVERIFY2(index.findMatches(QLatin1String("www.google.co.uk")) == expected,
+             "Cosmetic filter index should match entity domains with a multi-label public suffix");
+
+    QVERIFY2(index.findMatches(QLatin1String("news.org")).empty(),
+             "Cosmetic filter index should not match any filter on news.org");
+}
+
+void AdBlockFilterTest::testRegExpPrefilter()
+{
+    FilterParser parser(nullptr);
+    std::vector<std::unique_ptr<Filter>> filters;
+    filters.push_back(parser.makeFilter(QLatin1String("/banner[0-9]+\\.gif/")));
+    filters.push_back(parser.makeFilter(QLatin1String("/\\/ads\\/[a-z]+\\.js/")));
+    filters.push_back(parser.makeFilter(QLatin1String("/^https?:\\/\\/[a-z]{8,15}\\.(com|net)\\/$/")));
+    filters.push_back(parser.makeFilter(QLatin1String("/^https?:\\/\\/[0-9]{1,3}(\\.[0-9]{1,3}){3}\\//$third-party")));
+
+    FilterBucket bucket;
+    for (auto &filter : filters)
+        bucket.add(filter.get());
+    bucket.build();
+
+    const QUrl firstPartyUrl(QLatin1String("https://example.org/"));
+    auto makeContext = [&](const char *requestUrl) {
+        return RequestContext(QUrl(QLatin1String(requestUrl)), firstPartyUrl, ElementType::Script | ElementType::ThirdParty);
+    };
+
+    // Evaluations of the expressions are only counted while profiling
+    QVERIFY(filters.at(0)->isMatch(makeContext("https://site.com/banner12.gif")));
+    QCOMPARE(filters.at(0)->getNumRegExpEvaluations(), quint32(0));
+
+    Filter::setProfilingEnabled(true);
+
+    QCOMPARE(bucket.findMatch(makeContext("https://site.com/banner12.gif")), filters.at(0).get());
+    QCOMPARE(bucket.findMatch(makeContext("https://site.com/ads/popup.js")), filters.at(1).get());
+    QCOMPARE(bucket.findMatch(makeContext("https://abcdefghij.net/")), filters.at(2).get());
+    QCOMPARE(bucket.findMatch(makeContext("https://10.20.30.40/x.js")), filters.at(3).get());
+
+    // The expression should not be evaluated against URLs that lack the literal string found in it
+    const quint32 numEvaluations = filters.at(0)->getNumRegExpEvaluations();
+    QVERIFY(numEvaluations > 0);
+    QVERIFY(!filters.at(0)->isMatch(makeContext("https://site.com/logo.gif")));
+    QCOMPARE(filters.at(0)->getNumRegExpEvaluations(), numEvaluations);
+
+    Filter::setProfilingEnabled(false);
+
+    QVERIFY2(bucket.findMatch(makeContext("https://site.com/index.html")) == nullptr,
+             "Regular expression filters should not match an unrelated request");
+}
+
+void AdBlockFilterTest::testRegExpLiteralEscapes_data()
+{
+    QTest::addColumn<QString>("rule");
+    QTest::addColumn<QString>("requestUrl");
+
+    // The operands of these escape sequences must not be taken for literal characters of the URL
+    QTest::newRow("hex") << QString("/foo\\x2fbar/") << QString("https://site.com/foo/bar");
+    QTest::newRow("hex braces") << QString("/foo\\x{2f}bar/") << QString("https://site.com/foo/bar");
+    QTest::newRow("octal braces") << QString("/foo\\o{57}bar/") << QString("https://site.com/foo/bar");
+    QTest::newRow("octal digits") << QString("/img\\0561\\.gif/") << QString("https://site.com/img.1.gif");
+    QTest::newRow("property") << QString("/ad\\p{L}banner/") << QString("https://site.com/adxbanner.js");
+    QTest::newRow("property letter") << QString("/ad\\PLbanner/") << QString("https://site.com/ad_banner.js");
+    QTest::newRow("named back-reference") << QString("/(?<n>ad)s\\k<n>vert/") << QString("https://site.com/adsadvert.png");
+    QTest::newRow("relative back-reference") << QString("/(ad)s\\g{-1}vert/") << QString("https://site.com/adsadvert.png");
+}
+
+void AdBlockFilterTest::testRegExpLiteralEscapes()
+{
+    QFETCH(QString, rule);
+    QFETCH(QString, requestUrl);
+
+    FilterParser parser(nullptr);
+    std::unique_ptr<Filter> filter = parser.makeFilter(rule);
+    QCOMPARE(filter->getCategory(), FilterCategory::RegExp);
+
+    const RequestContext context(QUrl(requestUrl), QUrl(QLatin1String("https://example.org/")), ElementType::Image | ElementType::ThirdParty);
+    Filter::setProfilingEnabled(true);
+    const bool isMatch = filter->isMatch(context);
+    Filter::setProfilingEnabled(false);
+    QVERIFY2(isMatch, "The literal prefilter should not reject a URL that the expression matches");
+    QCOMPARE(filter->getNumRegExpEvaluations(), quint32(1));
+}
+
+void AdBlockFilterTest::testFilterMask()
+{
+    FilterParser parser(nullptr);
+    std::vector<std::unique_ptr<Filter>> filters;
+    filters.push_back(parser.makeFilter(QLatin1String("/banners/ad_")));
+    filters.push_back(parser.makeFilter(QLatin1String("||tracker.net^$third-party")));
+    filters.push_back(parser.makeFilter(QLatin1String("||cdn.example.com^$image,script,~third-party")));
+    filters.push_back(parser.makeFilter(QLatin1String("@@||example.com^$~xmlhttprequest,~image")));
+    filters.push_back(parser.makeFilter(QLatin1String("||example.com^$inline-script")));
+    filters.push_back(parser.makeFilter(QLatin1String("-advert-$csp=script-src 'none'")));
+    filters.push_back(parser.makeFilter(QLatin1String("||popups.example.net^$popup")));
+    filters.push_back(parser.makeFilter(QLatin1String("||ads.example.net^$script,popup,match-case")));
+    filters.push_back(parser.makeFilter(QLatin1String("@@||example.com^$elemhide")));
+
+    const std::vector<ElementType> requestTypes = {
+        ElementType::XMLHTTPRequest, ElementType::Document, ElementType::Object, ElementType::Subdocument,
+        ElementType::Image, ElementType::Script, ElementType::Stylesheet, ElementType::WebSocket,
+        ElementType::ObjectSubrequest, ElementType::InlineScript, ElementType::Ping, ElementType::CSP,
+        ElementType::Other, ElementType::Image | ElementType::Script, ElementType::XMLHTTPRequest | ElementType::Other
+    };
+
+    const QUrl requestUrl(QLatin1String("https://site.com/banners/ad_1.png"));
+    const QUrl firstPartyUrl(QLatin1String("https://example.org/"));
+    for (const auto &filter : filters)
+    {
+        const FilterMask mask(filter.get());
+        for (ElementType requestType : requestTypes)
+        {
+            const RequestContext firstPartyContext(requestUrl, firstPartyUrl, requestType);
+            const RequestContext thirdPartyContext(requestUrl, firstPartyUrl, requestType | ElementType::ThirdParty);
+            QCOMPARE(mask.isMatch(requestType), filter->isOptionMatch(firstPartyContext));
+            QCOMPARE(mask.isMatch(requestType | ElementType::ThirdParty), filter->isOptionMatch(thirdPartyContext));
+        }
+    }
+}
+
+void AdBlockFilterTest::testStringPool()
+{
+    FilterParser parser(nullptr);
+    std::unique_ptr<Filter> first = parser.makeFilter(QLatin1String("||cdn.example.com/ads.js$script,redirect=noopjs,domain=example.org"));
+    std::unique_ptr<Filter> second = parser.makeFilter(QLatin1String("||cdn.example.net/ads.js$script,redirect=noopjs,domain=example.org"));
+    QVERIFY(first->getRedirectName().constData() != second->getRedirectName().constData());
+
+    StringPool stringPool;
+    first->internStrings(stringPool);
+    second->internStrings(stringPool);
+
+    // Two rules, two evaluation strings, one redirect name and one domain
+    QCOMPARE(stringPool.size(), 6);
+    QCOMPARE(first->getRedirectName(), QLatin1String("noopjs"));
+    QVERIFY2(first->getRedirectName().constData() == second->getRedirectName().constData(),
+             "Interned option values should share their data");
+    QVERIFY(first->isDomainStyleMatch(QLatin1String("www.example.org")));
+    QVERIFY(second->isDomainStyleMatch(QLatin1String("example.org")));
+
+    // The same rule in another list shares the rule and evaluation strings of the first
+    std::unique_ptr<Filter> duplicate = parser.makeFilter(QLatin1String("||cdn.example.com/ads.js$script,redirect=noopjs,domain=example.org"));
+    duplicate->internStrings(stringPool);
+    QCOMPARE(stringPool.size(), 6);
+    QVERIFY(duplicate->getRule().constData() == first->getRule().constData());
+    QVERIFY(duplicate->getEvalString().constData() == first->getEvalString().constData());
+}
+
+void AdBlockFilterTest::testFilterArena()
+{
+    FilterArena arena;
+    QCOMPARE(arena.size(), std::size_t(0));
+
+    std::vector<Filter> firstBlock;
+    firstBlock.emplace_back(QLatin1String("||ads.example.com^"));
+    firstBlock.emplace_back(QLatin1String("||tracker.example.com^"));
+    arena.addBlock(std::move(firstBlock));
+
+    const Filter *firstFilter = arena.at(0);
+
+    std::vector<Filter> secondBlock;
+    secondBlock.emplace_back(QLatin1String("example.org##.banner"));
+    arena.addBlock(std::move(secondBlock));
+    arena.addBlock(std::vector<Filter>());
+
+    Filter *copy = arena.addCopy(*arena.at(1));
+
+    // Filters keep their addresses and their order as blocks are added
+    QCOMPARE(arena.size(), std::size_t(4));
+    QVERIFY(arena.at(0) == firstFilter);
+    QCOMPARE(arena.at(0)->getRule(), QLatin1String("||ads.example.com^"));
+    QCOMPARE(arena.at(1)->getRule(), QLatin1String("||tracker.example.com^"));
+    QCOMPARE(arena.at(2)->getRule(), QLatin1String("example.org##.banner"));
+    QVERIFY(arena.at(3) == copy);
+    QCOMPARE(copy->getRule(), QLatin1String("||tracker.example.com^"));
+}
+
+void AdBlockFilterTest::testFilterSerialization()
+{
+    FilterParser parser(nullptr);
+    std::unique_ptr<Filter> regExpRule = parser.makeFilter(QLatin1String("/banner\\d+\\.gif/$image,domain=example.org|~shop.example.org"));
+
+    QByteArray buffer;
+    {
+        QDataStream out(&buffer, QIODevice::WriteOnly);
+        out << *blockDomainRule << *allowDomainRule << *regExpRule;
+    }
+
+    Filter blockCopy(QString()), allowCopy(QString()), regExpCopy(QString());
+    QDataStream in(buffer);
+    in >> blockCopy >> allowCopy >> regExpCopy;
+    QCOMPARE(in.status(), QDataStream::Ok);
+
+    QCOMPARE(blockCopy.getRule(), blockDomainRule->getRule());
+    QCOMPARE(blockCopy.getCategory(), blockDomainRule->getCategory());
+    QCOMPARE(allowCopy.isException(), allowDomainRule->isException());
+
+    QUrl requestUrl(QLatin1String("https://subdomain.mycdn.com/videos/thumbnails/5.jpg"));
+    const RequestContext thirdPartyContext(requestUrl, QUrl(QLatin1String("https://watchvid.com/")), ElementType::Image | ElementType::ThirdParty);
+    QVERIFY2(blockCopy.isMatch(thirdPartyContext),
+             "Deserialized blocking filter should match the same request as the original");
+    QVERIFY2(allowCopy.isMatch(thirdPartyContext),
+             "Deserialized exception filter should match the same request as the original");
+
+    requestUrl = QUrl(QLatin1String("https://cdn.example.org/banner12.gif"));
+    QVERIFY2(regExpCopy.isMatch(RequestContext(requestUrl, QUrl(QLatin1String("https://example.org/")), ElementType::Image)),
+             "Deserialized regular expression filter should match the same request as the original");
+    QVERIFY2(!regExpCopy.isMatch(RequestContext(requestUrl, QUrl(QLatin1String("https://shop.example.org/")), ElementType::Image)),
+             "Deserialized regular expression filter should retain its domain whitelist");
+}
+
+void AdBlockFilterTest::testVerdictCache()
+{
+    VerdictCache cache(2);
+
+    const QString baseUrl = QLatin1String("watchvid.com");
+    const QString requestUrl = QLatin1String("https://subdomain.mycdn.com/videos/thumbnails/5.jpg");
+    const quint64 key = VerdictCache::getKey(baseUrl, requestUrl, ElementType::Image);
+
+    QVERIFY2(key != VerdictCache::getKey(baseUrl, requestUrl, ElementType::Script),
+             "Requests of different element types should have different keys");
+
+    Verdict verdict { FilterAction::Block, blockDomainRule.get(), 1 };
+    cache.insert(key, baseUrl, requestUrl, ElementType::Image, verdict);
+
+    Verdict cachedVerdict {};
+    QVERIFY(cache.find(key, baseUrl, requestUrl, ElementType::Image, 1, cachedVerdict));
+    QCOMPARE(cachedVerdict.MatchedFilter, blockDomainRule.get());
+    QVERIFY2(!cache.find(key, baseUrl, requestUrl, ElementType::Image, 2, cachedVerdict),
+             "Verdicts of an older filter container generation should not be returned");
+
+    QCOMPARE(cache.getHitCount(), quint64(1));
+    QCOMPARE(cache.getMissCount(), quint64(1));
+
+    // Simulate a hash collision: another request stored under the same key must not share its verdict
+    const QString collidingUrl = QLatin1String("https://watchvid.com/videos/5.mp4");
+    QVERIFY2(!cache.find(key, baseUrl, collidingUrl, ElementType::Image, 1, cachedVerdict),
+             "A verdict should only be returned for the request it was made for");
+    QVERIFY(!cache.find(key, QLatin1String("example.com"), requestUrl, ElementType::Image, 1, cachedVerdict));
+    QVERIFY(!cache.find(key, baseUrl, requestUrl, ElementType::Script, 1, cachedVerdict));
+
+    Verdict collidingVerdict { FilterAction::Allow, nullptr, 1 };
+    cache.insert(key, baseUrl, collidingUrl, ElementType::Image, collidingVerdict);
+    QVERIFY(cache.find(key, baseUrl, collidingUrl, ElementType::Image, 1, cachedVerdict));
+    QCOMPARE(cachedVerdict.Action, FilterAction::Allow);
+    QVERIFY2(!cache.find(key, baseUrl, requestUrl, ElementType::Image, 1, cachedVerdict),
+             "The colliding request should have replaced the verdict instead of sharing it");
+
+    cache.insert(key, baseUrl, requestUrl, ElementType::Image, verdict);
+
+    // Fill one shard past its capacity
+    std::size_t numInserted = 0;
+    for (int i = 0; numInserted < 3; ++i)
+    {
+        const QString otherUrl = requestUrl + QString::number(i);
+        const quint64 otherKey = VerdictCache::getKey(baseUrl, otherUrl, ElementType::Image);
+        if ((otherKey >> 60) % VerdictCache::NumShards != (key >> 60) % VerdictCache::NumShards)
+            continue;
+
+        cache.insert(otherKey, baseUrl, otherUrl, ElementType::Image, verdict);
+        ++numInserted;
+    }
+
+    QCOMPARE(cache.getEvictionCount(), quint64(2));
+    QVERIFY2(!cache.find(key, baseUrl, requestUrl, ElementType::Image, 1, cachedVerdict),
+             "The least recently used verdict should have been evicted");
+}
+
+void AdBlockFilterTest::testLogRingBuffer()
+{
+    AdBlockLog log;
+
+    const QUrl firstPage(QLatin1String("https://watchvid.com/"));
+    const QUrl secondPage(QLatin1String("https://zerohedge.com/"));
+    log.loadStarted(firstPage);
+
+    log.addEntry(FilterAction::Block, firstPage, QUrl(QLatin1String("https://subdomain.mycdn.com/5.jpg")),
+                 ElementType::Image, blockDomainRule.get(), 1);
+    log.addEntry(FilterAction::Allow, firstPage, QUrl(QLatin1String("https://mycdn.com/6.jpg")),
+                 ElementType::Image, allowDomainRule.get(), 1);
+    log.addEntry(FilterAction::Block, secondPage, QUrl(QLatin1String("https://mssl.fwmrm.net/ad.js")),
+                 ElementType::Script, blockScriptDomainRule.get(), 1);
+
+    std::vector<LogEntry> entries = log.getEntriesFor(firstPage);
+    QCOMPARE(entries.size(), std::size_t(2));
+    QCOMPARE(entries.at(0).Rule, blockDomainRule->getRule());
+    QCOMPARE(entries.at(1).Action, FilterAction::Allow);
+    QCOMPARE(entries.at(1).FirstPartyUrl, firstPage);
+
+    LogCounts counts = log.getPageCounts(firstPage);
+    QCOMPARE(counts.NumBlocked, quint32(1));
+    QCOMPARE(counts.NumAllowed, quint32(1));
+
+    log.loadStarted(firstPage);
+    QCOMPARE(log.getPageCounts(firstPage).NumBlocked, quint32(0));
+
+    // Overflow the buffer, which should keep only the most recent entries
+    const QUrl requestUrl(QLatin1String("https://mssl.fwmrm.net/ad.js"));
+    for (std::size_t i = 0; i < AdBlockLog::Capacity; ++i)
+        log.addEntry(FilterAction::Block, secondPage, requestUrl, ElementType::Script, blockScriptDomainRule.get(), 1);
+
+    entries = log.getAllEntries();
+    QCOMPARE(entries.size(), AdBlockLog::Capacity);
+    QVERIFY2(log.getEntriesFor(firstPage).empty(), "The oldest entries should have been overwritten");
+    QCOMPARE(log.getPageCounts(secondPage).NumBlocked, quint32(AdBlockLog::Capacity + 1));
+
+    std::vector<FilterLogStatistics> filterStats = log.getFilterStatistics();
+    QCOMPARE(filterStats.size(), std::size_t(3));
+    for (const FilterLogStatistics &stats : filterStats)
+    {
+        if (stats.Rule == blockScriptDomainRule->getRule())
+            QCOMPARE(stats.Counts.NumBlocked, quint32(AdBlockLog::Capacity + 1));
+        else
+            QCOMPARE(stats.Counts.NumBlocked + stats.Counts.NumAllowed, quint32(1));
+    }
+
+    // Page counters are bounded, replacing the pages with the oldest entries
+    for (std::size_t i = 0; i < AdBlockLog::MaxPages; ++i)
+        log.loadStarted(QUrl(QString("https://example%1.com/").arg(i)));
+    QCOMPARE(log.getPageStatistics().size(), AdBlockLog::MaxPages);
+
+    // Filter counters are bounded as well. Entries of filters beyond the limit are logged but not counted
+    std::vector<Filter> filters;
+    filters.reserve(AdBlockLog::MaxRules);
+    for (std::size_t i = 0; i < AdBlockLog::MaxRules; ++i)
+        filters.emplace_back(QString("||ads%1.example.com^").arg(i));
+    for (const Filter &filter : filters)
+        log.addEntry(FilterAction::Block, secondPage, requestUrl, ElementType::Script, &filter, 1);
+
+    filterStats = log.getFilterStatistics();
+    QVERIFY(filterStats.size() > std::size_t(3));
+    QVERIFY(filterStats.size() <= AdBlockLog::MaxRules);
+    QCOMPARE(log.getAllEntries().back().Rule, filters.back().getRule());
+
+    // The filters of a newer generation reuse the entries of the older filters. A rule that is counted in both
+    // generations is reported once, with its counters combined
+    log.addEntry(FilterAction::Block, secondPage, requestUrl, ElementType::Script, blockScriptDomainRule.get(), 2);
+
+    Filter reloadedFilter(QLatin1String("||reloaded.example.com^"));
+    log.addEntry(FilterAction::Block, secondPage, requestUrl, ElementType::Script, &reloadedFilter, 2);
+
+    bool isReloadedFilterCounted = false;
+    filterStats = log.getFilterStatistics();
+    for (const FilterLogStatistics &stats : filterStats)
+    {
+        if (stats.Rule == blockScriptDomainRule->getRule())
+            QCOMPARE(stats.Counts.NumBlocked, quint32(AdBlockLog::Capacity + 2));
+        else if (stats.Rule == reloadedFilter.getRule())
+            isReloadedFilterCounted = true;
+    }
+    QVERIFY2(isReloadedFilterCounted, "Entries of an older generation should be reused once the filter table is full");
+}
+
+void AdBlockFilterTest::testFilterProfiling()
+{
+    FilterParser parser(nullptr);
+    std::unique_ptr<Filter> filter = parser.makeFilter(QLatin1String("||mssl.fwmrm.net$script,domain=zerohedge.com"));
+
+    const QUrl firstPartyUrl(QLatin1String("https://zerohedge.com/"));
+    const QUrl requestUrl(QLatin1String("https://mssl.fwmrm.net/libs/adm/6.24.0/AdManager.js"));
+    const RequestContext scriptContext(requestUrl, firstPartyUrl, ElementType::Script);
+
+    QVERIFY(!Filter::isProfilingEnabled());
+    QVERIFY(filter->isMatch(scriptContext));
+    QCOMPARE(filter->getNumEvaluations(), quint32(0));
+
+    Filter::setProfilingEnabled(true);
+    QVERIFY(filter->isMatch(scriptContext));
+    QVERIFY(!filter->isMatch(RequestContext(requestUrl, firstPartyUrl, ElementType::Image)));
+    QVERIFY(!filter->isOptionMatch(RequestContext(requestUrl, QUrl(QLatin1String("https://example.com/")), ElementType::Script)));
+    Filter::setProfilingEnabled(false);
+
+    QCOMPARE(filter->getNumEvaluations(), quint32(3));
+    QCOMPARE(filter->getNumMatches(), quint32(1));
+    QVERIFY(filter->getEvaluationTime() >= 0);
+
+    Filter copy(*filter);
+    QCOMPARE(copy.getNumEvaluations(), quint32(3));
+}
+
+void AdBlockFilterTest::testRequestContext()
+{
+    RequestContext context(QUrl(QLatin1String("https://user@WWW.Ads.Example.co.uk:8080/Banner.JS?x=1#top")),
+                           QUrl(QLatin1String("https://news.example.co.uk/")), QWebEngineUrlRequestInfo::ResourceTypeScript);
+    QCOMPARE(context.getUrlString(), QLatin1String("https://user@www.ads.example.co.uk:8080/banner.js?x=1#top"));
+    QCOMPARE(context.getScheme().toString(), QLatin1String("https"));
+    QCOMPARE(context.getHost().toString(), QLatin1String("www.ads.example.co.uk"));
+    QCOMPARE(context.getDomain().toString(), QLatin1String("ads.example.co.uk"));
+    QCOMPARE(context.getRegistrableDomain().toString(), QLatin1String("example.co.uk"));
+    QCOMPARE(context.getFirstPartyHost(), QLatin1String("news.example.co.uk"));
+    QVERIFY2(!context.isThirdParty(), "Requests to the same registrable domain should be first-party");
+    QCOMPARE(context.getElementType(), ElementType::Script);
+
+    context = RequestContext(QUrl(QLatin1String("wss://tracker.net/socket")), QUrl(QLatin1String("https://example.org/")),
+                             QWebEngineUrlRequestInfo::ResourceTypeSubResource);
+    QVERIFY(context.isThirdParty());
+    QCOMPARE(context.getElementType(), ElementType::Other | ElementType::WebSocket | ElementType::ThirdParty);
+
+    context = RequestContext(QUrl(QLatin1String("http://[::1]:8080/index.html")), QUrl(), QWebEngineUrlRequestInfo::ResourceTypeSubResource);
+    QCOMPARE(context.getHost().toString(), QLatin1String("::1"));
+    QCOMPARE(context.getElementType(), ElementType::Subdocument | ElementType::ThirdParty);
+
+    // The party of the request is left to the caller when the element types are given
+    context = RequestContext(QUrl(QLatin1String("https://cdn.net/a.js")), QUrl(QLatin1String("https://example.org/")), ElementType::Script);
+    QVERIFY(context.isThirdParty());
+    QCOMPARE(context.getElementType(), ElementType::Script);
+}
+
+void AdBlockFilterTest::testRequestContextAllocations()
+{
+#if defined(__GLIBC__)
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QString listPath = dir.filePath(QLatin1String("filters.txt"));
+    QFile listFile(listPath);
+    QVERIFY(listFile.open(QIODevice::WriteOnly | QIODevice::Text));
+    listFile.write("[Adblock Plus 2.0]\n"
+                   "! Title: Allocation test\n"
+                   "||tracker.net^$third-party\n"
+                   "||ads.example.com^\n"
+                   "/banners/ad_\n"
+                   "-advert-$image\n"
+                   "@@||ads.example.com/allowed/$script,domain=example.org\n");
+    listFile.close();
+
+    std::vector<Subscription> subscriptions;
+    Subscription subscription(listPath);
+    subscription.load(nullptr);
+    subscriptions.push_back(std::move(subscription));
+    const FilterContainer filterContainer(subscriptions);
+
+    const QUrl firstPartyUrl(QLatin1String("https://news.example.org/"));
+    const std::vector<RequestContext> contexts = {
+        RequestContext(QUrl(QLatin1String("https://ads.example.com/banner.js")), firstPartyUrl, QWebEngineUrlRequestInfo::ResourceTypeScript),
+        RequestContext(QUrl(QLatin1String("https://ads.example.com/allowed/x.js")), firstPartyUrl, QWebEngineUrlRequestInfo::ResourceTypeScript),
+        RequestContext(QUrl(QLatin1String("https://a.tracker.net/t?id=1")), firstPartyUrl, QWebEngineUrlRequestInfo::ResourceTypeXhr),
+        RequestContext(QUrl(QLatin1String("https://site.com/img-advert-1.jpg")), firstPartyUrl, QWebEngineUrlRequestInfo::ResourceTypeImage),
+        RequestContext(QUrl(QLatin1String("https://cdn.example.org/app.js")), firstPartyUrl, QWebEngineUrlRequestInfo::ResourceTypeScript)
+    };
+
+    // Matches each request in the same order as the request handler, keeping the blocking and exception filters found
+    std::vector<std::pair<Filter*, Filter*>> matches(contexts.size());
+    auto matchRequests = [&]() {
+        for (std::size_t i = 0; i < contexts.size(); ++i)
+        {
+            const RequestContext &context = contexts[i];
+            Filter *blockFilter = filterContainer.findImportantBlockingFilter(context);
+            if (blockFilter == nullptr)
+                blockFilter = filterContainer.findBlockingRequestFilter(context);
+            Filter *allowFilter = blockFilter != nullptr ? filterContainer.findWhitelistingFilter(context) : nullptr;
+            matches[i] = { blockFilter, allowFilter };
+        }
+    };
+
+    // Warm up any data that is lazily initialized on first use
+    matchRequests();
+
+    numAllocations.store(0);
+    countingAllocations.store(true);
+    matchRequests();
+    countingAllocations.store(false);
+    QCOMPARE(numAllocations.load(), quint64(0));
+
+    QVERIFY2(matches[0].first != nullptr && matches[0].second == nullptr, "First request should be blocked");
+    QVERIFY2(matches[1].first != nullptr && matches[1].second != nullptr, "Second request should be allowed by an exception");
+    QVERIFY2(matches[2].first != nullptr, "Third-party tracker request should be blocked");
+    QVERIFY2(matches[3].first != nullptr, "Image containing an advert pattern should be blocked");
+    QVERIFY2(matches[4].first == nullptr, "Unrelated request should not match any filter");
+
+    // A verdict found in the cache should also be returned without allocating. Only the first lookup, which fills
+    // the cache, allocates
+    AdBlockLog log;
+    RequestHandler requestHandler(&log, nullptr);
+    const Verdict verdict = requestHandler.getVerdict(filterContainer, contexts[0]);
+
+    Verdict cachedVerdict {};
+    numAllocations.store(0);
+    countingAllocations.store(true);
+    cachedVerdict = requestHandler.getVerdict(filterContainer, contexts[0]);
+    countingAllocations.store(false);
+    QCOMPARE(numAllocations.load(), quint64(0));
+    QCOMPARE(cachedVerdict.MatchedFilter, verdict.MatchedFilter);
+    QCOMPARE(cachedVerdict.Action, FilterAction::Block);
+#else
+    QSKIP("Heap allocations can only be counted with the GNU C library");
+#endif
+}
+
+void AdBlockFilterTest::testElementTypeQueries()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    const QString listPath = dir.filePath(QLatin1String("filters.txt"));
+    QFile listFile(listPath);
+    QVERIFY(listFile.open(QIODevice::WriteOnly | QIODevice::Text));
+    listFile.write("[Adblock Plus 2.0]\n"
+                   "! Title: Element type test\n"
+                   "||ads.example.com^\n"
+                   "/banners/ad_\n"
+                   "||scripts.example.com^$inline-script\n"
+                   "||strict.example.net^$inline-script,important\n"
+                   "||untyped.example.com^\n"
+                   "||negated.example.com^$~image\n"
+                   "||disabled.example.net^$inline-script,important\n"
+                   "||disabled.example.net^$inline-script,important,badfilter\n"
+                   "||tracker.example.net^$important\n"
+                   "||tracker.example.net^$important,badfilter\n"
+                   "||example.org^$csp=worker-src 'none'\n"
+                   "||example.org^$csp=script-src 'self'\n"
+                   "@@||news.example.org^$csp=script-src 'self'\n"
+                   "@@||forum.example.org^$generichide\n");
+    listFile.close();
+
+    std::vector<Subscription> subscriptions;
+    Subscription subscription(listPath);
+    subscription.load(nullptr);
+    subscriptions.push_back(std::move(subscription));
+    const FilterContainer filterContainer(subscriptions);
+
+    auto makeContext = [](const char *url, ElementType elementType) {
+        const QUrl pageUrl(QLatin1String(url));
+        return RequestContext(pageUrl, pageUrl, elementType);
+    };
+
+    // Only the filters with the inline-script option apply to the inline scripts of a page
+    const Filter *filter = filterContainer.findInlineScriptBlockingFilter(makeContext("https://scripts.example.com/", ElementType::InlineScript));
+    QVERIFY(filter != nullptr);
+    QCOMPARE(filter->getRule(), QLatin1String("||scripts.example.com^$inline-script"));
+
+    filter = filterContainer.findInlineScriptBlockingFilter(makeContext("https://www.strict.example.net/", ElementType::InlineScript));
+    QVERIFY(filter != nullptr);
+    QVERIFY(filter->isImportant());
+
+    QVERIFY(filterContainer.findInlineScriptBlockingFilter(makeContext("https://ads.example.com/", ElementType::InlineScript)) == nullptr);
+
+    // Filters without a type, or with only negated types, match other requests but not inline scripts
+    QVERIFY(filterContainer.findInlineScriptBlockingFilter(makeContext("https://untyped.example.com/", ElementType::InlineScript)) == nullptr);
+    QVERIFY(filterContainer.findBlockingRequestFilter(makeContext("https://untyped.example.com/", ElementType::InlineScript)) == nullptr);
+    QVERIFY(filterContainer.findBlockingRequestFilter(makeContext("https://untyped.example.com/", ElementType::Script)) != nullptr);
+    QVERIFY(filterContainer.findInlineScriptBlockingFilter(makeContext("https://negated.example.com/", ElementType::InlineScript)) == nullptr);
+    QVERIFY(filterContainer.findBlockingRequestFilter(makeContext("https://negated.example.com/", ElementType::Script)) != nullptr);
+
+    // Important inline-script filters are disabled by the badfilter option
+    QVERIFY(filterContainer.findInlineScriptBlockingFilter(makeContext("https://disabled.example.net/", ElementType::InlineScript)) == nullptr);
+
+    // So are important blocking filters
+    QVERIFY(filterContainer.findImportantBlockingFilter(makeContext("https://tracker.example.net/", ElementType::Script)) == nullptr);
+    QVERIFY(filterContainer.findBlockingRequestFilter(makeContext("https://tracker.example.net/", ElementType::Script)) == nullptr);
+
+    // Content security policies that are whitelisted by an exception are left out
+    std::vector<Filter*> cspFilters = filterContainer.getMatchingCSPFilters(makeContext("https://www.example.org/", ElementType::CSP));
+    QCOMPARE(cspFilters.size(), std::size_t(2));
+
+    cspFilters = filterContainer.getMatchingCSPFilters(makeContext("https://news.example.org/", ElementType::CSP));
+    QCOMPARE(cspFilters.size(), std::size_t(1));
+    QCOMPARE(cspFilters.at(0)->getContentSecurityPolicy(), QLatin1String("worker-src 'none'"));
+
+    QVERIFY(filterContainer.getMatchingCSPFilters(makeContext("https://example.com/", ElementType::CSP)).empty());
+
+    QVERIFY(filterContainer.hasGenericHideFilter(makeContext("https://forum.example.org/thread/1", ElementType::Other)));
+    QVERIFY(!filterContainer.hasGenericHideFilter(makeContext("https://news.example.org/", ElementType::Other)));
+}
+
+void AdBlockFilterTest::testResourceStore()
+{
+    ResourceStore store;
+    store.load(QByteArray("# Resources test\n"
+                          "\n"
+                          "noopjs application/javascript\n"
+                          "(function() {\n"
+                          "})();\n"
+                          "\n"
+                          "1x1-transparent.gif image/gif;base64\r\n"
+                          "R0lGODlhAQABAIAAAAAAAP///yH5BAEAAAAALAAAAAABAAEAAAIBRAA7\r\n"
+                          "\r\n"
+                          "nooptext text/plain\n"
+                          "\n"
+                          "noopcss text/css\n"
+                          "/* empty */"));
+
+    QCOMPARE(store.size(), 4);
+
+    Resource resource = store.getResource(QLatin1String("noopjs"));
+    QCOMPARE(resource.MimeType, QByteArray("application/javascript"));
+    QCOMPARE(resource.Data, QByteArray("(function() {\n})();\n"));
+
+    // Base64 resources are decoded when they are loaded
+    resource = store.getResource(QLatin1String("1x1-transparent.gif"));
+    QCOMPARE(resource.MimeType, QByteArray("image/gif"));
+    QCOMPARE(resource.Data.size(), 42);
+    QVERIFY(resource.Data.startsWith("GIF89a"));
+
+    QVERIFY(store.getResource(QLatin1String("nooptext")).Data.isEmpty());
+    QCOMPARE(store.getResource(QLatin1String("noopcss")).Data, QByteArray("/* empty */"));
+    QVERIFY(store.getResource(QLatin1String("missing")).Data.isEmpty());
+
+    // The device reads the data of the resource without copying it
+    ResourceDevice device(resource.Data);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+    QCOMPARE(device.size(), qint64(42));
+    QCOMPARE(device.read(6), QByteArray("GIF89a"));
+    QCOMPARE(device.bytesAvailable(), qint64(36));
+    QCOMPARE(device.readAll(), resource.Data.mid(6));
+    QVERIFY(device.atEnd());
+    QVERIFY(device.seek(0));
+    QCOMPARE(device.readAll(), resource.Data);
+    QCOMPARE(device.write("x"), qint64(-1));
+}
+
+void AdBlockFilterTest::testStylesheetScripts()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    // Generic selectors are listed more than once, and some of them need to be escaped
+    QByteArray list("[Adblock Plus 2.0]\n"
+                    "! Title: Stylesheet test\n"
+                    "##.banner-ad\n"
+                    "##.banner-ad\n"
+                    "##a[href^='http://ads.example.com']\n"
+                    "example.com##.sidebar-ad\n"
+                    "example.com##div[data-ad='1']\n");
+    for (int i = 0; i < 1500; ++i)
+        list.append(QString("##.generic-ad-%1\n").arg(i).toUtf8());
+
+    const QString listPath = dir.filePath(QLatin1String("filters.txt"));
+    QFile listFile(listPath);
+    QVERIFY(listFile.open(QIODevice::WriteOnly | QIODevice::Text));
+    listFile.write(list);
+    listFile.close();
+
+    std::vector<Subscription> subscriptions;
+    Subscription subscription(listPath);
+    subscription.load(nullptr);
+    subscriptions.push_back(std::move(subscription));
+    const FilterContainer filterContainer(subscriptions);
+
+    // The 1502 unique generic selectors are split into chunks of at most 1000 selectors
+    const std::vector<QString> &scripts = filterContainer.getStylesheetScripts();
+    QCOMPARE(scripts.size(), std::size_t(2));
+
+    int numSelectors = 0, numBannerSelectors = 0;
+    for (const QString &script : scripts)
+    {
+        QVERIFY(script.startsWith(QLatin1String("document.body.insertAdjacentHTML('beforeend', '<style>")));
+        QVERIFY(script.endsWith(QLatin1String("{ display: none !important; } </style>');")));
+        numSelectors += script.count(QLatin1String(".generic-ad-"));
+        numBannerSelectors += script.count(QLatin1String(".banner-ad"));
+    }
+    QCOMPARE(numSelectors, 1500);
+    QCOMPARE(numBannerSelectors, 1);
+    QVERIFY(scripts.at(0).contains(QLatin1String("a[href^=\\'http://ads.example.com\\']"))
+            || scripts.at(1).contains(QLatin1String("a[href^=\\'http://ads.example.com\\']")));
+
+    // Domain-specific rules are escaped once, when the container is built
+    std::vector<Filter*> domainFilters = filterContainer.getDomainBasedHidingFilters(QLatin1String("example.com"));
+    QCOMPARE(domainFilters.size(), std::size_t(2));
+
+    QStringList escapedRules;
+    for (Filter *filter : domainFilters)
+        escapedRules.append(filterContainer.getEscapedStyleRule(filter));
+    QVERIFY(escapedRules.contains(QLatin1String(".sidebar-ad")));
+    QVERIFY(escapedRules.contains(QLatin1String("div[data-ad=\\'1\\']")));
+}
+
+void AdBlockFilterTest::testSubscriptionReload()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    auto writeList = [](const QString &path, const QByteArray &contents) {
+        QFile file(path);
+        return file.open(QIODevice::WriteOnly) && file.write(contents) == contents.size();
+    };
+
+    const QString firstPath = dir.filePath(QLatin1String("first.txt"));
+    const QString secondPath = dir.filePath(QLatin1String("second.txt"));
+    QVERIFY(writeList(firstPath, QByteArray("||ads.one.com^\n||keep.one.com^\n")));
+    QVERIFY(writeList(secondPath, QByteArray("||ads.two.com^\n")));
+
+    std::vector<Subscription> subscriptions;
+    subscriptions.emplace_back(firstPath);
+    subscriptions.emplace_back(secondPath);
+    for (Subscription &subscription : subscriptions)
+        subscription.load(nullptr);
+
+    const QUrl firstPartyUrl(QLatin1String("https://example.org/"));
+    auto findFilter = [&firstPartyUrl](const FilterContainer &container, const QString &url) {
+        return container.findBlockingRequestFilter(RequestContext(QUrl(url), firstPartyUrl, ElementType::Script));
+    };
+
+    const FilterContainer firstContainer(subscriptions);
+    Filter *oldSecondFilter = findFilter(firstContainer, QLatin1String("https://ads.two.com/a.js"));
+    Filter *oldKeepFilter = findFilter(firstContainer, QLatin1String("https://keep.one.com/a.js"));
+    QVERIFY(oldSecondFilter != nullptr);
+    QVERIFY(oldKeepFilter != nullptr);
+    QVERIFY(findFilter(firstContainer, QLatin1String("https://ads.one.com/a.js")) != nullptr);
+
+    // Count a match on the rule that stays in the first list. The count is carried over if its filter is reused
+    Filter::setProfilingEnabled(true);
+    QVERIFY(oldKeepFilter->isMatch(RequestContext(QUrl(QLatin1String("https://keep.one.com/a.js")), firstPartyUrl, ElementType::Script)));
+    Filter::setProfilingEnabled(false);
+    QCOMPARE(oldKeepFilter->getNumMatches(), quint32(1));
+
+    // Write the same contents to the second list, and edit a rule of the first list without changing its size
+    // or modification time
+    QVERIFY(writeList(secondPath, QByteArray("||ads.two.com^\n")));
+
+    const QDateTime firstModified = QFileInfo(firstPath).lastModified();
+    QVERIFY(writeList(firstPath, QByteArray("||ads.uno.com^\n||keep.one.com^\n")));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    {
+        QFile firstFile(firstPath);
+        QVERIFY(firstFile.open(QIODevice::ReadWrite));
+        QVERIFY(firstFile.setFileTime(firstModified, QFileDevice::FileModificationTime));
+    }
+    QCOMPARE(QFileInfo(firstPath).lastModified(), firstModified);
+#endif
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    // The first list has the same size and modification time, so its contents are not read unless they are checked
+    subscriptions.at(0).load(nullptr);
+    const FilterContainer uncheckedContainer(subscriptions);
+    QVERIFY(findFilter(uncheckedContainer, QLatin1String("https://ads.one.com/a.js")) != nullptr);
+#endif
+
+    subscriptions.at(0).load(nullptr, nullptr, true);
+    subscriptions.at(1).load(nullptr);
+
+    const FilterContainer secondContainer(subscriptions);
+
+    // The second list has the same size and checksum, so it keeps its filters
+    QVERIFY(findFilter(secondContainer, QLatin1String("https://ads.two.com/a.js")) == oldSecondFilter);
 
-    QString domain = requestUrl.host().toLower();
-    if (domain.startsWith(QLatin1String("www.")))
-        domain = domain.mid(4);
-    if (domain.isEmpty())
-        domain = getSecondLevelDomain(requestUrl);
+    // The first list is parsed again, reusing the filter of the rule that did not change
+    QCOMPARE(subscriptions.at(0).getNumFilters(), std::size_t(2));
+    QVERIFY(findFilter(secondContainer, QLatin1String("https://ads.one.com/a.js")) == nullptr);
+    QVERIFY(findFilter(secondContainer, QLatin1String("https://ads.uno.com/a.js")) != nullptr);
 
-    QVERIFY2(redirectScriptRule->isMatch(baseUrl, requestUrlStr, domain, elemType), "Block rule should match the request");
+    Filter *newKeepFilter = findFilter(secondContainer, QLatin1String("https://keep.one.com/a.js"));
+    QVERIFY(newKeepFilter != nullptr);
+    QVERIFY(newKeepFilter != oldKeepFilter);
+    QCOMPARE(newKeepFilter->getNumMatches(), quint32(1));
 }
 
 QTEST_APPLESS_MAIN(AdBlockFilterTest)
@@ -25,21 +25,27 @@ class AdBlockModel
 
 AdBlockManager::AdBlockManager(const ViperServiceLocator &, QObject *parent) :
     QObject(parent),
-    m_filterContainer(),
+    m_filterContainer(std::make_shared<const FilterContainer>()),
     m_downloadManager(nullptr),
+    m_networkAccessManager(nullptr),
+    m_subscriptionUpdater(nullptr),
+    m_subscriptionsUpdated(false),
     m_enabled(false),
     m_configFile("AdBlockStub.json"),
     m_subscriptionDir(),
     m_cosmeticJSTemplate(),
     m_subscriptions(),
-    m_resourceMap(),
-    m_resourceContentTypeMap(),
+    m_resources(),
     m_domainStylesheetCache(24),
     m_jsInjectionCache(24),
     m_emptyStr(),
+    m_emptyScripts(),
     m_adBlockModel(nullptr),
     m_log(nullptr),
-    m_requestHandler(nullptr)
+    m_requestHandler(nullptr),
+    m_filterLoadWatcher(nullptr),
+    m_filterLoadJob(nullptr),
+    m_filterReloadPending(false)
 {
 }
 
@@ -51,6 +57,10 @@ void AdBlockManager::onSettingChanged(BrowserSetting, const QVariant &)
 {
 }
 
+void AdBlockManager::onFiltersLoaded()
+{
+}
+
 void AdBlockManager::setEnabled(bool value)
 {
     m_enabled = value;
@@ -66,6 +76,19 @@ void AdBlockManager::updateSubscriptions()
         return;
 }
 
+void AdBlockManager::onSubscriptionUpdateFinished(const SubscriptionUpdate &)
+{
+}
+
+void AdBlockManager::onSubscriptionUpdatesFinished()
+{
+}
+
+void AdBlockManager::setNetworkAccessManager(NetworkAccessManager *networkAccessManager)
+{
+    m_networkAccessManager = networkAccessManager;
+}
+
 void AdBlockManager::installResource(const QUrl &url)
 {
     if (!url.isValid())
@@ -91,9 +114,9 @@ AdBlockModel *AdBlockManager::getModel()
     return nullptr;
 }
 
-const QString &AdBlockManager::getStylesheet(const URL &/*url*/) const
+std::vector<QString> AdBlockManager::getStylesheetScripts(const URL &/*url*/) const
 {
-    return m_emptyStr;
+    return {};
 }
 
 const QString &AdBlockManager::getDomainStylesheet(const URL &/*url*/)
@@ -101,9 +124,9 @@ const QString &AdBlockManager::getDomainStylesheet(const URL &/*url*/)
     return m_emptyStr;
 }
 
-const QString &AdBlockManager::getDomainJavaScript(const URL &/*url*/)
+const DomainScripts &AdBlockManager::getDomainJavaScript(const URL &/*url*/)
 {
-    return m_emptyStr;
+    return m_emptyScripts;
 }
 
 bool AdBlockManager::shouldBlockRequest(QWebEngineUrlRequestInfo &/*info*/, const QUrl &/*firstPartyUrl*/)
@@ -123,12 +146,12 @@ int AdBlockManager::getNumberAdsBlocked(const QUrl &/*url*/) const
 
 QString AdBlockManager::getResource(const QString &key) const
 {
-    return m_resourceMap.value(key);
+    return QString::fromUtf8(m_resources.getResource(key).Data);
 }
 
-QString AdBlockManager::getResourceContentType(const QString &key) const
+Resource AdBlockManager::getDecodedResource(const QString &key) const
 {
-    return m_resourceContentTypeMap.value(key);
+    return m_resources.getResource(key);
 }
 
 int AdBlockManager::getNumSubscriptions() const
@@ -171,6 +194,7 @@ void AdBlockManager::removeSubscription(int index)
         if (!subFile.remove())
             qDebug() << "[Advertisement Blocker]: Could not remove subscription file " << subFile.fileName();
     }
+    it->removeCacheFile();
 
     m_subscriptions.erase(it);
 
@@ -183,25 +207,6 @@ void AdBlockManager::reloadSubscriptions()
     extractFilters();
 }
 
-QString AdBlockManager::getSecondLevelDomain(const QUrl &url) const
-{
-    const QString topLevelDomain = url.topLevelDomain();
-    const QString host = url.host();
-
-    if (topLevelDomain.isEmpty() || host.isEmpty())
-        return QString();
-
-    QString domain = host.left(host.size() - topLevelDomain.size());
-
-    if (domain.count(QChar('.')) == 0)
-        return host;
-
-    while (domain.count(QChar('.')) != 0)
-        domain = domain.mid(domain.indexOf(QChar('.')) + 1);
-
-    return domain + topLevelDomain;
-}
-
 void AdBlockManager::loadDynamicTemplate()
 {
     QFile templateFile(QLatin1String(":/AdBlock.js"));
@@ -218,7 +223,7 @@ void AdBlockManager::loadUBOResources()
     if (!resourceDir.exists())
         resourceDir.mkpath(QStringLiteral("."));
 
-    // Iterate through files in directory, loading into m_resourceMap
+    // Iterate through files in directory, loading into the resource map
     QDirIterator resourceItr(resourceDir.absolutePath(), QDir::Files);
     while (resourceItr.hasNext())
     {
@@ -228,53 +233,7 @@ void AdBlockManager::loadUBOResources()
 
 void AdBlockManager::loadResourceFile(const QString &path)
 {
-    QFile f(path);
-    if (!f.exists() || !f.open(QIODevice::ReadOnly))
-        return;
-
-    bool readingValue = false;
-    QString currentKey, mimeType;
-    QByteArray currentValue;
-    QList<QByteArray> contents = f.readAll().split('\n');
-    f.close();
-    for (int i = 0; i < contents.size(); ++i)
-    {
-        const QByteArray &line = contents.at(i);
-        if ((!readingValue && line.isEmpty()) || line.startsWith('#'))
-            continue;
-
-        // Extract key from line if not loading a value associated with a key
-        if (!readingValue)
-        {
-            int sepIdx = line.indexOf(' ');
-            if (sepIdx < 0)
-                currentKey = line;
-            else
-            {
-                currentKey = line.left(sepIdx);
-                mimeType = line.mid(sepIdx + 1);
-                m_resourceContentTypeMap.insert(currentKey, mimeType);
-            }
-            readingValue = true;
-        }
-        else
-        {
-            // Append currentValue with line if not empty.
-            if (!line.isEmpty())
-            {
-                currentValue.append(line);
-                if (mimeType.contains(QLatin1String("javascript")))
-                    currentValue.append('\n');
-            }
-            else
-            {
-                // Insert key-value pair into map once an empty line is reached and search for next key
-                m_resourceMap.insert(currentKey, QString(currentValue));
-                currentValue.clear();
-                readingValue = false;
-            }
-        }
-    }
+    m_resources.loadFile(path);
 }
 
 void AdBlockManager::loadSubscriptions()
@@ -331,9 +290,19 @@ void AdBlockManager::loadSubscriptions()
     extractFilters();
 }
 
+std::shared_ptr<const FilterContainer> AdBlockManager::getFilterContainer() const
+{
+    return std::atomic_load(&m_filterContainer);
+}
+
+void AdBlockManager::setFilterContainer(std::shared_ptr<const FilterContainer> filterContainer)
+{
+    std::atomic_store(&m_filterContainer, std::move(filterContainer));
+}
+
 void AdBlockManager::clearFilters()
 {
-    m_filterContainer.clearFilters();
+    setFilterContainer(std::make_shared<const FilterContainer>());
 }
 
 void AdBlockManager::extractFilters()
@@ -343,7 +312,7 @@ void AdBlockManager::extractFilters()
         // calling load() does nothing if subscription is disabled
         s.load(this);
     }
-    m_filterContainer.extractFilters(m_subscriptions);
+    setFilterContainer(std::make_shared<const FilterContainer>(m_subscriptions));
 }
 
 void AdBlockManager::save()
@@ -0,0 +1,136 @@
+#include "DomainSet.h"
+
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QtTest>
+
+using namespace adblock;
+
+class DomainSetTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    DomainSetTest();
+
+    /// Linear search over a set of domains, as done by filters before the introduction of the DomainSet
+    bool isLinearMatch(const QSet<QString> &domains, const QString &host) const;
+
+private Q_SLOTS:
+    void testMatchesParentDomains_data();
+
+    void testMatchesParentDomains();
+
+    void testLargeDomainList_data();
+
+    void testLargeDomainList();
+
+private:
+    /// A long domain= list, typical of some cosmetic filters
+    QStringList m_largeDomainList;
+};
+
+DomainSetTest::DomainSetTest() :
+    m_largeDomainList()
+{
+    for (int i = 0; i < 500; ++i)
+        m_largeDomainList.append(QString("site%1.example%2.com").arg(i).arg(i % 7));
+    m_largeDomainList.append(QLatin1String("streamingsite."));
+    m_largeDomainList.append(QLatin1String("news.co.uk"));
+}
+
+bool DomainSetTest::isLinearMatch(const QSet<QString> &domains, const QString &host) const
+{
+    for (const QString &domainStr : domains)
+    {
+        QString base = host;
+        if (domainStr.endsWith(QChar('.')))
+            base = base.left(base.lastIndexOf(QChar('.')) + 1);
+
+        if (base.compare(domainStr) == 0)
+            return true;
+
+        if (base.endsWith(domainStr) && base.at(base.size() - domainStr.size() - 1) == QChar('.'))
+            return true;
+    }
+    return false;
+}
+
+void DomainSetTest::testMatchesParentDomains_data()
+{
+    QTest::addColumn<QStringList>("domains");
+    QTest::addColumn<QString>("host");
+    QTest::addColumn<bool>("expected");
+
+    QTest::newRow("exact") << QStringList({ "example.com" }) << QString("example.com") << true;
+    QTest::newRow("subdomain") << QStringList({ "example.co.uk" }) << QString("ads.cdn.example.co.uk") << true;
+    QTest::newRow("partial label") << QStringList({ "example.com" }) << QString("myexample.com") << false;
+    QTest::newRow("parent of host") << QStringList({ "ads.example.com" }) << QString("example.com") << false;
+    QTest::newRow("repeated labels") << QStringList({ "a.b" }) << QString("a.b.a.b") << true;
+    QTest::newRow("entity") << QStringList({ "google." }) << QString("www.google.co") << true;
+    QTest::newRow("entity with multi-label suffix") << QStringList({ "google." }) << QString("www.google.co.uk") << true;
+    QTest::newRow("entity mismatch") << QStringList({ "google." }) << QString("google.evil.com") << false;
+    QTest::newRow("entity mismatch with multi-label suffix") << QStringList({ "google." }) << QString("google.evil.co.uk") << false;
+    QTest::newRow("no top-level domain") << QStringList({ "localhost." }) << QString("localhost") << false;
+}
+
+void DomainSetTest::testMatchesParentDomains()
+{
+    QFETCH(QStringList, domains);
+    QFETCH(QString, host);
+    QFETCH(bool, expected);
+
+    DomainSet domainSet;
+    for (const QString &domain : domains)
+        domainSet.insert(domain);
+
+    QCOMPARE(domainSet.size(), domains.size());
+    QCOMPARE(domainSet.matches(host), expected);
+}
+
+void DomainSetTest::testLargeDomainList_data()
+{
+    QTest::addColumn<bool>("useDomainSet");
+    QTest::addColumn<QString>("host");
+
+    QTest::newRow("DomainSet hit") << true << QString("video.site250.example5.com");
+    QTest::newRow("DomainSet miss") << true << QString("www.unrelated-site.org");
+    QTest::newRow("QSet hit") << false << QString("video.site250.example5.com");
+    QTest::newRow("QSet miss") << false << QString("www.unrelated-site.org");
+}
+
+void DomainSetTest::testLargeDomainList()
+{
+    QFETCH(bool, useDomainSet);
+    QFETCH(QString, host);
+
+    DomainSet domainSet;
+    QSet<QString> domainQSet;
+    for (const QString &domain : m_largeDomainList)
+    {
+        domainSet.insert(domain);
+        domainQSet.insert(domain);
+    }
+
+    const bool expected = isLinearMatch(domainQSet, host);
+    bool result = false;
+    if (useDomainSet)
+    {
+        QBENCHMARK {
+            result = domainSet.matches(host);
+        }
+    }
+    else
+    {
+        QBENCHMARK {
+            result = isLinearMatch(domainQSet, host);
+        }
+    }
+
+    QCOMPARE(result, expected);
+}
+
+QTEST_APPLESS_MAIN(DomainSetTest)
+
+#include "DomainSetTest.moc"
@@ -0,0 +1,325 @@
+#include "SubscriptionUpdater.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QSignalSpy>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QtTest>
+
+using namespace adblock;
+
+/// Contents of the filter list served by the HTTP stand-in
+static const QByteArray FixtureList = QByteArrayLiteral(
+        "[Adblock Plus 2.0]\n"
+        "! Title: Fixture List\n"
+        "! Expires: 2 days\n"
+        "||ads.example.com^\n"
+        "##.banner-ad\n");
+
+/// Entity tag of the fixture list
+static const QByteArray FixtureEntityTag = QByteArrayLiteral("\"fixture-v1\"");
+
+/// Last-Modified header of the fixture list
+static const QByteArray FixtureLastModified = QByteArrayLiteral("Sat, 01 Aug 2020 10:00:00 GMT");
+
+/**
+ * @class HttpStandIn
+ * @brief A minimal HTTP server that serves the fixture list from /list.txt, answers conditional requests
+ *        that match the validators of the list with 304 Not Modified, and answers any other path with 404.
+ *        Responses can be delayed, to keep several requests open at the same time.
+ */
+class HttpStandIn : public QTcpServer
+{
+public:
+    explicit HttpStandIn(QObject *parent = nullptr) :
+        QTcpServer(parent),
+        m_responseDelay(0),
+        m_numRequests(0),
+        m_numOpenRequests(0),
+        m_maxOpenRequests(0),
+        m_lastHeaders()
+    {
+        connect(this, &QTcpServer::newConnection, this, &HttpStandIn::onNewConnection);
+    }
+
+    /// Sets the number of milliseconds to wait before responding to a request
+    void setResponseDelay(int milliseconds) { m_responseDelay = milliseconds; }
+
+    /// Returns the URL of the given path on the server
+    QUrl getUrl(const QString &path) const
+    {
+        return QUrl(QString("http://127.0.0.1:%1%2").arg(serverPort()).arg(path));
+    }
+
+    /// Returns the number of requests received
+    int getNumRequests() const { return m_numRequests; }
+
+    /// Returns the largest number of requests that were open at the same time
+    int getMaxOpenRequests() const { return m_maxOpenRequests; }
+
+    /// Returns the headers of the last request, with lower case names
+    const QHash<QByteArray, QByteArray> &getLastHeaders() const { return m_lastHeaders; }
+
+private:
+    void onNewConnection()
+    {
+        while (QTcpSocket *socket = nextPendingConnection())
+        {
+            connect(socket, &QTcpSocket::disconnected, socket, &QTcpSocket::deleteLater);
+            connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        }
+    }
+
+    void onReadyRead(QTcpSocket *socket)
+    {
+        QByteArray &buffer = m_buffers[socket];
+        buffer.append(socket->readAll());
+
+        const int headerEnd = buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0)
+            return;
+
+        const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+        m_buffers.remove(socket);
+
+        const QList<QByteArray> requestLine = lines.at(0).trimmed().split(' ');
+        const QByteArray path = requestLine.size() > 1 ? requestLine.at(1) : QByteArray();
+
+        m_lastHeaders.clear();
+        for (int i = 1; i < lines.size(); ++i)
+        {
+            const QByteArray &line = lines.at(i);
+            const int separator = line.indexOf(':');
+            if (separator > 0)
+                m_lastHeaders.insert(line.left(separator).trimmed().toLower(), line.mid(separator + 1).trimmed());
+        }
+
+        ++m_numRequests;
+        m_maxOpenRequests = std::max(m_maxOpenRequests, ++m_numOpenRequests);
+
+        const QByteArray response = getResponse(path, m_lastHeaders);
+        QTimer::singleShot(m_responseDelay, socket, [this, socket, response]() {
+            --m_numOpenRequests;
+            socket->write(response);
+            socket->disconnectFromHost();
+        });
+    }
+
+    QByteArray getResponse(const QByteArray &path, const QHash<QByteArray, QByteArray> &headers) const
+    {
+        if (path != "/list.txt")
+            return QByteArrayLiteral("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+        if (headers.value("if-none-match") == FixtureEntityTag)
+            return QByteArrayLiteral("HTTP/1.1 304 Not Modified\r\nETag: ") + FixtureEntityTag
+                    + QByteArrayLiteral("\r\nConnection: close\r\n\r\n");
+
+        return QByteArrayLiteral("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nETag: ") + FixtureEntityTag
+                + QByteArrayLiteral("\r\nLast-Modified: ") + FixtureLastModified
+                + QByteArrayLiteral("\r\nContent-Length: ") + QByteArray::number(FixtureList.size())
+                + QByteArrayLiteral("\r\nConnection: close\r\n\r\n") + FixtureList;
+    }
+
+private:
+    int m_responseDelay;
+    int m_numRequests;
+    int m_numOpenRequests;
+    int m_maxOpenRequests;
+    QHash<QByteArray, QByteArray> m_lastHeaders;
+    QHash<QTcpSocket*, QByteArray> m_buffers;
+};
+
+class SubscriptionUpdaterTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    SubscriptionUpdaterTest();
+
+private Q_SLOTS:
+    void init();
+
+    void cleanup();
+
+    /// Verifies that a list is downloaded and its validators recorded, and that a second update of the
+    /// unchanged list sends the validators and is answered with 304 without touching the file
+    void testConditionalUpdate();
+
+    /// Verifies that the validators are not sent when the subscription file no longer exists
+    void testValidatorsRequireFile();
+
+    /// Verifies that a failed update leaves the subscription file as it was
+    void testFailedUpdateKeepsFile();
+
+    /// Verifies that no more than the maximum number of downloads are active at once, and that every
+    /// queued update still finishes
+    void testConcurrencyCap();
+
+private:
+    /// Runs the updates with an updater limited to the given number of downloads, returning their results
+    std::vector<SubscriptionUpdate> runUpdates(const std::vector<SubscriptionUpdate> &updates, int maxConcurrentDownloads);
+
+    /// Returns an update of the file with the given name from the given path of the stand-in server
+    SubscriptionUpdate makeUpdate(const QString &fileName, const QString &path = QLatin1String("/list.txt")) const;
+
+    /// Returns the contents of the file at the given path
+    QByteArray readFile(const QString &path) const;
+
+private:
+    QNetworkAccessManager m_networkAccessManager;
+
+    std::unique_ptr<HttpStandIn> m_server;
+
+    std::unique_ptr<QTemporaryDir> m_dataDir;
+};
+
+SubscriptionUpdaterTest::SubscriptionUpdaterTest() :
+    QObject(nullptr),
+    m_networkAccessManager(),
+    m_server(nullptr),
+    m_dataDir(nullptr)
+{
+}
+
+void SubscriptionUpdaterTest::init()
+{
+    m_server = std::make_unique<HttpStandIn>();
+    QVERIFY(m_server->listen(QHostAddress::LocalHost));
+
+    m_dataDir = std::make_unique<QTemporaryDir>();
+    QVERIFY(m_dataDir->isValid());
+}
+
+void SubscriptionUpdaterTest::cleanup()
+{
+    m_server.reset();
+    m_dataDir.reset();
+}
+
+void SubscriptionUpdaterTest::testConditionalUpdate()
+{
+    SubscriptionUpdate update = makeUpdate(QLatin1String("list.txt"));
+
+    std::vector<SubscriptionUpdate> results = runUpdates({ update }, SubscriptionUpdater::DefaultMaxConcurrentDownloads);
+    QCOMPARE(results.size(), size_t(1));
+    QCOMPARE(results.at(0).Status, SubscriptionUpdateStatus::Updated);
+    QCOMPARE(results.at(0).EntityTag, QString::fromLatin1(FixtureEntityTag));
+    QCOMPARE(results.at(0).LastModified, QString::fromLatin1(FixtureLastModified));
+    QCOMPARE(readFile(update.FilePath), FixtureList);
+    QVERIFY(!m_server->getLastHeaders().contains("if-none-match"));
+
+    // Mark the file, so that it can be seen whether it was written again
+    QFile file(update.FilePath);
+    QVERIFY(file.open(QIODevice::Append));
+    file.write("! Local copy\n");
+    file.close();
+    const QByteArray localContents = readFile(update.FilePath);
+
+    results = runUpdates({ results.at(0) }, SubscriptionUpdater::DefaultMaxConcurrentDownloads);
+    QCOMPARE(results.size(), size_t(1));
+    QCOMPARE(results.at(0).Status, SubscriptionUpdateStatus::NotModified);
+    QCOMPARE(m_server->getLastHeaders().value("if-none-match"), FixtureEntityTag);
+    QCOMPARE(m_server->getLastHeaders().value("if-modified-since"), FixtureLastModified);
+    QCOMPARE(readFile(update.FilePath), localContents);
+    QCOMPARE(m_server->getNumRequests(), 2);
+}
+
+void SubscriptionUpdaterTest::testValidatorsRequireFile()
+{
+    SubscriptionUpdate update = makeUpdate(QLatin1String("missing.txt"));
+    update.EntityTag = QString::fromLatin1(FixtureEntityTag);
+    update.LastModified = QString::fromLatin1(FixtureLastModified);
+
+    const std::vector<SubscriptionUpdate> results = runUpdates({ update }, SubscriptionUpdater::DefaultMaxConcurrentDownloads);
+    QCOMPARE(results.size(), size_t(1));
+    QCOMPARE(results.at(0).Status, SubscriptionUpdateStatus::Updated);
+    QVERIFY(!m_server->getLastHeaders().contains("if-none-match"));
+    QVERIFY(!m_server->getLastHeaders().contains("if-modified-since"));
+    QCOMPARE(readFile(update.FilePath), FixtureList);
+}
+
+void SubscriptionUpdaterTest::testFailedUpdateKeepsFile()
+{
+    SubscriptionUpdate update = makeUpdate(QLatin1String("existing.txt"), QLatin1String("/missing.txt"));
+
+    const QByteArray contents = QByteArrayLiteral("[Adblock Plus 2.0]\n||tracker.example.com^\n");
+    QFile file(update.FilePath);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(contents);
+    file.close();
+
+    const std::vector<SubscriptionUpdate> results = runUpdates({ update }, SubscriptionUpdater::DefaultMaxConcurrentDownloads);
+    QCOMPARE(results.size(), size_t(1));
+    QCOMPARE(results.at(0).Status, SubscriptionUpdateStatus::Failed);
+    QCOMPARE(readFile(update.FilePath), contents);
+}
+
+void SubscriptionUpdaterTest::testConcurrencyCap()
+{
+    const int maxConcurrentDownloads = 2;
+    m_server->setResponseDelay(50);
+
+    std::vector<SubscriptionUpdate> updates;
+    for (int i = 0; i < 5; ++i)
+        updates.push_back(makeUpdate(QString("list%1.txt").arg(i)));
+
+    const std::vector<SubscriptionUpdate> results = runUpdates(updates, maxConcurrentDownloads);
+    QCOMPARE(results.size(), updates.size());
+    for (const SubscriptionUpdate &result : results)
+        QCOMPARE(result.Status, SubscriptionUpdateStatus::Updated);
+
+    QCOMPARE(m_server->getNumRequests(), 5);
+    QVERIFY(m_server->getMaxOpenRequests() <= maxConcurrentDownloads);
+}
+
+std::vector<SubscriptionUpdate> SubscriptionUpdaterTest::runUpdates(const std::vector<SubscriptionUpdate> &updates, int maxConcurrentDownloads)
+{
+    std::vector<SubscriptionUpdate> results;
+
+    SubscriptionUpdater updater(&m_networkAccessManager, maxConcurrentDownloads);
+    connect(&updater, &SubscriptionUpdater::updateFinished, [&results](const SubscriptionUpdate &update) {
+        results.push_back(update);
+    });
+
+    QSignalSpy finishedSpy(&updater, &SubscriptionUpdater::finished);
+    for (const SubscriptionUpdate &update : updates)
+    {
+        updater.addUpdate(update);
+        if (updater.getNumActiveDownloads() > maxConcurrentDownloads)
+            return {};
+    }
+
+    if (!updater.isRunning() || !finishedSpy.wait(5000))
+        return {};
+
+    return results;
+}
+
+SubscriptionUpdate SubscriptionUpdaterTest::makeUpdate(const QString &fileName, const QString &path) const
+{
+    SubscriptionUpdate update;
+    update.SourceUrl = m_server->getUrl(path);
+    update.FilePath = m_dataDir->filePath(fileName);
+    return update;
+}
+
+QByteArray SubscriptionUpdaterTest::readFile(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+QTEST_GUILESS_MAIN(SubscriptionUpdaterTest)
+
+#include "SubscriptionUpdaterTest.moc"
@@ -1,6 +1,9 @@
 #include "DatabaseFactory.h"
 #include "HistoryStore.h"
 
+#include <cmath>
+
+#include <QDateTime>
 #include <QFile>
 #include <QObject>
 #include <QString>
@@ -132,16 +135,219 @@ private slots:
         QCOMPARE(records.at(1).getUrl(), secondUrlRequested);
     }
 
-    /*
-     * todo: test cases for:
+    /// Tests that the visit count, last visit and frecency of each entry follow the visits that are added and removed
+    void testVisitAggregates()
+    {
+        std::unique_ptr<HistoryStore> historyStore = DatabaseFactory::createWorker<HistoryStore>(m_dbFile);
+
+        const QUrl frequentUrl { QStringLiteral("https://viper-browser.com") }, otherUrl { QStringLiteral("https://website.net") };
+        const QDateTime now = QDateTime::currentDateTime();
+        historyStore->addVisit(frequentUrl, QLatin1String("Viper Browser"), now.addDays(-3), frequentUrl, true);
+        historyStore->addVisit(frequentUrl, QLatin1String("Viper Browser"), now.addDays(-2), frequentUrl, false);
+        historyStore->addVisit(frequentUrl, QLatin1String("Viper Browser"), now, frequentUrl, false);
+        historyStore->addVisit(otherUrl, QLatin1String("Some Website"), now.addDays(-1), otherUrl, false);
+
+        HistoryEntry entry = historyStore->getEntry(frequentUrl);
+        QCOMPARE(entry.NumVisits, 3);
+        QCOMPARE(entry.LastVisit, now);
+        QCOMPARE(entry.URLTypedCount, 1);
+        QCOMPARE(historyStore->getTimesVisited(frequentUrl), 3);
+
+        std::vector<WebPageInformation> mostVisited = historyStore->loadMostVisitedEntries(2);
+        QCOMPARE(mostVisited.size(), size_t(2));
+        QCOMPARE(mostVisited.at(0).URL, frequentUrl);
+        QCOMPARE(mostVisited.at(1).URL, otherUrl);
+
+        // Removing the latest visit moves the last visit of the entry back to the one before it
+        historyStore->clearHistoryFrom(now.addSecs(-60));
+        entry = historyStore->getEntry(frequentUrl);
+        QCOMPARE(entry.NumVisits, 2);
+        QCOMPARE(entry.LastVisit, now.addDays(-2));
+
+        // The frecency computed again from the remaining visits keeps the weight of the typed visit
+        {
+            sqlite::Database db(m_dbFile.toStdString());
+            auto stmt = db.prepare(R"(SELECT Frecency FROM History WHERE URL = ?)");
+            stmt << frequentUrl;
+            double frecency = 0.0;
+            QVERIFY(stmt.next());
+            stmt >> frecency;
+
+            const double typedScore = static_cast<double>(now.addDays(-3).toMSecsSinceEpoch()) / HistoryStore::FrecencyHalfLife + 1.0;
+            const double otherScore = static_cast<double>(now.addDays(-2).toMSecsSinceEpoch()) / HistoryStore::FrecencyHalfLife;
+            QVERIFY(std::abs(frecency - std::log2(std::exp2(typedScore) + std::exp2(otherScore))) < 1e-9);
+        }
+
+        // Entries without any remaining visits are removed
+        historyStore->clearHistoryInRange({ now.addDays(-1).addSecs(-60), now });
+        QVERIFY(!historyStore->contains(otherUrl));
+        QCOMPARE(historyStore->getTimesVisited(frequentUrl), 2);
+    }
+
+    /// Tests that visits are held in memory until they are flushed, while still being visible to the store
+    void testVisitBatching()
+    {
+        auto countVisits = [this]() {
+            sqlite::Database db(m_dbFile.toStdString());
+            auto stmt = db.prepare(R"(SELECT COUNT(*) FROM Visits)");
+            int numVisits = -1;
+            if (stmt.next())
+                stmt >> numVisits;
+            return numVisits;
+        };
+
+        const QUrl url { QStringLiteral("https://viper-browser.com") };
+        const QDateTime now = QDateTime::currentDateTime();
+        {
+            std::unique_ptr<HistoryStore> historyStore = DatabaseFactory::createWorker<HistoryStore>(m_dbFile);
+
+            historyStore->addVisit(url, QLatin1String("Viper Browser"), now.addSecs(-2), url, true);
+            historyStore->addVisit(url, QLatin1String("Viper Browser"), now.addSecs(-1), url, false);
+            QCOMPARE(countVisits(), 0);
+
+            // The waiting visits can be read without writing them
+            std::vector<HistoryEntry> pendingEntries = historyStore->getPendingEntries();
+            QCOMPARE(pendingEntries.size(), size_t(1));
+            QCOMPARE(pendingEntries.at(0).URL, url);
+            QCOMPARE(pendingEntries.at(0).NumVisits, 2);
+            QCOMPARE(pendingEntries.at(0).URLTypedCount, 1);
+            QCOMPARE(pendingEntries.at(0).LastVisit, now.addSecs(-1));
+
+            // Reads made through the store include the visits that have not been written yet
+            QCOMPARE(historyStore->getTimesVisited(url), 2);
+            QCOMPARE(countVisits(), 2);
+            QVERIFY(historyStore->getPendingEntries().empty());
+
+            // Reaching the size of a batch writes the visits without an explicit flush
+            for (std::size_t i = 0; i < HistoryStore::MaxPendingVisits; ++i)
+                historyStore->addVisit(url, QLatin1String("Viper Browser"), now.addMSecs(static_cast<qint64>(i)), url, false);
+            QCOMPARE(countVisits(), 2 + static_cast<int>(HistoryStore::MaxPendingVisits));
+
+            // Visits that are still waiting when the store is destroyed are written before it closes
+            historyStore->addVisit(url, QLatin1String("Viper Browser"), now.addSecs(1), url, false);
+        }
+
+        std::unique_ptr<HistoryStore> historyStore = DatabaseFactory::createWorker<HistoryStore>(m_dbFile);
+        HistoryEntry entry = historyStore->getEntry(url);
+        QCOMPARE(entry.NumVisits, 3 + static_cast<int>(HistoryStore::MaxPendingVisits));
+        QCOMPARE(entry.LastVisit, now.addSecs(1));
+    }
+
+    /// Tests that a database whose visit aggregate columns were added, but never computed, keeps its entries when loaded
+    void testInterruptedAggregateMigration()
+    {
+        const qint64 visitTime = QDateTime::currentMSecsSinceEpoch();
+        {
+            sqlite::Database db(m_dbFile.toStdString());
+            QVERIFY(db.execute("CREATE TABLE History(VisitID INTEGER PRIMARY KEY AUTOINCREMENT, URL TEXT UNIQUE NOT NULL, "
+                               "Title TEXT, URLTypedCount INTEGER DEFAULT 0)"));
+            QVERIFY(db.execute("CREATE TABLE Visits(VisitID INTEGER NOT NULL, Date INTEGER NOT NULL, PRIMARY KEY(VisitID, Date))"));
+            QVERIFY(db.execute("INSERT INTO History(VisitID, URL, Title, URLTypedCount) VALUES (1, 'https://viper-browser.com', 'Viper Browser', 0)"));
+            QVERIFY(db.execute("INSERT INTO History(VisitID, URL, Title, URLTypedCount) VALUES (2, 'https://website.net', 'Some Website', 0)"));
+            QVERIFY(db.execute(QString("INSERT INTO Visits(VisitID, Date) VALUES (1, %1), (1, %2)")
+                               .arg(visitTime - 60000).arg(visitTime).toStdString()));
+
+            // The columns were committed, but the computation of their values was not
+            QVERIFY(db.execute("ALTER TABLE History ADD VisitCount INTEGER DEFAULT 0"));
+            QVERIFY(db.execute("ALTER TABLE History ADD LastVisit INTEGER DEFAULT 0"));
+            QVERIFY(db.execute("ALTER TABLE History ADD Frecency REAL DEFAULT 0"));
+        }
+
+        std::unique_ptr<HistoryStore> historyStore = DatabaseFactory::createWorker<HistoryStore>(m_dbFile);
+
+        const QUrl url { QStringLiteral("https://viper-browser.com") };
+        QVERIFY(historyStore->contains(url));
 
-    /// Returns a queue of recently visited items, with the most recent visits being at the front of the queue
-    std::deque<HistoryEntry> getRecentItems();
+        HistoryEntry entry = historyStore->getEntry(url);
+        QCOMPARE(entry.NumVisits, 2);
+        QCOMPARE(entry.LastVisit, QDateTime::fromMSecsSinceEpoch(visitTime));
 
-    /// Fetches the set of most frequently visited web pages, up to the given limit. This is used to
-    /// determine which web pages' thumbnails to retrieve for the "New Tab" page
-    std::vector<WebPageInformation> loadMostVisitedEntries(int limit = 10);
-    */
+        // Entries without any visits are still removed
+        QVERIFY(!historyStore->contains(QUrl(QStringLiteral("https://website.net"))));
+    }
+
+    /// Tests that the entries of a database with the word tables of older versions are moved to the full-text
+    /// search index, and that the index follows changes to the entries
+    void testSearchIndexMigration()
+    {
+        const qint64 visitTime = QDateTime::currentMSecsSinceEpoch();
+        {
+            sqlite::Database db(m_dbFile.toStdString());
+            QVERIFY(db.execute("CREATE TABLE History(VisitID INTEGER PRIMARY KEY AUTOINCREMENT, URL TEXT UNIQUE NOT NULL, "
+                               "Title TEXT, URLTypedCount INTEGER DEFAULT 0)"));
+            QVERIFY(db.execute("CREATE TABLE Visits(VisitID INTEGER NOT NULL, Date INTEGER NOT NULL, PRIMARY KEY(VisitID, Date))"));
+            QVERIFY(db.execute("CREATE TABLE Words(WordID INTEGER PRIMARY KEY AUTOINCREMENT, Word TEXT COLLATE NOCASE UNIQUE NOT NULL)"));
+            QVERIFY(db.execute("CREATE TABLE URLWords(HistoryID INTEGER NOT NULL, WordID INTEGER NOT NULL, PRIMARY KEY(HistoryID, WordID))"));
+            QVERIFY(db.execute("INSERT INTO History(VisitID, URL, Title, URLTypedCount) VALUES (1, 'https://viper-browser.com', 'Viper Browser', 0)"));
+            QVERIFY(db.execute(QString("INSERT INTO Visits(VisitID, Date) VALUES (1, %1)").arg(visitTime).toStdString()));
+        }
+
+        std::unique_ptr<HistoryStore> historyStore = DatabaseFactory::createWorker<HistoryStore>(m_dbFile);
+
+        // The word tables are removed even when the index cannot be created
+        {
+            sqlite::Database db(m_dbFile.toStdString());
+            auto stmt = db.prepare(R"(SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name IN ('Words', 'URLWords'))");
+            int numWordTables = -1;
+            QVERIFY(stmt.next());
+            stmt >> numWordTables;
+            QCOMPARE(numWordTables, 0);
+
+            auto stmtIndex = db.prepare(R"(SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'HistorySearch')");
+            int numIndexTables = 0;
+            QVERIFY(stmtIndex.next());
+            stmtIndex >> numIndexTables;
+            if (numIndexTables == 0)
+                QSKIP("SQLite was built without FTS5 or the trigram tokenizer, so the history has no full-text index");
+        }
+
+        auto getMatches = [this](const std::string &expression) {
+            sqlite::Database db(m_dbFile.toStdString());
+            auto stmt = db.prepare(R"(SELECT rowid FROM HistorySearch WHERE HistorySearch MATCH ?)");
+            stmt << expression;
+
+            std::vector<int> result;
+            while (stmt.next())
+            {
+                int rowId = 0;
+                stmt >> rowId;
+                result.push_back(rowId);
+            }
+            return result;
+        };
+
+        QCOMPARE(getMatches("\"browser.com\""), std::vector<int>({ 1 }));
+        QCOMPARE(getMatches("\"VIPER\""), std::vector<int>({ 1 }));
+
+        // Renaming the page replaces its title in the index
+        const QUrl url { QStringLiteral("https://viper-browser.com") };
+        historyStore->addVisit(url, QLatin1String("Release Notes"), QDateTime::currentDateTime(), url, false);
+        QCOMPARE(historyStore->getEntry(url).Title, QLatin1String("Release Notes"));
+        QCOMPARE(getMatches("\"release\""), std::vector<int>({ 1 }));
+        QVERIFY(getMatches("\"viper browser\"").empty());
+
+        historyStore->clearAllHistory();
+        QVERIFY(getMatches("\"browser.com\"").empty());
+    }
+
+    /// Tests that the recent items list each entry once, with the most recently visited entry first
+    void testRecentItems()
+    {
+        std::unique_ptr<HistoryStore> historyStore = DatabaseFactory::createWorker<HistoryStore>(m_dbFile);
+
+        const QUrl firstUrl { QStringLiteral("https://viper-browser.com") }, secondUrl { QStringLiteral("https://website.net") };
+        const QDateTime now = QDateTime::currentDateTime();
+        historyStore->addVisit(firstUrl, QLatin1String("Viper Browser"), now.addSecs(-30), firstUrl, false);
+        historyStore->addVisit(secondUrl, QLatin1String("Some Website"), now.addSecs(-20), secondUrl, false);
+        historyStore->addVisit(firstUrl, QLatin1String("Viper Browser"), now.addSecs(-10), firstUrl, false);
+
+        std::deque<HistoryEntry> recentItems = historyStore->getRecentItems();
+        QCOMPARE(recentItems.size(), size_t(2));
+        QCOMPARE(recentItems.at(0).URL, firstUrl);
+        QCOMPARE(recentItems.at(0).NumVisits, 2);
+        QCOMPARE(recentItems.at(0).LastVisit, now.addSecs(-10));
+        QCOMPARE(recentItems.at(1).URL, secondUrl);
+    }
 
 private:
     /// Bookmark database file used for testing
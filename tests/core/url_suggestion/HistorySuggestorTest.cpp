@@ -7,16 +7,21 @@
 #include "HistorySuggestor.h"
 #include "ServiceLocator.h"
 #include "Settings.h"
+#include "SQLiteWrapper.h"
 #include "URLSuggestion.h"
 
+#include <algorithm>
 #include <atomic>
+#include <memory>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QObject>
 #include <QTest>
 
 const static QString TEST_FAVICON_DB_FILE = QStringLiteral("HISTORY_SUGGESTOR_TEST_FAVICON.db");
 const static QString TEST_DB_FILE = QStringLiteral("HISTORY_SUGGESTOR_TEST.db");
+const static QString TEST_LATENCY_DB_FILE = QStringLiteral("HISTORY_SUGGESTOR_LATENCY_TEST.db");
 
 class HistorySuggestorTest : public QObject
 {
@@ -45,10 +50,20 @@ private Q_SLOTS:
         if (QFile::exists(TEST_DB_FILE))
             QFile::remove(TEST_DB_FILE);
 
+        if (QFile::exists(TEST_LATENCY_DB_FILE))
+            QFile::remove(TEST_LATENCY_DB_FILE);
+
         if (QFile::exists(TEST_FAVICON_DB_FILE))
             QFile::remove(TEST_FAVICON_DB_FILE);
     }
 
+    /// Called after all tests have been executed
+    void cleanupTestCase()
+    {
+        if (QFile::exists(TEST_LATENCY_DB_FILE))
+            QFile::remove(TEST_LATENCY_DB_FILE);
+    }
+
     /// Called after every test function. This closes the DB connection and deallocates / clears
     /// the HistoryStore instance
     void cleanup()
@@ -209,6 +224,80 @@ private Q_SLOTS:
         t1.join();
     }
 
+    void testSuggestionLatency_data()
+    {
+        QTest::addColumn<QString>("searchTerm");
+        QTest::addColumn<qint64>("maxMilliseconds");
+        QTest::addColumn<bool>("hasMatches");
+
+        // Every entry contains "example" and "page", so the words of the first term match the whole history
+        QTest::newRow("separate common words") << QStringLiteral("EXAMPLE PAGE 1234") << qint64{15} << true;
+        QTest::newRow("rare term") << QStringLiteral("SITE499999") << qint64{5} << true;
+        QTest::newRow("common term") << QStringLiteral("EXAMPLE") << qint64{5} << true;
+        QTest::newRow("substring scan") << QStringLiteral("PA") << qint64{5} << true;
+        QTest::newRow("no match") << QStringLiteral("ZZZZ") << qint64{5} << false;
+    }
+
+    /// Measures the time taken to suggest entries from a history of 500000 pages, and checks that the median
+    /// of a number of runs stays within the given bound
+    void testSuggestionLatency()
+    {
+        QFETCH(QString, searchTerm);
+        QFETCH(qint64, maxMilliseconds);
+        QFETCH(bool, hasMatches);
+
+        // Create the tables and the search index, then fill the history directly. The history is shared by all rows
+        if (!QFile::exists(TEST_LATENCY_DB_FILE))
+        {
+            DatabaseFactory::createWorker<HistoryStore>(TEST_LATENCY_DB_FILE).reset();
+
+            sqlite::Database db(TEST_LATENCY_DB_FILE.toStdString());
+            const qint64 now = QDateTime::currentMSecsSinceEpoch();
+            auto stmt = db.prepare(R"(INSERT INTO History(URL, Title, URLTypedCount, VisitCount, LastVisit, Frecency)
+                                      WITH RECURSIVE N(I) AS (SELECT 1 UNION ALL SELECT I + 1 FROM N WHERE I < 500000)
+                                      SELECT 'https://site' || I || '.example.com/page/' || (I % 97), 'Example page ' || I,
+                                             1, 1 + I % 13, ?, ? + (I % 8) FROM N)");
+            stmt << now
+                 << static_cast<double>(now) / HistoryStore::FrecencyHalfLife;
+            QVERIFY(stmt.execute());
+        }
+
+        ViperServiceLocator serviceLocator;
+        FaviconManager faviconManager(TEST_FAVICON_DB_FILE);
+        QVERIFY(serviceLocator.addService(faviconManager.objectName().toStdString(), &faviconManager));
+
+        HistorySuggestor suggestor;
+        suggestor.setServiceLocator(serviceLocator);
+        suggestor.setHistoryFile(TEST_LATENCY_DB_FILE);
+
+        std::atomic_bool working { true };
+        const QStringList searchTermParts = CommonUtil::tokenizePossibleUrl(searchTerm);
+        const FastHashParameters hashParams = getHashParams(searchTerm);
+
+        std::vector<URLSuggestion> result;
+        QBENCHMARK
+        {
+            result = suggestor.getSuggestions(working, searchTerm, searchTermParts, hashParams);
+        }
+
+        std::vector<qint64> durations;
+        QElapsedTimer timer;
+        for (int i = 0; i < 21; ++i)
+        {
+            timer.start();
+            suggestor.getSuggestions(working, searchTerm, searchTermParts, hashParams);
+            durations.push_back(timer.nsecsElapsed());
+        }
+
+        std::nth_element(durations.begin(), durations.begin() + 10, durations.end());
+        const qint64 median = durations[10];
+        QVERIFY2(median <= maxMilliseconds * 1000000,
+                 qPrintable(QString("Median suggestion latency of %1 ms is above %2 ms")
+                            .arg(static_cast<double>(median) / 1000000.0).arg(maxMilliseconds)));
+
+        QCOMPARE(!result.empty(), hasMatches);
+    }
+
     void testThatStaleEntriesDontMatch()
     {
         /*
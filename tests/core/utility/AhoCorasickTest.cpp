@@ -0,0 +1,93 @@
+#include "AhoCorasick.h"
+
+#include <set>
+
+#include <QString>
+#include <QStringList>
+#include <QtTest>
+
+class AhoCorasickTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    AhoCorasickTest();
+
+private Q_SLOTS:
+    void testFindsAllPatterns_data();
+
+    void testFindsAllPatterns();
+
+    void testStopsWhenCallbackReturnsTrue();
+};
+
+AhoCorasickTest::AhoCorasickTest()
+{
+}
+
+void AhoCorasickTest::testFindsAllPatterns_data()
+{
+    QTest::addColumn<QStringList>("needles");
+    QTest::addColumn<QString>("haystack");
+
+    QTest::newRow("tracking url") << QStringList({ "/ads/", "banner", "-advert-", "pixel.gif", "/track?" })
+                                  << QString("https://cdn.example.com/ads/img/banner-1.png?ref=/track?id=5");
+    QTest::newRow("overlapping needles") << QStringList({ "he", "she", "his", "hers", "s" })
+                                         << QString("ushers");
+    QTest::newRow("case insensitive") << QStringList({ "adserver", "doubleclick" })
+                                      << QString("HTTPS://AdServer.DoubleClick.net/");
+    QTest::newRow("no matches") << QStringList({ "somecdn.com/img", ".example.com/ads/" })
+                                << QString("https://subdomain.somecnd.com/img/a/123/4/xyz.jpg");
+}
+
+void AhoCorasickTest::testFindsAllPatterns()
+{
+    QFETCH(QStringList, needles);
+    QFETCH(QString, haystack);
+
+    AhoCorasick automaton;
+    for (const QString &needle : needles)
+        automaton.addPattern(needle);
+    automaton.build();
+
+    QCOMPARE(automaton.size(), needles.size());
+
+    std::set<int> expected;
+    for (int i = 0; i < needles.size(); ++i)
+    {
+        if (haystack.contains(needles.at(i), Qt::CaseInsensitive))
+            expected.insert(i);
+    }
+
+    std::set<int> found;
+    QBENCHMARK {
+        found.clear();
+        automaton.search(haystack, [&found](int patternId) {
+            found.insert(patternId);
+            return false;
+        });
+    }
+
+    QVERIFY2(found == expected, "The automaton did not report exactly the needles contained in the haystack");
+}
+
+void AhoCorasickTest::testStopsWhenCallbackReturnsTrue()
+{
+    AhoCorasick automaton;
+    automaton.addPattern(QLatin1String("ads"));
+    automaton.addPattern(QLatin1String("track"));
+    automaton.build();
+
+    int numCalls = 0;
+    const bool stopped = automaton.search(QLatin1String("https://ads.example.com/track"), [&numCalls](int) {
+        ++numCalls;
+        return true;
+    });
+
+    QVERIFY(stopped);
+    QCOMPARE(numCalls, 1);
+}
+
+QTEST_APPLESS_MAIN(AhoCorasickTest)
+
+#include "AhoCorasickTest.moc"